@@ -622,10 +622,10 @@ bool AppleUSBCDC::initDevice(UInt8 numConfigs)
 										}
 									}
 								}
-                                if ( (intf->bInterfaceSubClass == kUSBMobileBroadbandInterfaceModel) || (intf->bInterfaceSubClass == kUSBNetworkControlModel) )
+                                if (intf->bInterfaceSubClass == kUSBMobileBroadbandInterfaceModel)
 								{
                                         cdc = false;
-                                        XTRACE(this, 0, 0, "initDevice - NCM or MBIM interface. Completely get out of the way...");
+                                        XTRACE(this, 0, 0, "initDevice - MBIM interface. Completely get out of the way...");
 								}
 							} else {
 								XTRACE(this, intf->bInterfaceClass, intf->bInterfaceNumber, "initDevice bInterfaceClass,bInterfaceNumber- Ignoring interface...");
@@ -994,7 +994,7 @@ bool AppleUSBCDC::checkDMM(IOUSBInterface *Comm, UInt8 cInterfaceNumber, UInt8 d
 //
 //		Outputs:	return Code - true (correct), false (incorrect)
 //
-//		Desc:		Checks the interface number of MBIM/NCM interface
+//		Desc:		Checks the interface number of MBIM interface
 //
 /****************************************************************************************************/
 
@@ -1079,7 +1079,9 @@ bool AppleUSBCDC::confirmDriver(UInt8 subClass, UInt8 dataInterface)
                     }
                     break;
 				case kUSBNetworkControlModel:
-					driverOK = checkMBIM(Comm, controlInterfaceNumber, dataInterface);
+						// NCM has the same Union and Ethernet functional descriptors as ECM
+					
+					driverOK = checkECM(Comm, controlInterfaceNumber, dataInterface);
                     break;
 				case kUSBMobileBroadbandInterfaceModel:
 					driverOK = checkMBIM(Comm, controlInterfaceNumber, dataInterface);
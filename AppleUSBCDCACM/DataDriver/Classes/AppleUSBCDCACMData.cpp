@@ -691,12 +691,12 @@ void AppleUSBCDCACMData::CheckQueues()
 
 	// Initialise the QueueState with the current state.
         
-    QueuingState = fPort.State;
+    QueuingState = fPort->State;
 
         // Check to see if there is anything in the Transmit buffer.
         
-    Used = UsedSpaceinQueue(&fPort.TX);
-    Free = FreeSpaceinQueue(&fPort.TX);
+    Used = UsedSpaceinQueue(&fPort->TX);
+    Free = FreeSpaceinQueue(&fPort->TX);
     
     XTRACE(this, Free, Used, "CheckQueues");
     
@@ -717,19 +717,19 @@ void AppleUSBCDCACMData::CheckQueues()
 
     	// Check to see if we are below the low water mark.
         
-    if (Used < fPort.TXStats.LowWater)
+    if (Used < fPort->TXStats.LowWater)
          QueuingState |=  PD_S_TXQ_LOW_WATER;
     else QueuingState &= ~PD_S_TXQ_LOW_WATER;
 
-    if (Used > fPort.TXStats.HighWater)
+    if (Used > fPort->TXStats.HighWater)
          QueuingState |= PD_S_TXQ_HIGH_WATER;
     else QueuingState &= ~PD_S_TXQ_HIGH_WATER;
 
 
         // Check to see if there is anything in the Receive buffer.
         
-    Used = UsedSpaceinQueue(&fPort.RX);
-    Free = FreeSpaceinQueue(&fPort.RX);
+    Used = UsedSpaceinQueue(&fPort->RX);
+    Free = FreeSpaceinQueue(&fPort->RX);
 
     if (Free == 0)
     {
@@ -748,17 +748,17 @@ void AppleUSBCDCACMData::CheckQueues()
 
         // Check to see if we are below the low water mark.
     
-    if (Used < fPort.RXStats.LowWater)
+    if (Used < fPort->RXStats.LowWater)
          QueuingState |= PD_S_RXQ_LOW_WATER;
     else QueuingState &= ~PD_S_RXQ_LOW_WATER;
 
-    if (Used > fPort.RXStats.HighWater)
+    if (Used > fPort->RXStats.HighWater)
          QueuingState |= PD_S_RXQ_HIGH_WATER;
     else QueuingState &= ~PD_S_RXQ_HIGH_WATER;
 
         // Figure out what has changed to get mask.
         
-    DeltaState = QueuingState ^ fPort.State;
+    DeltaState = QueuingState ^ fPort->State;
     setStateGated(&QueuingState, &DeltaState);
 	
 }/* end CheckQueues */
@@ -781,33 +781,33 @@ void AppleUSBCDCACMData::CheckHold()
 	inPipeBuffers	*buffs;
 	IOReturn		ior = kIOReturnSuccess;
 	
-	XTRACE(this, fPort.holdQueueIndxIn, fPort.holdQueueIndxOut, "CheckHold");
+	XTRACE(this, fPort->holdQueueIndxIn, fPort->holdQueueIndxOut, "CheckHold");
 	
 	while (1)
 	{
-		if (fPort.holdQueue[fPort.holdQueueIndxOut] != 0)
+		if (fPort->holdQueue[fPort->holdQueueIndxOut] != 0)
 		{
-			buffs = fPort.holdQueue[fPort.holdQueueIndxOut];
-			size = AddtoRXQueue(&fPort.RX, buffs, buffs->count);
+			buffs = fPort->holdQueue[fPort->holdQueueIndxOut];
+			size = AddtoRXQueue(&fPort->RX, buffs, buffs->count);
 			if (size == 0)
 			{
-				XTRACE(this, fPort.holdQueueIndxIn, fPort.holdQueueIndxOut, "CheckHold - Still holding");
+				XTRACE(this, fPort->holdQueueIndxIn, fPort->holdQueueIndxOut, "CheckHold - Still holding");
 				break;
 			} else {
 				buffs->count = 0;
 				buffs->held = false;
-				XTRACE(this, fPort.holdQueueIndxIn, fPort.holdQueueIndxOut, "CheckHold - Read issued");
-				ior = fPort.InPipe->Read(buffs->pipeMDP, &buffs->completionInfo, NULL);
+				XTRACE(this, fPort->holdQueueIndxIn, fPort->holdQueueIndxOut, "CheckHold - Read issued");
+				ior = fPort->InPipe->Read(buffs->pipeMDP, &buffs->completionInfo, NULL);
 				if (ior != kIOReturnSuccess)
 				{
-					XTRACE(this, fPort.holdQueueIndxOut, ior, "CheckHold - Read io err");
+					XTRACE(this, fPort->holdQueueIndxOut, ior, "CheckHold - Read io err");
 					buffs->dead = true;
 				}
-				fPort.holdQueue[fPort.holdQueueIndxOut] = 0;
-				fPort.holdQueueIndxOut++;
-				if (fPort.holdQueueIndxOut >= kMaxInBufPool)
+				fPort->holdQueue[fPort->holdQueueIndxOut] = 0;
+				fPort->holdQueueIndxOut++;
+				if (fPort->holdQueueIndxOut >= fInBufPool)
 				{
-					fPort.holdQueueIndxOut = 0;
+					fPort->holdQueueIndxOut = 0;
 				}
 			}
 		} else {
@@ -817,7 +817,7 @@ void AppleUSBCDCACMData::CheckHold()
 	
 	CheckQueues();
 	
-	XTRACE(this, fPort.holdQueueIndxIn, fPort.holdQueueIndxOut, "CheckHold - Exit");
+	XTRACE(this, fPort->holdQueueIndxIn, fPort->holdQueueIndxOut, "CheckHold - Exit");
 	
 }/* end CheckHold */
 
@@ -852,7 +852,7 @@ void AppleUSBCDCACMData::dataReadComplete(void *obj, void *param, IOReturn rc, U
     if (rc == kIOReturnSuccess)				// If operation returned ok
     {
         length = DATA_BUFF_SIZE - remaining;
-        XTRACE(me, me->fPort.State, length, "dataReadComplete - data length");
+        XTRACE(me, me->fPort->State, length, "dataReadComplete - data length");
 		
 		if (length > 0)
 		{
@@ -860,26 +860,26 @@ void AppleUSBCDCACMData::dataReadComplete(void *obj, void *param, IOReturn rc, U
 	
 				// Move the incoming bytes to the ring buffer, if we can
             
-//			me->AddtoQueue(&me->fPort.RX, buffs->pipeBuffer, length);
+//			me->AddtoQueue(&me->fPort->RX, buffs->pipeBuffer, length);
 		
 				// If the indices are not equal then there's something in the hold queue
 		
-			if (me->fPort.holdQueueIndxIn != me->fPort.holdQueueIndxOut)
+			if (me->fPort->holdQueueIndxIn != me->fPort->holdQueueIndxOut)
 			{
-                XTRACE(me, me->fPort.holdQueueIndxIn, me->fPort.holdQueueIndxOut, "dataReadComplete - holdQueueIndxIn holdQueueIndxOut !!!");
+                XTRACE(me, me->fPort->holdQueueIndxIn, me->fPort->holdQueueIndxOut, "dataReadComplete - holdQueueIndxIn holdQueueIndxOut !!!");
 				putInQueue = 0;
 			} else {
-				putInQueue = me->AddtoRXQueue(&me->fPort.RX, buffs, length);
+				putInQueue = me->AddtoRXQueue(&me->fPort->RX, buffs, length);
 			}
 			if (putInQueue == 0)
 			{
-				XTRACE(me, 0, me->fPort.holdQueueIndxIn, "dataReadComplete - Buffer held");
+				XTRACE(me, 0, me->fPort->holdQueueIndxIn, "dataReadComplete - Buffer held");
 				buffs->held = true;
 				buffs->count = length;
-				me->fPort.holdQueue[me->fPort.holdQueueIndxIn++] = buffs;
-				if (me->fPort.holdQueueIndxIn >= kMaxInBufPool)
+				me->fPort->holdQueue[me->fPort->holdQueueIndxIn++] = buffs;
+				if (me->fPort->holdQueueIndxIn >= me->fInBufPool)
 				{
-					me->fPort.holdQueueIndxIn = 0;
+					me->fPort->holdQueueIndxIn = 0;
 				}
 			}
 		}
@@ -889,9 +889,9 @@ void AppleUSBCDCACMData::dataReadComplete(void *obj, void *param, IOReturn rc, U
         {
 			if ((rc == kIOUSBPipeStalled) || (rc == kIOUSBHighSpeedSplitError))
 			{
-				rc = me->checkPipe(me->fPort.InPipe, true);
+				rc = me->checkPipe(me->fPort->InPipe, true);
 			} else {
-				rc = me->checkPipe(me->fPort.InPipe, false);
+				rc = me->checkPipe(me->fPort->InPipe, false);
 			}
             if (rc != kIOReturnSuccess)
             {
@@ -906,19 +906,19 @@ void AppleUSBCDCACMData::dataReadComplete(void *obj, void *param, IOReturn rc, U
     {
 		if (!buffs->held)
 		{
-			XTRACE(me, 0, me->fPort.holdQueueIndxIn, "dataReadComplete - Read issued");
-			ior = me->fPort.InPipe->Read(buffs->pipeMDP, &buffs->completionInfo, NULL);
+			XTRACE(me, 0, me->fPort->holdQueueIndxIn, "dataReadComplete - Read issued");
+			ior = me->fPort->InPipe->Read(buffs->pipeMDP, &buffs->completionInfo, NULL);
 			if (ior != kIOReturnSuccess)
 			{
 				XTRACEP(me, buffs, ior, "dataReadComplete - Read io err");
 				buffs->dead = true;
 			} else {
-				XTRACEP(me, buffs, me->fPort.InPipe, "dataReadComplete - Read posted");
+				XTRACEP(me, buffs, me->fPort->InPipe, "dataReadComplete - Read posted");
 			}
 		}
         me->CheckQueues();
 	} else {
-		XTRACEP(me, buffs, me->fPort.InPipe, "dataReadComplete - Read aborted");
+		XTRACEP(me, buffs, me->fPort->InPipe, "dataReadComplete - Read aborted");
 	}
 	
 }/* end dataReadComplete */
@@ -959,13 +959,13 @@ void AppleUSBCDCACMData::dataWriteComplete(void *obj, void *param, IOReturn rc,
         XTRACE(me, 0, dLen, "dataWriteComplete - data length");
         if (dLen > 0)						// Check if it was a zero length write
         {
-            if ((dLen % me->fPort.OutPacketSize) == 0)		// If it was a multiple of max packet size then we need to do a zero length write
+            if (cdc_NeedZLP(dLen, me->fPort->OutPacketSize))	// If it was a multiple of max packet size then we need to do a zero length write
             {
                 XTRACE(me, rc, dLen, "dataWriteComplete - writing zero length packet");
                 buffs->count = 0;
                 buffs->pipeMDP->setLength(0);
                 
-                me->fPort.OutPipe->Write(buffs->pipeMDP, &buffs->completionInfo);
+                me->fPort->OutPipe->Write(buffs->pipeMDP, &buffs->completionInfo);
                 return;
             } else {
                 buffs->avail = true;
@@ -980,7 +980,7 @@ void AppleUSBCDCACMData::dataWriteComplete(void *obj, void *param, IOReturn rc,
 
         for (i=0; i<me->fOutBufPool; i++)
         {
-            if (!me->fPort.outPool[i].avail)
+            if (!me->fPort->outPool[i].avail)
             {
                 busy = true;
                 break;
@@ -1002,9 +1002,9 @@ void AppleUSBCDCACMData::dataWriteComplete(void *obj, void *param, IOReturn rc,
         {
 			if ((rc == kIOUSBPipeStalled) || (rc == kIOUSBHighSpeedSplitError))
 			{
-				rc = me->checkPipe(me->fPort.InPipe, true);
+				rc = me->checkPipe(me->fPort->InPipe, true);
 			} else {
-				rc = me->checkPipe(me->fPort.InPipe, false);
+				rc = me->checkPipe(me->fPort->InPipe, false);
 			}
             if (rc != kIOReturnSuccess)
             {
@@ -1019,7 +1019,7 @@ void AppleUSBCDCACMData::dataWriteComplete(void *obj, void *param, IOReturn rc,
 
         for (i=0; i<me->fOutBufPool; i++)
         {
-            if (!me->fPort.outPool[i].avail)
+            if (!me->fPort->outPool[i].avail)
             {
                 busy = true;
                 break;
@@ -1106,6 +1106,19 @@ bool AppleUSBCDCACMData::start(IOService *provider)
     fThreadSleepCount = 0;
     fReady = false;
     
+        // The port's cache line layout needs it to start on a line
+    
+    if (!fPort)
+    {
+        fPort = (PortInfo_t *)IOMallocAligned(sizeof(PortInfo_t), kCacheLineSize);
+        if (!fPort)
+        {
+            ALERT(0, 0, "start - Port allocation failed");
+            return false;
+        }
+    }
+    bzero(fPort, sizeof(PortInfo_t));
+    
     initStructure();
     
     if(!super::start(provider))
@@ -1135,14 +1148,14 @@ bool AppleUSBCDCACMData::start(IOService *provider)
 		fWanDevice = kOSBooleanTrue;
 
 
-    fPort.DataInterfaceNumber = fDataInterface->GetInterfaceNumber();
+    fPort->DataInterfaceNumber = fDataInterface->GetInterfaceNumber();
     
 		// See if we can find/wait for the CDC driver
 		
 	while (!fCDCDriver)
 	{
 		rtn = kIOReturnSuccess;
-		fCDCDriver = findCDCDriverAD(this, fPort.DataInterfaceNumber, &rtn);
+		fCDCDriver = findCDCDriverAD(this, fPort->DataInterfaceNumber, &rtn);
 		if (fCDCDriver)
 		{
 			XTRACE (this, 0, 0, "start: Found the CDC device driver");
@@ -1151,7 +1164,7 @@ bool AppleUSBCDCACMData::start(IOService *provider)
 			if (rtn == kIOReturnNotReady)
 			{
 				devDriverCount++;
-				XTRACE(this, devDriverCount, fPort.DataInterfaceNumber, "start - Waiting for CDC device driver...");
+				XTRACE(this, devDriverCount, fPort->DataInterfaceNumber, "start - Waiting for CDC device driver...");
 				if (devDriverCount > 9)
 				{
 					break;
@@ -1167,7 +1180,7 @@ bool AppleUSBCDCACMData::start(IOService *provider)
 	
 	if (!fCDCDriver)
 	{
-		ALERT(0, fPort.DataInterfaceNumber, "start - Find CDC driver for ACM data interface failed");
+		ALERT(0, fPort->DataInterfaceNumber, "start - Find CDC driver for ACM data interface failed");
 		return false;
 	}
     
@@ -1361,6 +1374,33 @@ bool AppleUSBCDCACMData::start(IOService *provider)
     	
 }/* end start */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCACMData::free
+//
+//		Inputs:		
+//
+//		Outputs:	None
+//
+//		Desc:		Frees the port
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCACMData::free()
+{
+    
+    XTRACE(this, 0, 0, "free");
+    
+    if (fPort)
+    {
+        IOFreeAligned(fPort, sizeof(PortInfo_t));
+        fPort = NULL;
+    }
+    
+    super::free();
+    
+}/* end free */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCACMData::stop
@@ -1437,6 +1477,7 @@ void AppleUSBCDCACMData::stopGated()
     XTRACE(this, 0, 0, "stopGated");
     
     releaseResources();
+    freePools();
 	
 }/* end stopGated */
 
@@ -1519,10 +1560,10 @@ bool AppleUSBCDCACMData::createSuffix(unsigned char *sufKey)
     
     if (keyOK)
     {
-        sufKey[sig] = Asciify((UInt8)fPort.DataInterfaceNumber >> 4);
+        sufKey[sig] = Asciify((UInt8)fPort->DataInterfaceNumber >> 4);
 		if (sufKey[sig] != '0')
             sig++;	
-        sufKey[sig++] = Asciify((UInt8)fPort.DataInterfaceNumber);
+        sufKey[sig++] = Asciify((UInt8)fPort->DataInterfaceNumber);
         sufKey[sig] = 0x00;
     }
 	
@@ -1934,7 +1975,7 @@ IOReturn AppleUSBCDCACMData::acquirePortGated(bool sleep)
     retain(); 							// Hold reference till releasePortGated, unless we fail to acquire
     while (true)
     {
-        busyState = fPort.State & PD_S_ACQUIRED;
+        busyState = fPort->State & PD_S_ACQUIRED;
         if (!busyState)
         {		
                 // Set busy bit (acquired), and clear everything else
@@ -1981,19 +2022,19 @@ IOReturn AppleUSBCDCACMData::acquirePortGated(bool sleep)
         
         for (i=0; i<fInBufPool; i++)
         {
-            if (fPort.inPool[i].pipeMDP)
+            if (fPort->inPool[i].pipeMDP)
             {
-                fPort.inPool[i].completionInfo.target = this;
-                fPort.inPool[i].completionInfo.action = dataReadComplete;
-                fPort.inPool[i].completionInfo.parameter = (void *)&fPort.inPool[i];
-                rtn = fPort.InPipe->Read(fPort.inPool[i].pipeMDP, &fPort.inPool[i].completionInfo, NULL);
+                fPort->inPool[i].completionInfo.target = this;
+                fPort->inPool[i].completionInfo.action = dataReadComplete;
+                fPort->inPool[i].completionInfo.parameter = (void *)&fPort->inPool[i];
+                rtn = fPort->InPipe->Read(fPort->inPool[i].pipeMDP, &fPort->inPool[i].completionInfo, NULL);
                 if (rtn != kIOReturnSuccess)
                 {
                     XTRACE(this, i, rtn, "acquirePortGated - Read for bulk-in pipe failed");
-					fPort.inPool[i].dead = true;
+					fPort->inPool[i].dead = true;
                     break;
                 }
-				XTRACEP(this, &fPort.inPool[i], fPort.InPipe, "acquirePortGated - Read posted");
+				XTRACEP(this, &fPort->inPool[i], fPort->InPipe, "acquirePortGated - Read posted");
             }
         }
         if (rtn == kIOReturnSuccess)
@@ -2003,11 +2044,11 @@ IOReturn AppleUSBCDCACMData::acquirePortGated(bool sleep)
 		
             for (i=0; i<fOutBufPool; i++)
             {
-                if (fPort.outPool[i].pipeMDP)
+                if (fPort->outPool[i].pipeMDP)
                 {
-                    fPort.outPool[i].completionInfo.target = this;
-                    fPort.outPool[i].completionInfo.action = dataWriteComplete;
-                    fPort.outPool[i].completionInfo.parameter = (void *)&fPort.outPool[i];
+                    fPort->outPool[i].completionInfo.target = this;
+                    fPort->outPool[i].completionInfo.action = dataWriteComplete;
+                    fPort->outPool[i].completionInfo.parameter = (void *)&fPort->outPool[i];
                 }
             }
         } else {
@@ -2068,10 +2109,10 @@ IOReturn AppleUSBCDCACMData::releasePort(void *refCon)
 
 	if (!fTerminate)
 	{
-		if (fPort.InPipe)
-			fPort.InPipe->Abort();
-		if (fPort.OutPipe)
-			fPort.OutPipe->Abort();
+		if (fPort->InPipe)
+			fPort->InPipe->Abort();
+		if (fPort->OutPipe)
+			fPort->OutPipe->Abort();
 	}
 
 //	IOSleep(10);
@@ -2087,11 +2128,11 @@ IOReturn AppleUSBCDCACMData::releasePort(void *refCon)
     {
 		if (fResetOnClose)
 		{
-			if (fPort.InPipe)
-				checkPipe(fPort.InPipe, true);
+			if (fPort->InPipe)
+				checkPipe(fPort->InPipe, true);
     
-			if (fPort.OutPipe)
-				checkPipe(fPort.OutPipe, true);
+			if (fPort->OutPipe)
+				checkPipe(fPort->OutPipe, true);
 
 			if (fDataInterface)
 			{
@@ -2145,7 +2186,7 @@ IOReturn AppleUSBCDCACMData::releasePortGated()
 
     XTRACE(this, 0, 0, "releasePortGated");
     
-    busyState = (fPort.State & PD_S_ACQUIRED);
+    busyState = (fPort->State & PD_S_ACQUIRED);
     if (!busyState)
     {
         if (fTerminate || fStopping)
@@ -2168,10 +2209,10 @@ IOReturn AppleUSBCDCACMData::releasePortGated()
 #if 0    
         // Abort any outstanding I/O
         
-    if (fPort.InPipe)
-        fPort.InPipe->Abort();
-    if (fPort.OutPipe)
-        fPort.OutPipe->Abort();
+    if (fPort->InPipe)
+        fPort->InPipe->Abort();
+    if (fPort->OutPipe)
+        fPort->OutPipe->Abort();
 #endif
         
         // Tell the Control driver the port's been released, only when not terminated (control driver may already be gone)
@@ -2187,12 +2228,12 @@ IOReturn AppleUSBCDCACMData::releasePortGated()
     fSessions--;					// reduce number of active sessions
     
     
-    if (fPort.ringsAllocated == true)
+    if (fPort->ringsAllocated == true)
     {
         XTRACE(this, 0, 0, "releasePortGated - freeing rings");
-        freeRingBuffer(&fPort.TX);
-        freeRingBuffer(&fPort.RX);
-        fPort.ringsAllocated = false;
+        freeRingBuffer(&fPort->TX);
+        freeRingBuffer(&fPort->RX);
+        fPort->ringsAllocated = false;
     }
     
     release(); 						// Dispose of the self-reference we took in acquirePortGated()
@@ -2276,7 +2317,7 @@ UInt32 AppleUSBCDCACMData::getStateGated()
 	
     CheckQueues();
 	
-    state = fPort.State & EXTERNAL_MASK;
+    state = fPort->State & EXTERNAL_MASK;
 	
     XTRACE(this, state, EXTERNAL_MASK, "getStateGated - Exit");
 	
@@ -2319,7 +2360,7 @@ IOReturn AppleUSBCDCACMData::setState(UInt32 state, UInt32 mask, void *refCon)
         
             // ignore any bits that are read-only
         
-        mask &= (~fPort.FlowControl & PD_RS232_A_MASK) | PD_S_MASK;
+        mask &= (~fPort->FlowControl & PD_RS232_A_MASK) | PD_S_MASK;
         if (mask)
         {
             retain();
@@ -2385,21 +2426,21 @@ IOReturn AppleUSBCDCACMData::setStateGated(UInt32 *pState, UInt32 *pMask)
     
         // Check if it's being acquired or already acquired
 
-    if ((state & PD_S_ACQUIRED) || (fPort.State & PD_S_ACQUIRED))
+    if ((state & PD_S_ACQUIRED) || (fPort->State & PD_S_ACQUIRED))
     {
 		XTRACE(this, state, mask, "setState - Requested state and mask");
-		XTRACE(this, 0, fPort.State, "setState - Current state");
-		DTRstate = fPort.State & PD_RS232_S_DTR;
-		RTSstate = fPort.State & PD_RS232_S_RTS;
+		XTRACE(this, 0, fPort->State, "setState - Current state");
+		DTRstate = fPort->State & PD_RS232_S_DTR;
+		RTSstate = fPort->State & PD_RS232_S_RTS;
 		XTRACE(this, DTRstate, RTSstate, "setState - DTRstate and RTSstate");
 		
 			// Set the new state based on the current setting
 			
-		if (fPort.State & PD_RS232_S_DTR)
+		if (fPort->State & PD_RS232_S_DTR)
 		{
 			DTRnew = true;
 		}
-		if (fPort.State & PD_RS232_S_RTS)
+		if (fPort->State & PD_RS232_S_RTS)
 		{
 			RTSnew = true;
 		}
@@ -2409,7 +2450,7 @@ IOReturn AppleUSBCDCACMData::setStateGated(UInt32 *pState, UInt32 *pMask)
 		
         if (mask & PD_RS232_S_DTR)
         {
-            if ((state & PD_RS232_S_DTR) != (fPort.State & PD_RS232_S_DTR))
+            if ((state & PD_RS232_S_DTR) != (fPort->State & PD_RS232_S_DTR))
             {
 				controlUpdate = true;
                 if (state & PD_RS232_S_DTR)
@@ -2426,7 +2467,7 @@ IOReturn AppleUSBCDCACMData::setStateGated(UInt32 *pState, UInt32 *pMask)
         }
 		if (mask & PD_RS232_S_RTS)
 		{
-			if ((state & PD_RS232_S_RTS) != (fPort.State & PD_RS232_S_RTS))
+			if ((state & PD_RS232_S_RTS) != (fPort->State & PD_RS232_S_RTS))
             {
 				controlUpdate = true;
                 if (state & PD_RS232_S_RTS)
@@ -2449,21 +2490,21 @@ IOReturn AppleUSBCDCACMData::setStateGated(UInt32 *pState, UInt32 *pMask)
 			setControlLineState(RTSnew, DTRnew);
 		}
         
-        state = (fPort.State & ~mask) | (state & mask); 		// compute the new state
-        delta = state ^ fPort.State;		    			// keep a copy of the diffs
-        fPort.State = state;
+        state = (fPort->State & ~mask) | (state & mask); 		// compute the new state
+        delta = state ^ fPort->State;		    			// keep a copy of the diffs
+        fPort->State = state;
 
 	    // Wake up all threads asleep on WatchStateMask
 		
-        if (delta & fPort.WatchStateMask)
+        if (delta & fPort->WatchStateMask)
         {
-            fCommandGate->commandWakeup((void *)&fPort.State);
+            fCommandGate->commandWakeup((void *)&fPort->State);
         }
         
         return kIOReturnSuccess;
 
     } else {
-        XTRACE(this, fPort.State, 0, "setStateGated - Not Acquired");
+        XTRACE(this, fPort->State, 0, "setStateGated - Not Acquired");
     }
     
     return kIOReturnNotOpen;
@@ -2555,7 +2596,7 @@ IOReturn AppleUSBCDCACMData::watchStateGated(UInt32 *pState, UInt32 *pMask)
     if (fTerminate || fStopping)
         return kIOReturnOffline;
         
-    if (fPort.State & PD_S_ACQUIRED)
+    if (fPort->State & PD_S_ACQUIRED)
     {
         ret = kIOReturnSuccess;
         mask &= EXTERNAL_MASK;
@@ -2573,11 +2614,11 @@ IOReturn AppleUSBCDCACMData::watchStateGated(UInt32 *pState, UInt32 *pMask)
                 // Check port state for any interesting bits with watchState value
                 // NB. the '^ ~' is a XNOR and tests for equality of bits.
 			
-            foundStates = (watchState ^ ~fPort.State) & mask;
+            foundStates = (watchState ^ ~fPort->State) & mask;
 
             if (foundStates)
             {
-                *pState = fPort.State;
+                *pState = fPort->State;
                 if (autoActiveBit && (foundStates & PD_S_ACTIVE))
                 {
                     ret = kIOReturnIOError;
@@ -2592,22 +2633,22 @@ IOReturn AppleUSBCDCACMData::watchStateGated(UInt32 *pState, UInt32 *pMask)
                 // wakeup all watch state threads.  The two events are an interrupt
                 // or one of the bits in the WatchStateMask changing.
 			
-            fPort.WatchStateMask |= mask;
+            fPort->WatchStateMask |= mask;
             
-            XTRACE(this, fPort.State, fPort.WatchStateMask, "watchStateGated - Thread sleeping");
+            XTRACE(this, fPort->State, fPort->WatchStateMask, "watchStateGated - Thread sleeping");
             
             retain();								// Just to make sure all threads are awake
             fCommandGate->retain();					// before we're released
         
             fThreadSleepCount++;
             
-            ret = fCommandGate->commandSleep((void *)&fPort.State);
+            ret = fCommandGate->commandSleep((void *)&fPort->State);
             
             fThreadSleepCount--;
         
             fCommandGate->release();
             
-            XTRACE(this, fPort.State, ret, "watchStateGated - Thread restart");
+            XTRACE(this, fPort->State, ret, "watchStateGated - Thread restart");
 
             if (ret == THREAD_TIMED_OUT)
             {
@@ -2636,9 +2677,9 @@ IOReturn AppleUSBCDCACMData::watchStateGated(UInt32 *pState, UInt32 *pMask)
             // thread, we clear down the watch state mask and wakeup
             // every sleeping thread to reinitialize the mask before exiting.
 		
-        fPort.WatchStateMask = 0;
+        fPort->WatchStateMask = 0;
         XTRACE(this, *pState, 0, "watchStateGated - Thread wakeing others");
-        fCommandGate->commandWakeup((void *)&fPort.State);
+        fCommandGate->commandWakeup((void *)&fPort->State);
  
         *pState &= EXTERNAL_MASK;
     }
@@ -2669,7 +2710,7 @@ UInt32 AppleUSBCDCACMData::nextEvent(void *refCon)
     if (fTerminate || fStopping)
         return kIOReturnOffline;
         
-    if (getState(&fPort) & PD_S_ACTIVE)
+    if (getState(fPort) & PD_S_ACTIVE)
     {
         return kIOReturnSuccess;
     }
@@ -2754,7 +2795,7 @@ IOReturn AppleUSBCDCACMData::executeEventGated(UInt32 *pEvent, UInt32 *pData)
         return kIOReturnOffline;
         
     delta = 0;
-    state = fPort.State;	
+    state = fPort->State;	
     XTRACE(this, state, event, "executeEventGated");
 	
     if ((state & PD_S_ACQUIRED) == 0)
@@ -2764,19 +2805,19 @@ IOReturn AppleUSBCDCACMData::executeEventGated(UInt32 *pEvent, UInt32 *pData)
     {
 	case PD_RS232_E_XON_BYTE:
             XTRACE(this, data, event, "executeEventGated - PD_RS232_E_XON_BYTE");
-            fPort.XONchar = data;
+            fPort->XONchar = data;
             break;
 	case PD_RS232_E_XOFF_BYTE:
             XTRACE(this, data, event, "executeEventGated - PD_RS232_E_XOFF_BYTE");
-            fPort.XOFFchar = data;
+            fPort->XOFFchar = data;
             break;
 	case PD_E_SPECIAL_BYTE:
             XTRACE(this, data, event, "executeEventGated - PD_E_SPECIAL_BYTE");
-            fPort.SWspecial[ data >> SPECIAL_SHIFT ] |= (1 << (data & SPECIAL_MASK));
+            fPort->SWspecial[ data >> SPECIAL_SHIFT ] |= (1 << (data & SPECIAL_MASK));
             break;
 	case PD_E_VALID_DATA_BYTE:
             XTRACE(this, data, event, "executeEventGated - PD_E_VALID_DATA_BYTE");
-            fPort.SWspecial[ data >> SPECIAL_SHIFT ] &= ~(1 << (data & SPECIAL_MASK));
+            fPort->SWspecial[ data >> SPECIAL_SHIFT ] &= ~(1 << (data & SPECIAL_MASK));
             break;
 	case PD_E_FLOW_CONTROL:
             XTRACE(this, data, event, "executeEventGated - PD_E_FLOW_CONTROL");
@@ -2815,11 +2856,11 @@ IOReturn AppleUSBCDCACMData::executeEventGated(UInt32 *pEvent, UInt32 *pData)
             break;
 	case PD_E_DATA_LATENCY:
             XTRACE(this, data, event, "executeEventGated - PD_E_DATA_LATENCY");
-            fPort.DataLatInterval = long2tval(data * 1000);
+            fPort->DataLatInterval = long2tval(data * 1000);
             break;
 	case PD_RS232_E_MIN_LATENCY:
             XTRACE(this, data, event, "executeEventGated - PD_RS232_E_MIN_LATENCY");
-            fPort.MinLatency = bool(data);
+            fPort->MinLatency = bool(data);
             break;
 	case PD_E_DATA_INTEGRITY:
             XTRACE(this, data, event, "executeEventGated - PD_E_DATA_INTEGRITY");
@@ -2827,8 +2868,8 @@ IOReturn AppleUSBCDCACMData::executeEventGated(UInt32 *pEvent, UInt32 *pData)
             {
                 ret = kIOReturnBadArgument;
             } else {
-                fPort.TX_Parity = data;
-                fPort.RX_Parity = PD_RS232_PARITY_DEFAULT;
+                fPort->TX_Parity = data;
+                fPort->RX_Parity = PD_RS232_PARITY_DEFAULT;
 			
                 setLineCoding();			
             }
@@ -2844,7 +2885,7 @@ IOReturn AppleUSBCDCACMData::executeEventGated(UInt32 *pEvent, UInt32 *pData)
             {
                 ret = kIOReturnBadArgument;
             } else {
-                fPort.BaudRate = data;
+                fPort->BaudRate = data;
 			
                 setLineCoding();			
             }		
@@ -2860,7 +2901,7 @@ IOReturn AppleUSBCDCACMData::executeEventGated(UInt32 *pEvent, UInt32 *pData)
             {
                 ret = kIOReturnBadArgument;
             } else {
-                fPort.CharLength = data;
+                fPort->CharLength = data;
 			
                 setLineCoding();			
             }
@@ -2871,7 +2912,7 @@ IOReturn AppleUSBCDCACMData::executeEventGated(UInt32 *pEvent, UInt32 *pData)
             {
                 ret = kIOReturnBadArgument;
             } else {
-                fPort.StopBits = data;
+                fPort->StopBits = data;
 			
                 setLineCoding();
             }
@@ -2885,7 +2926,7 @@ IOReturn AppleUSBCDCACMData::executeEventGated(UInt32 *pEvent, UInt32 *pData)
             {
                 ret = kIOReturnBadArgument;
             } else {
-                fPort.RX_Parity = data;
+                fPort->RX_Parity = data;
             }
             break;
 	case PD_E_RX_DATA_RATE:
@@ -2924,7 +2965,7 @@ IOReturn AppleUSBCDCACMData::executeEventGated(UInt32 *pEvent, UInt32 *pData)
             break;
 	case PD_E_DELAY:
             XTRACE(this, data, event, "executeEventGated - PD_E_DELAY");
-            fPort.CharLatInterval = long2tval(data * 1000);
+            fPort->CharLatInterval = long2tval(data * 1000);
             break;
 	case PD_E_RXQ_SIZE:
             XTRACE(this, data, event, "executeEventGated - PD_E_RXQ_SIZE");
@@ -2992,27 +3033,27 @@ IOReturn AppleUSBCDCACMData::requestEvent(UInt32 event, UInt32 *data, void *refC
         {
             case PD_E_ACTIVE:
                 XTRACE(this, 0, event, "requestEvent - PD_E_ACTIVE");
-                *data = bool(getState(&fPort) & PD_S_ACTIVE);			// Just to be safe put this through the gate
+                *data = bool(getState(fPort) & PD_S_ACTIVE);			// Just to be safe put this through the gate
                 break;
             case PD_E_FLOW_CONTROL:
-                XTRACE(this, fPort.FlowControl, event, "requestEvent - PD_E_FLOW_CONTROL");
-                *data = fPort.FlowControl;							
+                XTRACE(this, fPort->FlowControl, event, "requestEvent - PD_E_FLOW_CONTROL");
+                *data = fPort->FlowControl;							
                 break;
             case PD_E_DELAY:
                 XTRACE(this, 0, event, "requestEvent - PD_E_DELAY");
-                *data = tval2long(fPort.CharLatInterval)/ 1000;	
+                *data = tval2long(fPort->CharLatInterval)/ 1000;	
                 break;
             case PD_E_DATA_LATENCY:
                 XTRACE(this, 0, event, "requestEvent - PD_E_DATA_LATENCY");
-                *data = tval2long(fPort.DataLatInterval)/ 1000;	
+                *data = tval2long(fPort->DataLatInterval)/ 1000;	
                 break;
             case PD_E_TXQ_SIZE:
                 XTRACE(this, 0, event, "requestEvent - PD_E_TXQ_SIZE");
-                *data = GetQueueSize(&fPort.TX);	
+                *data = GetQueueSize(&fPort->TX);	
                 break;
             case PD_E_RXQ_SIZE:
                 XTRACE(this, 0, event, "requestEvent - PD_E_RXQ_SIZE");
-                *data = GetQueueSize(&fPort.RX);	
+                *data = GetQueueSize(&fPort->RX);	
                 break;
             case PD_E_TXQ_LOW_WATER:
                 XTRACE(this, 0, event, "requestEvent - PD_E_TXQ_LOW_WATER");
@@ -3036,15 +3077,15 @@ IOReturn AppleUSBCDCACMData::requestEvent(UInt32 event, UInt32 *data, void *refC
                 break;
             case PD_E_TXQ_AVAILABLE:
                 XTRACE(this, 0, event, "requestEvent - PD_E_TXQ_AVAILABLE");
-                *data = FreeSpaceinQueue(&fPort.TX);	 
+                *data = FreeSpaceinQueue(&fPort->TX);	 
                 break;
             case PD_E_RXQ_AVAILABLE:
                 XTRACE(this, 0, event, "requestEvent - PD_E_RXQ_AVAILABLE");
-                *data = UsedSpaceinQueue(&fPort.RX); 	
+                *data = UsedSpaceinQueue(&fPort->RX); 	
                 break;
             case PD_E_DATA_RATE:
                 XTRACE(this, 0, event, "requestEvent - PD_E_DATA_RATE");
-                *data = fPort.BaudRate << 1;		
+                *data = fPort->BaudRate << 1;		
                 break;
             case PD_E_RX_DATA_RATE:
                 XTRACE(this, 0, event, "requestEvent - PD_E_RX_DATA_RATE");
@@ -3052,7 +3093,7 @@ IOReturn AppleUSBCDCACMData::requestEvent(UInt32 event, UInt32 *data, void *refC
                 break;
             case PD_E_DATA_SIZE:
                 XTRACE(this, 0, event, "requestEvent - PD_E_DATA_SIZE");
-                *data = fPort.CharLength << 1;	
+                *data = fPort->CharLength << 1;	
                 break;
             case PD_E_RX_DATA_SIZE:
                 XTRACE(this, 0, event, "requestEvent - PD_E_RX_DATA_SIZE");
@@ -3060,15 +3101,15 @@ IOReturn AppleUSBCDCACMData::requestEvent(UInt32 event, UInt32 *data, void *refC
                 break;
             case PD_E_DATA_INTEGRITY:
                 XTRACE(this, 0, event, "requestEvent - PD_E_DATA_INTEGRITY");
-                *data = fPort.TX_Parity;			
+                *data = fPort->TX_Parity;			
                 break;
             case PD_E_RX_DATA_INTEGRITY:
                 XTRACE(this, 0, event, "requestEvent - PD_E_RX_DATA_INTEGRITY");
-                *data = fPort.RX_Parity;			
+                *data = fPort->RX_Parity;			
                 break;
             case PD_RS232_E_STOP_BITS:
                 XTRACE(this, 0, event, "requestEvent - PD_RS232_E_STOP_BITS");
-                *data = fPort.StopBits << 1;		
+                *data = fPort->StopBits << 1;		
                 break;
             case PD_RS232_E_RX_STOP_BITS:
                 XTRACE(this, 0, event, "requestEvent - PD_RS232_E_RX_STOP_BITS");
@@ -3076,19 +3117,19 @@ IOReturn AppleUSBCDCACMData::requestEvent(UInt32 event, UInt32 *data, void *refC
                 break;
             case PD_RS232_E_XON_BYTE:
                 XTRACE(this, 0, event, "requestEvent - PD_RS232_E_XON_BYTE");
-                *data = fPort.XONchar;			
+                *data = fPort->XONchar;			
                 break;
             case PD_RS232_E_XOFF_BYTE:
                 XTRACE(this, 0, event, "requestEvent - PD_RS232_E_XOFF_BYTE");
-                *data = fPort.XOFFchar;			
+                *data = fPort->XOFFchar;			
                 break;
             case PD_RS232_E_LINE_BREAK:
                 XTRACE(this, 0, event, "requestEvent - PD_RS232_E_LINE_BREAK");
-                *data = bool(getState(&fPort) & PD_RS232_S_BRK);			// This should be gated too
+                *data = bool(getState(fPort) & PD_RS232_S_BRK);			// This should be gated too
                 break;
             case PD_RS232_E_MIN_LATENCY:
                 XTRACE(this, 0, event, "requestEvent - PD_RS232_E_MIN_LATENCY");
-                *data = bool(fPort.MinLatency);		
+                *data = bool(fPort->MinLatency);		
                 break;
             default:
                 XTRACE(this, 0, event, "requestEvent - unrecognized event");
@@ -3164,7 +3205,7 @@ IOReturn AppleUSBCDCACMData::dequeueEvent(UInt32 *event, UInt32 *data, bool slee
     if ((event == NULL) || (data == NULL))
         return kIOReturnBadArgument;
 
-    if (getState(&fPort) & PD_S_ACTIVE)
+    if (getState(fPort) & PD_S_ACTIVE)
     {
         return kIOReturnSuccess;
     }
@@ -3268,15 +3309,15 @@ IOReturn AppleUSBCDCACMData::enqueueDataGated(UInt8 *buffer, UInt32 *pSize, UInt
 
     *count = 0;
 
-    if (!(fPort.State & PD_S_ACTIVE))
+    if (!(fPort->State & PD_S_ACTIVE))
         return kIOReturnNotOpen;
 
-    XTRACE(this, fPort.State, size, "enqueueDataGated - current State");	
+    XTRACE(this, fPort->State, size, "enqueueDataGated - current State");	
 //    LogData(kDataOther, size, buffer);
 
         // Go ahead and try to add something to the buffer
         
-    *count = AddtoQueue(&fPort.TX, buffer, size);
+    *count = AddtoQueue(&fPort->TX, buffer, size);
     CheckQueues();
 
         // Let the tranmitter know that we have something ready to go
@@ -3297,7 +3338,7 @@ IOReturn AppleUSBCDCACMData::enqueueDataGated(UInt8 *buffer, UInt32 *pSize, UInt
             return rtn;
         }
 
-        *count += AddtoQueue(&fPort.TX, buffer + *count, size - *count);
+        *count += AddtoQueue(&fPort->TX, buffer + *count, size - *count);
         CheckQueues();
 
             // Let the tranmitter know that we have something ready to go.
@@ -3413,12 +3454,12 @@ IOReturn AppleUSBCDCACMData::dequeueDataGated(UInt8 *buffer, UInt32 *pSize, UInt
         // If the port is not active then there should not be any chars.
         
     *count = 0;
-    if (!(fPort.State & PD_S_ACTIVE))
+    if (!(fPort->State & PD_S_ACTIVE))
         return kIOReturnNotOpen;
 
         // Get any data living in the queue.
         
-    *count = RemovefromQueue(&fPort.RX, buffer, size);
+    *count = RemovefromQueue(&fPort->RX, buffer, size);
 	if (*count > 0)
 	{
 		addr = (uintptr_t)buffer;
@@ -3444,10 +3485,10 @@ IOReturn AppleUSBCDCACMData::dequeueDataGated(UInt8 *buffer, UInt32 *pSize, UInt
         
             // Try and get more data starting from where we left off
 		
-//		*count += RemovefromQueue(&fPort.RX, buffer + *count, (size - *count));
+//		*count += RemovefromQueue(&fPort->RX, buffer + *count, (size - *count));
 		
 		savCount = *count;
-		*count += RemovefromQueue(&fPort.RX, &buffer[*count], (size - *count));
+		*count += RemovefromQueue(&fPort->RX, &buffer[*count], (size - *count));
 		addr = (uintptr_t)buffer;
 		XTRACE(this, *count, addr, "dequeueDataGated - Removed from Queue (next)");
 		LogData(kDataOther, *count, &buffer[savCount]);
@@ -3460,12 +3501,12 @@ IOReturn AppleUSBCDCACMData::dequeueDataGated(UInt8 *buffer, UInt32 *pSize, UInt
 
         // Now let's check our receive buffer to see if we need to stop
         
-    goXOIdle = (UsedSpaceinQueue(&fPort.RX) < fPort.RXStats.LowWater) && (fPort.RXOstate == SENT_XOFF);
+    goXOIdle = (UsedSpaceinQueue(&fPort->RX) < fPort->RXStats.LowWater) && (fPort->RXOstate == SENT_XOFF);
 
     if (goXOIdle)
     {
-        fPort.RXOstate = IDLE_XO;
-        AddBytetoQueue(&fPort.TX, fPort.XOFFchar);
+        fPort->RXOstate = IDLE_XO;
+        AddBytetoQueue(&fPort->TX, fPort->XOFFchar);
         setUpTransmit();
     }
 
@@ -3500,7 +3541,7 @@ bool AppleUSBCDCACMData::setUpTransmit()
         return false;
     }
 
-    if (UsedSpaceinQueue(&fPort.TX) > 0)
+    if (UsedSpaceinQueue(&fPort->TX) > 0)
     {
         startTransmission();
     }
@@ -3535,14 +3576,14 @@ void AppleUSBCDCACMData::startTransmission()
 
         // Get an output buffer
 	
-	indx = fPort.outPoolIndex;
-	if (!fPort.outPool[indx].avail)
+	indx = fPort->outPoolIndex;
+	if (!fPort->outPool[indx].avail)
 	{
-		for (indx=0; indx<fPort.outPoolIndex; indx++)
+		for (indx=0; indx<fPort->outPoolIndex; indx++)
 		{
-			if (fPort.outPool[indx].avail)
+			if (fPort->outPool[indx].avail)
 			{
-				fPort.outPoolIndex = indx;
+				fPort->outPoolIndex = indx;
 				gotBuffer = true;
 				break;
 			}
@@ -3552,11 +3593,11 @@ void AppleUSBCDCACMData::startTransmission()
 	}
 	if (gotBuffer)
 	{
-		fPort.outPool[indx].avail = false;
-		fPort.outPoolIndex++;
-		if (fPort.outPoolIndex >= fOutBufPool)
+		fPort->outPool[indx].avail = false;
+		fPort->outPoolIndex++;
+		if (fPort->outPoolIndex >= fOutBufPool)
 		{
-			fPort.outPoolIndex = 0;
+			fPort->outPoolIndex = 0;
 		}
 	} else {
 		XTRACE(this, fOutBufPool, indx, "startTransmission - Output buffer unavailable");
@@ -3565,7 +3606,7 @@ void AppleUSBCDCACMData::startTransmission()
 
         // Fill up the buffer with characters from the queue
 		
-    count = RemovefromQueue(&fPort.TX, fPort.outPool[indx].pipeBuffer, MAX_BLOCK_SIZE);
+    count = RemovefromQueue(&fPort->TX, fPort->outPool[indx].pipeBuffer, MAX_BLOCK_SIZE);
 
         // If there are no bytes to send just exit:
 		
@@ -3574,7 +3615,7 @@ void AppleUSBCDCACMData::startTransmission()
             // Updates all the status flags:
 			
         CheckQueues();
-		fPort.outPool[indx].avail = true;
+		fPort->outPool[indx].avail = true;
         return;
     }
     
@@ -3582,14 +3623,14 @@ void AppleUSBCDCACMData::startTransmission()
 	mask = PD_S_TX_BUSY;
     setStateGated(&state, &mask);
     
-    XTRACE(this, fPort.State, count, "startTransmission - Bytes to write");
-    LogData(kDataOut, count, fPort.outPool[indx].pipeBuffer);
+    XTRACE(this, fPort->State, count, "startTransmission - Bytes to write");
+    LogData(kDataOut, count, fPort->outPool[indx].pipeBuffer);
     	
-    fPort.outPool[indx].count = count;
-    fPort.outPool[indx].completionInfo.parameter = (void *)&fPort.outPool[indx];
-    fPort.outPool[indx].pipeMDP->setLength(count);
+    fPort->outPool[indx].count = count;
+    fPort->outPool[indx].completionInfo.parameter = (void *)&fPort->outPool[indx];
+    fPort->outPool[indx].pipeMDP->setLength(count);
     
-    ior = fPort.OutPipe->Write(fPort.outPool[indx].pipeMDP, &fPort.outPool[indx].completionInfo);
+    ior = cdc_PipeWrite(fPort->OutPipe, fPort->outPool[indx].pipeMDP, count, kPipeNoTimeout, kPipeNoTimeout, &fPort->outPool[indx].completionInfo);
     if (ior != kIOReturnSuccess)
     {
         XTRACE(this, 0, ior, "startTransmission - Write failed");
@@ -3622,8 +3663,8 @@ void AppleUSBCDCACMData::setLineCoding()
     
     	// Check for changes and only do it if something's changed
 	
-    if ((fPort.BaudRate == fPort.LastBaudRate) && (fPort.StopBits == fPort.LastStopBits) && 
-        (fPort.TX_Parity == fPort.LastTX_Parity) && (fPort.CharLength == fPort.LastCharLength))
+    if ((fPort->BaudRate == fPort->LastBaudRate) && (fPort->StopBits == fPort->LastStopBits) && 
+        (fPort->TX_Parity == fPort->LastTX_Parity) && (fPort->CharLength == fPort->LastCharLength))
     {
         return;
     }
@@ -3632,13 +3673,13 @@ void AppleUSBCDCACMData::setLineCoding()
 		
 	if (fControlDriver)
 	{
-		fControlDriver->USBSendSetLineCoding(fPort.BaudRate, fPort.StopBits, fPort.TX_Parity, fPort.CharLength);
+		fControlDriver->USBSendSetLineCoding(fPort->BaudRate, fPort->StopBits, fPort->TX_Parity, fPort->CharLength);
 	}
 	
-	fPort.LastBaudRate = fPort.BaudRate;
-	fPort.LastStopBits = fPort.StopBits;
-	fPort.LastTX_Parity = fPort.TX_Parity;
-	fPort.LastCharLength = fPort.CharLength;
+	fPort->LastBaudRate = fPort->BaudRate;
+	fPort->LastStopBits = fPort->StopBits;
+	fPort->LastTX_Parity = fPort->TX_Parity;
+	fPort->LastCharLength = fPort->CharLength;
 	
 }/* end setLineCoding */
 
@@ -3712,17 +3753,7 @@ IOReturn AppleUSBCDCACMData::checkPipe(IOUSBPipe *thePipe, bool devReq)
     
     XTRACEP(this, 0, thePipe, "checkPipe");
     
-    if (!devReq)
-    {
-        rtn = thePipe->GetPipeStatus();
-        if (rtn != kIOUSBPipeStalled)
-        {
-            XTRACE(this, 0, rtn, "checkPipe - Pipe not stalled");
-            return rtn;
-        }
-    }
-    
-    rtn = thePipe->ClearPipeStall(true);
+    rtn = cdc_CheckPipe(thePipe, devReq);
     if (rtn == kIOReturnSuccess)
     {
         XTRACE(this, 0, 0, "checkPipe - ClearPipeStall Successful");
@@ -3748,40 +3779,24 @@ IOReturn AppleUSBCDCACMData::checkPipe(IOUSBPipe *thePipe, bool devReq)
 
 void AppleUSBCDCACMData::initStructure()
 {
-    UInt16	i;
 	
     XTRACE(this, 0, 0, "initStructure");
 
         // These are set up at start and should not be reset during execution.
         
-    fPort.FCRimage = 0x00;
-    fPort.IERmask = 0x00;
-
-    fPort.State = (PD_S_TXQ_EMPTY | PD_S_TXQ_LOW_WATER | PD_S_RXQ_EMPTY | PD_S_RXQ_LOW_WATER);
-    fPort.WatchStateMask = 0x00000000;
-    fPort.InPipe = NULL;
-    fPort.OutPipe = NULL;
-    for (i=0; i<kMaxInBufPool; i++)
-    {
-        fPort.inPool[i].pipeMDP = NULL;
-        fPort.inPool[i].pipeBuffer = NULL;
-        fPort.inPool[i].dead = false;
-		fPort.inPool[i].count = -1;
-		fPort.inPool[i].held = false;
-		
-		fPort.holdQueue[i] = 0;
-    }
-	fPort.holdQueueIndxIn = 0;
-	fPort.holdQueueIndxOut = 0;
-	
-    for (i=0; i<kMaxOutBufPool; i++)
-    {
-        fPort.outPool[i].pipeMDP = NULL;
-        fPort.outPool[i].pipeBuffer = NULL;
-        fPort.outPool[i].count = -1;
-        fPort.outPool[i].avail = false;
-    }
-    fPort.outPoolIndex = 0;
+    fPort->FCRimage = 0x00;
+    fPort->IERmask = 0x00;
+
+    fPort->State = (PD_S_TXQ_EMPTY | PD_S_TXQ_LOW_WATER | PD_S_RXQ_EMPTY | PD_S_RXQ_LOW_WATER);
+    fPort->WatchStateMask = 0x00000000;
+    fPort->InPipe = NULL;
+    fPort->OutPipe = NULL;
+    fPort->inPool = NULL;				// Allocated with the resources once the pool sizes are known
+    fPort->outPool = NULL;
+    fPort->holdQueue = NULL;
+	fPort->holdQueueIndxIn = 0;
+	fPort->holdQueueIndxOut = 0;
+    fPort->outPoolIndex = 0;
 
 }/* end initStructure */
 
@@ -3803,37 +3818,124 @@ void AppleUSBCDCACMData::setStructureDefaults()
 	
     XTRACE(this, 0, 0, "setStructureDefaults");
 
-    fPort.BaudRate = kDefaultBaudRate;			// 9600 bps
-    fPort.LastBaudRate = 0;
-    fPort.CharLength = 8;				// 8 Data bits
-    fPort.LastCharLength = 0;
-    fPort.StopBits = 2;					// 1 Stop bit
-    fPort.LastStopBits = 0;
-    fPort.TX_Parity = 1;				// No Parity
-    fPort.LastTX_Parity	= 0;
-    fPort.RX_Parity = 1;				// --ditto--
-    fPort.MinLatency = false;
-    fPort.XONchar = '\x11';
-    fPort.XOFFchar = '\x13';
-    fPort.FlowControl = 0x00000000;
-    fPort.RXOstate = IDLE_XO;
-    fPort.TXOstate = IDLE_XO;
-    fPort.FrameTOEntry = NULL;
-
-    fPort.RXStats.BufferSize = kMaxCirBufferSize;
-    fPort.RXStats.HighWater = (fPort.RXStats.BufferSize << 1) / 3;
-    fPort.RXStats.LowWater = fPort.RXStats.HighWater >> 1;
-    fPort.TXStats.BufferSize = kMaxCirBufferSize;
-    fPort.TXStats.HighWater = (fPort.RXStats.BufferSize << 1) / 3;
-    fPort.TXStats.LowWater = fPort.RXStats.HighWater >> 1;
-
-    fPort.FlowControl = (DEFAULT_AUTO | DEFAULT_NOTIFY);
+    fPort->BaudRate = kDefaultBaudRate;			// 9600 bps
+    fPort->LastBaudRate = 0;
+    fPort->CharLength = 8;				// 8 Data bits
+    fPort->LastCharLength = 0;
+    fPort->StopBits = 2;					// 1 Stop bit
+    fPort->LastStopBits = 0;
+    fPort->TX_Parity = 1;				// No Parity
+    fPort->LastTX_Parity	= 0;
+    fPort->RX_Parity = 1;				// --ditto--
+    fPort->MinLatency = false;
+    fPort->XONchar = '\x11';
+    fPort->XOFFchar = '\x13';
+    fPort->FlowControl = 0x00000000;
+    fPort->RXOstate = IDLE_XO;
+    fPort->TXOstate = IDLE_XO;
+    fPort->FrameTOEntry = NULL;
+
+    fPort->RXStats.BufferSize = kMaxCirBufferSize;
+    fPort->RXStats.HighWater = (fPort->RXStats.BufferSize << 1) / 3;
+    fPort->RXStats.LowWater = fPort->RXStats.HighWater >> 1;
+    fPort->TXStats.BufferSize = kMaxCirBufferSize;
+    fPort->TXStats.HighWater = (fPort->RXStats.BufferSize << 1) / 3;
+    fPort->TXStats.LowWater = fPort->RXStats.HighWater >> 1;
+
+    fPort->FlowControl = (DEFAULT_AUTO | DEFAULT_NOTIFY);
 
     for (tmp=0; tmp < (256 >> SPECIAL_SHIFT); tmp++)
-        fPort.SWspecial[ tmp ] = 0;
+        fPort->SWspecial[ tmp ] = 0;
 	
 }/* end setStructureDefaults */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCACMData::allocatePools
+//
+//		Inputs:		
+//
+//		Outputs:	return code - true (allocate was successful), false (it failed)
+//
+//		Desc:		Allocate the buffer records and the hold queue at the configured pool sizes
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCACMData::allocatePools()
+{
+    UInt16	i;
+    
+    XTRACE(this, fInBufPool, fOutBufPool, "allocatePools");
+    
+    if (fPort->inPool)
+    {
+        return true;
+    }
+    
+    fPort->inPool = (inPipeBuffers *)IOMalloc(fInBufPool * sizeof(inPipeBuffers));
+    fPort->outPool = (outPipeBuffers *)IOMalloc(fOutBufPool * sizeof(outPipeBuffers));
+    fPort->holdQueue = (inPipeBuffers **)IOMalloc(fInBufPool * sizeof(inPipeBuffers *));
+    if (!fPort->inPool || !fPort->outPool || !fPort->holdQueue)
+    {
+        XTRACE(this, 0, 0, "allocatePools - IOMalloc failed");
+        freePools();
+        return false;
+    }
+    bzero(fPort->inPool, fInBufPool * sizeof(inPipeBuffers));
+    bzero(fPort->outPool, fOutBufPool * sizeof(outPipeBuffers));
+    bzero(fPort->holdQueue, fInBufPool * sizeof(inPipeBuffers *));
+    
+    for (i=0; i<fInBufPool; i++)
+    {
+		fPort->inPool[i].count = -1;
+    }
+    for (i=0; i<fOutBufPool; i++)
+    {
+        fPort->outPool[i].count = -1;
+    }
+	fPort->holdQueueIndxIn = 0;
+	fPort->holdQueueIndxOut = 0;
+    fPort->outPoolIndex = 0;
+    
+    return true;
+    
+}/* end allocatePools */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCACMData::freePools
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Free the buffer records and the hold queue, the buffers have already gone
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCACMData::freePools()
+{
+    
+    XTRACE(this, 0, 0, "freePools");
+    
+    if (fPort->inPool)
+    {
+        IOFree(fPort->inPool, fInBufPool * sizeof(inPipeBuffers));
+        fPort->inPool = NULL;
+    }
+    if (fPort->outPool)
+    {
+        IOFree(fPort->outPool, fOutBufPool * sizeof(outPipeBuffers));
+        fPort->outPool = NULL;
+    }
+    if (fPort->holdQueue)
+    {
+        IOFree(fPort->holdQueue, fInBufPool * sizeof(inPipeBuffers *));
+        fPort->holdQueue = NULL;
+    }
+    
+}/* end freePools */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCACMData::allocateResources
@@ -3852,6 +3954,12 @@ bool AppleUSBCDCACMData::allocateResources()
     UInt16			i;
 
     XTRACE(this, 0, 0, "allocateResources.");
+    
+    if (!allocatePools())
+    {
+        XTRACE(this, 0, 0, "allocateResources - allocatePools failed.");
+        return false;
+    }
 
         // Open all the end points and get the buffers
 
@@ -3867,60 +3975,60 @@ bool AppleUSBCDCACMData::allocateResources()
     epReq.direction = kUSBIn;
     epReq.maxPacketSize	= 0;
     epReq.interval = 0;
-    fPort.InPipe = fDataInterface->FindNextPipe(0, &epReq);
-    if (!fPort.InPipe)
+    fPort->InPipe = fDataInterface->FindNextPipe(0, &epReq);
+    if (!fPort->InPipe)
     {
         XTRACE(this, 0, 0, "allocateResources - no bulk input pipe.");
         return false;
     }
-    fPort.InPacketSize = epReq.maxPacketSize;
+    fPort->InPacketSize = epReq.maxPacketSize;
     XTRACE(this, epReq.maxPacketSize << 16 |epReq.interval, 0, "allocateResources - bulk input pipe.");
     
         // Allocate Memory Descriptor Pointer with memory for the bulk in pipe
     
     for (i=0; i<fInBufPool; i++)
     {
-//        fPort.inPool[i].pipeMDP = IOBufferMemoryDescriptor::withCapacity(DATA_BUFF_SIZE, kIODirectionIn);
-        fPort.inPool[i].pipeMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionIn | kIOMemoryPhysicallyContiguous, DATA_BUFF_SIZE, PAGE_SIZE);
-        if (!fPort.inPool[i].pipeMDP)
+//        fPort->inPool[i].pipeMDP = IOBufferMemoryDescriptor::withCapacity(DATA_BUFF_SIZE, kIODirectionIn);
+        fPort->inPool[i].pipeMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionIn | kIOMemoryPhysicallyContiguous, DATA_BUFF_SIZE, PAGE_SIZE);
+        if (!fPort->inPool[i].pipeMDP)
         {
             XTRACE(this, 0, i, "allocateResources - Allocate input MDP failed");
             return false;
         }
-        fPort.inPool[i].pipeBuffer = (UInt8*)fPort.inPool[i].pipeMDP->getBytesNoCopy();
-        XTRACEP(this, fPort.inPool[i].pipeMDP, fPort.inPool[i].pipeBuffer, "allocateResources - input buffer");
-        fPort.inPool[i].dead = false;
+        fPort->inPool[i].pipeBuffer = (UInt8*)fPort->inPool[i].pipeMDP->getBytesNoCopy();
+        XTRACEP(this, fPort->inPool[i].pipeMDP, fPort->inPool[i].pipeBuffer, "allocateResources - input buffer");
+        fPort->inPool[i].dead = false;
     }
     
         // Bulk Out pipe
 
     epReq.direction = kUSBOut;
-    fPort.OutPipe = fDataInterface->FindNextPipe(0, &epReq);
-    if (!fPort.OutPipe)
+    fPort->OutPipe = fDataInterface->FindNextPipe(0, &epReq);
+    if (!fPort->OutPipe)
     {
         XTRACE(this, 0, 0, "allocateResources - no bulk output pipe.");
         return false;
     }
-    fPort.OutPacketSize = epReq.maxPacketSize;
+    fPort->OutPacketSize = epReq.maxPacketSize;
     XTRACE(this, epReq.maxPacketSize << 16 |epReq.interval, 0, "allocateResources - bulk output pipe.");
     
         // Allocate Memory Descriptor Pointer with memory for the bulk out pipe
 
     for (i=0; i<fOutBufPool; i++)
     {
-//        fPort.outPool[i].pipeMDP = IOBufferMemoryDescriptor::withCapacity(MAX_BLOCK_SIZE, kIODirectionOut);
-        fPort.outPool[i].pipeMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionOut | kIOMemoryPhysicallyContiguous, MAX_BLOCK_SIZE, PAGE_SIZE);
-        if (!fPort.outPool[i].pipeMDP)
+//        fPort->outPool[i].pipeMDP = IOBufferMemoryDescriptor::withCapacity(MAX_BLOCK_SIZE, kIODirectionOut);
+        fPort->outPool[i].pipeMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionOut | kIOMemoryPhysicallyContiguous, MAX_BLOCK_SIZE, PAGE_SIZE);
+        if (!fPort->outPool[i].pipeMDP)
         {
             XTRACE(this, 0, i, "allocateResources - Allocate output MDP failed");
             return false;
         }
-        fPort.outPool[i].pipeBuffer = (UInt8*)fPort.outPool[i].pipeMDP->getBytesNoCopy();
-        XTRACEP(this, fPort.outPool[i].pipeMDP, fPort.outPool[i].pipeBuffer, "allocateResources - output buffer");
-        fPort.outPool[i].avail = true;
+        fPort->outPool[i].pipeBuffer = (UInt8*)fPort->outPool[i].pipeMDP->getBytesNoCopy();
+        XTRACEP(this, fPort->outPool[i].pipeMDP, fPort->outPool[i].pipeBuffer, "allocateResources - output buffer");
+        fPort->outPool[i].avail = true;
     }
         
-    XTRACEP(this, 0, fPort.RX.Start, "allocateResources - RX ring buffer");
+    XTRACEP(this, 0, fPort->RX.Start, "allocateResources - RX ring buffer");
 
     return true;
 	
@@ -3951,27 +4059,27 @@ void AppleUSBCDCACMData::releaseResources()
         fDataInterface = NULL;
     }
     
-    for (i=0; i<fInBufPool; i++)
+    for (i=0; (fPort->inPool != NULL) && (i<fInBufPool); i++)
     {
-        if (fPort.inPool[i].pipeMDP)	
+        if (fPort->inPool[i].pipeMDP)	
         { 
-            fPort.inPool[i].pipeMDP->release();	
-            fPort.inPool[i].pipeMDP = NULL;
-            fPort.inPool[i].dead = false;
+            fPort->inPool[i].pipeMDP->release();	
+            fPort->inPool[i].pipeMDP = NULL;
+            fPort->inPool[i].dead = false;
         }
     }
 	
-    for (i=0; i<fOutBufPool; i++)
+    for (i=0; (fPort->outPool != NULL) && (i<fOutBufPool); i++)
     {
-        if (fPort.outPool[i].pipeMDP)	
+        if (fPort->outPool[i].pipeMDP)	
         { 
-            fPort.outPool[i].pipeMDP->release();	
-            fPort.outPool[i].pipeMDP = NULL;
-            fPort.outPool[i].count = -1;
-            fPort.outPool[i].avail = false;
+            fPort->outPool[i].pipeMDP->release();	
+            fPort->outPool[i].pipeMDP = NULL;
+            fPort->outPool[i].count = -1;
+            fPort->outPool[i].avail = false;
         }
     }
-    fPort.outPoolIndex = 0;
+    fPort->outPoolIndex = 0;
     
     if (fWorkLoop)
     {
@@ -3979,8 +4087,8 @@ void AppleUSBCDCACMData::releaseResources()
         fWorkLoop = NULL;
     }
 
-    freeRingBuffer(&fPort.TX);
-    freeRingBuffer(&fPort.RX);
+    freeRingBuffer(&fPort->TX);
+    freeRingBuffer(&fPort->RX);
 	
 }/* end releaseResources */
 
@@ -4029,28 +4137,28 @@ void AppleUSBCDCACMData::freeRingBuffer(CirQueue *Queue)
 bool AppleUSBCDCACMData::createSerialRingBuffers()
 {
     
-    if (fPort.ringsAllocated == true)
+    if (fPort->ringsAllocated == true)
     {
         XTRACE(this, 0, 0, "createSerialRingBuffers - rings already allocated");
         return true;
     }
     
     // Now the ring buffers
-    if (!allocateRingBuffer(&fPort.TX, fPort.TXStats.BufferSize))
+    if (!allocateRingBuffer(&fPort->TX, fPort->TXStats.BufferSize))
     {
         XTRACE(this, 0, 0, "createSerialRingBuffers - Couldn't allocate TX ring buffer");
         return false;
     }
     
-    XTRACEP(this, 0, fPort.TX.Start, "createSerialRingBuffers - TX ring buffer");
+    XTRACEP(this, 0, fPort->TX.Start, "createSerialRingBuffers - TX ring buffer");
     
-    if (!allocateRingBuffer(&fPort.RX, fPort.RXStats.BufferSize))
+    if (!allocateRingBuffer(&fPort->RX, fPort->RXStats.BufferSize))
     {
         XTRACE(this, 0, 0, "createSerialRingBuffers - Couldn't allocate RX ring buffer");
         return false;
     }
     
-    fPort.ringsAllocated = true;
+    fPort->ringsAllocated = true;
     
     return true;
 }
@@ -4283,8 +4391,8 @@ void AppleUSBCDCACMData::clearSleepingThreads()
     {
         if (fThreadSleepCount > 0)
         {
-            fPort.WatchStateMask = 0;
-            fCommandGate->commandWakeup((void *)&fPort.State);
+            fPort->WatchStateMask = 0;
+            fCommandGate->commandWakeup((void *)&fPort->State);
         }
     }
 		    
@@ -4316,29 +4424,29 @@ void AppleUSBCDCACMData::resurrectRead()
     }
 		// Let's check the pipes first
 	
-	if (fPort.InPipe)
+	if (fPort->InPipe)
 	{
-		checkPipe(fPort.InPipe, false);
+		checkPipe(fPort->InPipe, false);
 	}
     
-	if (fPort.OutPipe)
+	if (fPort->OutPipe)
 	{
-		checkPipe(fPort.OutPipe, false);
+		checkPipe(fPort->OutPipe, false);
 	}
 
 	for (i=0; i<fInBufPool; i++)
 	{
-		if (fPort.inPool[i].pipeMDP)
+		if (fPort->inPool[i].pipeMDP)
 		{
-			if (fPort.inPool[i].dead)
+			if (fPort->inPool[i].dead)
 			{
-				rtn = fPort.InPipe->Read(fPort.inPool[i].pipeMDP, &fPort.inPool[i].completionInfo, NULL);
+				rtn = fPort->InPipe->Read(fPort->inPool[i].pipeMDP, &fPort->inPool[i].completionInfo, NULL);
 				if (rtn != kIOReturnSuccess)
 				{
 					XTRACE(this, i, rtn, "resurrectRead - Read for bulk-in pipe failed, still dead");
 				} else {
-					XTRACEP(this, &fPort.inPool[i], fPort.InPipe, "resurrectRead - Read posted");
-					fPort.inPool[i].dead = false;
+					XTRACEP(this, &fPort->inPool[i], fPort->InPipe, "resurrectRead - Read posted");
+					fPort->inPool[i].dead = false;
 				}
 			}
 		}
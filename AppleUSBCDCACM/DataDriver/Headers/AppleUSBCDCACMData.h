@@ -28,6 +28,7 @@
 #include <IOKit/IOUserClient.h>
 
 #include "AppleUSBCDCCommon.h"
+#include "AppleUSBCDCPipe.h"
 #include "AppleUSBCDC.h"
 #include "AppleUSBCDCACMControl.h"
 #include "AppleUSBCDCACMDataUser.h"
@@ -141,24 +142,37 @@ typedef struct
     IOUSBCompletion		completionInfo;
 } outPipeBuffers;
 
+    // The port is laid out by who writes it. The client side (under the command gate),
+    // each of the circular queues and the read completion each get their own cache
+    // lines, configuration that's only read on the data path comes after them. The
+    // offsets only mean something if the port starts on a line, so it's allocated
+    // with IOMallocAligned rather than living in the (kalloc'd) driver object.
+
 typedef struct
 {
 
-        // State and serialization variables
+        // State and serialization variables (client side)
 
     UInt32		State;
     UInt32		WatchStateMask;
+    SInt16		RXOstate;    			// Indicates our receive state.
+    SInt16		TXOstate;			// Indicates our transmit state, if we have received any Flow Control.
 
-        // queue control structures:
+        // queue control structures (producer and consumer share each queue):
 			
-    CirQueue		RX;
-    CirQueue		TX;
+    CirQueue		RX __attribute__((aligned(kCacheLineSize)));
+    CirQueue		TX __attribute__((aligned(kCacheLineSize)));
 
-	inPipeBuffers	*holdQueue[kMaxInBufPool];
-	UInt16			holdQueueIndxIn;
+        // read completion side
+    
+	UInt16			holdQueueIndxIn __attribute__((aligned(kCacheLineSize)));
 	UInt16			holdQueueIndxOut;
+    UInt16		outPoolIndex;
+	inPipeBuffers	**holdQueue;				// fInBufPool entries
+
+        // Read mostly from here on
 
-    BufferMarks		RXStats;
+    BufferMarks		RXStats __attribute__((aligned(kCacheLineSize)));
     BufferMarks		TXStats;
 	
         // UART configuration info:
@@ -172,15 +186,12 @@ typedef struct
     UInt8		IERmask;
     bool            	MinLatency;
 	
-        // flow control state & configuration:
+        // flow control configuration:
 			
     UInt8		XONchar;
     UInt8		XOFFchar;
     UInt32		SWspecial[ 0x100 >> SPECIAL_SHIFT ];
     UInt32		FlowControl;			// notify-on-delta & auto_control
-		
-    SInt16		RXOstate;    			// Indicates our receive state.
-    SInt16		TXOstate;			// Indicates our transmit state, if we have received any Flow Control.
 	
     IOThread		FrameTOEntry;
 	
@@ -192,10 +203,6 @@ typedef struct
     IOUSBPipe		*InPipe;
     IOUSBPipe		*OutPipe;
     
-    inPipeBuffers       inPool[kMaxInBufPool];
-    outPipeBuffers      outPool[kMaxOutBufPool];
-    UInt16		outPoolIndex;
-    
     UInt8		CommInterfaceNumber;
     UInt8		DataInterfaceNumber;
 
@@ -207,9 +214,20 @@ typedef struct
     UInt32		LastTX_Parity;
     UInt32		LastBaudRate;
     bool        ringsAllocated;
+    
+        // Buffer pools, allocated at the configured sizes
+    
+    inPipeBuffers       *inPool;
+    outPipeBuffers      *outPool;
 
 } PortInfo_t;
 
+static_assert(sizeof(CirQueue) <= kCacheLineSize, "CirQueue must fit a cache line");
+static_assert((offsetof(PortInfo_t, RX) - offsetof(PortInfo_t, State)) >= kCacheLineSize, "State shares a line with the receive queue");
+static_assert((offsetof(PortInfo_t, TX) - offsetof(PortInfo_t, RX)) >= kCacheLineSize, "The receive and transmit queues share a line");
+static_assert((offsetof(PortInfo_t, holdQueueIndxIn) - offsetof(PortInfo_t, TX)) >= kCacheLineSize, "The transmit queue shares a line with the hold queue");
+static_assert((offsetof(PortInfo_t, RXStats) % kCacheLineSize) == 0, "Configuration shares a line with the hold queue");
+
 class AppleUSBCDC;
 class AppleUSBCDCACMControl;
 
@@ -242,7 +260,7 @@ public:
     IOUSBInterface		*fDataInterface;
     IOWorkLoop			*fWorkLoop;
     IOCommandGate		*fCommandGate;
-    PortInfo_t 			fPort;					// Port structure
+    PortInfo_t 			*fPort;					// Port structure (cache line aligned)
     
     UInt16			fInBufPool;
     UInt16			fOutBufPool;
@@ -269,6 +287,7 @@ public:
 		
 	virtual IOService   *probe(IOService *provider, SInt32 *score);
     virtual bool		start(IOService *provider);
+    virtual void		free(void);
     virtual void		stop(IOService *provider);
     virtual bool		didTerminate(IOService *provider, IOOptionBits options, bool *defer);
     virtual IOReturn 	message(UInt32 type, IOService *provider,  void *argument = 0);
@@ -330,6 +349,8 @@ public:
     IOReturn		checkPipe(IOUSBPipe *thePipe, bool devReq);
     void 			initStructure(void);
     void 			setStructureDefaults(void);
+    bool			allocatePools(void);
+    void			freePools(void);
     bool 			allocateResources(void);
     void			releaseResources(void);
     void 			freeRingBuffer(CirQueue *Queue);
@@ -73,21 +73,29 @@ static IOPMPowerState gOurPowerStates[kNumCDCStates] =
 };
 #endif
 
-#define	numStats	13
-UInt16	stats[numStats] = { kXMIT_OK_REQ,
-                            kRCV_OK_REQ,
-                            kXMIT_ERROR_REQ,
-                            kRCV_ERROR_REQ, 
-                            kRCV_CRC_ERROR_REQ,
-                            kRCV_ERROR_ALIGNMENT_REQ,
-                            kXMIT_ONE_COLLISION_REQ,
-                            kXMIT_MORE_COLLISIONS_REQ,
-                            kXMIT_DEFERRED_REQ,
-                            kXMIT_MAX_COLLISION_REQ,
-                            kRCV_OVERRUN_REQ,
-                            kXMIT_TIMES_CARRIER_LOST_REQ,
-                            kXMIT_LATE_COLLISIONS_REQ
-                        };
+    // Statistics request and where its bit lives in bmEthernetStatistics
+
+typedef struct
+{
+    UInt16	request;
+    UInt8	byte;
+    UInt8	mask;
+} statsSupport;
+
+static const statsSupport	stats[numStats] = { {kXMIT_OK_REQ, 0, kXMIT_OK},
+                                                    {kRCV_OK_REQ, 0, kRCV_OK},
+                                                    {kXMIT_ERROR_REQ, 0, kXMIT_ERROR},
+                                                    {kRCV_ERROR_REQ, 0, kRCV_ERROR},
+                                                    {kRCV_CRC_ERROR_REQ, 2, kRCV_CRC_ERROR},
+                                                    {kRCV_ERROR_ALIGNMENT_REQ, 2, kRCV_ERROR_ALIGNMENT},
+                                                    {kXMIT_ONE_COLLISION_REQ, 2, kXMIT_ONE_COLLISION},
+                                                    {kXMIT_MORE_COLLISIONS_REQ, 2, kXMIT_MORE_COLLISIONS},
+                                                    {kXMIT_DEFERRED_REQ, 2, kXMIT_DEFERRED},
+                                                    {kXMIT_MAX_COLLISION_REQ, 2, kXMIT_MAX_COLLISION},
+                                                    {kRCV_OVERRUN_REQ, 3, kRCV_OVERRUN},
+                                                    {kXMIT_TIMES_CARRIER_LOST_REQ, 3, kXMIT_TIMES_CARRIER_LOST},
+                                                    {kXMIT_LATE_COLLISIONS_REQ, 3, kXMIT_LATE_COLLISIONS}
+                                                };
 
 #define super IOService
 
@@ -324,6 +332,18 @@ void AppleUSBCDCECMControl::merWriteComplete(void *obj, void *param, IOReturn rc
             XTRACE(me, MER->bRequest, remaining, "merWriteComplete");
         } else {
             XTRACE(me, MER->bRequest, rc, "merWriteComplete - io err");
+            
+                // The device still has the old packet filter, mcFilterFlush sends it again
+            
+            if (MER->bRequest == kSet_Ethernet_Packet_Filter)
+            {
+                me->fPktFilterStale = true;
+                me->fMcDirty = true;
+                if (me->fDataDriver)
+                {
+                    me->fDataDriver->mcRetry();
+                }
+            }
         }
 		
         dataLen = MER->wLength;
@@ -347,6 +367,47 @@ void AppleUSBCDCECMControl::merWriteComplete(void *obj, void *param, IOReturn rc
 	
 }/* end merWriteComplete */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMControl::mcWriteComplete
+//
+//		Inputs:		obj - me
+//				param - not used (the request is preallocated)
+//				rc - return code
+//				remaining - what's left
+//
+//		Outputs:	
+//
+//		Desc:		Set_Ethernet_Multicast_Filter write completion routine. A failed request
+//				marks the set dirty again and has the data driver retry it.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMControl::mcWriteComplete(void *obj, void *param, IOReturn rc, UInt32 remaining)
+{
+    AppleUSBCDCECMControl	*me = (AppleUSBCDCECMControl *)obj;
+	
+    if (rc == kIOReturnSuccess)
+    {
+        XTRACE(me, me->fMcRequest.wValue, remaining, "mcWriteComplete");
+        me->fMcInFlight = false;
+    } else {
+        XTRACE(me, me->fMcRequest.wValue, rc, "mcWriteComplete - io err");
+        
+            // The device still has the old list, send the current one again shortly
+        
+        me->fMcDirty = true;
+        me->fMcInFlight = false;
+        if (me->fDataDriver)
+        {
+            me->fDataDriver->mcRetry();
+        }
+    }
+	
+    return;
+	
+}/* end mcWriteComplete */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCECMControl::statsWriteComplete
@@ -365,66 +426,64 @@ void AppleUSBCDCECMControl::merWriteComplete(void *obj, void *param, IOReturn rc
 void AppleUSBCDCECMControl::statsWriteComplete(void *obj, void *param, IOReturn rc, UInt32 remaining)
 {
     AppleUSBCDCECMControl	*me = (AppleUSBCDCECMControl *)obj;
-    IOUSBDevRequest		*STREQ = (IOUSBDevRequest*)param;
-    UInt16			currStat;
+    statsRequests		*statReq = (statsRequests *)param;
+    UInt32			value;
 	
-    if (STREQ)
+    if (statReq)
     {
-        if (rc == kIOReturnSuccess)
+        if ((rc == kIOReturnSuccess) && me->fpNetStats && me->fpEtherStats)
         {
-            XTRACE(me, STREQ->bRequest, remaining, "statsWriteComplete");
-            currStat = STREQ->wValue;
-            switch(currStat)
+            XTRACE(me, statReq->statCode, remaining, "statsWriteComplete");
+            value = USBToHostLong(statReq->value);
+            switch(statReq->statCode)
             {
                 case kXMIT_OK_REQ:
-                    me->fpNetStats->outputPackets = USBToHostLong(me->fStatValue);
+                    me->fpNetStats->outputPackets = value;
                     break;
                 case kRCV_OK_REQ:
-                    me->fpNetStats->inputPackets = USBToHostLong(me->fStatValue);
+                    me->fpNetStats->inputPackets = value;
                     break;
                 case kXMIT_ERROR_REQ:
-                    me->fpNetStats->outputErrors = USBToHostLong(me->fStatValue);
+                    me->fpNetStats->outputErrors = value;
                     break;
                 case kRCV_ERROR_REQ:
-                    me->fpNetStats->inputErrors = USBToHostLong(me->fStatValue);
+                    me->fpNetStats->inputErrors = value;
                     break;
                 case kRCV_CRC_ERROR_REQ:
-                    me->fpEtherStats->dot3StatsEntry.fcsErrors = USBToHostLong(me->fStatValue); 
+                    me->fpEtherStats->dot3StatsEntry.fcsErrors = value; 
                     break;
                 case kRCV_ERROR_ALIGNMENT_REQ:
-                    me->fpEtherStats->dot3StatsEntry.alignmentErrors = USBToHostLong(me->fStatValue);
+                    me->fpEtherStats->dot3StatsEntry.alignmentErrors = value;
                     break;
                 case kXMIT_ONE_COLLISION_REQ:
-                    me->fpEtherStats->dot3StatsEntry.singleCollisionFrames = USBToHostLong(me->fStatValue);
+                    me->fpEtherStats->dot3StatsEntry.singleCollisionFrames = value;
                     break;
                 case kXMIT_MORE_COLLISIONS_REQ:
-                    me->fpEtherStats->dot3StatsEntry.multipleCollisionFrames = USBToHostLong(me->fStatValue);
+                    me->fpEtherStats->dot3StatsEntry.multipleCollisionFrames = value;
                     break;
                 case kXMIT_DEFERRED_REQ:
-                    me->fpEtherStats->dot3StatsEntry.deferredTransmissions = USBToHostLong(me->fStatValue);
+                    me->fpEtherStats->dot3StatsEntry.deferredTransmissions = value;
                     break;
                 case kXMIT_MAX_COLLISION_REQ:
-                    me->fpNetStats->collisions = USBToHostLong(me->fStatValue);
+                    me->fpNetStats->collisions = value;
                     break;
                 case kRCV_OVERRUN_REQ:
-                    me->fpEtherStats->dot3StatsEntry.frameTooLongs = USBToHostLong(me->fStatValue);
+                    me->fpEtherStats->dot3StatsEntry.frameTooLongs = value;
                     break;
                 case kXMIT_TIMES_CARRIER_LOST_REQ:
-                    me->fpEtherStats->dot3StatsEntry.carrierSenseErrors = USBToHostLong(me->fStatValue);
+                    me->fpEtherStats->dot3StatsEntry.carrierSenseErrors = value;
                     break;
                 case kXMIT_LATE_COLLISIONS_REQ:
-                    me->fpEtherStats->dot3StatsEntry.lateCollisions = USBToHostLong(me->fStatValue);
+                    me->fpEtherStats->dot3StatsEntry.lateCollisions = value;
                     break;
                 default:
-                    XTRACE(me, currStat, rc, "statsWriteComplete - Invalid stats code");
+                    XTRACE(me, statReq->statCode, rc, "statsWriteComplete - Invalid stats code");
                     break;
             }
-
         } else {
-            XTRACE(me, STREQ->bRequest, rc, "statsWriteComplete - io err");
+            XTRACE(me, statReq->statCode, rc, "statsWriteComplete - io err");
         }
-		
-        IOFree(STREQ, sizeof(IOUSBDevRequest));
+        statReq->value = 0;
     } else {
         if (rc == kIOReturnSuccess)
         {
@@ -434,8 +493,12 @@ void AppleUSBCDCECMControl::statsWriteComplete(void *obj, void *param, IOReturn
         }
     }
 	
-    me->fStatValue = 0;
-    me->fStatInProgress = false;
+        // Last one in closes out the burst
+    
+    if (me->fStatsOutstanding > 0)
+    {
+        OSDecrementAtomic((volatile SInt32 *)&me->fStatsOutstanding);
+    }
     return;
 	
 }/* end statsWriteComplete */
@@ -492,9 +555,20 @@ bool AppleUSBCDCECMControl::start(IOService *provider)
 
     XTRACEP(this, provider, 0, "start");
 
-    fCurrStat = 0;
 	fCDCDriver = NULL;
-    fStatInProgress = false;
+    fStatsCount = 0;
+    fStatsOutstanding = 0;
+    fStatsRefreshMS = kStatsRefreshMS;
+    fStatsLastBurst = 0;
+    fHostStats = true;
+    cdc_McFilterInit(&fMcFilter);
+    fMcDirty = false;
+    fMcInFlight = false;
+    fPktFilterStale = false;
+    fMcSoftFilter = false;
+    fMcCompletionInfo.target = this;
+    fMcCompletionInfo.action = mcWriteComplete;
+    fMcCompletionInfo.parameter = NULL;
     fMax_Block_Size = MAX_BLOCK_SIZE;
     fCommDead = false;
     fReleased = false;
@@ -551,6 +625,30 @@ bool AppleUSBCDCECMControl::start(IOService *provider)
 		ALERT(0, fControlInterface->GetInterfaceNumber(), "start - Failed to find the CDC driver");
         fControlInterface = NULL;
         return false;
+	}
+    
+		// Statistics overrides - refresh interval and who owns the packet counters
+	
+	OSNumber *statsNumber = (OSNumber *)provider->getProperty(statsIntervalTag);
+	if (!statsNumber)
+	{
+		statsNumber = (OSNumber *)getProperty(statsIntervalTag);
+	}
+	if (statsNumber)
+	{
+		fStatsRefreshMS = statsNumber->unsigned32BitValue();
+		XTRACE(this, 0, fStatsRefreshMS, "start - Statistics interval override value");
+	}
+	
+	OSBoolean *hostBool = OSDynamicCast(OSBoolean, provider->getProperty(hostStatsTag));
+	if (!hostBool)
+	{
+		hostBool = OSDynamicCast(OSBoolean, getProperty(hostStatsTag));
+	}
+	if (hostBool)
+	{
+		fHostStats = hostBool->isTrue();
+		XTRACE(this, 0, fHostStats, "start - Host statistics override value");
 	}
     
     if (!configureECM())
@@ -560,6 +658,8 @@ bool AppleUSBCDCECMControl::start(IOService *provider)
         return false;
     }
     
+    buildStatsList();
+    
     if (!allocateResources()) 
     {
         ALERT(0, 0, "start - allocateResources failed");
@@ -876,12 +976,6 @@ bool AppleUSBCDCECMControl::dataAcquired(IONetworkStats *netStats, IOEthernetSta
         fMERCompletionInfo.action = merWriteComplete;
         fMERCompletionInfo.parameter = NULL;
         
-            // Set up the statistics request completion routine:
-
-        fStatsCompletionInfo.target = this;
-        fStatsCompletionInfo.action = statsWriteComplete;
-        fStatsCompletionInfo.parameter = NULL;
-        
      } else {
         XTRACE(this, 0, rtn, "dataAcquired - Reading the interrupt pipe failed");
         return false;
@@ -1031,10 +1125,8 @@ void AppleUSBCDCECMControl::releaseResources()
 bool AppleUSBCDCECMControl::USBSetMulticastFilter(IOEthernetAddress *addrs, UInt32 count)
 {
     IOReturn		rc;
-    IOUSBDevRequest	*MER;
-    UInt8		*eaddrs;
     UInt32		eaddLen;
-    UInt32		i,j,rnum;
+    UInt32		i;
 	
     XTRACE(this, fMcFilters, count, "USBSetMulticastFilter");
     
@@ -1044,61 +1136,42 @@ bool AppleUSBCDCECMControl::USBSetMulticastFilter(IOEthernetAddress *addrs, UInt
         return true;
     }
 
-    if (count > (UInt32)(fMcFilters & kFiltersSupportedMask))
+    if ((count > (UInt32)(fMcFilters & kFiltersSupportedMask)) || (count > kMcMaxAddrs))
     {
         XTRACE(this, 0, 0, "USBSetMulticastFilter - No multicast filters supported");
         return false;
     }
-
-    MER = (IOUSBDevRequest*)IOMalloc(sizeof(IOUSBDevRequest));
-    if (!MER)
-    {
-        XTRACE(this, 0, 0, "USBSetMulticastFilter - allocate MER failed");
-        return false;
-    }
-    bzero(MER, sizeof(IOUSBDevRequest));
-	
-    eaddLen = count * kIOEthernetAddressSize;
-    eaddrs = (UInt8 *)IOMalloc(eaddLen);
-    if (!eaddrs)
+    
+    if (fMcInFlight)
     {
-        XTRACE(this, 0, 0, "USBSetMulticastFilter - allocate address buffer failed");
+        XTRACE(this, 0, 0, "USBSetMulticastFilter - Previous request still outstanding");
         return false;
     }
-    bzero(eaddrs, eaddLen); 
 	
         // Build the filter address buffer
          
-    rnum = 0;
+    eaddLen = count * kIOEthernetAddressSize;
     for (i=0; i<count; i++)
     {
-        if (rnum > eaddLen)				// Just in case
-        {
-            break;
-        }
-        for (j=0; j<kIOEthernetAddressSize; j++)
-        {
-            eaddrs[rnum++] = addrs[i].bytes[j];
-        }
+        bcopy(addrs[i].bytes, &fMcBuffer[i * kIOEthernetAddressSize], kIOEthernetAddressSize);
     }
     
-        // Now build the Management Element Request
+        // Now build the Management Element Request (it's preallocated so only one at a time)
 		
-    MER->bmRequestType = USBmakebmRequestType(kUSBOut, kUSBClass, kUSBInterface);
-    MER->bRequest = kSet_Ethernet_Multicast_Filter;
-    MER->wValue = count;
-    MER->wIndex = fCommInterfaceNumber;
-    MER->wLength = eaddLen;
-    MER->pData = eaddrs;
+    bzero(&fMcRequest, sizeof(IOUSBDevRequest));
+    fMcRequest.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBClass, kUSBInterface);
+    fMcRequest.bRequest = kSet_Ethernet_Multicast_Filter;
+    fMcRequest.wValue = count;
+    fMcRequest.wIndex = fCommInterfaceNumber;
+    fMcRequest.wLength = eaddLen;
+    fMcRequest.pData = (eaddLen > 0) ? fMcBuffer : NULL;
 	
-    fMERCompletionInfo.parameter = MER;
-	
-    rc = fControlInterface->GetDevice()->DeviceRequest(MER, &fMERCompletionInfo);
+    fMcInFlight = true;
+    rc = fControlInterface->GetDevice()->DeviceRequest(&fMcRequest, &fMcCompletionInfo);
     if (rc != kIOReturnSuccess)
     {
-        XTRACE(this, MER->bRequest, rc, "USBSetMulticastFilter - Error issueing DeviceRequest");
-        IOFree(MER->pData, eaddLen);
-        IOFree(MER, sizeof(IOUSBDevRequest));
+        XTRACE(this, fMcRequest.bRequest, rc, "USBSetMulticastFilter - Error issueing DeviceRequest");
+        fMcInFlight = false;
         return false;
     }
     
@@ -1167,6 +1240,9 @@ bool AppleUSBCDCECMControl::USBSetPacketFilter()
                 IOFree(MER, sizeof(IOUSBDevRequest));
                 return false;
             }
+        } else {
+            IOFree(MER, sizeof(IOUSBDevRequest));
+            return false;
         }
     }
     
@@ -1174,6 +1250,119 @@ bool AppleUSBCDCECMControl::USBSetPacketFilter()
     
 }/* end USBSetPacketFilter */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMControl::mcFilterUpdate
+//
+//		Inputs:		addrs - the list of addresses
+//				count - How many
+//
+//		Outputs:	true (the set changed and needs flushing), false (no change)
+//
+//		Desc:		Builds the new multicast set (cdc_McFilterUpdate). The device is only
+//				told (by mcFilterFlush) if it really changed.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCECMControl::mcFilterUpdate(IOEthernetAddress *addrs, UInt32 count)
+{
+    
+    XTRACE(this, fMcFilter.count, count, "mcFilterUpdate");
+    
+    if (!cdc_McFilterUpdate(&fMcFilter, (const UInt8 *)addrs, count))
+    {
+        XTRACE(this, fMcFilter.overflow, fMcFilter.count, "mcFilterUpdate - No change");
+        return false;
+    }
+    
+    if (fMcFilter.overflow)
+    {
+        XTRACE(this, kMcMaxAddrs, count, "mcFilterUpdate - Too many addresses, passing all multicast");
+    }
+    fMcDirty = true;
+    
+    return true;
+    
+}/* end mcFilterUpdate */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMControl::mcFilterFlush
+//
+//		Inputs:		
+//
+//		Outputs:	true (done), false (a request is still outstanding or failed, try again later)
+//
+//		Desc:		Sends the current multicast set to the device. If there are more addresses than
+//				hardware filters we switch to all multicast and filter in software instead.
+//				Anything that doesn't go leaves the set dirty so the next try sends it.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCECMControl::mcFilterFlush()
+{
+    UInt16	oldFilter = fPacketFilter;
+    UInt32	slots = fMcFilters & kFiltersSupportedMask;
+    UInt32	i, count = 0;
+    
+    if (!fMcDirty)
+    {
+        return true;
+    }
+    
+    if (fMcInFlight)
+    {
+        XTRACE(this, 0, 0, "mcFilterFlush - Request outstanding, deferred");
+        return false;
+    }
+    
+    XTRACE(this, slots, fMcFilter.count, "mcFilterFlush");
+    
+    fMcDirty = false;
+    
+    if (fMcFilter.overflow || (fMcFilter.count > slots))
+    {
+        fPacketFilter |= kPACKET_TYPE_ALL_MULTICAST;
+        fMcSoftFilter = !fMcFilter.overflow;
+    } else {
+        fPacketFilter &= ~kPACKET_TYPE_ALL_MULTICAST;
+        fMcSoftFilter = false;
+    }
+    
+    if ((fPacketFilter != oldFilter) || fPktFilterStale)
+    {
+        fPktFilterStale = false;
+        if (!USBSetPacketFilter())
+        {
+            XTRACE(this, 0, fPacketFilter, "mcFilterFlush - Setting the packet filter failed");
+            fPktFilterStale = true;
+            fMcDirty = true;
+        }
+    }
+    
+        // In all multicast mode the device's list doesn't matter
+    
+    if (!(fPacketFilter & kPACKET_TYPE_ALL_MULTICAST))
+    {
+        for (i=0; i<kMcHashSize; i++)
+        {
+            if (fMcFilter.set[fMcFilter.active][i].used)
+            {
+                bcopy(fMcFilter.set[fMcFilter.active][i].addr, &fMcBuffer[count * kIOEthernetAddressSize], kIOEthernetAddressSize);
+                count++;
+            }
+        }
+        if (!USBSetMulticastFilter((IOEthernetAddress *)fMcBuffer, count))
+        {
+            XTRACE(this, 0, count, "mcFilterFlush - Setting the multicast filter failed");
+            fMcDirty = true;
+        }
+    }
+    
+    return !fMcDirty;
+    
+}/* end mcFilterFlush */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCECMControl::checkInterfaceNumber
@@ -1269,177 +1458,188 @@ IOReturn AppleUSBCDCECMControl::checkPipe(IOUSBPipe *thePipe, bool devReq)
 
 /****************************************************************************************************/
 //
-//		Method:		AppleUSBCDCECMControl::statsProcessing
+//		Method:		AppleUSBCDCECMControl::buildStatsList
 //
 //		Inputs:		
 //
 //		Outputs:	
 //
-//		Desc:		Handles stats gathering.
+//		Desc:		Sets up the preallocated request for every statistic the device supports.
+//				If the host is keeping the packet counts they're not asked for.
 //
 /****************************************************************************************************/
 
-bool AppleUSBCDCECMControl::statsProcessing()
+void AppleUSBCDCECMControl::buildStatsList()
 {
-    UInt32		*enetStats;
-    UInt16		currStat;
-    IOReturn		rc;
-    IOUSBDevRequest	*STREQ;
-    bool		statOk = false;
+    UInt16		i;
+    statsRequests	*statReq;
 
-//    XTRACE(this, 0, 0, "statsProcessing");
+    fStatsCount = 0;
+    
+    if (fHostStats)
+    {
+        fOutputPktsOK = true;
+        fInputPktsOK = true;
+        fOutputErrsOK = true;
+        fInputErrsOK = true;
+    }
 
-    enetStats = (UInt32 *)&fEthernetStatistics;
-    if (*enetStats == 0)
+    for (i=0; i<numStats; i++)
     {
-        XTRACE(this, 0, 0, "statsProcessing - No Ethernet statistics defined");
-        return false;						// and don't bother us again
+        if (!(fEthernetStatistics[stats[i].byte] & stats[i].mask))
+        {
+            continue;
+        }
+        if (fHostStats && (stats[i].byte == 0))
+        {
+            continue;
+        }
+        
+        statReq = &fStatsReq[fStatsCount];
+        bzero(statReq, sizeof(statsRequests));
+        
+        statReq->statCode = stats[i].request;
+        
+        statReq->request.bmRequestType = USBmakebmRequestType(kUSBIn, kUSBClass, kUSBInterface);
+        statReq->request.bRequest = kGet_Ethernet_Statistics;
+        statReq->request.wValue = stats[i].request;
+        statReq->request.wIndex = fCommInterfaceNumber;
+        statReq->request.wLength = sizeof(statReq->value);
+        statReq->request.pData = &statReq->value;
+        
+        statReq->completionInfo.target = this;
+        statReq->completionInfo.action = statsWriteComplete;
+        statReq->completionInfo.parameter = statReq;
+        
+        fStatsCount++;
+    }
+    
+    XTRACE(this, fStatsCount, fStatsRefreshMS, "buildStatsList - Statistics to collect");
+
+}/* end buildStatsList */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMControl::startStatsBurst
+//
+//		Inputs:		
+//
+//		Outputs:	return code - true (burst issued), false (nothing to do or one is still out)
+//
+//		Desc:		Issues the requests for all the supported statistics in one go
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCECMControl::startStatsBurst()
+{
+    UInt16		i;
+    IOReturn		rc;
+
+    if ((fStatsCount == 0) || !fdataAcquired || !fControlInterface)
+    {
+        return false;
     }
     
     if ((fpNetStats == NULL) || (fpEtherStats == NULL))		// Means we're not ready yet
     {
-        XTRACE(this, 0, 0, "statsProcessing - Not ready");
-        return true;
+        XTRACE(this, 0, 0, "startStatsBurst - Not ready");
+        return false;
     }
     
-    if (fReady == false)
+        // Only do it if the last one is finished
+    
+    if (!OSCompareAndSwap(0, fStatsCount, &fStatsOutstanding))
     {
-        XTRACE(this, 0, 0, "statsProcessing - Spurious");    
-    } else {
+        XTRACE(this, 0, fStatsOutstanding, "startStatsBurst - Previous burst still outstanding");
+        return false;
+    }
     
-            // Only do it if it's not already in progress
+    fStatsLastBurst = mach_absolute_time();
     
-        if (!fStatInProgress)
+    for (i=0; i<fStatsCount; i++)
+    {
+        rc = fControlInterface->GetDevice()->DeviceRequest(&fStatsReq[i].request, &fStatsReq[i].completionInfo);
+        if (rc != kIOReturnSuccess)
         {
-
-                // Check if the stat we're currently interested in is supported
-            
-            currStat = stats[fCurrStat++];
-            if (fCurrStat >= numStats)
-            {
-                fCurrStat = 0;
-            }
-            switch(currStat)
-            {
-                case kXMIT_OK_REQ:
-                    if (fEthernetStatistics[0] & kXMIT_OK)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kRCV_OK_REQ:
-                    if (fEthernetStatistics[0] & kRCV_OK)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kXMIT_ERROR_REQ:
-                    if (fEthernetStatistics[0] & kXMIT_ERROR_REQ)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kRCV_ERROR_REQ:
-                    if (fEthernetStatistics[0] & kRCV_ERROR_REQ)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kRCV_CRC_ERROR_REQ:
-                    if (fEthernetStatistics[2] & kRCV_CRC_ERROR)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kRCV_ERROR_ALIGNMENT_REQ:
-                    if (fEthernetStatistics[2] & kRCV_ERROR_ALIGNMENT)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kXMIT_ONE_COLLISION_REQ:
-                    if (fEthernetStatistics[2] & kXMIT_ONE_COLLISION)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kXMIT_MORE_COLLISIONS_REQ:
-                    if (fEthernetStatistics[2] & kXMIT_MORE_COLLISIONS)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kXMIT_DEFERRED_REQ:
-                    if (fEthernetStatistics[2] & kXMIT_DEFERRED)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kXMIT_MAX_COLLISION_REQ:
-                    if (fEthernetStatistics[2] & kXMIT_MAX_COLLISION)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kRCV_OVERRUN_REQ:
-                    if (fEthernetStatistics[3] & kRCV_OVERRUN)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kXMIT_TIMES_CARRIER_LOST_REQ:
-                    if (fEthernetStatistics[3] & kXMIT_TIMES_CARRIER_LOST)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                case kXMIT_LATE_COLLISIONS_REQ:
-                    if (fEthernetStatistics[3] & kXMIT_LATE_COLLISIONS)
-                    {
-                        statOk = true;
-                    }
-                    break;
-                default:
-                    break;
-            }
+            XTRACE(this, fStatsReq[i].statCode, rc, "startStatsBurst - Error issueing DeviceRequest");
+            OSDecrementAtomic((volatile SInt32 *)&fStatsOutstanding);
         }
+    }
 
-        if (statOk)
-        {
-            STREQ = (IOUSBDevRequest*)IOMalloc(sizeof(IOUSBDevRequest));
-            if (!STREQ)
-            {
-                XTRACE(this, 0, 0, "statsProcessing - allocate STREQ failed");
-            } else {
-                bzero(STREQ, sizeof(IOUSBDevRequest));
-        
-                    // Now build the Statistics Request
-		
-                STREQ->bmRequestType = USBmakebmRequestType(kUSBOut, kUSBClass, kUSBInterface);
-                STREQ->bRequest = kGet_Ethernet_Statistics;
-                STREQ->wValue = currStat;
-                STREQ->wIndex = fCommInterfaceNumber;
-                STREQ->wLength = 4;
-                STREQ->pData = &fStatValue;
-	
-                fStatsCompletionInfo.parameter = STREQ;
-	
-                rc = fControlInterface->GetDevice()->DeviceRequest(STREQ, &fStatsCompletionInfo);
-                if (rc != kIOReturnSuccess)
-                {
-                    XTRACE(this, STREQ->bRequest, rc, "statsProcessing - Error issueing DeviceRequest");
-                    IOFree(STREQ, sizeof(IOUSBDevRequest));
-                } else {
-                    fStatInProgress = true;
-                }
-            }
-        }
+    return true;
+    
+}/* end startStatsBurst */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMControl::statsProcessing
+//
+//		Inputs:		
+//
+//		Outputs:	return code - true (keep calling), false (nothing to collect)
+//
+//		Desc:		Handles stats gathering. Called from the data driver's watchdog, 
+//				a burst is issued every fStatsRefreshMS (0 means only on demand).
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCECMControl::statsProcessing()
+{
+    UInt64		elapsed;
+
+//    XTRACE(this, 0, 0, "statsProcessing");
+
+    if (fStatsCount == 0)
+    {
+        XTRACE(this, 0, 0, "statsProcessing - No Ethernet statistics to collect");
+        return false;						// and don't bother us again
+    }
+    
+    if (fStatsRefreshMS == 0)
+    {
+        return true;						// On demand only
+    }
+    
+    absolutetime_to_nanoseconds(mach_absolute_time() - fStatsLastBurst, &elapsed);
+    if ((elapsed / 1000000) >= fStatsRefreshMS)
+    {
+        startStatsBurst();
     }
 
     return true;
 
 }/* end statsProcessing */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMControl::statsRequested
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Someone is reading the statistics so refresh them (rate limited)
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMControl::statsRequested()
+{
+    UInt64		elapsed;
+
+    if (fStatsCount == 0)
+    {
+        return;
+    }
+    
+    absolutetime_to_nanoseconds(mach_absolute_time() - fStatsLastBurst, &elapsed);
+    if ((elapsed / 1000000) >= kStatsMinIntervalMS)
+    {
+        XTRACE(this, 0, 0, "statsRequested - Refreshing statistics");
+        startStatsBurst();
+    }
+    
+}/* end statsRequested */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCECMControl::message
@@ -27,6 +27,7 @@
 #define __APPLEUSBCDCECMControl__
 
 #include "AppleUSBCDCCommon.h"
+#include "AppleUSBCDCMcFilter.h"
 #include "AppleUSBCDCECMData.h"
 
     // Miscellaneous
@@ -34,6 +35,26 @@
 #define COMM_BUFF_SIZE		16
 #define WATCHDOG_TIMER_MS       1000
 #define kDeviceSelfPowered	1
+
+    // Ethernet statistics polling
+
+#define numStats			13
+#define kStatsRefreshMS		2000			// Default burst interval (0 means on demand only)
+#define kStatsMinIntervalMS	250				// On demand refreshes are limited to this rate
+#define	statsIntervalTag	"StatisticsInterval"
+#define	hostStatsTag		"HostStatistics"
+
+typedef struct
+{
+    IOUSBDevRequest		request;
+    IOUSBCompletion		completionInfo;
+    UInt32			value;				// Little endian, straight from the device
+    UInt16			statCode;
+} statsRequests;
+
+    // Multicast filter management
+
+#define kMcCoalesceMS		50				// Updates inside this window go out as one request
     
 enum
 {
@@ -64,7 +85,6 @@ private:
     UInt8			*fCommPipeBuffer;			// Interrupt pipe buffer
     IOUSBCompletion		fCommCompletionInfo;			// Interrupt completion routine
     IOUSBCompletion		fMERCompletionInfo;			// MER Completion routine
-    IOUSBCompletion		fStatsCompletionInfo;			// Stats Completion routine
     UInt8			fCommInterfaceNumber;			// My interface number
     
     bool			fReady;
@@ -73,13 +93,24 @@ private:
     UInt32			fUpSpeed;
     UInt32			fDownSpeed;
     
-    bool			fStatInProgress;
-    UInt16			fCurrStat;
-    UInt32			fStatValue;
+    statsRequests		fStatsReq[numStats];			// Preallocated, one per supported statistic
+    UInt16			fStatsCount;				// Number in use
+    volatile UInt32		fStatsOutstanding;			// Requests of the current burst still out
+    UInt32			fStatsRefreshMS;
+    UInt64			fStatsLastBurst;			// mach_absolute_time of the last burst
+    bool			fHostStats;				// Host side counters are authoritative (default)
     
     static void			commReadComplete( void *obj, void *param, IOReturn ior, UInt32 remaining);
     static void			merWriteComplete(void *obj, void *param, IOReturn ior, UInt32 remaining);
     static void			statsWriteComplete(void *obj, void *param, IOReturn rc, UInt32 remaining);
+    static void			mcWriteComplete(void *obj, void *param, IOReturn rc, UInt32 remaining);
+    
+    IOUSBDevRequest		fMcRequest;				// Preallocated Set_Ethernet_Multicast_Filter request
+    IOUSBCompletion		fMcCompletionInfo;
+    UInt8			fMcBuffer[kMcMaxAddrs * kIOEthernetAddressSize];
+    bool			fMcDirty;				// Set changed, device not told yet
+    bool			fMcInFlight;				// Request still outstanding
+    bool			fPktFilterStale;			// Last Set_Ethernet_Packet_Filter failed, send it again
     
     UInt16			fVendorID;
     UInt16			fProductID;
@@ -92,6 +123,8 @@ public:
     UInt16			fPacketFilter;
     UInt8			fEaddr[6];
     UInt16			fMcFilters;
+    bool			fMcSoftFilter;				// All multicast fallback, drop what we didn't ask for
+    mcFilter			fMcFilter;				// The multicast set, the data driver's ingress filter looks in it
     
     UInt16			fMax_Block_Size;
     
@@ -124,7 +157,12 @@ public:
     IOReturn			checkPipe(IOUSBPipe *thePipe, bool devReq);
     virtual bool		USBSetMulticastFilter(IOEthernetAddress *addrs, UInt32 count);
     virtual bool		USBSetPacketFilter(void);
+    bool			mcFilterUpdate(IOEthernetAddress *addrs, UInt32 count);
+    bool			mcFilterFlush(void);
+    void			buildStatsList(void);
+    bool			startStatsBurst(void);
     virtual bool		statsProcessing(void);
+    virtual void		statsRequested(void);
     
             // Power Manager Methods
 
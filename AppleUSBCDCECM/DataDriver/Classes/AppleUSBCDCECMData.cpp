@@ -422,9 +422,10 @@ void AppleUSBCDCECMData::dataReadComplete(void *obj, void *param, IOReturn rc, U
 {
     AppleUSBCDCECMData	*me = (AppleUSBCDCECMData*)obj;
     IOReturn			ior;
-	pipeInBuffers		*pipeInBuff = (pipeInBuffers *)param;
+	UInt32			indx = (UInt32)(uintptr_t)param;
+	pipeInBuffers		*pipeInBuff = &me->fPipeInBuff[indx];
     
-    XTRACE(me, 0, pipeInBuff->indx, "dataReadComplete");
+    XTRACE(me, 0, indx, "dataReadComplete");
     
     if (me->fTerminate) //rcs revisit for IOUSBFamily 2.0
         return;
@@ -432,6 +433,11 @@ void AppleUSBCDCECMData::dataReadComplete(void *obj, void *param, IOReturn rc, U
     if (rc == kIOReturnSuccess)	// If operation returned ok
     {	
         XTRACE(me, 0, me->fControlDriver->fMax_Block_Size - remaining, "dataReadComplete - data length");
+        
+        if (me->fWakePending)
+        {
+            me->resumeTraffic();
+        }
 		
         meLogData(kDataIn, (me->fControlDriver->fMax_Block_Size - remaining), pipeInBuff->pipeInBuffer);
 		
@@ -450,11 +456,13 @@ void AppleUSBCDCECMData::dataReadComplete(void *obj, void *param, IOReturn rc, U
             // Move the incoming bytes up the stack
 
         me->receivePacket(pipeInBuff->pipeInBuffer, me->fControlDriver->fMax_Block_Size - remaining);
+        pipeInBuff = &me->fPipeInBuff[indx];			// The records may have moved under the stack
 	
     } else {
         XTRACE(me, 0, rc, "dataReadComplete - Read completion io err");
         if (rc != kIOReturnAborted)
         {
+			me->fRxCounters.errPipe++;
 			me->fDeferredClear = true;
 #if 0
             rc = me->clearPipeStall(me->fInPipe);
@@ -503,64 +511,68 @@ void AppleUSBCDCECMData::dataReadComplete(void *obj, void *param, IOReturn rc, U
 void AppleUSBCDCECMData::dataWriteComplete(void *obj, void *param, IOReturn rc, UInt32 remaining)
 {
     AppleUSBCDCECMData	*me = (AppleUSBCDCECMData *)obj;
-    mbuf_t		m;
-    UInt32		pktLen = 0;
-//    UInt32		poolIndx = (UInt32)param;
-	pipeOutBuffers	*pipeOutBuff = (pipeOutBuffers *)param;
+    UInt32		pktLen;
+    UInt64		latency;
+    UInt32		poolIndx = (UInt32)(uintptr_t)param;
+	pipeOutBuffers	*pipeOutBuff = &me->fPipeOutBuff[poolIndx];
     
     if (rc == kIOReturnSuccess)						// If operation returned ok
     {	
         XTRACE(me, rc, pipeOutBuff->indx, "dataWriteComplete");
         
-        if (pipeOutBuff->m != NULL)			// Null means zero length write
+        if (me->fWakePending)
         {
-            m = pipeOutBuff->m;
-			while (m)
-			{
-				pktLen += mbuf_len(m);
-				m = mbuf_next(m);
-			}
-                        
-            me->freePacket(pipeOutBuff->m);		// Free the mbuf
-            pipeOutBuff->m = NULL;
+            me->resumeTraffic();
+        }
         
-            if ((pktLen % me->fOutPacketSize) == 0)			// If it was a multiple of max packet size then we need to do a zero length write
+        if (pipeOutBuff->length != 0)			// Zero means zero length write
+        {
+            OSAddAtomic(-(SInt32)pipeOutBuff->length, &me->fTxInFlight);
+        
+                // Fold this completion into the smoothed write latency (used for pool sizing)
+            
+            absolutetime_to_nanoseconds(mach_absolute_time() - pipeOutBuff->submitTime, &latency);
+            latency /= 1000;
+            if (me->fWriteLatency == 0)
             {
-                XTRACE(me, rc, pktLen, "dataWriteComplete - writing zero length packet");
-//                pipeOutBuff->pipeOutMDP->setLength(0);
-                pipeOutBuff->writeCompletionInfo.parameter = (void *)pipeOutBuff;
-//                me->fOutPipe->Write(pipeOutBuff->pipeOutMDP, &pipeOutBuff->writeCompletionInfo);
-				me->fOutPipe->Write(pipeOutBuff->pipeOutMDP, 2000, 5000, 0, &pipeOutBuff->writeCompletionInfo);
+                me->fWriteLatency = (UInt32)latency;
             } else {
-                pipeOutBuff->avail = true;
-                if (me->fTxStalled)
-                {
-                    me->fTxStalled = false;
-                    me->fTransmitQueue->service(IOBasicOutputQueue::kServiceAsync);
-                }
+                me->fWriteLatency = (UInt32)(((me->fWriteLatency * 7) + latency) / 8);
             }
-        } else {
-            pipeOutBuff->avail = true;			// Make the buffer available again
-            if (me->fTxStalled)
+            
+            pktLen = pipeOutBuff->length;
+            if (pipeOutBuff->m != NULL)			// Segmented sends have already freed theirs
+            {
+                me->freePacket(pipeOutBuff->m, kDelayFree);	// Freed with the rest of the batch
+                pipeOutBuff->m = NULL;
+            }
+        
+            if (cdc_NeedZLP(pktLen, me->fOutPacketSize))		// If it was a multiple of max packet size then we need to do a zero length write
             {
-                me->fTxStalled = false;
-                me->fTransmitQueue->service(IOBasicOutputQueue::kServiceAsync);
+                XTRACE(me, rc, pktLen, "dataWriteComplete - writing zero length packet");
+                pipeOutBuff->length = 0;
+//                pipeOutBuff->pipeOutMDP->setLength(0);
+                pipeOutBuff->writeCompletionInfo.parameter = (void *)(uintptr_t)poolIndx;
+//                me->fOutPipe->Write(pipeOutBuff->pipeOutMDP, &pipeOutBuff->writeCompletionInfo);
+				me->fOutPipe->Write(pipeOutBuff->pipeOutMDP, kPipeNoDataTimeout, kPipeCompletionTimeout, 0, &pipeOutBuff->writeCompletionInfo);
+				return;						// Buffer's done when that completes
             }
         }
     } else {
         XTRACE(me, rc, pipeOutBuff->indx, "dataWriteComplete - IO err");
 
-        if (pipeOutBuff->m != NULL)
+        if (pipeOutBuff->length != 0)
         {
-            me->freePacket(pipeOutBuff->m);		// Free the mbuf anyway
-            pipeOutBuff->m = NULL;
+            OSAddAtomic(-(SInt32)pipeOutBuff->length, &me->fTxInFlight);
+            if (rc != kIOReturnAborted)
+            {
+                me->fTxDoneCounters.errPipe++;
+            }
         }
-        
-        pipeOutBuff->avail = true;
-        if (me->fTxStalled)
+        if (pipeOutBuff->m != NULL)
         {
-            me->fTxStalled = false;
-            me->fTransmitQueue->service(IOBasicOutputQueue::kServiceAsync);
+            me->freePacket(pipeOutBuff->m, kDelayFree);	// Free the mbuf anyway
+            pipeOutBuff->m = NULL;
         }
         
         if (rc != kIOReturnAborted)
@@ -575,11 +587,70 @@ void AppleUSBCDCECMData::dataWriteComplete(void *obj, void *param, IOReturn rc,
 #endif
         }
     }
+    
+        // The buffer's finished with, it goes back to the pool with the rest of the batch
+    
+    pipeOutBuff->length = 0;
+    me->fTxDone[me->fTxDoneCount++] = (UInt16)poolIndx;
+    if ((OSDecrementAtomic(&me->fTxOutstanding) <= 1) || (me->fTxDoneCount >= me->fTxDoneBatch))
+    {
+        me->completeWrites();
+    }
             
     return;
 	
 }/* end dataWriteComplete */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::completeWrites
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		End of a write completion batch. The mbufs are freed together, the buffers
+//				go back to the pool in one go and then the bulk lane or the output queue
+//				gets one chance to use them. A batch ends when enough buffers have
+//				completed or when nothing else is outstanding.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::completeWrites()
+{
+    UInt32	i;
+    UInt32	count = fTxDoneCount;
+    
+    XTRACE(this, count, fTxOutstanding, "completeWrites");
+    
+    releaseFreePackets();
+    
+    for (i=0; i<count; i++)
+    {
+        fPipeOutBuff[fTxDone[i]].avail = true;
+    }
+    fTxDoneCount = 0;
+    
+    if (!fReady || (count == 0))
+    {
+        return;
+    }
+    
+        // Let the bulk lane have them before the queue runs again
+    
+    if (fBulkHead)
+    {
+        drainBulkLane();
+    }
+    
+    if (fTxStalled)
+    {
+        fTxStalled = false;
+        fTransmitQueue->service(IOBasicOutputQueue::kServiceAsync);
+    }
+    
+}/* end completeWrites */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCECMData::init
@@ -594,7 +665,6 @@ void AppleUSBCDCECMData::dataWriteComplete(void *obj, void *param, IOReturn rc,
 
 bool AppleUSBCDCECMData::init(OSDictionary *properties)
 {
-    UInt32	i;
 
     XTRACE(this, 0, 0, "init");
     
@@ -613,33 +683,52 @@ bool AppleUSBCDCECMData::init(OSDictionary *properties)
 	fLinkStatus = kLinkDown;
 	fUpSpeed = 10000000;				// Set to 10 until we know better (bits/sec)
     fDownSpeed = 10000000;				// Same here
+    fWriteLatency = 0;
+    fPacing = false;
+    fPaceLimit = 0;
+    fTxInFlight = 0;
+    fLanes = true;
+    fBulkHead = NULL;
+    fBulkTail = NULL;
+    fBulkCount = 0;
+    fTxOutstanding = 0;
+    fTxDoneCount = 0;
+    fTxDoneBatch = 1;
+    fStatsOK = false;
+    fMcTimer = NULL;
+    fMcPending = false;
+    fSoftFilterForced = false;
+    fSoftFilter = false;
+    fPromiscuous = false;
+    fOurAddrHi = 0;
+    fOurAddrLo = 0;
+    fZLPPad = true;
+    fKeepPools = true;
+    fWakeStart = 0;
+    fWakePending = 0;
+    fTSO = true;
+    fLRO = true;
+    fLROFlow.head = NULL;
+    fLROFlow.tail = NULL;
+    fLROTimer = NULL;
+    fInPacketSize = 0;
+    bzero(&fTxCounters, sizeof(fTxCounters));
+    bzero(&fTxDoneCounters, sizeof(fTxDoneCounters));
+    bzero(&fRxCounters, sizeof(fRxCounters));
+    bzero(&fHostTotals, sizeof(fHostTotals));
     
     fQueueStarted = false;              // State of the IO output queue
     fTxStalled = false;
 	
-    for (i=0; i<kMaxOutBufPool; i++)
-    {
-        fPipeOutBuff[i].pipeOutMDP = NULL;
-        fPipeOutBuff[i].pipeOutBuffer = NULL;
-        fPipeOutBuff[i].m = NULL;
-        fPipeOutBuff[i].avail = false;
-        fPipeOutBuff[i].writeCompletionInfo.target = NULL;
-        fPipeOutBuff[i].writeCompletionInfo.action = NULL;
-        fPipeOutBuff[i].writeCompletionInfo.parameter = NULL;
-		fPipeOutBuff[i].indx = i;
-    }
+    fPipeInBuff = NULL;				// Allocated in start once the pool sizes are known
+    fPipeOutBuff = NULL;
+    fTxDone = NULL;
+    fInBufAlloc = 0;
+    fOutBufAlloc = 0;
+    fInBufMax = 0;
+    fOutBufMax = 0;
+    fTSOMaxSegs = 0;
     fOutPoolIndex = 0;
-    
-    for (i=0; i<kMaxInBufPool; i++)
-    {
-        fPipeInBuff[i].pipeInMDP = NULL;
-        fPipeInBuff[i].pipeInBuffer = NULL;
-        fPipeInBuff[i].dead = false;
-        fPipeInBuff[i].readCompletionInfo.target = NULL;
-        fPipeInBuff[i].readCompletionInfo.action = NULL;
-        fPipeInBuff[i].readCompletionInfo.parameter = NULL;
-		fPipeInBuff[i].indx = i;
-    }
 
     return true;
 
@@ -783,11 +872,11 @@ bool AppleUSBCDCECMData::start(IOService *provider)
     {
 		bufValue = bufNumber->unsigned16BitValue();
 		XTRACE(this, 0, bufValue, "start - Number of input buffers override value");
-        if (bufValue <= kMaxInBufPool)
+        if (bufValue <= kMaxInBufPoolSS)
         {
             fInBufPool = bufValue;
         } else {
-            fInBufPool = kMaxInBufPool;
+            fInBufPool = kMaxInBufPoolSS;
         }
 	} else {
 		fInBufPool = 0;
@@ -803,11 +892,11 @@ bool AppleUSBCDCECMData::start(IOService *provider)
 		{
 			bufValue = bufNumber->unsigned16BitValue();
 			XTRACE(this, 0, bufValue, "start - Number of input buffers requested");
-			if (bufValue <= kMaxInBufPool)
+			if (bufValue <= kMaxInBufPoolSS)
 			{
 				fInBufPool = bufValue;
 			} else {
-				fInBufPool = kMaxInBufPool;
+				fInBufPool = kMaxInBufPoolSS;
 			}
 		} else {
 			fInBufPool = kInBufPool;
@@ -822,11 +911,11 @@ bool AppleUSBCDCECMData::start(IOService *provider)
     {
 		bufValue = bufNumber->unsigned16BitValue();
 		XTRACE(this, 0, bufValue, "start - Number of output buffers override value");
-        if (bufValue <= kMaxOutBufPool)
+        if (bufValue <= kMaxOutBufPoolSS)
         {
             fOutBufPool = bufValue;
         } else {
-            fOutBufPool = kMaxOutBufPool;
+            fOutBufPool = kMaxOutBufPoolSS;
         }
 	} else {
 		fOutBufPool = 0;
@@ -842,17 +931,164 @@ bool AppleUSBCDCECMData::start(IOService *provider)
 		{
 			bufValue = bufNumber->unsigned16BitValue();
 			XTRACE(this, 0, bufValue, "start - Number of output buffers requested");
-			if (bufValue <= kMaxOutBufPool)
+			if (bufValue <= kMaxOutBufPoolSS)
 			{
 				fOutBufPool = bufValue;
 			} else {
-				fOutBufPool = kMaxOutBufPool;
+				fOutBufPool = kMaxOutBufPoolSS;
 			}
 		} else {
 			fOutBufPool = kOutBufPool;
 		}
 	}
     
+        // The configured values are the floor, the link speed may ask for more later
+        // (up to what this bus can use)
+    
+    switch (fDataInterface->GetDevice()->GetSpeed())
+    {
+        case kUSBDeviceSpeedLow:
+        case kUSBDeviceSpeedFull:
+            fInBufMax = kMaxInBufPoolFS;
+            fOutBufMax = kMaxOutBufPoolFS;
+            break;
+        case kUSBDeviceSpeedHigh:
+            fInBufMax = kMaxInBufPool;
+            fOutBufMax = kMaxOutBufPool;
+            break;
+        default:
+            fInBufMax = kMaxInBufPoolSS;
+            fOutBufMax = kMaxOutBufPoolSS;
+            break;
+    }
+    if (fInBufMax < fInBufPool)
+    {
+        fInBufMax = fInBufPool;
+    }
+    if (fOutBufMax < fOutBufPool)
+    {
+        fOutBufMax = fOutBufPool;
+    }
+    XTRACE(this, fInBufMax, fOutBufMax, "start - Buffer pool ceilings (input, output)");
+    
+        // A large send reserves all its buffers as bulk, at the ceiling bulk can't
+        // have the priority reserve so anything bigger could never be sent
+    
+    fTSOMaxSegs = kTSOMaxSegments;
+    if (fTSOMaxSegs > (UInt32)(fOutBufMax - kTxPriorityReserve))
+    {
+        fTSOMaxSegs = fOutBufMax - kTxPriorityReserve;
+    }
+    
+    if (!allocatePools())
+    {
+        ALERT(0, 0, "start - allocatePools failed");
+        return false;
+    }
+    
+    fInBufPoolMin = fInBufPool;
+    fOutBufPoolMin = fOutBufPool;
+    fInBufTarget = fInBufPool;
+    fOutBufTarget = fOutBufPool;
+    
+        // Some devices deliver everything regardless of the packet filter
+    
+    OSBoolean *softFilter = OSDynamicCast(OSBoolean, provider->getProperty(softFilterTag));
+    if (!softFilter)
+    {
+        softFilter = OSDynamicCast(OSBoolean, getProperty(softFilterTag));
+    }
+    if (softFilter && softFilter->isTrue())
+    {
+        XTRACE(this, 0, 0, "start - Software ingress filter forced");
+        fSoftFilterForced = true;
+    }
+    
+        // Some devices can't take the pad byte, they get a zero length packet instead
+    
+    OSBoolean *zlpPad = OSDynamicCast(OSBoolean, provider->getProperty(zlpPadTag));
+    if (!zlpPad)
+    {
+        zlpPad = OSDynamicCast(OSBoolean, getProperty(zlpPadTag));
+    }
+    if (zlpPad && zlpPad->isFalse())
+    {
+        XTRACE(this, 0, 0, "start - Zero length packet padding disabled");
+        fZLPPad = false;
+    }
+    
+        // Normally the buffer pools stay allocated over sleep (it's quicker to resume and
+        // the contiguous allocations can't fail on wake), this puts the old behavior back
+    
+    OSBoolean *keepPools = OSDynamicCast(OSBoolean, provider->getProperty(keepPoolsTag));
+    if (!keepPools)
+    {
+        keepPools = OSDynamicCast(OSBoolean, getProperty(keepPoolsTag));
+    }
+    if (keepPools && keepPools->isFalse())
+    {
+        XTRACE(this, 0, 0, "start - Buffer pools released on sleep");
+        fKeepPools = false;
+    }
+    
+        // Priority and bulk transmit lanes
+    
+    OSBoolean *lanes = OSDynamicCast(OSBoolean, provider->getProperty(lanesTag));
+    if (!lanes)
+    {
+        lanes = OSDynamicCast(OSBoolean, getProperty(lanesTag));
+    }
+    if (lanes && lanes->isFalse())
+    {
+        XTRACE(this, 0, 0, "start - Transmit lanes disabled");
+        fLanes = false;
+    }
+    
+        // Pacing is off unless asked for
+    
+    OSBoolean *pacing = OSDynamicCast(OSBoolean, provider->getProperty(pacingTag));
+    if (!pacing)
+    {
+        pacing = OSDynamicCast(OSBoolean, getProperty(pacingTag));
+    }
+    if (pacing && pacing->isTrue())
+    {
+        XTRACE(this, 0, 0, "start - Transmit pacing enabled");
+        fPacing = true;
+    }
+    
+        // Segment large TCP sends here unless told not to (must be known before the interface attaches)
+    
+    OSBoolean *tso = OSDynamicCast(OSBoolean, provider->getProperty(tsoTag));
+    if (!tso)
+    {
+        tso = OSDynamicCast(OSBoolean, getProperty(tsoTag));
+    }
+    if (tso && tso->isFalse())
+    {
+        XTRACE(this, 0, 0, "start - TCP segmentation disabled");
+        fTSO = false;
+    }
+    
+        // Only offer it if the biggest send fits the pool, slower buses have smaller
+        // pools and the stack does the segmenting there
+    
+    if (fTSO && ((fTSOMaxSegs * kTSOMinMSS) < kTSOMaxSend))
+    {
+        XTRACE(this, fTSOMaxSegs, fOutBufMax, "start - TCP segmentation off, output pool too small");
+        fTSO = false;
+    }
+    
+    OSBoolean *lro = OSDynamicCast(OSBoolean, provider->getProperty(lroTag));
+    if (!lro)
+    {
+        lro = OSDynamicCast(OSBoolean, getProperty(lroTag));
+    }
+    if (lro && lro->isFalse())
+    {
+        XTRACE(this, 0, 0, "start - Receive coalescing disabled");
+        fLRO = false;
+    }
     
     //Do not automatically re-enumerate CDC ECM devices on wake
     fEnumOnWake = FALSE;
@@ -919,6 +1155,28 @@ void AppleUSBCDCECMData::free()
         fMediumDict->release();
     }
 
+    if (fMcTimer)
+    {
+        if (fWorkLoop)
+        {
+            fWorkLoop->removeEventSource(fMcTimer);
+        }
+        fMcTimer->release();
+        fMcTimer = NULL;
+    }
+
+    if (fLROTimer)
+    {
+        if (fWorkLoop)
+        {
+            fWorkLoop->removeEventSource(fLROTimer);
+        }
+        fLROTimer->release();
+        fLROTimer = NULL;
+    }
+    
+    freePools();
+
     if (fWorkLoop)
     {
         fWorkLoop->release();
@@ -956,6 +1214,7 @@ void AppleUSBCDCECMData::stop(IOService *provider)
     
         // Release all resources
 		
+    flushBulkLane();
     releaseResources();
     
     if (fNetworkInterface)
@@ -1095,6 +1354,39 @@ bool AppleUSBCDCECMData::createNetworkInterface()
 			return false;
 		}
 	}
+    
+        // And one for the multicast list updates (we can live without it)
+        
+    fMcTimer = IOTimerEventSource::timerEventSource(this, mcTimerFired);
+    if (fMcTimer && fWorkLoop)
+    {
+        if (fWorkLoop->addEventSource(fMcTimer) != kIOReturnSuccess)
+        {
+            XTRACE(this, 0, 0, "createNetworkInterface - Add multicast timer event source failed");
+            fMcTimer->release();
+            fMcTimer = NULL;
+        }
+    }
+    
+        // And one to end the receive batches, no timer means no coalescing
+        
+    if (fLRO)
+    {
+        fLROTimer = IOTimerEventSource::timerEventSource(this, lroTimerFired);
+        if (fLROTimer && fWorkLoop)
+        {
+            if (fWorkLoop->addEventSource(fLROTimer) != kIOReturnSuccess)
+            {
+                XTRACE(this, 0, 0, "createNetworkInterface - Add coalescing timer event source failed");
+                fLROTimer->release();
+                fLROTimer = NULL;
+            }
+        }
+        if (!fLROTimer)
+        {
+            fLRO = false;
+        }
+    }
 
         // Attach an IOEthernetInterface client
         
@@ -1381,6 +1673,34 @@ IOReturn AppleUSBCDCECMData::getMaxPacketSize(UInt32 *maxSize) const
     
 }/* end getMaxPacketSize */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::getFeatures
+//
+//		Inputs:		
+//
+//		Outputs:	Features supported
+//
+//		Desc:		Advertise TCP segmentation, we do it in USBTransmitTSO so the stack
+//				can hand us large sends.
+//
+/****************************************************************************************************/
+
+UInt32 AppleUSBCDCECMData::getFeatures() const
+{
+    UInt32	features = super::getFeatures();
+    
+    if (fTSO)
+    {
+        features |= kIONetworkFeatureTSOIPv4 | kIONetworkFeatureTSOIPv6;
+    }
+    
+    XTRACE(this, 0, features, "getFeatures");
+    
+    return features;
+    
+}/* end getFeatures */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCECMData::selectMedium
@@ -1610,23 +1930,25 @@ IOReturn AppleUSBCDCECMData::setMulticastList(IOEthernetAddress *addrs, UInt32 c
     
     if (fControlDriver)
     {
+    
+            // Only bother the device if the set really changed, and then not straight away
         
-        if (count > fControlDriver->fMcFilters)
-        {
-            fControlDriver->fPacketFilter |= kPACKET_TYPE_ALL_MULTICAST;
-        }
-        else
-        {
-            fControlDriver->fPacketFilter &= ~kPACKET_TYPE_ALL_MULTICAST;
-
-        }
-
-        fControlDriver->USBSetPacketFilter();
-
-        uStat = fControlDriver->USBSetMulticastFilter(addrs, count);
-        if (!uStat)
+        if (fControlDriver->mcFilterUpdate(addrs, count))
         {
-            return kIOReturnIOError;
+            if (fMcTimer)
+            {
+                if (!fMcPending)
+                {
+                    fMcPending = true;
+                    fMcTimer->setTimeoutMS(kMcCoalesceMS);
+                }
+            } else {
+                uStat = fControlDriver->mcFilterFlush();
+                if (!uStat)
+                {
+                    return kIOReturnIOError;
+                }
+            }
         }
 
         return kIOReturnSuccess;
@@ -1652,6 +1974,8 @@ IOReturn AppleUSBCDCECMData::setPromiscuousMode(IOEnetPromiscuousMode active)
 {
     
     XTRACE(this, 0, active, "setPromiscuousMode");
+    
+    fPromiscuous = active;
 
     if (!fReady)
     {
@@ -1724,6 +2048,7 @@ IOOutputQueue* AppleUSBCDCECMData::createOutputQueue()
 UInt32 AppleUSBCDCECMData::outputPacket(mbuf_t pkt, void *param)
 {
     UInt32	ior = kIOReturnSuccess;
+    bool	priority;
     
     XTRACEP(this, pkt, 0, "outputPacket");
     
@@ -1737,8 +2062,7 @@ UInt32 AppleUSBCDCECMData::outputPacket(mbuf_t pkt, void *param)
     if (fLinkStatus == kLinkDown)
     {
         XTRACEP(this, pkt, 0, "outputPacket - link is down");
-        if (fControlDriver->fOutputErrsOK)
-            fpNetStats->outputErrors++;
+        fTxCounters.errLinkDown++;
         freePacket(pkt);
         return kIOReturnOutputDropped;
     }
@@ -1746,8 +2070,7 @@ UInt32 AppleUSBCDCECMData::outputPacket(mbuf_t pkt, void *param)
 	if (fResetState != kResetNormal)
 	{
 		XTRACEP(this, pkt, 0, "outputPacket - deferred reset");
-        if (fControlDriver->fOutputErrsOK)
-            fpNetStats->outputErrors++;
+        fTxCounters.errLinkDown++;
         freePacket(pkt);
 		if (fResetState == kResetNeeded)
 		{
@@ -1757,7 +2080,32 @@ UInt32 AppleUSBCDCECMData::outputPacket(mbuf_t pkt, void *param)
         return kIOReturnOutputDropped;
 	}
     
-    ior = USBTransmitPacket(pkt);
+    priority = !fLanes || txPriority(pkt);
+    
+        // Bulk stays in order behind anything already waiting in its lane
+    
+    if (!priority && fBulkHead)
+    {
+        ior = kIOReturnOutputStall;
+    } else {
+        ior = USBTransmitPacket(pkt, priority);
+    }
+    
+    if ((ior == kIOReturnOutputStall) && !priority && (fBulkCount < kTxBulkLaneMax))
+    {
+        XTRACEP(this, pkt, fBulkCount, "outputPacket - Bulk packet held");
+        mbuf_setnextpkt(pkt, NULL);
+        if (fBulkTail)
+        {
+            mbuf_setnextpkt(fBulkTail, pkt);
+        } else {
+            fBulkHead = pkt;
+        }
+        fBulkTail = pkt;
+        fBulkCount++;
+        return kIOReturnOutputSuccess;
+    }
+    
     if (ior != kIOReturnSuccess)
     {
         if (ior == kIOReturnOutputStall)
@@ -1805,6 +2153,10 @@ bool AppleUSBCDCECMData::configureInterface(IONetworkInterface *netif)
         ALERT(0, 0, "configureInterface - Invalid network statistics");
         return false;
     }
+    
+        // Bring the counters up to date when someone reads them
+    
+    nd->setNotificationTarget(this, statsAccessed, NULL);
 
         // Get the Ethernet statistics structure
 
@@ -1814,6 +2166,19 @@ bool AppleUSBCDCECMData::configureInterface(IONetworkInterface *netif)
         ALERT(0, 0, "configureInterface - Invalid ethernet statistics\n");
         return false;
     }
+    nd->setNotificationTarget(this, statsAccessed, NULL);
+    
+        // Publish the full 64 bit host counters as well
+    
+    nd = IONetworkData::withExternalBuffer(hostCountersTag, sizeof(hostTotals), &fHostTotals, kIONetworkDataBasicAccessTypes, this, statsAccessed, NULL);
+    if (nd)
+    {
+        if (!netif->addNetworkData(nd))
+        {
+            XTRACE(this, 0, 0, "configureInterface - Failed to add the host counters");
+        }
+        nd->release();
+    }
 
     return true;
     
@@ -1837,9 +2202,11 @@ bool AppleUSBCDCECMData::wakeUp()
     IOReturn 	rtn = kIOReturnSuccess;
     UInt32	i;
     bool	readOK = false;
+    UInt64	setupTime;
 
     XTRACE(this, 0, 0, "wakeUp");
 	
+    fWakeStart = mach_absolute_time();
     
     fDataInterface->GetDevice()->SuspendDevice(false);
     
@@ -1863,7 +2230,7 @@ bool AppleUSBCDCECMData::wakeUp()
         if (fPipeInBuff[i].pipeInMDP)
         {
 //            fPipeInBuff[i].readCompletionInfo.parameter = (void *)i;
-			fPipeInBuff[i].readCompletionInfo.parameter = (void *)&fPipeInBuff[i];
+			fPipeInBuff[i].readCompletionInfo.parameter = (void *)(uintptr_t)i;
             rtn = fInPipe->Read(fPipeInBuff[i].pipeInMDP, &fPipeInBuff[i].readCompletionInfo, NULL);
             if (rtn == kIOReturnSuccess)
             {
@@ -1891,14 +2258,38 @@ bool AppleUSBCDCECMData::wakeUp()
             }
         }
 
+		fStatsOK = true;
 		if (fTimerSource)
 		{
 			fTimerSource->setTimeoutMS(WATCHDOG_TIMER_MS);
 		}
         fReady = true;
+        
+            // Filter in software if the device can't (or won't) filter multicast for us
+        
+        if (fControlDriver)
+        {
+            bcopy(&fControlDriver->fEaddr[0], &fOurAddrHi, sizeof(fOurAddrHi));
+            bcopy(&fControlDriver->fEaddr[4], &fOurAddrLo, sizeof(fOurAddrLo));
+            fSoftFilter = fSoftFilterForced || ((fControlDriver->fMcFilters & kFiltersSupportedMask) == 0);
+            XTRACE(this, fSoftFilterForced, fSoftFilter, "wakeUp - Software ingress filter");
+        }
+        
+            // Send any multicast change that was still waiting when we went to sleep
+        
+        if (fControlDriver && !fControlDriver->mcFilterFlush() && fMcTimer)
+        {
+            fMcPending = true;
+            fMcTimer->setTimeoutMS(kMcCoalesceMS);
+        }
     }
 
 	fSleeping = false;
+    
+    absolutetime_to_nanoseconds(mach_absolute_time() - fWakeStart, &setupTime);
+    setProperty(resumeSetupKey, setupTime / 1000, 32);
+    fWakePending = 1;
+    XTRACE(this, 0, (UInt32)(setupTime / 1000), "wakeUp - Setup time (microseconds)");
 	
     return true;
 	
@@ -1933,8 +2324,25 @@ void AppleUSBCDCECMData::putToSleep()
     { 
         fTimerSource->cancelTimeout();
     }
+    if (fMcTimer)
+    {
+        fMcTimer->cancelTimeout();
+        fMcPending = false;
+    }
+    if (fLROTimer)
+    {
+        fLROTimer->cancelTimeout();
+    }
+    lroFlush();
+    flushBulkLane();
+    fWakePending = 0;
     
-    releaseResources();
+    if (fKeepPools)
+    {
+        idleResources();
+    } else {
+        releaseResources();
+    }
     linkStatusChange(kLinkDown);
 	fSleeping = true;
     
@@ -1994,30 +2402,259 @@ bool AppleUSBCDCECMData::createMediumTables()
 
 /****************************************************************************************************/
 //
-//		Method:		AppleUSBCDCECMData::allocateResources
+//		Method:		AppleUSBCDCECMData::linkMedium
 //
-//		Inputs:		
+//		Inputs:		speed - link speed (bits/sec)
 //
-//		Outputs:	return code - true (allocate was successful), false (it failed)
+//		Outputs:	The medium for this speed
 //
-//		Desc:		Gets all the endpoints open and buffers allocated etc.
+//		Desc:		Modems and USB 3 adapters report all sorts of speeds (150 Mbit LTE, 5 Gbit...)
+//				so the entry is made from what the device reported. The standard Ethernet
+//				speeds get their own type, anything else is auto (full duplex, so it's not
+//				the selectable auto entry) with the reported speed. There's one entry per
+//				type and it's replaced (and the dictionary republished) when the speed changes.
 //
 /****************************************************************************************************/
 
-bool AppleUSBCDCECMData::allocateResources()
+IONetworkMedium *AppleUSBCDCECMData::linkMedium(UInt64 speed)
 {
-    IOUSBFindEndpointRequest		epReq;
-    UInt32				i;
-
-    XTRACE(this, 0, 0, "allocateResources.");
-	
-		// Check things are still around (waking from sleep)
-	
-	if (!fDataInterface)
-	{
-		XTRACE(this, 0, 0, "allocateResources - No data interface");
-		return false;
-	}
+    IONetworkMedium	*medium;
+    IOMediumType	mediumType = kIOMediumOptionFullDuplex;
+    
+    switch (speed)
+    {
+        case 10000000ULL:
+            mediumType |= kIOMediumEthernet10BaseT;
+            break;
+        case 100000000ULL:
+            mediumType |= kIOMediumEthernet100BaseTX;
+            break;
+        case 1000000000ULL:
+            mediumType |= kIOMediumEthernet1000BaseTX;
+            break;
+        case 2500000000ULL:
+            mediumType |= kIOMediumEthernet2500BaseT;
+            break;
+        case 5000000000ULL:
+            mediumType |= kIOMediumEthernet5000BaseT;
+            break;
+        case 10000000000ULL:
+            mediumType |= kIOMediumEthernet10GBaseT;
+            break;
+        default:
+            mediumType |= kIOMediumEthernetAuto;
+            break;
+    }
+    
+    if (!fMediumDict)
+    {
+        return NULL;
+    }
+    
+    medium = IONetworkMedium::getMediumWithType(fMediumDict, mediumType);
+    if (medium && (medium->getSpeed() == speed))
+    {
+        return medium;
+    }
+    
+    XTRACE(this, mediumType, (UInt32)(speed / 1000000), "linkMedium - New medium entry (Mbit)");
+    
+    medium = IONetworkMedium::medium(mediumType, speed);
+    if (!medium)
+    {
+        return IONetworkMedium::getMediumWithType(fMediumDict, mediumType);
+    }
+    IONetworkMedium::addMedium(fMediumDict, medium);
+    medium->release();
+    
+    if (!publishMediumDictionary(fMediumDict))
+    {
+        XTRACE(this, 0, 0, "linkMedium - publish dict. failed");
+    }
+    
+    return IONetworkMedium::getMediumWithType(fMediumDict, mediumType);
+    
+}/* end linkMedium */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::allocatePools
+//
+//		Inputs:		
+//
+//		Outputs:	return code - true (allocate was successful), false (it failed)
+//
+//		Desc:		Allocate the buffer records (not the buffers) at the configured pool sizes
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCECMData::allocatePools()
+{
+    
+    XTRACE(this, fInBufPool, fOutBufPool, "allocatePools");
+    
+    if (!growPools(fInBufPool, fOutBufPool))
+    {
+        XTRACE(this, 0, 0, "allocatePools - IOMalloc failed");
+        freePools();
+        return false;
+    }
+    
+    return true;
+    
+}/* end allocatePools */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::growPools
+//
+//		Inputs:		inCount - input records wanted
+//				outCount - output records wanted
+//
+//		Outputs:	return code - true (there are at least that many), false (IOMalloc failed)
+//
+//		Desc:		Make room for more buffer records. A bigger array is allocated, the
+//				records copied over and the old one freed. Only done on the workloop,
+//				completions and the done list index the records so nothing points
+//				into the old array (the USB family copies the completion when the
+//				transfer is queued).
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCECMData::growPools(UInt16 inCount, UInt16 outCount)
+{
+    pipeInBuffers	*newIn;
+    pipeOutBuffers	*newOut;
+    UInt16		*newDone;
+    UInt32		i;
+    
+    if (inCount > fInBufAlloc)
+    {
+        XTRACE(this, fInBufAlloc, inCount, "growPools - Input records");
+        newIn = (pipeInBuffers *)IOMalloc(inCount * sizeof(pipeInBuffers));
+        if (!newIn)
+        {
+            return false;
+        }
+        bzero(newIn, inCount * sizeof(pipeInBuffers));
+        if (fPipeInBuff)
+        {
+            bcopy(fPipeInBuff, newIn, fInBufAlloc * sizeof(pipeInBuffers));
+            IOFree(fPipeInBuff, fInBufAlloc * sizeof(pipeInBuffers));
+        }
+        for (i=fInBufAlloc; i<inCount; i++)
+        {
+            newIn[i].indx = i;
+        }
+        fPipeInBuff = newIn;
+        fInBufAlloc = inCount;
+    }
+    
+    if (outCount > fOutBufAlloc)
+    {
+        XTRACE(this, fOutBufAlloc, outCount, "growPools - Output records");
+        newOut = (pipeOutBuffers *)IOMalloc(outCount * sizeof(pipeOutBuffers));
+        newDone = (UInt16 *)IOMalloc(outCount * sizeof(UInt16));
+        if (!newOut || !newDone)
+        {
+            if (newOut)
+            {
+                IOFree(newOut, outCount * sizeof(pipeOutBuffers));
+            }
+            if (newDone)
+            {
+                IOFree(newDone, outCount * sizeof(UInt16));
+            }
+            return false;
+        }
+        bzero(newOut, outCount * sizeof(pipeOutBuffers));
+        bzero(newDone, outCount * sizeof(UInt16));
+        if (fPipeOutBuff)
+        {
+            bcopy(fPipeOutBuff, newOut, fOutBufAlloc * sizeof(pipeOutBuffers));
+            IOFree(fPipeOutBuff, fOutBufAlloc * sizeof(pipeOutBuffers));
+        }
+        if (fTxDone)
+        {
+            bcopy(fTxDone, newDone, fTxDoneCount * sizeof(UInt16));
+            IOFree(fTxDone, fOutBufAlloc * sizeof(UInt16));
+        }
+        for (i=fOutBufAlloc; i<outCount; i++)
+        {
+            newOut[i].indx = i;
+        }
+        fPipeOutBuff = newOut;
+        fTxDone = newDone;
+        fOutBufAlloc = outCount;
+    }
+    
+    return true;
+    
+}/* end growPools */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::freePools
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Free the buffer records, the buffers themselves have already gone
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::freePools()
+{
+    
+    XTRACE(this, 0, 0, "freePools");
+    
+    if (fPipeInBuff)
+    {
+        IOFree(fPipeInBuff, fInBufAlloc * sizeof(pipeInBuffers));
+        fPipeInBuff = NULL;
+    }
+    if (fPipeOutBuff)
+    {
+        IOFree(fPipeOutBuff, fOutBufAlloc * sizeof(pipeOutBuffers));
+        fPipeOutBuff = NULL;
+    }
+    if (fTxDone)
+    {
+        IOFree(fTxDone, fOutBufAlloc * sizeof(UInt16));
+        fTxDone = NULL;
+    }
+    fInBufAlloc = 0;
+    fOutBufAlloc = 0;
+    
+}/* end freePools */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::allocateResources
+//
+//		Inputs:		
+//
+//		Outputs:	return code - true (allocate was successful), false (it failed)
+//
+//		Desc:		Gets all the endpoints open and buffers allocated etc.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCECMData::allocateResources()
+{
+    IOUSBFindEndpointRequest		epReq;
+    UInt32				i;
+
+    XTRACE(this, 0, 0, "allocateResources.");
+	
+		// Check things are still around (waking from sleep)
+	
+	if (!fDataInterface)
+	{
+		XTRACE(this, 0, 0, "allocateResources - No data interface");
+		return false;
+	}
 	
 	if (!fControlDriver)
 	{
@@ -2037,6 +2674,7 @@ bool AppleUSBCDCECMData::allocateResources()
         XTRACE(this, 0, 0, "allocateResources - no bulk input pipe.");
         return false;
     }
+    fInPacketSize = epReq.maxPacketSize;
     XTRACE(this, epReq.maxPacketSize << 16 |epReq.interval, 0, "allocateResources - bulk input pipe.");
 
     epReq.direction = kUSBOut;
@@ -2053,6 +2691,11 @@ bool AppleUSBCDCECMData::allocateResources()
 
     for (i=0; i<fInBufPool; i++)
     {
+        if (fPipeInBuff[i].pipeInMDP)		// Kept over sleep
+        {
+            fPipeInBuff[i].dead = false;
+            continue;
+        }
 //        fPipeInBuff[i].pipeInMDP = IOBufferMemoryDescriptor::withCapacity(fControlDriver->fMax_Block_Size, kIODirectionIn);
         fPipeInBuff[i].pipeInMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionIn | kIOMemoryPhysicallyContiguous, fControlDriver->fMax_Block_Size, PAGE_SIZE);
         if (!fPipeInBuff[i].pipeInMDP)
@@ -2074,6 +2717,11 @@ bool AppleUSBCDCECMData::allocateResources()
 
     for (i=0; i<fOutBufPool; i++)
     {
+        if (fPipeOutBuff[i].pipeOutMDP)		// Kept over sleep
+        {
+            fPipeOutBuff[i].avail = true;
+            continue;
+        }
 //        fPipeOutBuff[i].pipeOutMDP = IOBufferMemoryDescriptor::withCapacity(fControlDriver->fMax_Block_Size, kIODirectionOut);
         fPipeOutBuff[i].pipeOutMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionOut | kIOMemoryPhysicallyContiguous, fControlDriver->fMax_Block_Size, PAGE_SIZE);
         if (!fPipeOutBuff[i].pipeOutMDP)
@@ -2090,6 +2738,8 @@ bool AppleUSBCDCECMData::allocateResources()
         fPipeOutBuff[i].writeCompletionInfo.action = dataWriteComplete;
         fPipeOutBuff[i].writeCompletionInfo.parameter = NULL;				// for now, filled in with pool index when sent
     }
+    
+    computeBufferTargets();
 		
     return true;
 	
@@ -2126,6 +2776,10 @@ void AppleUSBCDCECMData::releaseResources()
         }
     }
     fOutPoolIndex = 0;
+    fTxInFlight = 0;
+    fTxOutstanding = 0;
+    fTxDoneCount = 0;
+    releaseFreePackets();
     
     for (i=0; i<fInBufPool; i++)
     {
@@ -2139,11 +2793,84 @@ void AppleUSBCDCECMData::releaseResources()
             fPipeInBuff[i].readCompletionInfo.parameter = NULL;
         }
     }
+    
+        // Back to the configured sizes, the link speed will grow them again
+    
+    fInBufPool = fInBufPoolMin;
+    fOutBufPool = fOutBufPoolMin;
+    fInBufTarget = fInBufPoolMin;
+    fOutBufTarget = fOutBufPoolMin;
 
     XTRACE(this, 0, 0, "releaseResources <<<");
     
 }/* end releaseResources */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::idleResources
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		The sleep time alternative to releaseResources. The I/O has been aborted,
+//				the buffers are kept but anything still attached to them is let go
+//				(the aborted reads have already marked themselves dead). allocateResources
+//				finds the pipes again and wakeUp re-arms the reads.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::idleResources()
+{
+    UInt32	i;
+    
+    XTRACE(this, fInBufPool, fOutBufPool, "idleResources");
+
+    for (i=0; i<fOutBufPool; i++)
+    {
+        if (fPipeOutBuff[i].m != NULL)
+        {
+            freePacket(fPipeOutBuff[i].m);
+            fPipeOutBuff[i].m = NULL;
+        }
+        fPipeOutBuff[i].length = 0;
+        fPipeOutBuff[i].avail = false;		// Nothing goes out until we're awake
+    }
+    fOutPoolIndex = 0;
+    fTxInFlight = 0;
+    fTxOutstanding = 0;
+    fTxDoneCount = 0;
+    releaseFreePackets();
+    
+}/* end idleResources */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::resumeTraffic
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		First transfer after wakeUp, publish how long it took
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::resumeTraffic()
+{
+    UInt64	latency;
+    
+    if (!OSCompareAndSwap(1, 0, &fWakePending))
+    {
+        return;
+    }
+    
+    absolutetime_to_nanoseconds(mach_absolute_time() - fWakeStart, &latency);
+    setProperty(resumeTrafficKey, latency / 1000, 32);
+    XTRACE(this, 0, (UInt32)(latency / 1000), "resumeTraffic - Resume to traffic time (microseconds)");
+    
+}/* end resumeTraffic */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCECMData::getOutputBuffer
@@ -2156,12 +2883,36 @@ void AppleUSBCDCECMData::releaseResources()
 //
 /****************************************************************************************************/
 
-bool AppleUSBCDCECMData::getOutputBuffer(UInt32 *bufIndx)
+bool AppleUSBCDCECMData::getOutputBuffer(UInt32 *bufIndx, bool priority)
 {
 	bool	gotBuffer = false;
 	UInt32	indx = 0;
+	UInt32	free = 0;
+	
+	XTRACE(this, 0, priority, "getOutputBuffer");
 	
-	XTRACE(this, 0, 0, "getOutputBuffer");
+		// Bulk has to leave the reserve alone (the pool can still grow if it's not at its maximum)
+		
+	if (!priority && (fOutBufPool >= fOutBufMax))
+	{
+		for (indx=0; indx<fOutBufPool; indx++)
+		{
+			if (fPipeOutBuff[indx].avail)
+			{
+				free++;
+				if (free > kTxPriorityReserve)
+				{
+					break;
+				}
+			}
+		}
+		if (free <= kTxPriorityReserve)
+		{
+			XTRACE(this, free, fOutBufPool, "getOutputBuffer - Only the priority reserve left");
+			*bufIndx = 0;
+			return false;
+		}
+	}
 	
 		// Get an ouput buffer (use the hint first then if that's not available look for one and then create one...)
 		
@@ -2190,9 +2941,9 @@ bool AppleUSBCDCECMData::getOutputBuffer(UInt32 *bufIndx)
 			fOutPoolIndex = 0;
 		}
 	} else {
-		if (fOutBufPool >= kMaxOutBufPool)
+		if (fOutBufPool >= fOutBufMax)
 		{
-			ALERT(kMaxOutBufPool, fOutBufPool, "getOutputBuffer - Output buffer pool empty");
+			ALERT(fOutBufMax, fOutBufPool, "getOutputBuffer - Output buffer pool empty");
 			indx = 0;
 			gotBuffer = false;
 		} else {
@@ -2201,8 +2952,11 @@ bool AppleUSBCDCECMData::getOutputBuffer(UInt32 *bufIndx)
 				// Create a new one (should never really get here - maybe very very heavy transmit traffic)
 			
 			indx = fOutBufPool;
-			fPipeOutBuff[indx].pipeOutMDP = IOBufferMemoryDescriptor::withCapacity(fControlDriver->fMax_Block_Size, kIODirectionOut);
-			if (!fPipeOutBuff[indx].pipeOutMDP)
+			if (growPools(fInBufAlloc, fOutBufPool + 1))
+			{
+				fPipeOutBuff[indx].pipeOutMDP = IOBufferMemoryDescriptor::withCapacity(fControlDriver->fMax_Block_Size, kIODirectionOut);
+			}
+			if ((fOutBufAlloc <= indx) || !fPipeOutBuff[indx].pipeOutMDP)
 			{
 				XTRACE(this, 0, indx, "getOutputBuffer - Allocate output descriptor failed");
 				gotBuffer = false;
@@ -2229,11 +2983,204 @@ bool AppleUSBCDCECMData::getOutputBuffer(UInt32 *bufIndx)
 
 }/* end getOutputBuffer */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::computeBufferTargets
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Work out how many reads and writes need to be in flight to cover the
+//				bandwidth-delay product of the link. The delay is the larger of the bus
+//				(micro)frame time for this endpoint and the measured write latency.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::computeBufferTargets()
+{
+    UInt64	latency;
+    UInt64	inFlight;
+    UInt32	blockSize;
+    
+    if (!fControlDriver || (fControlDriver->fMax_Block_Size == 0))
+    {
+        return;
+    }
+    blockSize = fControlDriver->fMax_Block_Size;
+    
+        // Floor is set by the endpoint type (max packet size tells us the bus speed)
+    
+    if (fInPacketSize > 512)
+    {
+        latency = kBDPLatencySuperSpeed;
+    } else {
+        if (fInPacketSize > 64)
+        {
+            latency = kBDPLatencyHighSpeed;
+        } else {
+            latency = kBDPLatencyFullSpeed;
+        }
+    }
+    if (fWriteLatency > latency)
+    {
+        latency = fWriteLatency;
+    }
+    latency *= kBDPHeadroom;
+    
+        // Input side (device to host)
+    
+    inFlight = ((fDownSpeed / 8) * latency) / 1000000;
+    inFlight = (inFlight / blockSize) + 1;
+    if (inFlight < fInBufPoolMin)
+    {
+        inFlight = fInBufPoolMin;
+    }
+    if (inFlight > fInBufMax)
+    {
+        inFlight = fInBufMax;
+    }
+    fInBufTarget = (UInt16)inFlight;
+    
+        // Output side (host to device)
+    
+    inFlight = ((fUpSpeed / 8) * latency) / 1000000;
+    inFlight = (inFlight / blockSize) + 1;
+    if (inFlight < fOutBufPoolMin)
+    {
+        inFlight = fOutBufPoolMin;
+    }
+    if (inFlight > fOutBufMax)
+    {
+        inFlight = fOutBufMax;
+    }
+    fOutBufTarget = (UInt16)inFlight;
+    
+        // Write completions are batched a quarter of the pool at a time
+    
+    fTxDoneBatch = fOutBufTarget / 4;
+    if (fTxDoneBatch < 1)
+    {
+        fTxDoneBatch = 1;
+    }
+    if (fTxDoneBatch > kTxDoneBatchMax)
+    {
+        fTxDoneBatch = kTxDoneBatchMax;
+    }
+    
+        // Pacing limit, at least a couple of frames so a slow link still streams
+    
+    if (fUpSpeed == 0)
+    {
+        fPaceLimit = 0;
+    } else {
+        inFlight = ((fUpSpeed / 8) * kPaceTargetUS) / 1000000;
+        if (inFlight < (blockSize * 2))
+        {
+            inFlight = blockSize * 2;
+        }
+        fPaceLimit = (UInt32)inFlight;
+    }
+    
+    XTRACE(this, fInBufTarget, fOutBufTarget, "computeBufferTargets - Input and output targets");
+    XTRACE(this, fPacing, fPaceLimit, "computeBufferTargets - Pacing limit");
+    
+}/* end computeBufferTargets */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::growBufferPools
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Grow the read and write pools up to their targets. Only done while the
+//				link is up and always from the workloop (watchdog timer), the pools are
+//				never shrunk while I/O is outstanding.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::growBufferPools()
+{
+    IOReturn	rtn;
+    UInt32	i;
+    
+    if (!fReady || (fLinkStatus != kLinkUp) || !fControlDriver || !fInPipe)
+    {
+        return;
+    }
+    
+    if (!growPools(fInBufTarget, fOutBufTarget))
+    {
+        XTRACE(this, fInBufTarget, fOutBufTarget, "growBufferPools - Grow records failed");
+        fInBufTarget = fInBufPool;
+        fOutBufTarget = fOutBufPool;
+        return;
+    }
+    
+    while (fInBufPool < fInBufTarget)
+    {
+        i = fInBufPool;
+        fPipeInBuff[i].pipeInMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionIn | kIOMemoryPhysicallyContiguous, fControlDriver->fMax_Block_Size, PAGE_SIZE);
+        if (!fPipeInBuff[i].pipeInMDP)
+        {
+            XTRACE(this, 0, i, "growBufferPools - Allocate input descriptor failed");
+            fInBufTarget = fInBufPool;
+            break;
+        }
+        fPipeInBuff[i].pipeInMDP->setLength(fControlDriver->fMax_Block_Size);
+        fPipeInBuff[i].pipeInBuffer = (UInt8*)fPipeInBuff[i].pipeInMDP->getBytesNoCopy();
+        fPipeInBuff[i].dead = false;
+        fPipeInBuff[i].readCompletionInfo.target = this;
+        fPipeInBuff[i].readCompletionInfo.action = dataReadComplete;
+        fPipeInBuff[i].readCompletionInfo.parameter = (void *)(uintptr_t)i;
+        fInBufPool++;
+        
+        rtn = fInPipe->Read(fPipeInBuff[i].pipeInMDP, &fPipeInBuff[i].readCompletionInfo, NULL);
+        if (rtn != kIOReturnSuccess)
+        {
+            XTRACE(this, i, rtn, "growBufferPools - Read failed");
+            fPipeInBuff[i].dead = true;					// Resurrected on resume
+        }
+    }
+    
+    while (fOutBufPool < fOutBufTarget)
+    {
+        i = fOutBufPool;
+        fPipeOutBuff[i].pipeOutMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionOut | kIOMemoryPhysicallyContiguous, fControlDriver->fMax_Block_Size, PAGE_SIZE);
+        if (!fPipeOutBuff[i].pipeOutMDP)
+        {
+            XTRACE(this, 0, i, "growBufferPools - Allocate output descriptor failed");
+            fOutBufTarget = fOutBufPool;
+            break;
+        }
+        fPipeOutBuff[i].pipeOutMDP->setLength(fControlDriver->fMax_Block_Size);
+        fPipeOutBuff[i].pipeOutBuffer = (UInt8*)fPipeOutBuff[i].pipeOutMDP->getBytesNoCopy();
+        fPipeOutBuff[i].m = NULL;
+        fPipeOutBuff[i].writeCompletionInfo.target = this;
+        fPipeOutBuff[i].writeCompletionInfo.action = dataWriteComplete;
+        fPipeOutBuff[i].writeCompletionInfo.parameter = NULL;
+        fPipeOutBuff[i].avail = true;
+        fOutBufPool++;
+        
+        if (fTxStalled)						// New buffers, so get things moving again
+        {
+            fTxStalled = false;
+            fTransmitQueue->service(IOBasicOutputQueue::kServiceAsync);
+        }
+    }
+    
+    XTRACE(this, fInBufPool, fOutBufPool, "growBufferPools - Buffer pools (input, output)");
+    
+}/* end growBufferPools */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCECMData::USBTransmitPacket
 //
 //		Inputs:		packet - the packet
+//				priority - priority lane (can use the reserved buffers)
 //
 //		Outputs:	Return code - kIOReturnSuccess (transmit started), everything else (it didn't)
 //
@@ -2241,7 +3188,7 @@ bool AppleUSBCDCECMData::getOutputBuffer(UInt32 *bufIndx)
 //
 /****************************************************************************************************/
 
-IOReturn AppleUSBCDCECMData::USBTransmitPacket(mbuf_t packet)
+IOReturn AppleUSBCDCECMData::USBTransmitPacket(mbuf_t packet, bool priority)
 {
     UInt32		numbufs = 0;			// number of mbufs for this packet
     mbuf_t		m;						// current mbuf
@@ -2249,6 +3196,8 @@ IOReturn AppleUSBCDCECMData::USBTransmitPacket(mbuf_t packet)
     UInt32		rTotal = 0;
     IOReturn	ior = kIOReturnSuccess;
     UInt32		indx;
+    UInt32		tsoRequest = 0;
+    UInt32		tsoMSS = 0;
 	
     XTRACEP(this, 0, packet, "USBTransmitPacket");
 	
@@ -2277,72 +3226,334 @@ IOReturn AppleUSBCDCECMData::USBTransmitPacket(mbuf_t packet)
     
     XTRACE(this, total_pkt_length, numbufs, "USBTransmitPacket - Total packet length and Number of mbufs");
     
+    if (fTSO && (mbuf_get_tso_requested(packet, &tsoRequest, &tsoMSS) == 0))
+    {
+        if ((tsoRequest & (MBUF_TSO_IPV4 | MBUF_TSO_IPV6)) && (tsoMSS != 0))
+        {
+            return USBTransmitTSO(packet, tsoRequest, tsoMSS);
+        }
+    }
+    
     if (total_pkt_length > fControlDriver->fMax_Block_Size)
     {
         XTRACE(this, 0, 0, "USBTransmitPacket - Bad packet size");	// Note for now and revisit later
-        if (fControlDriver->fOutputErrsOK)
-            fpNetStats->outputErrors++;
+        fTxCounters.errTooBig++;
+        return kIOReturnOutputDropped;
+    }
+    
+    if (fPacing && fPaceLimit && (fTxInFlight > 0) && ((UInt32)fTxInFlight + total_pkt_length > fPaceLimit))
+    {
+        XTRACE(this, fTxInFlight, fPaceLimit, "USBTransmitPacket - Paced");
+        return kIOReturnOutputStall;
+    }
+    
+    if (!getOutputBuffer(&indx, priority))
+    {
+        if (priority)
+        {
+            ALERT(fOutBufPool, fOutPoolIndex, "USBTransmitPacket - Output buffer unavailable");
+        }
+        return kIOReturnOutputStall;
+    }
+    
+        // Start filling in the send buffer
+
+    m = packet;							// start with the first mbuf of the packet
+    rTotal = 0;							// running total				
+    do
+    {  
+        if (mbuf_len(m) == 0)			// Ignore zero length buffers
+			continue;
+        
+        bcopy(mbuf_data(m), &fPipeOutBuff[indx].pipeOutBuffer[rTotal], mbuf_len(m));
+        rTotal += mbuf_len(m);
+        
+    } while ((m = mbuf_next(m)) != 0);
+	
+    LogData(kDataOut, rTotal, fPipeOutBuff[indx].pipeOutBuffer);
+    
+    rTotal = zlpPad(fPipeOutBuff[indx].pipeOutBuffer, rTotal);
+	
+    fPipeOutBuff[indx].m = packet;
+	fPipeOutBuff[indx].length = rTotal;
+	fPipeOutBuff[indx].writeCompletionInfo.parameter = (void *)(uintptr_t)indx;
+	fPipeOutBuff[indx].submitTime = mach_absolute_time();
+	OSAddAtomic((SInt32)rTotal, &fTxInFlight);
+	OSIncrementAtomic(&fTxOutstanding);
+
+	ior = cdc_PipeWrite(fOutPipe, fPipeOutBuff[indx].pipeOutMDP, rTotal, kPipeNoDataTimeout, kPipeCompletionTimeout, &fPipeOutBuff[indx].writeCompletionInfo);
+    if (ior != kIOReturnSuccess)
+    {
+        XTRACE(this, 0, ior, "USBTransmitPacket - Write failed");
+        fTxCounters.errPipe++;
+
+        OSAddAtomic(-(SInt32)rTotal, &fTxInFlight);
+        OSDecrementAtomic(&fTxOutstanding);
+        fPipeOutBuff[indx].m = NULL;		// outputPacket frees it
+        fPipeOutBuff[indx].length = 0;
+        fPipeOutBuff[indx].avail = true;
+        return ior;
+    }
+    
+    fTxCounters.packets++;
+    fTxCounters.bytes += total_pkt_length;		// Not the pad
+    
+    return ior;
+
+}/* end USBTransmitPacket */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::txPriority
+//
+//		Inputs:		packet - the packet
+//
+//		Outputs:	true (priority lane), false (bulk lane)
+//
+//		Desc:		Short packets (ACKs, DNS and the like) and the latency sensitive service
+//				classes go in the priority lane, everything else is bulk.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCECMData::txPriority(mbuf_t packet)
+{
+    
+    if (mbuf_pkthdr_len(packet) <= kTxPriorityMaxLen)
+    {
+        return true;
+    }
+    
+    switch (mbuf_get_service_class(packet))
+    {
+        case MBUF_SC_VI:
+        case MBUF_SC_VO:
+        case MBUF_SC_CTL:
+        case MBUF_SC_OAM:
+        case MBUF_SC_SIG:
+            return true;
+        default:
+            return false;
+    }
+    
+}/* end txPriority */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::drainBulkLane
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Send what we can from the bulk lane, called when output buffers come back.
+//				The write completions run on our workloop so this is serialized with
+//				outputPacket.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::drainBulkLane()
+{
+    mbuf_t	m;
+    mbuf_t	next;
+    IOReturn	ior;
+    
+    while (fBulkHead)
+    {
+        m = fBulkHead;
+        next = mbuf_nextpkt(m);
+        mbuf_setnextpkt(m, NULL);
+        
+        ior = USBTransmitPacket(m, false);
+        if (ior == kIOReturnOutputStall)
+        {
+            mbuf_setnextpkt(m, next);			// Still no room, leave it at the front
+            break;
+        }
+        if (ior != kIOReturnSuccess)
+        {
+            freePacket(m);
+        }
+        
+        fBulkHead = next;
+        if (!fBulkHead)
+        {
+            fBulkTail = NULL;
+        }
+        fBulkCount--;
+    }
+    
+    XTRACE(this, 0, fBulkCount, "drainBulkLane - Packets still held");
+    
+}/* end drainBulkLane */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::flushBulkLane
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Drop anything held in the bulk lane (going to sleep or stopping)
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::flushBulkLane()
+{
+    mbuf_t	m;
+    
+    while (fBulkHead)
+    {
+        m = fBulkHead;
+        fBulkHead = mbuf_nextpkt(m);
+        mbuf_setnextpkt(m, NULL);
+        freePacket(m);
+        fTxCounters.errLinkDown++;
+    }
+    fBulkTail = NULL;
+    fBulkCount = 0;
+    
+}/* end flushBulkLane */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::zlpPad
+//
+//		Inputs:		buffer - output buffer
+//				len - frame length
+//
+//		Outputs:	Length to write
+//
+//		Desc:		A transfer that's a multiple of the packet size would need a zero length
+//				packet to end it, which holds the buffer for another round trip. ECM lets
+//				us add a byte instead, the device drops it with the rest of the padding.
+//
+/****************************************************************************************************/
+
+UInt32 AppleUSBCDCECMData::zlpPad(UInt8 *buffer, UInt32 len)
+{
+    
+    if (fZLPPad && ((len % fOutPacketSize) == 0) && (len < fControlDriver->fMax_Block_Size))
+    {
+        buffer[len] = 0;
+        fTxCounters.zlpAvoided++;
+        return len + 1;
+    }
+    
+    return len;
+    
+}/* end zlpPad */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::USBTransmitTSO
+//
+//		Inputs:		packet - the large send
+//				request - MBUF_TSO_IPV4 or MBUF_TSO_IPV6
+//				mss - segment size
+//
+//		Outputs:	Return code - kIOReturnSuccess (transmit started), everything else (it didn't)
+//
+//		Desc:		Split a large TCP send into frames that fit the device. All the output
+//				buffers needed are reserved first so a shortage stalls the queue with the
+//				packet intact rather than sending part of it. Each segment is built straight
+//				into its own buffer, the packet is freed once they're all queued. If a write
+//				fails the rest aren't sent and the send is reported as dropped (the caller
+//				frees it), TCP sees the loss rather than a hole it wasn't told about.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCECMData::USBTransmitTSO(mbuf_t packet, UInt32 request, UInt32 mss)
+{
+    tsoInfo		*tso = &fTSOInfo;
+    UInt32		*bufs = fTSOBufs;
+    UInt32		seg;
+    UInt32		frameLen;
+    UInt32		len;
+    IOReturn	ior = kIOReturnSuccess;
+	
+    XTRACE(this, request, mss, "USBTransmitTSO");
+    
+    if (!cdc_TSOParse(packet, mss, (request & MBUF_TSO_IPV6) != 0, tso))
+    {
+        XTRACE(this, 0, 0, "USBTransmitTSO - Not a TCP packet we can segment");
+        fTxCounters.errFormat++;
         return kIOReturnOutputDropped;
     }
     
-    if (!getOutputBuffer(&indx))
+    if ((tso->hdrLen + tso->mss > fControlDriver->fMax_Block_Size) || (tso->segments > fTSOMaxSegs))
+    {
+        XTRACE(this, tso->hdrLen + tso->mss, tso->segments, "USBTransmitTSO - Segment too big or too many segments");
+        fTxCounters.errTooBig++;
+        return kIOReturnOutputDropped;
+    }
+    
+    if (fPacing && fPaceLimit && (fTxInFlight > 0) && ((UInt32)fTxInFlight + (tso->hdrLen * tso->segments) + tso->payloadLen > fPaceLimit))
+    {
+        XTRACE(this, fTxInFlight, fPaceLimit, "USBTransmitTSO - Paced");
+        return kIOReturnOutputStall;
+    }
+    
+        // Reserve the buffers up front
+    
+    for (seg=0; seg<tso->segments; seg++)
+    {
+        if (!getOutputBuffer(&bufs[seg], false))
+        {
+            XTRACE(this, seg, tso->segments, "USBTransmitTSO - Output buffers unavailable");
+            while (seg > 0)
+            {
+                seg--;
+                fPipeOutBuff[bufs[seg]].avail = true;
+            }
+            return kIOReturnOutputStall;
+        }
+    }
+    
+    for (seg=0; seg<tso->segments; seg++)
     {
-        ALERT(fOutBufPool, fOutPoolIndex, "USBTransmitPacket - Output buffer unavailable");
-        return kIOReturnOutputStall;
-    }
-    
-        // Start filling in the send buffer
-
-    m = packet;							// start with the first mbuf of the packet
-    rTotal = 0;							// running total				
-    do
-    {  
-        if (mbuf_len(m) == 0)			// Ignore zero length buffers
-			continue;
+        pipeOutBuffers	*pipeOutBuff = &fPipeOutBuff[bufs[seg]];
         
-        bcopy(mbuf_data(m), &fPipeOutBuff[indx].pipeOutBuffer[rTotal], mbuf_len(m));
-        rTotal += mbuf_len(m);
+        frameLen = cdc_TSOSegment(packet, tso, seg, pipeOutBuff->pipeOutBuffer);
+        LogData(kDataOut, frameLen, pipeOutBuff->pipeOutBuffer);
+        len = zlpPad(pipeOutBuff->pipeOutBuffer, frameLen);
         
-    } while ((m = mbuf_next(m)) != 0);
-	
-    LogData(kDataOut, rTotal, fPipeOutBuff[indx].pipeOutBuffer);
-	
-    fPipeOutBuff[indx].m = packet;
-	fPipeOutBuff[indx].writeCompletionInfo.parameter = (void *)&fPipeOutBuff[indx];
-
-	ior = fOutPipe->Write(fPipeOutBuff[indx].pipeOutMDP, 2000, 5000, rTotal, &fPipeOutBuff[indx].writeCompletionInfo);
-    if (ior != kIOReturnSuccess)
-    {
-        XTRACE(this, 0, ior, "USBTransmitPacket - Write failed");
-        if (ior == kIOUSBPipeStalled)
+        pipeOutBuff->m = NULL;
+        pipeOutBuff->length = len;
+        pipeOutBuff->writeCompletionInfo.parameter = (void *)(uintptr_t)bufs[seg];
+        pipeOutBuff->submitTime = mach_absolute_time();
+        OSAddAtomic((SInt32)len, &fTxInFlight);
+        OSIncrementAtomic(&fTxOutstanding);
+        
+        ior = cdc_PipeWrite(fOutPipe, pipeOutBuff->pipeOutMDP, len, kPipeNoDataTimeout, kPipeCompletionTimeout, &pipeOutBuff->writeCompletionInfo);
+        if (ior != kIOReturnSuccess)
         {
-//            fOutPipe->Reset();
-            clearPipeStall(fOutPipe);
-			ior = fOutPipe->Write(fPipeOutBuff[indx].pipeOutMDP, 2000, 5000, rTotal, &fPipeOutBuff[indx].writeCompletionInfo);
-            if (ior != kIOReturnSuccess)
+            XTRACE(this, seg, ior, "USBTransmitTSO - Write failed");
+            OSAddAtomic(-(SInt32)len, &fTxInFlight);
+            OSDecrementAtomic(&fTxOutstanding);
+            pipeOutBuff->length = 0;
+            
+                // This one and the rest go back unsent
+            
+            fTxCounters.errPipe += tso->segments - seg;
+            while (seg < tso->segments)
             {
-                XTRACE(this, 0, ior, "USBTransmitPacket - Write really failed");
-                if (fControlDriver->fOutputErrsOK)
-                    fpNetStats->outputErrors++;
-
-				fPipeOutBuff[indx].avail = true;
-                return ior;
+                fPipeOutBuff[bufs[seg]].avail = true;
+                seg++;
             }
-        } else {
-			if (fControlDriver->fOutputErrsOK)
-				fpNetStats->outputErrors++;
-			
-			fPipeOutBuff[indx].avail = true;
-			return ior;
-		}
+            return kIOReturnOutputDropped;
+        }
+        
+        fTxCounters.packets++;
+        fTxCounters.bytes += frameLen;
+        fTxCounters.offload++;
     }
     
-    if (fControlDriver->fOutputPktsOK)		
-        fpNetStats->outputPackets++;
+    freePacket(packet);					// Everything has been copied
     
-    return ior;
+    return kIOReturnSuccess;
 
-}/* end USBTransmitPacket */
+}/* end USBTransmitTSO */
 
 /****************************************************************************************************/
 //
@@ -2362,24 +3573,44 @@ IOReturn AppleUSBCDCECMData::clearPipeStall(IOUSBPipe *thePipe)
     
     XTRACEP(this, 0, thePipe, "clearPipeStall");
     
-//    rtn = thePipe->GetPipeStatus();
-//    if (rtn == kIOUSBPipeStalled)
-//    {
-        rtn = thePipe->ClearPipeStall(true);
-        if (rtn == kIOReturnSuccess)
-        {
-            XTRACE(this, 0, 0, "clearPipeStall - Successful");
-        } else {
-            XTRACE(this, 0, rtn, "clearPipeStall - Failed");
-        }
-//    } else {
-//        XTRACE(this, 0, 0, "clearPipeStall - Pipe not stalled");
- //   }
+    rtn = cdc_CheckPipe(thePipe, true);
+    if (rtn == kIOReturnSuccess)
+    {
+        XTRACE(this, 0, 0, "clearPipeStall - Successful");
+    } else {
+        XTRACE(this, 0, rtn, "clearPipeStall - Failed");
+    }
     
     return rtn;
 
 }/* end clearPipeStall */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::ingressAccept
+//
+//		Inputs:		frame - the received frame (at least an address long)
+//
+//		Outputs:	true (pass it up), false (drop it)
+//
+//		Desc:		Software receive filter (cdc_IngressAccept), multicast goes through the
+//				control driver's set.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCECMData::ingressAccept(const UInt8 *frame)
+{
+    UInt16	filter = fControlDriver->fPacketFilter;
+    
+    if (fPromiscuous)
+    {
+        filter |= kIngressPromiscuous;				// Asked for before the device was ready
+    }
+    
+    return cdc_IngressAccept(frame, fOurAddrHi, fOurAddrLo, filter, &fControlDriver->fMcFilter);
+    
+}/* end ingressAccept */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCECMData::receivePacket
@@ -2410,11 +3641,31 @@ void AppleUSBCDCECMData::receivePacket(UInt8 *packet, UInt32 size)
     if (size > fControlDriver->fMax_Block_Size)
     {
         XTRACE(this, 0, 0, "receivePacket - Packet size error, packet dropped");
-        if (fControlDriver->fInputErrsOK)
-            fpNetStats->inputErrors++;
+        fRxCounters.errTooBig++;
         return;
     }
     
+        // Drop what the stack didn't ask for before we spend an mbuf on it
+    
+    if ((fSoftFilter || fControlDriver->fMcSoftFilter) && (size >= kIOEthernetAddressSize))
+    {
+        if (!ingressAccept(packet))
+        {
+            XTRACE(this, 0, size, "receivePacket - Not for us, packet dropped");
+            fRxCounters.filtered++;
+            return;
+        }
+    }
+    
+    if (fLRO)
+    {
+        if (lroInput(packet, size))
+        {
+            return;
+        }
+        lroFlush();					// Keep the flow in order
+    }
+    
     m = allocatePacket(size);
     if (m)
     {
@@ -2422,24 +3673,128 @@ void AppleUSBCDCECMData::receivePacket(UInt8 *packet, UInt32 size)
         if (err)
         {
             XTRACE(this, 0, err, "receivePacket - Buffer copy failed, packet dropped");
-            if (fControlDriver->fInputErrsOK)
-                fpNetStats->inputErrors++;
+            fRxCounters.errFormat++;
             freePacket(m);
             return;
         }
 //        bcopy(packet, mbuf_data(m), size);
         submit = fNetworkInterface->inputPacket(m, size);
         XTRACE(this, 0, submit, "receivePacket - Packets submitted");
-        if (fControlDriver->fInputPktsOK)
-            fpNetStats->inputPackets++;
+        fRxCounters.packets++;
+        fRxCounters.bytes += size;
     } else {
         XTRACE(this, 0, 0, "receivePacket - Buffer allocation failed, packet dropped");
-        if (fControlDriver->fInputErrsOK)
-            fpNetStats->inputErrors++;
+        fRxCounters.errNoBuffer++;
     }
 
 }/* end receivePacket */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::lroInput
+//
+//		Inputs:		packet - the packet
+//				size - Number of bytes in the packet
+//
+//		Outputs:	true (taken), false (not a candidate, receivePacket should send it up)
+//
+//		Desc:		Merges in-order TCP segments of one flow. The packet being built goes up
+//				when the next segment doesn't follow it, on PSH, when it's full or when
+//				the batch timer fires.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCECMData::lroInput(UInt8 *packet, UInt32 size)
+{
+    lroSegment	seg;
+    mbuf_t		m;
+    
+    if (!cdc_LROParse(packet, size, &seg))
+    {
+        return false;
+    }
+    
+    if (fLROFlow.head)
+    {
+        if (cdc_LROMatch(&fLROFlow, packet, &seg) && cdc_LROAppend(&fLROFlow, packet, &seg))
+        {
+            XTRACE(this, fLROFlow.segs, seg.payloadLen, "lroInput - Segment merged");
+            fRxCounters.packets++;
+            fRxCounters.bytes += size;
+            fRxCounters.offload++;
+            if ((seg.flags & kTCPFlagPSH) || (fLROFlow.segs >= kLROMaxSegments))
+            {
+                lroFlush();
+            }
+            return true;
+        }
+        lroFlush();
+    }
+    
+    if (seg.flags & kTCPFlagPSH)			// Nothing to merge it with
+    {
+        return false;
+    }
+    
+    m = allocatePacket(size);
+    if (!m)
+    {
+        return false;
+    }
+    if ((mbuf_copyback(m, 0, size, packet, MBUF_DONTWAIT) != 0) || !cdc_LROStart(&fLROFlow, m, &seg))
+    {
+        freePacket(m);
+        return false;
+    }
+    
+    fRxCounters.packets++;
+    fRxCounters.bytes += size;
+    fLROTimer->setTimeoutUS(kLROFlushUS);
+    
+    return true;
+    
+}/* end lroInput */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::lroFlush
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Send the packet being merged (if any) up the stack
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::lroFlush()
+{
+    mbuf_t		m;
+    UInt32		len;
+    UInt32		submit;
+    
+    if (!fLROFlow.head)
+    {
+        return;
+    }
+    
+    if (fLROTimer)
+    {
+        fLROTimer->cancelTimeout();
+    }
+    
+    m = cdc_LROFinish(&fLROFlow, &len);
+    XTRACE(this, 0, len, "lroFlush");
+    if (fNetworkInterface)
+    {
+        submit = fNetworkInterface->inputPacket(m, len);
+        XTRACE(this, 0, submit, "lroFlush - Packets submitted");
+    } else {
+        freePacket(m);
+    }
+    
+}/* end lroFlush */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCECMData::linkStatusChange
@@ -2522,6 +3877,8 @@ void AppleUSBCDCECMData::linkSpeedChange(UInt32 upSpeed, UInt32 downSpeed)
 	fUpSpeed = upSpeed;
     fDownSpeed = downSpeed;
     
+    computeBufferTargets();
+    
 	//IOEthernetController does not handle asymmetric speeds. So pick the min speed as worst case scenario for traffic shaping. 
 	 speed = min(fDownSpeed,fUpSpeed);
     
@@ -2576,32 +3933,11 @@ void AppleUSBCDCECMData::setLinkStatusUp()
     
     XTRACE(this, speed, linkSpeed, "speed, linkSpeed mbps+++");
 
-    switch (linkSpeed) {
-         
-        case 0:
-            mediumType |= kIOMediumEthernetNone;
-            fLinkStatus = kLinkDown;
-            XTRACE(this, speed, linkSpeed, "setLinkStatusUp linkspeed is 0 +");
-            return;
-        
-        case 10:
-            mediumType |= kIOMediumEthernet10BaseT;
-            break;
-
-        case 100:
-            mediumType |= kIOMediumEthernet100BaseTX;
-            break;
-
-        case 1000:
-            mediumType |= kIOMediumEthernet1000BaseTX;
-            break;
-
-        default:
-            mediumType |= kIOMediumEthernet10BaseT;
-            XTRACE(this, speed, linkSpeed, "default linkspeed+");
-            linkSpeed = 10;                 //Force to 10 Mbps
-            speed = linkSpeed*1000000;      //Corresponding value in bits per second
-           break;
+    if (speed == 0)
+    {
+        fLinkStatus = kLinkDown;
+        XTRACE(this, speed, linkSpeed, "setLinkStatusUp linkspeed is 0 +");
+        return;
     }
     
     
@@ -2639,7 +3975,11 @@ void AppleUSBCDCECMData::setLinkStatusUp()
 #endif
     
     
-    medium = IONetworkMedium::getMediumWithType(fMediumDict, mediumType);
+    medium = linkMedium(speed);
+    if (medium)
+    {
+        mediumType = medium->getType();
+    }
     
     XTRACE(this, 0, mediumType, "setLinkStatusUp - LinkStatus set");
     
@@ -2709,6 +4049,86 @@ void AppleUSBCDCECMData::timerFired(OSObject *owner, IOTimerEventSource *sender)
     
 }/* end timerFired */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::mcRetry
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		A filter request failed (the control driver's completion), send the
+//				current set again after the coalescing delay.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::mcRetry()
+{
+    
+    XTRACE(this, 0, fMcPending, "mcRetry");
+    
+    if (fMcTimer && fReady)
+    {
+        fMcPending = true;
+        fMcTimer->setTimeoutMS(kMcCoalesceMS);
+    }
+    
+}/* end mcRetry */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::mcTimerFired
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Static member function called when the multicast coalescing timer fires.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::mcTimerFired(OSObject *owner, IOTimerEventSource *sender)
+{
+    AppleUSBCDCECMData	*target = OSDynamicCast(AppleUSBCDCECMData, owner);
+    
+    if (target)
+    {
+        target->fMcPending = false;
+        if (target->fControlDriver && target->fReady)
+        {
+            if (!target->fControlDriver->mcFilterFlush())
+            {
+                target->fMcPending = true;
+                sender->setTimeoutMS(kMcCoalesceMS);		// Device is busy, try again shortly
+            }
+        }
+    }
+    
+}/* end mcTimerFired */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::lroTimerFired
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Static member function called at the end of a receive batch.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::lroTimerFired(OSObject *owner, IOTimerEventSource *sender)
+{
+    AppleUSBCDCECMData	*target = OSDynamicCast(AppleUSBCDCECMData, owner);
+    
+    if (target)
+    {
+        target->lroFlush();
+    }
+    
+}/* end lroTimerFired */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCECMData::timeoutOccurred
@@ -2723,25 +4143,101 @@ void AppleUSBCDCECMData::timerFired(OSObject *owner, IOTimerEventSource *sender)
 
 void AppleUSBCDCECMData::timeoutOccurred(IOTimerEventSource * /*timer*/)
 {
-    bool		statsOK = false;
 
 //    XTRACE(this, 0, 0, "timeoutOccurred");
 
-    if (fControlDriver)
+    growBufferPools();
+
+    if (fControlDriver && fStatsOK)
     {
-        statsOK = fControlDriver->statsProcessing();
+        fStatsOK = fControlDriver->statsProcessing();
     }
 
-    if (statsOK)
-    {
-            
-            // Restart the watchdog timer
+        // Restart the watchdog timer (pool sizing still needs it even if there are no stats)
         
+    if (fReady)
+    {
         fTimerSource->setTimeoutMS(WATCHDOG_TIMER_MS);
     }
 
 }/* end timeoutOccurred */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::statsAccessed
+//
+//		Inputs:		target - me
+//				type - access type
+//
+//		Outputs:	kIOReturnSuccess
+//
+//		Desc:		Static member function called when the network statistics are accessed.
+//				Host counters are current, any device refresh completes later.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCECMData::statsAccessed(void *target, void *param, IONetworkData *data, UInt32 type, void *buffer, UInt32 *bufferSize, UInt32 offset)
+{
+    AppleUSBCDCECMData	*me = (AppleUSBCDCECMData *)target;
+    
+    if (me && ((type == kIONetworkDataAccessTypeRead) || (type == kIONetworkDataAccessTypeSerialize)))
+    {
+        me->updateStatistics();
+        if (me->fControlDriver && me->fStatsOK)
+        {
+            me->fControlDriver->statsRequested();
+        }
+    }
+    
+    return kIOReturnSuccess;
+    
+}/* end statsAccessed */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCECMData::updateStatistics
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Adds up the per context host counters and updates the interface statistics
+//				we're responsible for (the device owns the rest).
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCECMData::updateStatistics()
+{
+    hostTotals		totals;
+    
+    bzero(&totals, sizeof(totals));
+    hostCountersAdd(&totals.input, &fRxCounters);
+    hostCountersAdd(&totals.output, &fTxCounters);
+    hostCountersAdd(&totals.output, &fTxDoneCounters);
+    
+    fHostTotals = totals;
+    
+    if (!fControlDriver || !fpNetStats || !fpEtherStats)
+    {
+        return;
+    }
+    
+        // The interface statistics are 32 bits so they just wrap
+    
+    if (fControlDriver->fInputPktsOK)
+        fpNetStats->inputPackets = (UInt32)totals.input.packets;
+    if (fControlDriver->fInputErrsOK)
+        fpNetStats->inputErrors = (UInt32)hostErrors(&totals.input);
+    if (fControlDriver->fOutputPktsOK)
+        fpNetStats->outputPackets = (UInt32)totals.output.packets;
+    if (fControlDriver->fOutputErrsOK)
+        fpNetStats->outputErrors = (UInt32)hostErrors(&totals.output);
+        
+    fpEtherStats->dot3RxExtraEntry.resourceErrors = (UInt32)totals.input.errNoBuffer;
+    fpEtherStats->dot3TxExtraEntry.resourceErrors = (UInt32)totals.output.errNoBuffer;
+    
+}/* end updateStatistics */
+
 
 
 bool AppleUSBCDCECMData::willTerminate( IOService * provider, IOOptionBits options )
@@ -28,6 +28,8 @@
 #include "AppleUSBCDCCommon.h"
 #include "AppleUSBCDC.h"
 #include "AppleUSBCDCECMControl.h"
+#include "AppleUSBCDCOffload.h"
+#include "AppleUSBCDCPipe.h"
 
 #define TRANSMIT_QUEUE_SIZE     PAGE_SIZE
 #define WATCHDOG_TIMER_MS       1000
@@ -46,11 +48,57 @@
 #define kInBufPool		4
 #define kOutBufPool		8
 
-#define kMaxInBufPool		kInBufPool*16
+    // Pool ceilings by bus speed, the buffer records start at the configured
+    // sizes and are reallocated as the pools grow towards these
+
+#define kMaxInBufPoolFS		kInBufPool*4			// Low and full speed
+#define kMaxOutBufPoolFS	kOutBufPool*4
+#define kMaxInBufPool		kInBufPool*16			// High speed
 #define kMaxOutBufPool		kOutBufPool*16
+#define kMaxInBufPoolSS		kInBufPool*64			// SuperSpeed
+#define kMaxOutBufPoolSS	kOutBufPool*32
+
+#define kTSOMaxSegments		kOutBufPool*16			// Most segments in one large send
+#define kTSOMaxSend		65535				// Largest send the stack hands us
+#define kTSOMinMSS		536				// Smallest MSS it'll segment it with
 
 #define	inputTag		"InputBuffers"
 #define	outputTag		"OutputBuffers"
+#define	softFilterTag		"SoftwareFilter"
+#define	zlpPadTag		"PadZeroLengthPackets"
+#define	keepPoolsTag		"KeepBuffersAcrossSleep"
+#define	pacingTag		"TransmitPacing"
+#define	lanesTag		"PriorityLanes"
+
+    // Measured resume times (microseconds)
+
+#define	resumeSetupKey		"ResumeSetupTime"		// Spent in wakeUp
+#define	resumeTrafficKey	"ResumeToTrafficTime"		// Until the first completed transfer
+
+    // Bandwidth-delay pool sizing (latencies in microseconds)
+
+#define kBDPLatencyFullSpeed	1000			// One frame
+#define kBDPLatencyHighSpeed	250				// Two microframes
+#define kBDPLatencySuperSpeed	125				// One microframe
+#define kBDPHeadroom			2				// Cover completion and re-arm turnaround
+
+    // Transmit pacing, queue no more than the uplink drains in this time (microseconds)
+
+#define kPaceTargetUS			2000
+
+    // Transmit lanes, short or latency sensitive packets have buffers kept back for them
+
+#define kTxPriorityReserve		2				// Output buffers bulk can't use
+#define kTxPriorityMaxLen		128				// Anything this short is priority (TCP ACKs, DNS)
+#define kTxBulkLaneMax			32				// Bulk packets held while waiting for a buffer
+
+    // Write completions are handled in batches of up to this many buffers
+
+#define kTxDoneBatchMax			8
+
+    // Receive coalescing, a merged packet is held no longer than this (microseconds)
+
+#define kLROFlushUS			250
 
 typedef struct 
 {
@@ -60,6 +108,8 @@ typedef struct
     bool			avail;
     IOUSBCompletion		writeCompletionInfo;
 	UInt32			indx;
+	UInt32			length;				// Bytes written (zero for a zero length packet)
+	UInt64			submitTime;			// mach_absolute_time of the Write
 } pipeOutBuffers;
 
 typedef struct 
@@ -99,15 +149,56 @@ private:
     IOUSBPipe			*fInPipe;
     IOUSBPipe			*fOutPipe;
     
-    pipeInBuffers		fPipeInBuff[kMaxInBufPool];
-    pipeOutBuffers		fPipeOutBuff[kMaxOutBufPool];
+    pipeInBuffers		*fPipeInBuff;			// fInBufAlloc records
+    pipeOutBuffers		*fPipeOutBuff;			// fOutBufAlloc records
+    UInt16			fInBufAlloc;			// Records allocated (moved when they grow)
+    UInt16			fOutBufAlloc;
+    UInt16			fInBufMax;			// Ceiling for the pools on this bus
+    UInt16			fOutBufMax;
     UInt16			fOutPoolIndex;
     
     UInt8			fCommInterfaceNumber;
     UInt32			fCount;
     UInt32			fOutPacketSize;
+    UInt32			fInPacketSize;
+    
+    UInt16			fInBufPoolMin;			// Configured pool sizes (floor for the targets)
+    UInt16			fOutBufPoolMin;
+    UInt16			fInBufTarget;			// Pool sizes wanted for the current link speed
+    UInt16			fOutBufTarget;
+    UInt32			fWriteLatency;			// Smoothed write completion latency (microseconds)
+    bool			fPacing;			// Hold transmits to what the uplink can drain
+    UInt32			fPaceLimit;			// Bytes allowed in flight (zero is no limit)
+    volatile SInt32		fTxInFlight;			// Bytes written and not yet completed
+    bool			fLanes;				// Separate priority and bulk transmit lanes
+    mbuf_t			fBulkHead;			// Bulk lane (linked by nextpkt)
+    mbuf_t			fBulkTail;
+    UInt32			fBulkCount;
+    volatile SInt32		fTxOutstanding;			// Output buffers with a write outstanding
+    UInt16			*fTxDone;			// Completed (indices), waiting for the end of the batch (fOutBufAlloc)
+    UInt32			fTxDoneCount;
+    UInt32			fTxDoneBatch;			// Batch size for the current pool
 	
 	bool			fDeferredClear;
+	bool			fStatsOK;			// Control driver has statistics to collect
+    IOTimerEventSource		*fMcTimer;			// Coalesces multicast list updates
+    bool			fMcPending;			// fMcTimer is armed
+    bool			fSoftFilterForced;		// Device passes everything, filter it ourselves
+    bool			fSoftFilter;			// Ingress filter is on
+    bool			fPromiscuous;			// The stack wants everything
+    UInt32			fOurAddrHi;			// Our address, as loaded by ingressAccept
+    UInt16			fOurAddrLo;
+    bool			fZLPPad;			// Pad a byte rather than follow with a zero length packet
+    bool			fKeepPools;			// Keep the buffer pools allocated while asleep
+    UInt64			fWakeStart;			// mach_absolute_time wakeUp was called
+    volatile UInt32		fWakePending;			// Waiting for the first transfer after wakeUp
+    bool			fTSO;				// Segment large sends ourselves
+    tsoInfo			fTSOInfo;			// Current large send (output queue context only)
+    UInt32			fTSOBufs[kTSOMaxSegments];	// Output buffers reserved for it
+    UInt32			fTSOMaxSegs;			// Most segments a send can reserve (bulk can't have the priority reserve)
+    bool			fLRO;				// Merge received TCP segments
+    lroFlow			fLROFlow;			// Packet being merged (read completion context)
+    IOTimerEventSource		*fLROTimer;			// Ends a receive batch
 
     static void			dataReadComplete(void *obj, void *param, IOReturn ior, UInt32 remaining);
     static void			dataWriteComplete(void *obj, void *param, IOReturn ior, UInt32 remaining);
@@ -118,17 +209,38 @@ private:
     bool			wakeUp(void);
     void			putToSleep(void);
     bool			createMediumTables(void);
+    IONetworkMedium		*linkMedium(UInt64 speed);
+    bool			allocatePools(void);
+    bool			growPools(UInt16 inCount, UInt16 outCount);
+    void			freePools(void);
     bool 			allocateResources(void);
     void			releaseResources(void);
+    void			idleResources(void);
+    void			resumeTraffic(void);
     bool			createNetworkInterface(void);
     UInt32			outputPacket(mbuf_t pkt, void *param);
-	bool			getOutputBuffer(UInt32 *bufIndx);
-    IOReturn		USBTransmitPacket(mbuf_t packet);
+	bool			getOutputBuffer(UInt32 *bufIndx, bool priority = true);
+    bool			txPriority(mbuf_t packet);
+    void			drainBulkLane(void);
+    void			completeWrites(void);
+    void			flushBulkLane(void);
+    void			computeBufferTargets(void);
+    void			growBufferPools(void);
+    IOReturn		USBTransmitPacket(mbuf_t packet, bool priority = true);
+    IOReturn		USBTransmitTSO(mbuf_t packet, UInt32 request, UInt32 mss);
+    UInt32			zlpPad(UInt8 *buffer, UInt32 len);
     IOReturn		clearPipeStall(IOUSBPipe *thePipe);
+    bool			ingressAccept(const UInt8 *frame);
     void			receivePacket(UInt8 *packet, UInt32 size);
+    bool			lroInput(UInt8 *packet, UInt32 size);
+    void			lroFlush(void);
     void            setLinkStatusUp(void);
     void            setLinkStatusDown(void);
+    void			updateStatistics(void);
     static void 	timerFired(OSObject *owner, IOTimerEventSource *sender);
+    static void 	mcTimerFired(OSObject *owner, IOTimerEventSource *sender);
+    static void 	lroTimerFired(OSObject *owner, IOTimerEventSource *sender);
+    static IOReturn	statsAccessed(void *target, void *param, IONetworkData *data, UInt32 type, void *buffer, UInt32 *bufferSize, UInt32 offset);
     void			timeoutOccurred(IOTimerEventSource *timer);
 
 public:
@@ -160,11 +272,16 @@ public:
     
     IONetworkStats		*fpNetStats;
     IOEthernetStats		*fpEtherStats;
+    hostCounters		fTxCounters;			// Transmit (output queue) context
+    hostCounters		fTxDoneCounters;		// Write completion context
+    hostCounters		fRxCounters;			// Read completion context
+    hostTotals			fHostTotals;			// Added up when the statistics are read
 	
 		// CDC Driver instance Methods
 	
 	virtual void		linkStatusChange(UInt8 linkState);
 	virtual void		linkSpeedChange(UInt32 upSpeed, UInt32 downSpeed);
+    void			mcRetry(void);
 
         // IOKit methods
         
@@ -185,6 +302,7 @@ public:
     virtual IOReturn		selectMedium(const IONetworkMedium *medium);
     virtual IOReturn		getHardwareAddress(IOEthernetAddress *addr);
 	virtual IOReturn		getMaxPacketSize(UInt32 *maxSize) const;
+    virtual UInt32		getFeatures(void) const;
     virtual IOReturn		setMulticastMode(IOEnetMulticastMode mode);
     virtual IOReturn		setMulticastList(IOEthernetAddress *addrs, UInt32 count);
     virtual IOReturn		setPromiscuousMode(IOEnetPromiscuousMode mode);
@@ -332,11 +332,7 @@ void AppleUSBCDCEEM::dataReadComplete(void *obj, void *param, IOReturn rc, UInt3
     AppleUSBCDCEEM	*me = (AppleUSBCDCEEM*)obj;
     IOReturn		ior;
 	pipeInBuffers	*pipeBuf = (pipeInBuffers *)param;
-//    UInt32			poolIndx = (UInt32)param;
-	UInt16			EEMHeader;
-    UInt8			*EEMHeaderAddress = (UInt8 *) &EEMHeader;
-	SInt16			actualLen, dataLen, i = 0;
-	bool			done = false;
+	UInt32			dataLen;
     
     XTRACE(me, 0, pipeBuf->indx, "dataReadComplete");
 
@@ -345,35 +341,48 @@ void AppleUSBCDCEEM::dataReadComplete(void *obj, void *param, IOReturn rc, UInt3
 		dataLen = me->fMax_Block_Size - remaining;
         XTRACE(me, 0, dataLen, "dataReadComplete - data length");
 		
-		while (!done)
+			// A full transfer while we're cutting back means there's more, hint or no hint
+		
+		if (me->fRxQuiet && (dataLen == me->fMax_Block_Size))
 		{
-			EEMHeaderAddress[0] = pipeBuf->pipeInBuffer[i];
-			EEMHeaderAddress[1] = pipeBuf->pipeInBuffer[i+1];
+			me->rxUnpark();
+		}
 		
-			if (EEMHeader & bmTypeCommand)
-			{
+			// Split it into EEM packets and send them on their way
 		
-					// Look at the command
-				
-				me->processEEMCommand(EEMHeader, pipeBuf->indx, i+2, &actualLen);
-			} else {
-				actualLen = EEMHeader & frameLenMask;
-				meLogData(kDataIn, actualLen+2, &pipeBuf->pipeInBuffer[i]);
-				
-					// Move the incoming bytes up the stack
-
-				me->receivePacket(&pipeBuf->pipeInBuffer[i+2], actualLen);
-			}
-			i += actualLen;
-			if (i >= dataLen)
-			{
-				done = true;
-			}
+		cdc_RxLoanSplit(&pipeBuf->loan);
+		me->fRxCurrent = pipeBuf;
+		me->rxDeframe(pipeBuf->pipeInBuffer, dataLen);
+		me->fRxCurrent = NULL;
+		
+			// End of the batch
+		
+		me->lroFlush();
+		
+			// If frames went up in place the read is queued again when the last one is freed
+		
+		switch (cdc_RxLoanSplitDone(&pipeBuf->loan))
+		{
+			case kRxLoanRecycle:
+				me->rxRecycle(pipeBuf);
+				return;
+			case kRxLoanOut:
+				return;
+			default:
+				break;
 		}
     } else {
         XTRACE(me, 0, rc, "dataReadComplete - Read completion io err");
+        
+            // The stream has a hole in it, anything partly reassembled is lost
+        
+        if (cdc_EEMDeframeReset(&me->fRxHold))
+        {
+            me->fRxCounters.errFormat++;
+        }
         if (rc != kIOReturnAborted)
         {
+            me->fRxCounters.errPipe++;
             rc = me->clearPipeStall(me->fInPipe);
             if (rc != kIOReturnSuccess)
             {
@@ -382,8 +391,12 @@ void AppleUSBCDCEEM::dataReadComplete(void *obj, void *param, IOReturn rc, UInt3
         }
     }
     
-        // Queue the next read, only if not aborted
+        // Queue the next read, only if not aborted (and the device hasn't said it's quiet)
 	
+    if ((rc == kIOReturnSuccess) && me->rxPark(pipeBuf))
+    {
+        return;
+    }
     if (rc != kIOReturnAborted)
     {
         ior = me->fInPipe->Read(pipeBuf->pipeInMDP, &pipeBuf->readCompletionInfo, NULL);
@@ -419,71 +432,29 @@ void AppleUSBCDCEEM::dataReadComplete(void *obj, void *param, IOReturn rc, UInt3
 void AppleUSBCDCEEM::dataWriteComplete(void *obj, void *param, IOReturn rc, UInt32 remaining)
 {
     AppleUSBCDCEEM	*me = (AppleUSBCDCEEM *)obj;
-    mbuf_t			m;
-    UInt32			pktLen = 0;
-    UInt32			numbufs = 0;
+    UInt32			pktLen;
 	pipeOutBuffers	*pipeBuf = (pipeOutBuffers *)param;
 //    UInt32		poolIndx = (UInt32)param;
 	
 	XTRACE(me, rc, pipeBuf->indx, "dataWriteComplete");
-
-    if (me->fBufferPoolLock)
-    {
-        IOLockLock(me->fBufferPoolLock);
-    }
     
     if (rc == kIOReturnSuccess)						// If operation returned ok
     {
-        if (pipeBuf->m != NULL)						// Null means zero length write or command
+        pktLen = (UInt32)pipeBuf->pipeOutMDP->getLength();	// What was written (zero for a zero length write)
+        if (cdc_NeedZLP(pktLen, me->fOutPacketSize))		// If it was a multiple of max packet size then we need to do a zero length write
         {
-            m = pipeBuf->m;
-            while (m)
-			{
-				pktLen += mbuf_len(m);
-				numbufs++;
-				m = mbuf_next(m);
-			}            
-            me->freePacket(pipeBuf->m);				// Free the mbuf
-            pipeBuf->m = NULL;
-        
-            if ((pktLen % me->fOutPacketSize) == 0)			// If it was a multiple of max packet size then we need to do a zero length write
-            {
-                XTRACE(me, rc, pktLen, "dataWriteComplete - writing zero length packet");
-                pipeBuf->pipeOutMDP->setLength(0);
-                pipeBuf->writeCompletionInfo.parameter = (void *)pipeBuf;
-                me->fOutPipe->Write(pipeBuf->pipeOutMDP, &pipeBuf->writeCompletionInfo);
-            } else {
-                pipeBuf->avail = true;
-                if (me->fTxStalled)
-                {
-                    me->fTxStalled = false;
-                    me->fTransmitQueue->service(IOBasicOutputQueue::kServiceAsync);
-                }
-            }
-        } else {
-            pipeBuf->avail = true;					// Make the buffer available again
-            if (me->fTxStalled)
-            {
-                me->fTxStalled = false;
-                me->fTransmitQueue->service(IOBasicOutputQueue::kServiceAsync);
-            }
+            XTRACE(me, rc, pktLen, "dataWriteComplete - writing zero length packet");
+            pipeBuf->pipeOutMDP->setLength(0);
+            pipeBuf->writeCompletionInfo.parameter = (void *)pipeBuf;
+            me->fOutPipe->Write(pipeBuf->pipeOutMDP, &pipeBuf->writeCompletionInfo);
+            return;							// Buffer's done when that completes
         }
     } else {
         XTRACE(me, rc, pipeBuf->indx, "dataWriteComplete - IO err");
 
-        if (pipeBuf->m != NULL)
-        {
-            me->freePacket(pipeBuf->m);				// Free the mbuf anyway
-            pipeBuf->m = NULL;
-            pipeBuf->avail = true;
-            if (me->fTxStalled)
-            {
-                me->fTxStalled = false;
-                me->fTransmitQueue->service(IOBasicOutputQueue::kServiceAsync);
-            }
-        }
         if (rc != kIOReturnAborted)
         {
+            me->fTxDoneCounters.errPipe++;
             rc = me->clearPipeStall(me->fOutPipe);
             if (rc != kIOReturnSuccess)
             {
@@ -492,15 +463,55 @@ void AppleUSBCDCEEM::dataWriteComplete(void *obj, void *param, IOReturn rc, UInt
         }
     }
     
-    if (me->fBufferPoolLock)
+        // The buffer's finished with, it goes back to the pool with the rest of the batch
+    
+    me->fTxDone[me->fTxDoneCount++] = pipeBuf;
+    if ((OSDecrementAtomic(&me->fTxOutstanding) <= 1) || (me->fTxDoneCount >= me->fTxDoneBatch))
     {
-        IOLockUnlock(me->fBufferPoolLock);
+        me->completeWrites();
     }
         
     return;
 	
 }/* end dataWriteComplete */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::completeWrites
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		End of a write completion batch. The buffers go back to the pool together,
+//				then the output queue gets one restart. A batch ends when enough buffers
+//				have completed or when nothing else is outstanding. The frames were copied
+//				and freed on the transmit side, there are no mbufs to free here.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::completeWrites()
+{
+    UInt32	i;
+    UInt32	count = fTxDoneCount;
+    
+    XTRACE(this, count, fTxOutstanding, "completeWrites");
+    
+    for (i=0; i<count; i++)
+    {
+        fTxDone[i]->avail = true;
+    }
+    fTxDoneCount = 0;
+    OSMemoryBarrier();					// Buffers are back before fTxStalled is looked at
+    
+    if ((count != 0) && fTxStalled)
+    {
+        fTxStalled = false;
+        fTransmitQueue->service(IOBasicOutputQueue::kServiceAsync);
+    }
+    
+}/* end completeWrites */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCEEM::probe
@@ -547,7 +558,6 @@ IOService* AppleUSBCDCEEM::probe( IOService *provider, SInt32 *score )
 
 bool AppleUSBCDCEEM::init(OSDictionary *properties)
 {
-    UInt32	i;
 
     XTRACE(this, 0, 0, "init");
     
@@ -557,29 +567,48 @@ bool AppleUSBCDCEEM::init(OSDictionary *properties)
         return false;
     }
     
-    for (i=0; i<kMaxOutBufPool; i++)
-    {
-        fPipeOutBuff[i].pipeOutMDP = NULL;
-        fPipeOutBuff[i].pipeOutBuffer = NULL;
-        fPipeOutBuff[i].m = NULL;
-        fPipeOutBuff[i].avail = false;
-        fPipeOutBuff[i].writeCompletionInfo.target = NULL;
-        fPipeOutBuff[i].writeCompletionInfo.action = NULL;
-        fPipeOutBuff[i].writeCompletionInfo.parameter = NULL;
-		fPipeOutBuff[i].indx = i;
-    }
+    fPipeInBuff = NULL;				// Allocated in start once the pool sizes are known
+    fPipeOutBuff = NULL;
+    fTxDone = NULL;
+    fRxHold.buffer = NULL;
+    cdc_EEMDeframeReset(&fRxHold);
+    fRxCurrent = NULL;
+    fRxLoaned = 0;
+    fRxQuiet = false;
+    fRxParked = 0;
+    bzero(&fRxHints, sizeof(fRxHints));
+    fInBufPool = 0;
+    fOutBufPool = 0;
     fOutPoolIndex = 0;
-    
-    for (i=0; i<kMaxInBufPool; i++)
-    {
-        fPipeInBuff[i].pipeInMDP = NULL;
-        fPipeInBuff[i].pipeInBuffer = NULL;
-        fPipeInBuff[i].dead = false;
-        fPipeInBuff[i].readCompletionInfo.target = NULL;
-        fPipeInBuff[i].readCompletionInfo.action = NULL;
-        fPipeInBuff[i].readCompletionInfo.parameter = NULL;
-		fPipeInBuff[i].indx = i;
-    }
+    fTxOutstanding = 0;
+    fTxDoneCount = 0;
+    fTxDoneBatch = 1;
+    fTxAgg = true;
+    fTxCRC = false;
+    fTxAggLock = NULL;
+    fTxAggBuf = NULL;
+    bzero(&fTxAggFill, sizeof(fTxAggFill));
+    fTxAggTimer = NULL;
+    fTxQueueGated = false;
+    fTxQueueSize = TRANSMIT_QUEUE_SIZE;
+    fHaveAddress = false;
+    fEchoInterval = 0;
+    fEchoSeq = 0;
+    fEchoTimer = NULL;
+    bzero(&fEchoStats, sizeof(fEchoStats));
+    fMax_Block_Size = MAX_BLOCK_SIZE;
+    
+    bzero(&fTxCounters, sizeof(fTxCounters));
+    bzero(&fTxDoneCounters, sizeof(fTxDoneCounters));
+    bzero(&fCmdCounters, sizeof(fCmdCounters));
+    bzero(fCmdBuff, sizeof(fCmdBuff));
+    bzero(&fRxCounters, sizeof(fRxCounters));
+    bzero(&fHostTotals, sizeof(fHostTotals));
+    
+    fZLPPad = true;
+    fLRO = true;
+    fLROFlow.head = NULL;
+    fLROFlow.tail = NULL;
 
     return true;
 
@@ -605,7 +634,18 @@ bool AppleUSBCDCEEM::start(IOService *provider)
 
     XTRACE(this, 0, 0, "start");
 	
-	return false;				// Don't load for EEM hardware at this time
+        // Don't load for EEM hardware unless the personality (or a merge nub) asks for it
+    
+    OSBoolean *enable = OSDynamicCast(OSBoolean, provider->getProperty(enableTag));
+    if (!enable)
+    {
+        enable = OSDynamicCast(OSBoolean, getProperty(enableTag));
+    }
+    if (!enable || !enable->isTrue())
+    {
+        XTRACE(this, 0, 0, "start - EEM not enabled");
+        return false;
+    }
     
     if(!super::start(provider))
     {
@@ -623,6 +663,8 @@ bool AppleUSBCDCEEM::start(IOService *provider)
     }
     
     fDataInterfaceNumber = fDataInterface->GetInterfaceNumber();
+    fVendorID = fDataInterface->GetDevice()->GetVendorID();
+    fProductID = fDataInterface->GetDevice()->GetProductID();
     
     if (findCDCDriverEED(fDataInterface->GetDevice(), this, fDataInterfaceNumber) != kIOReturnSuccess)
     {
@@ -638,6 +680,13 @@ bool AppleUSBCDCEEM::start(IOService *provider)
         return false;
     }
     
+    fTxAggLock = IOLockAlloc();
+    if (!fTxAggLock)
+    {
+        ALERT(0, 0, "start - Transmit aggregation lock allocate failed");
+        return false;
+    }
+    
         // get workloop
         
     fWorkLoop = getWorkLoop();
@@ -702,7 +751,7 @@ bool AppleUSBCDCEEM::start(IOService *provider)
     {
 		bufValue = bufNumber->unsigned16BitValue();
 		XTRACE(this, 0, bufValue, "start - Number of output buffers override value");
-        if (bufValue <= kMaxInBufPool)
+        if (bufValue <= kMaxOutBufPool)
         {
             fOutBufPool = bufValue;
         } else {
@@ -735,6 +784,127 @@ bool AppleUSBCDCEEM::start(IOService *provider)
     
     XTRACE(this, fInBufPool, fOutBufPool, "start - Buffer pools (input, output)");
     
+        // Write completions are handled in batches of a quarter of the output pool
+    
+    fTxDoneBatch = fOutBufPool / 4;
+    if (fTxDoneBatch == 0)
+    {
+        fTxDoneBatch = 1;
+    } else {
+        if (fTxDoneBatch > kTxDoneBatchMax)
+        {
+            fTxDoneBatch = kTxDoneBatchMax;
+        }
+    }
+    
+    if (!allocatePools())
+    {
+        ALERT(0, 0, "start - allocatePools failed");
+        return false;
+    }
+    
+    OSBoolean *zlpPad = OSDynamicCast(OSBoolean, provider->getProperty(zlpPadTag));
+    if (!zlpPad)
+    {
+        zlpPad = OSDynamicCast(OSBoolean, getProperty(zlpPadTag));
+    }
+    if (zlpPad && zlpPad->isFalse())
+    {
+        XTRACE(this, 0, 0, "start - Zero length packet padding disabled");
+        fZLPPad = false;
+    }
+    
+    OSBoolean *lro = OSDynamicCast(OSBoolean, provider->getProperty(lroTag));
+    if (!lro)
+    {
+        lro = OSDynamicCast(OSBoolean, getProperty(lroTag));
+    }
+    if (lro && lro->isFalse())
+    {
+        XTRACE(this, 0, 0, "start - Receive coalescing disabled");
+        fLRO = false;
+    }
+    
+    OSBoolean *txCRC = OSDynamicCast(OSBoolean, provider->getProperty(txCRCTag));
+    if (!txCRC)
+    {
+        txCRC = OSDynamicCast(OSBoolean, getProperty(txCRCTag));
+    }
+    if (txCRC && txCRC->isTrue())
+    {
+        XTRACE(this, 0, 0, "start - Transmit CRC enabled");
+        fTxCRC = true;
+    }
+    
+        // Needed for received frames with a CRC whether or not we send them
+    
+    cdc_CRC32Init();
+    
+    OSBoolean *txAgg = OSDynamicCast(OSBoolean, provider->getProperty(txAggTag));
+    if (!txAgg)
+    {
+        txAgg = OSDynamicCast(OSBoolean, getProperty(txAggTag));
+    }
+    if (txAgg && txAgg->isFalse())
+    {
+        XTRACE(this, 0, 0, "start - Transmit aggregation disabled");
+        fTxAgg = false;
+    }
+    
+        // Partly filled transfers go when this fires, no timer means no aggregation
+    
+    if (fTxAgg)
+    {
+        fTxAggTimer = IOTimerEventSource::timerEventSource(this, txAggTimerFired);
+        if (fTxAggTimer)
+        {
+            if (fWorkLoop->addEventSource(fTxAggTimer) != kIOReturnSuccess)
+            {
+                XTRACE(this, 0, 0, "start - Add aggregation timer event source failed");
+                fTxAggTimer->release();
+                fTxAggTimer = NULL;
+            }
+        }
+        if (!fTxAggTimer)
+        {
+            fTxAgg = false;
+        }
+    }
+    
+        // Echo latency probes, the timer's there for setProperties even if they're off for now
+    
+    OSNumber *echoInterval = OSDynamicCast(OSNumber, provider->getProperty(echoIntervalTag));
+    if (!echoInterval)
+    {
+        echoInterval = OSDynamicCast(OSNumber, getProperty(echoIntervalTag));
+    }
+    if (echoInterval)
+    {
+        fEchoInterval = echoInterval->unsigned32BitValue();
+        if (fEchoInterval && (fEchoInterval < kEchoMinIntervalMS))
+        {
+            fEchoInterval = kEchoMinIntervalMS;
+        }
+        XTRACE(this, 0, fEchoInterval, "start - Echo probe interval");
+    }
+    
+    fEchoTimer = IOTimerEventSource::timerEventSource(this, echoTimerFired);
+    if (fEchoTimer)
+    {
+        if (fWorkLoop->addEventSource(fEchoTimer) != kIOReturnSuccess)
+        {
+            XTRACE(this, 0, 0, "start - Add echo timer event source failed");
+            fEchoTimer->release();
+            fEchoTimer = NULL;
+        }
+    }
+    
+    if (!makeHardwareAddress())
+    {
+        ALERT(0, 0, "start - makeHardwareAddress failed");
+        return false;
+    }
+    
     if (!createNetworkInterface())
     {
         ALERT(0, 0, "start - createNetworkInterface failed");
@@ -750,6 +920,11 @@ bool AppleUSBCDCEEM::start(IOService *provider)
         // Ready to service interface requests
     
     fNetworkInterface->registerService();
+    
+    if (fEchoTimer && fEchoInterval)
+    {
+        fEchoTimer->setTimeoutMS(fEchoInterval);
+    }
         
     XTRACE(this, 0, 0, "start - successful");
 	Log(DEBUG_NAME ": Version number - %s, Input buffers %d, Output buffers %d\n", VersionNumber, fInBufPool, fOutBufPool);
@@ -775,6 +950,28 @@ void AppleUSBCDCEEM::stop(IOService *provider)
     
     XTRACE(this, 0, 0, "stop");
     
+    if (fTxAggTimer)
+    {
+        fTxAggTimer->cancelTimeout();
+        if (fWorkLoop)
+        {
+            fWorkLoop->removeEventSource(fTxAggTimer);
+        }
+        fTxAggTimer->release();
+        fTxAggTimer = NULL;
+    }
+    
+    if (fEchoTimer)
+    {
+        fEchoTimer->cancelTimeout();
+        if (fWorkLoop)
+        {
+            fWorkLoop->removeEventSource(fEchoTimer);
+        }
+        fEchoTimer->release();
+        fEchoTimer = NULL;
+    }
+    
         // Release all resources
 		
     releaseResources();
@@ -798,10 +995,10 @@ void AppleUSBCDCEEM::stop(IOService *provider)
         fMediumDict = NULL;
     }
     
-    if (fBufferPoolLock)
+    if (fTxAggLock)
     {
-        IOLockFree(fBufferPoolLock);
-        fBufferPoolLock = NULL;
+        IOLockFree(fTxAggLock);
+        fTxAggLock = NULL;
     }
     
     if (fWorkLoop)
@@ -822,6 +1019,36 @@ void AppleUSBCDCEEM::stop(IOService *provider)
 	
 }/* end stop */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::free
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Frees the buffer records. Frames passed up in place hold a reference on
+//				the driver so these (and the pool lock) outlast the last of them.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::free()
+{
+    
+    XTRACE(this, 0, 0, "free");
+    
+    freePools();
+    
+    if (fBufferPoolLock)
+    {
+        IOLockFree(fBufferPoolLock);
+        fBufferPoolLock = NULL;
+    }
+    
+    super::free();
+    
+}/* end free */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCEEM::configureData
@@ -925,7 +1152,7 @@ bool AppleUSBCDCEEM::createNetworkInterface()
     
             // Allocate memory for transmit queue
 
-    fTransmitQueue = (IOGatedOutputQueue *)getOutputQueue();
+    fTransmitQueue = (IOBasicOutputQueue *)getOutputQueue();
     if (!fTransmitQueue) 
     {
         ALERT(0, 0, "createNetworkInterface - Output queue initialization failed");
@@ -1007,8 +1234,8 @@ IOReturn AppleUSBCDCEEM::enable(IONetworkInterface *netif)
     
         // Start our IOOutputQueue object.
 
-    fTransmitQueue->setCapacity(TRANSMIT_QUEUE_SIZE);
-    XTRACE(this, 0, TRANSMIT_QUEUE_SIZE, "enable - capicity set");
+    fTransmitQueue->setCapacity(fTxQueueSize);
+    XTRACE(this, 0, fTxQueueSize, "enable - capicity set");
     fTransmitQueue->start();
     XTRACE(this, 0, 0, "enable - transmit queue started");
     
@@ -1185,39 +1412,92 @@ IOReturn AppleUSBCDCEEM::selectMedium(const IONetworkMedium *medium)
 //		Outputs:	Return code - kIOReturnSuccess or kIOReturnError
 //				ea - the address
 //
-//		Desc:		Make up an ethernet address for now
-//					***** THIS IS TEMPORARY AND MUST BE CHANGED *****
+//		Desc:		EEM devices don't have one, return the one made up in start
 //
 /****************************************************************************************************/
 
 IOReturn AppleUSBCDCEEM::getHardwareAddress(IOEthernetAddress *ea)
+{
+
+    XTRACE(this, 0, fHaveAddress, "getHardwareAddress");
+	
+	if (!fHaveAddress)
+	{
+		return kIOReturnError;
+	}
+	
+	*ea = fEthernetAddress;
+
+    return kIOReturnSuccess;
+    
+}/* end getHardwareAddress */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::makeHardwareAddress
+//
+//		Inputs:		
+//
+//		Outputs:	Return code - true (fEthernetAddress is set), false (it isn't)
+//
+//		Desc:		Make up an ethernet address. A device with a serial number gets one from
+//				its vendor, product and serial number, so it's the same every time it's
+//				attached and on any port. One without falls back to the location.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCEEM::makeHardwareAddress()
 {
     UInt32      i;
 	OSNumber	*location;
     UInt32		locVal;
 	UInt8		*rlocVal;
+    UInt32		crc;
+    UInt32		len;
+    OSString	*serial;
+    char		key[addressKeyLength];		// "vendor:product:serial number"
 
-    XTRACE(this, 0, 0, "getHardwareAddress");
+    XTRACE(this, fVendorID, fProductID, "makeHardwareAddress");
+	
+	serial = OSDynamicCast(OSString, fDataInterface->GetDevice()->getProperty(kUSBSerialNumberString));
+	if (serial && (serial->getLength() != 0))
+	{
+		len = snprintf(key, sizeof(key), "%04x:%04x:%s", fVendorID, fProductID, serial->getCStringNoCopy());
+		if (len >= sizeof(key))
+		{
+			len = sizeof(key) - 1;
+		}
+		crc = cdc_CRC32(0, (UInt8 *)key, len);
+		fEthernetAddress.bytes[0] = 0x02;			// Locally administered, unicast
+		OSWriteBigInt32(fEthernetAddress.bytes, 1, crc);
+		fEthernetAddress.bytes[5] = (UInt8)cdc_CRC32(crc, (UInt8 *)key, len);
+		fHaveAddress = true;
+		return true;
+	}
+	
+	XTRACE(this, 0, 0, "makeHardwareAddress - No serial number");
 	
 	location = (OSNumber *)fDataInterface->GetDevice()->getProperty(kUSBDevicePropertyLocationID);
 	if (location)
 	{
 		locVal = location->unsigned32BitValue();
 		rlocVal = (UInt8*)&locVal;
-		ea->bytes[0] = 0x00;
-		ea->bytes[1] = 0x03;
+		fEthernetAddress.bytes[0] = 0x00;
+		fEthernetAddress.bytes[1] = 0x03;
 		for (i=0; i<4; i++)
 		{
-			ea->bytes[i+2] = rlocVal[i];
+			fEthernetAddress.bytes[i+2] = rlocVal[i];
 		}
 	} else {
-		XTRACE(this, 0, 0, "getHardwareAddress - Get location failed");
-		return kIOReturnError;
+		XTRACE(this, 0, 0, "makeHardwareAddress - Get location failed");
+		return false;
 	}
+	
+	fHaveAddress = true;
 
-    return kIOReturnSuccess;
+    return true;
     
-}/* end getHardwareAddress */
+}/* end makeHardwareAddress */
 
 /****************************************************************************************************/
 //
@@ -1355,16 +1635,69 @@ IOReturn AppleUSBCDCEEM::setPromiscuousMode(bool active)
 //
 //		Outputs:	Return code - the output queue
 //
-//		Desc:		Creates the output queue
+//		Desc:		Creates the output queue. The basic queue has outputPacket called on
+//				the sending thread, the gated one on the work loop, the type and the
+//				depth can be set per device.
 //
 /****************************************************************************************************/
 
 IOOutputQueue* AppleUSBCDCEEM::createOutputQueue()
 {
+    IOService	*provider = getProvider();
+    OSString	*queueType = NULL;
+    OSNumber	*queueSize = NULL;
 
     XTRACE(this, 0, 0, "createOutputQueue");
     
-    return IOBasicOutputQueue::withTarget(this, TRANSMIT_QUEUE_SIZE);
+    if (provider)
+    {
+        queueType = OSDynamicCast(OSString, provider->getProperty(txQueueTag));
+        queueSize = OSDynamicCast(OSNumber, provider->getProperty(txQueueSizeTag));
+    }
+    if (!queueType)
+    {
+        queueType = OSDynamicCast(OSString, getProperty(txQueueTag));
+    }
+    if (!queueSize)
+    {
+        queueSize = OSDynamicCast(OSNumber, getProperty(txQueueSizeTag));
+    }
+    
+    if (queueType && queueType->isEqualTo("Gated"))
+    {
+        fTxQueueGated = true;
+    }
+    if (queueSize)
+    {
+        fTxQueueSize = queueSize->unsigned32BitValue();
+        if (fTxQueueSize < kMinTxQueueSize)
+        {
+            fTxQueueSize = kMinTxQueueSize;
+        } else {
+            if (fTxQueueSize > kMaxTxQueueSize)
+            {
+                fTxQueueSize = kMaxTxQueueSize;
+            }
+        }
+    }
+    
+    XTRACE(this, fTxQueueGated, fTxQueueSize, "createOutputQueue - Queue type and size");
+    
+    if (fTxQueueGated)
+    {
+        if (!fWorkLoop)
+        {
+            fWorkLoop = getWorkLoop();
+        }
+        if (fWorkLoop)
+        {
+            return IOGatedOutputQueue::withTarget(this, fWorkLoop, fTxQueueSize);
+        }
+        XTRACE(this, 0, 0, "createOutputQueue - No work loop, using the basic queue");
+        fTxQueueGated = false;
+    }
+    
+    return IOBasicOutputQueue::withTarget(this, fTxQueueSize);
     
 }/* end createOutputQueue */
 
@@ -1391,15 +1724,16 @@ UInt32 AppleUSBCDCEEM::outputPacket(mbuf_t pkt, void *param)
     if (!fLinkStatus)
     {
         XTRACE(this, 0, fLinkStatus, "outputPacket - link is down");
-		fpNetStats->outputErrors++;
+		fTxCounters.errLinkDown++;
         freePacket(pkt);
         return kIOReturnOutputDropped;
     }
     
     ior = USBTransmitPacket(pkt);
-    if (ior != kIOReturnOutputStall)
+    if ((ior != kIOReturnSuccess) && (ior != kIOReturnOutputStall))	// Already copied and freed, or to be retried
     {
         freePacket(pkt);
+        ior = kIOReturnOutputDropped;
     }
     
     XTRACE(this, 0, ior, "outputPacket - Exit");
@@ -1440,6 +1774,10 @@ bool AppleUSBCDCEEM::configureInterface(IONetworkInterface *netif)
         ALERT(0, 0, "configureInterface - Invalid network statistics");
         return false;
     }
+    
+        // Bring the counters up to date when someone reads them
+    
+    nd->setNotificationTarget(this, statsAccessed, NULL);
 
         // Get the Ethernet statistics structure
 
@@ -1449,6 +1787,19 @@ bool AppleUSBCDCEEM::configureInterface(IONetworkInterface *netif)
         ALERT(0, 0, "configureInterface - Invalid ethernet statistics\n");
         return false;
     }
+    nd->setNotificationTarget(this, statsAccessed, NULL);
+    
+        // Publish the full 64 bit host counters as well
+    
+    nd = IONetworkData::withExternalBuffer(hostCountersTag, sizeof(hostTotals), &fHostTotals, kIONetworkDataBasicAccessTypes, this, statsAccessed, NULL);
+    if (nd)
+    {
+        if (!netif->addNetworkData(nd))
+        {
+            XTRACE(this, 0, 0, "configureInterface - Failed to add the host counters");
+        }
+        nd->release();
+    }
 
     return true;
     
@@ -1489,7 +1840,7 @@ bool AppleUSBCDCEEM::wakeUp()
     
     for (i=0; i<fInBufPool; i++)
     {
-        if (fPipeInBuff[i].pipeInMDP)
+        if (fPipeInBuff[i].pipeInMDP && !fPipeInBuff[i].loan.loaned)
         {
             fPipeInBuff[i].readCompletionInfo.parameter = (void *)&fPipeInBuff[i];
             rtn = fInPipe->Read(fPipeInBuff[i].pipeInMDP, &fPipeInBuff[i].readCompletionInfo, NULL);
@@ -1602,26 +1953,112 @@ bool AppleUSBCDCEEM::createMediumTables()
 
 /****************************************************************************************************/
 //
-//		Method:		AppleUSBCDCEEM::allocateResources
+//		Method:		AppleUSBCDCEEM::allocatePools
 //
 //		Inputs:		
 //
 //		Outputs:	return code - true (allocate was successful), false (it failed)
 //
-//		Desc:		Gets all the endpoints open and buffers allocated etc.
+//		Desc:		Allocate the buffer records (not the buffers) at the configured pool sizes
 //
 /****************************************************************************************************/
 
-bool AppleUSBCDCEEM::allocateResources()
+bool AppleUSBCDCEEM::allocatePools()
 {
-    IOUSBFindEndpointRequest		epReq;
-    UInt32				i;
-
-    XTRACE(this, 0, 0, "allocateResources.");
-
-        // Open all the end points
-
-    epReq.type = kUSBBulk;
+    UInt32	i;
+    
+    XTRACE(this, fInBufPool, fOutBufPool, "allocatePools");
+    
+    fPipeInBuff = (pipeInBuffers *)IOMalloc(fInBufPool * sizeof(pipeInBuffers));
+    fPipeOutBuff = (pipeOutBuffers *)IOMalloc(fOutBufPool * sizeof(pipeOutBuffers));
+    fTxDone = (pipeOutBuffers **)IOMalloc(fOutBufPool * sizeof(pipeOutBuffers *));
+    fRxHold.buffer = (UInt8 *)IOMalloc(kEEMMaxPacket);
+    if (!fPipeInBuff || !fPipeOutBuff || !fTxDone || !fRxHold.buffer)
+    {
+        XTRACE(this, 0, 0, "allocatePools - IOMalloc failed");
+        freePools();
+        return false;
+    }
+    bzero(fPipeInBuff, fInBufPool * sizeof(pipeInBuffers));
+    bzero(fPipeOutBuff, fOutBufPool * sizeof(pipeOutBuffers));
+    bzero(fTxDone, fOutBufPool * sizeof(pipeOutBuffers *));
+    
+    for (i=0; i<fOutBufPool; i++)
+    {
+		fPipeOutBuff[i].indx = i;
+    }
+    for (i=0; i<fInBufPool; i++)
+    {
+		fPipeInBuff[i].indx = i;
+		fPipeInBuff[i].owner = this;
+    }
+    
+    return true;
+    
+}/* end allocatePools */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::freePools
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Free the buffer records, the buffers themselves have already gone
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::freePools()
+{
+    
+    XTRACE(this, 0, 0, "freePools");
+    
+    if (fPipeInBuff)
+    {
+        IOFree(fPipeInBuff, fInBufPool * sizeof(pipeInBuffers));
+        fPipeInBuff = NULL;
+    }
+    if (fPipeOutBuff)
+    {
+        IOFree(fPipeOutBuff, fOutBufPool * sizeof(pipeOutBuffers));
+        fPipeOutBuff = NULL;
+    }
+    if (fTxDone)
+    {
+        IOFree(fTxDone, fOutBufPool * sizeof(pipeOutBuffers *));
+        fTxDone = NULL;
+    }
+    if (fRxHold.buffer)
+    {
+        IOFree(fRxHold.buffer, kEEMMaxPacket);
+        fRxHold.buffer = NULL;
+    }
+    
+}/* end freePools */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::allocateResources
+//
+//		Inputs:		
+//
+//		Outputs:	return code - true (allocate was successful), false (it failed)
+//
+//		Desc:		Gets all the endpoints open and buffers allocated etc.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCEEM::allocateResources()
+{
+    IOUSBFindEndpointRequest		epReq;
+    UInt32				i;
+
+    XTRACE(this, 0, 0, "allocateResources.");
+
+        // Open all the end points
+
+    epReq.type = kUSBBulk;
     epReq.direction = kUSBIn;
     epReq.maxPacketSize	= 0;
     epReq.interval = 0;
@@ -1645,8 +2082,15 @@ bool AppleUSBCDCEEM::allocateResources()
     
         // Allocate Memory Descriptor Pointer with memory for the data-in bulk pipe
 
+    fRxQuiet = false;
+    fRxParked = 0;
     for (i=0; i<fInBufPool; i++)
     {
+        fPipeInBuff[i].parked = false;
+        if (!cdc_RxLoanReclaim(&fPipeInBuff[i].loan))	// Still ours, it's read into again when it's back
+        {
+            continue;
+        }
 //		fPipeInBuff[i].pipeInMDP = IOBufferMemoryDescriptor::withCapacity(fMax_Block_Size, kIODirectionIn);
         fPipeInBuff[i].pipeInMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionIn | kIOMemoryPhysicallyContiguous, fMax_Block_Size, PAGE_SIZE);
         if (!fPipeInBuff[i].pipeInMDP)
@@ -1684,6 +2128,25 @@ bool AppleUSBCDCEEM::allocateResources()
         fPipeOutBuff[i].writeCompletionInfo.action = dataWriteComplete;
         fPipeOutBuff[i].writeCompletionInfo.parameter = NULL;				// for now, filled in with pool index when sent
     }
+    
+        // And the command buffers
+    
+    for (i=0; i<kCmdBufPool; i++)
+    {
+        fCmdBuff[i].pipeOutMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionOut | kIOMemoryPhysicallyContiguous, fMax_Block_Size, PAGE_SIZE);
+        if (!fCmdBuff[i].pipeOutMDP)
+        {
+            XTRACE(this, 0, i, "allocateResources - Allocate command descriptor failed");
+            return false;
+        }
+		
+        fCmdBuff[i].pipeOutBuffer = (UInt8*)fCmdBuff[i].pipeOutMDP->getBytesNoCopy();
+        fCmdBuff[i].indx = i;
+        fCmdBuff[i].avail = true;
+        fCmdBuff[i].writeCompletionInfo.target = this;
+        fCmdBuff[i].writeCompletionInfo.action = cmdWriteComplete;
+        fCmdBuff[i].writeCompletionInfo.parameter = &fCmdBuff[i];
+    }
 		
     return true;
 	
@@ -1706,6 +2169,11 @@ void AppleUSBCDCEEM::releaseResources()
     UInt32	i;
     
     XTRACE(this, 0, 0, "releaseResources");
+    
+        // Anything still being aggregated goes with the buffers
+    
+    fTxAggBuf = NULL;
+    bzero(&fTxAggFill, sizeof(fTxAggFill));
 
     for (i=0; i<fOutBufPool; i++)
     {
@@ -1720,9 +2188,29 @@ void AppleUSBCDCEEM::releaseResources()
         }
     }
     fOutPoolIndex = 0;
+    fTxOutstanding = 0;
+    fTxDoneCount = 0;
+    
+    for (i=0; i<kCmdBufPool; i++)
+    {
+        if (fCmdBuff[i].pipeOutMDP)	
+        { 
+            fCmdBuff[i].pipeOutMDP->release();	
+            fCmdBuff[i].pipeOutMDP = NULL;
+            fCmdBuff[i].avail = false;
+        }
+    }
     
+    if (fBufferPoolLock)
+    {
+        IOLockLock(fBufferPoolLock);
+    }
     for (i=0; i<fInBufPool; i++)
     {
+        if (!cdc_RxLoanRelease(&fPipeInBuff[i].loan))	// rxRecycle frees it when it's back
+        {
+            continue;
+        }
         if (fPipeInBuff[i].pipeInMDP)	
         { 
             fPipeInBuff[i].pipeInMDP->release();	
@@ -1733,6 +2221,11 @@ void AppleUSBCDCEEM::releaseResources()
             fPipeInBuff[i].readCompletionInfo.parameter = NULL;
         }
     }
+    if (fBufferPoolLock)
+    {
+        IOLockUnlock(fBufferPoolLock);
+    }
+    cdc_EEMDeframeReset(&fRxHold);
 
 }/* end releaseResources */
 
@@ -1744,61 +2237,40 @@ void AppleUSBCDCEEM::releaseResources()
 //
 //		Outputs:	Return code - True (got one), False (none available)
 //
-//		Desc:		Get an available buffer from the output buffer pool
+//		Desc:		Get an available buffer from the output buffer pool, the search starts at
+//				the hint. Called with fTxAggLock held (it's the only claimer), the compare
+//				and swap is for the write completions which hand buffers back without it.
 //
 /****************************************************************************************************/
 
 bool AppleUSBCDCEEM::getOutputBuffer(UInt32 *bufIndx)
 {
-	bool	gotBuffer = false;
 	UInt32	indx;
+	UInt32	n;
 	
 	XTRACE(this, 0, 0, "getOutputBuffer");
-
-	if (fBufferPoolLock)
-    {
-        IOLockLock(fBufferPoolLock);
-    } else {
-		return false;
-	}
 	
-	while (!gotBuffer)
+	indx = fOutPoolIndex;
+	for (n=0; n<fOutBufPool; n++)
 	{
-			// Get an ouput buffer (use the hint first then if that's not available look for one)
-		
-		indx = fOutPoolIndex;
-		if (!fPipeOutBuff[indx].avail)
+		if (indx >= fOutBufPool)
 		{
-			for (indx=0; indx<fOutBufPool; indx++)
-			{
-				if (fPipeOutBuff[indx].avail)
-				{
-					fOutPoolIndex = indx;
-					gotBuffer = true;
-					break;
-				}
-			}
-		} else {
-			gotBuffer = true;
+			indx = 0;
 		}
-        
-		if (gotBuffer)
+		if (fPipeOutBuff[indx].avail && OSCompareAndSwap(true, false, &fPipeOutBuff[indx].avail))
 		{
-			fPipeOutBuff[indx].avail = false;
-			fOutPoolIndex++;
+			fOutPoolIndex = indx + 1;
 			if (fOutPoolIndex >= fOutBufPool)
 			{
 				fOutPoolIndex = 0;
 			}
+			*bufIndx = indx;
+			return true;
 		}
-        break;
-    }
-    
-	IOLockUnlock(fBufferPoolLock);
-	
-	*bufIndx = indx;
+		indx++;
+	}
 	
-	return gotBuffer;
+	return false;
 
 }/* end getOutputBuffer */
 
@@ -1808,353 +2280,1232 @@ bool AppleUSBCDCEEM::getOutputBuffer(UInt32 *bufIndx)
 //
 //		Inputs:		packet - the packet
 //
-//		Outputs:	Return code - kIOReturnSuccess (transmit started), everything else (it didn't)
+//		Outputs:	Return code - kIOReturnSuccess (packet queued, and freed), everything else (it wasn't)
 //
-//		Desc:		Set up and then transmit the packet.
+//		Desc:		Add the packet, as an EEM data packet, to the transfer being filled. The
+//				transfer goes when it's full, when it has kTxAggMaxPackets in it, when the
+//				pipe is idle or when the flush timer fires, whichever is first.
 //
 /****************************************************************************************************/
 
 IOReturn AppleUSBCDCEEM::USBTransmitPacket(mbuf_t packet)
 {
-    UInt32		numbufs = 0;			// number of mbufs for this packet
-    mbuf_t		m;					// current mbuf
-    UInt32		total_pkt_length = 0;
-    UInt32		rTotal = 0;
-    IOReturn	ior = kIOReturnSuccess;
+    UInt32		total_pkt_length;
+    UInt32		need;
+    UInt8		*frame;
     UInt32		indx;
 	
     XTRACE(this, 0, 0, "USBTransmitPacket");
-			
-        // Count the number of mbufs in this packet
-        
-    m = packet;
-    while (m)
-	{
-		if (mbuf_len(m) != 0)
-		{
-			total_pkt_length += mbuf_len(m);
-			numbufs++;
-		}
-		m = mbuf_next(m);
-    }
     
-    XTRACE(this, total_pkt_length, numbufs, "USBTransmitPacket - Total packet length and Number of mbufs");
+    total_pkt_length = (UInt32)mbuf_pkthdr_len(packet);
+    need = kEEMHeaderLen + total_pkt_length + kEEMCRCLen;
     
-	if (total_pkt_length > fMax_Block_Size)
+    XTRACE(this, total_pkt_length, need, "USBTransmitPacket - Total packet length and EEM packet length");
+    
+	if ((need > fMax_Block_Size) || ((total_pkt_length + kEEMCRCLen) > frameLenMask))
     {
-        XTRACE(this, 0, 0, "USBTransmitPacket - Bad packet size");	// Note for now and revisit later
-		fpNetStats->outputErrors++;
+        XTRACE(this, 0, 0, "USBTransmitPacket - Bad packet size");
+		fTxCounters.errTooBig++;
         return kIOReturnInternalError;
     }
     
-    if (!getOutputBuffer(&indx))
-	{
-		ALERT(fOutBufPool, fOutPoolIndex, "USBTransmitPacket - Output buffer unavailable");
-        fTxStalled = true;
-		return kIOReturnOutputStall;
-	}
-
-        // Start filling in the send buffer
-
-	m = packet;							// start with the first mbuf of the packet
-    rTotal = 0;							// running total				
-    do
-    {  
-        if (mbuf_len(m) == 0)			// Ignore zero length buffers
-			continue;
-        
-        bcopy(mbuf_data(m), &fPipeOutBuff[indx].pipeOutBuffer[rTotal], mbuf_len(m));
-        rTotal += mbuf_len(m);
-        
-    } while ((m = mbuf_next(m)) != 0);
+    IOLockLock(fTxAggLock);
     
-    LogData(kDataOut, rTotal, fPipeOutBuff[indx].pipeOutBuffer);
-	
-    fPipeOutBuff[indx].m = packet;
-    fPipeOutBuff[indx].writeCompletionInfo.parameter = (void *)&fPipeOutBuff[indx];
-    fPipeOutBuff[indx].pipeOutMDP->setLength(rTotal);
-    ior = fOutPipe->Write(fPipeOutBuff[indx].pipeOutMDP, &fPipeOutBuff[indx].writeCompletionInfo);
-    if (ior != kIOReturnSuccess)
+        // Send what's there if this one won't fit
+    
+    if (fTxAggBuf && !cdc_EEMAggFits(&fTxAggFill, total_pkt_length))
+    {
+        txAggFlush();
+    }
+    
+    if (!fTxAggBuf)
     {
-        XTRACE(this, 0, ior, "USBTransmitPacket - Write failed");
-        if (ior == kIOUSBPipeStalled)
+        if (!getOutputBuffer(&indx))
         {
-            fOutPipe->Reset();
-            ior = fOutPipe->Write(fPipeOutBuff[indx].pipeOutMDP, &fPipeOutBuff[indx].writeCompletionInfo);
-            if (ior != kIOReturnSuccess)
+                // Say we're stalled before looking again, a completion that frees a
+                // buffer after this restarts the queue
+            
+            fTxStalled = true;
+            OSMemoryBarrier();
+            if (!getOutputBuffer(&indx))
             {
-                XTRACE(this, 0, ior, "USBTransmitPacket - Write really failed");
-				fpNetStats->outputErrors++;
-                return ior;
+                XTRACE(this, fOutBufPool, fOutPoolIndex, "USBTransmitPacket - Output buffer unavailable");
+                IOLockUnlock(fTxAggLock);
+                return kIOReturnOutputStall;
             }
         }
+        fTxAggBuf = &fPipeOutBuff[indx];
+        cdc_EEMAggStart(&fTxAggFill, fTxAggBuf->pipeOutBuffer, fMax_Block_Size);
     }
-        
-	fpNetStats->outputPackets++;
+
+        // The frame, then the EEM header and the CRC (or the sentinel) round it
+
+    frame = cdc_EEMAggFrame(&fTxAggFill);
+    mbuf_copydata(packet, 0, total_pkt_length, frame);
+    cdc_EEMAggAddData(&fTxAggFill, total_pkt_length, fTxCRC, fTxCRC ? cdc_CRC32(0, frame, total_pkt_length) : 0);
     
-    return ior;
+    LogData(kDataOut, need, frame - kEEMHeaderLen);
+    
+	fTxCounters.packets++;
+	fTxCounters.bytes += total_pkt_length;
+    
+    freePacket(packet);					// Copied, it's ours to free
+    
+    switch (cdc_EEMAggNext(&fTxAggFill, fTxAgg ? kTxAggMaxPackets : 1, (fTxOutstanding == 0)))
+    {
+        case kEEMAggSend:
+            txAggFlush();
+            break;
+        case kEEMAggArmTimer:
+            if (fTxAggTimer)
+            {
+                fTxAggTimer->setTimeoutUS(kTxAggFlushUS);
+            }
+            break;
+        default:
+            break;
+    }
+    
+    IOLockUnlock(fTxAggLock);
+    
+    return kIOReturnSuccess;
 
 }/* end USBTransmitPacket */
 
 /****************************************************************************************************/
 //
-//		Method:		AppleUSBCDCEEM::USBSendCommand
+//		Method:		AppleUSBCDCEEM::txAggFlush
 //
-//		Inputs:		command - the command to be sent
-//					length - length of any data to be sent
-//					anyData - any actual data (must be present if length > 0)
+//		Inputs:		
 //
-//		Outputs:	Return code - kIOReturnSuccess (transmit started), everything else (it didn't)
+//		Outputs:	
 //
-//		Desc:		Set up and a command packet.
+//		Desc:		Send the transfer being filled. Called with fTxAggLock held, a write that
+//				fails loses the frames in it (they're counted as pipe errors).
 //
 /****************************************************************************************************/
 
-IOReturn AppleUSBCDCEEM::USBSendCommand(UInt16 command, UInt16 length, UInt8 *anyData)
+void AppleUSBCDCEEM::txAggFlush()
 {
-	IOReturn	ior = kIOReturnSuccess;
-    UInt32		indx;
-    bool		gotBuffer = false;
-	UInt16		EEMHeader = bmTypeCommand;
-	
-    XTRACE(this, command, length, "USBSendCommand");
-
-	if ((length > 0) && (anyData == NULL))
-	{
-		return kIOReturnBadArgument;
-	}
-	
-		// Get an ouput buffer (use the hint first then if that's not available look for one)
-
-    if (fBufferPoolLock)
-    {
-        IOLockLock(fBufferPoolLock);
-    }
+    pipeOutBuffers	*pipeBuf = fTxAggBuf;
+    UInt32		wLen;
+    IOReturn	ior;
     
-    indx = fOutPoolIndex;
-    if (!fPipeOutBuff[indx].avail)
-    {
-        for (indx=0; indx<fOutBufPool; indx++)
-        {
-            if (fPipeOutBuff[indx].avail)
-            {
-                fOutPoolIndex = indx;
-                gotBuffer = true;
-                break;
-            }
-        }
-        if (!gotBuffer)
-        {
-            XTRACE(this, fOutBufPool, fOutPoolIndex, "USBSendCommand - Output buffer unavailable");
-			fpNetStats->outputErrors++;
-            if (fBufferPoolLock)
-            {
-                IOLockUnlock(fBufferPoolLock);
-            }
-            return kIOReturnInternalError;
-        }
-    }
-    fOutPoolIndex++;
-    if (fOutPoolIndex >= fOutBufPool)
+    if (!pipeBuf)
     {
-        fOutPoolIndex = 0;
+        return;
     }
     
-    if (fBufferPoolLock)
+    XTRACE(this, fTxAggFill.count, fTxAggFill.len, "txAggFlush");
+    
+    fTxAggBuf = NULL;
+    if (fTxAggTimer)
     {
-        IOLockUnlock(fBufferPoolLock);
+        fTxAggTimer->cancelTimeout();
     }
-	
-		// Now handle the data
-		
-	EEMHeader |= command;
-	EEMHeader |= length;
-	
-	bcopy(&EEMHeader, fPipeOutBuff[indx].pipeOutBuffer, sizeof(EEMHeader));
-	if (length > 0)
-	{
-		bcopy(anyData, &fPipeOutBuff[indx].pipeOutBuffer[2], length);
-	}
     
-    LogData(kDataOut, length+2, fPipeOutBuff[indx].pipeOutBuffer);
-	
-    fPipeOutBuff[indx].m = NULL;
-    fPipeOutBuff[indx].writeCompletionInfo.parameter = (void *)indx;
-    fPipeOutBuff[indx].pipeOutMDP->setLength(length+2);
-    ior = fOutPipe->Write(fPipeOutBuff[indx].pipeOutMDP, &fPipeOutBuff[indx].writeCompletionInfo);
+    pipeBuf->writeCompletionInfo.parameter = (void *)pipeBuf;
+    wLen = zlpPad(pipeBuf->pipeOutBuffer, fTxAggFill.len, &fTxCounters);
+    pipeBuf->pipeOutMDP->setLength(wLen);
+    OSIncrementAtomic(&fTxOutstanding);
+    ior = cdc_PipeWrite(fOutPipe, pipeBuf->pipeOutMDP, wLen, kPipeNoTimeout, kPipeNoTimeout, &pipeBuf->writeCompletionInfo);
     if (ior != kIOReturnSuccess)
     {
-        XTRACE(this, 0, ior, "USBSendCommand - Write failed");
-        if (ior == kIOUSBPipeStalled)
-        {
-            fOutPipe->Reset();
-            ior = fOutPipe->Write(fPipeOutBuff[indx].pipeOutMDP, &fPipeOutBuff[indx].writeCompletionInfo);
-            if (ior != kIOReturnSuccess)
-            {
-                XTRACE(this, 0, ior, "USBSendCommand - Write really failed");
-				fpNetStats->outputErrors++;
-                return ior;
-            }
-        }
+        XTRACE(this, fTxAggFill.count, ior, "txAggFlush - Write failed");
+        fTxCounters.errPipe += fTxAggFill.count;
+        OSDecrementAtomic(&fTxOutstanding);
+        pipeBuf->avail = true;
     }
-        
-	fpNetStats->outputPackets++;
     
-    return ior;
-
-}/* end USBSendCommand */
+    fTxAggFill.len = 0;
+    fTxAggFill.count = 0;
+    
+}/* end txAggFlush */
 
 /****************************************************************************************************/
 //
-//		Method:		AppleUSBCDCEEM::clearPipeStall
+//		Method:		AppleUSBCDCEEM::txAggTimerFired
 //
-//		Inputs:		thePipe - the pipe
+//		Inputs:		
 //
 //		Outputs:	
 //
-//		Desc:		Clear a stall on the specified pipe.
+//		Desc:		Static member function, a partly filled transfer has waited long enough
 //
 /****************************************************************************************************/
 
-IOReturn AppleUSBCDCEEM::clearPipeStall(IOUSBPipe *thePipe)
+void AppleUSBCDCEEM::txAggTimerFired(OSObject *owner, IOTimerEventSource *sender)
 {
-    IOReturn 	rtn = kIOReturnSuccess;
+    AppleUSBCDCEEM	*target = OSDynamicCast(AppleUSBCDCEEM, owner);
     
-    XTRACE(this, 0, 0, "clearPipeStall");
-    
-    rtn = thePipe->GetPipeStatus();
-    if (rtn == kIOUSBPipeStalled)
+    if (target && target->fTxAggLock)
     {
-        rtn = thePipe->ClearPipeStall(true);
-        if (rtn == kIOReturnSuccess)
-        {
-            XTRACE(this, 0, 0, "clearPipeStall - Successful");
-        } else {
-            XTRACE(this, 0, rtn, "clearPipeStall - Failed");
-        }
-    } else {
-        XTRACE(this, 0, 0, "clearPipeStall - Pipe not stalled");
+        IOLockLock(target->fTxAggLock);
+        target->txAggFlush();
+        IOLockUnlock(target->fTxAggLock);
     }
     
-    return rtn;
-
-}/* end clearPipeStall */
+}/* end txAggTimerFired */
 
 /****************************************************************************************************/
 //
-//		Method:		AppleUSBCDCEEM::receivePacket
+//		Method:		AppleUSBCDCEEM::zlpPad
 //
-//		Inputs:		packet - the packet
-//				size - Number of bytes in the packet
+//		Inputs:		buffer - output buffer
+//				len - length so far
+//				counters - the calling context's counters (transmit or command)
 //
-//		Outputs:	
+//		Outputs:	Length to write
 //
-//		Desc:		Build the mbufs and then send to the network stack.
+//		Desc:		A transfer that's a multiple of the packet size would need a zero length
+//				packet to end it, which holds the buffer for another round trip. A zero
+//				length EEM packet (just the header) on the end does the same job.
 //
 /****************************************************************************************************/
 
-void AppleUSBCDCEEM::receivePacket(UInt8 *packet, UInt32 size)
+UInt32 AppleUSBCDCEEM::zlpPad(UInt8 *buffer, UInt32 len, hostCounters *counters)
 {
-    mbuf_t		m;
-    UInt32		submit;
     
-    XTRACE(this, 0, size, "receivePacket");
-    
-	if (size > fMax_Block_Size)
+    if (fZLPPad && ((len % fOutPacketSize) == 0) && (len + 2 <= fMax_Block_Size))
     {
-        XTRACE(this, 0, 0, "receivePacket - Packet size error, packet dropped");
-		fpNetStats->inputErrors++;
-        return;
+        buffer[len] = 0;
+        buffer[len+1] = 0;
+        counters->zlpAvoided++;
+        return len + 2;
     }
     
-    m = allocatePacket(size);
-    if (m)
-    {
-        bcopy(packet, mbuf_data(m), size);
-        submit = fNetworkInterface->inputPacket(m, size);
-        XTRACE(this, 0, submit, "receivePacket - Packets submitted");
-		fpNetStats->inputPackets++;
-    } else {
-        XTRACE(this, 0, 0, "receivePacket - Buffer allocation failed, packet dropped");
-		fpNetStats->inputErrors++;
-    }
-
-}/* end receivePacket */
+    return len;
+    
+}/* end zlpPad */
 
 /****************************************************************************************************/
 //
-//		Method:		AppleUSBCDCEEM::processEEMCommand
+//		Method:		AppleUSBCDCEEM::USBSendCommand
 //
-//		Inputs:		EEMHeader - the EEM packet header
-//					poolIndx - Index into the buffer pool
-//					dataIndx - Index into the buffer for the current command
+//		Inputs:		command - the command to be sent (EEMEcho etc.)
+//					length - length of any data to be sent
+//					anyData - any actual data (must be present if length > 0)
 //
-//		Outputs:	len - actual length of the command
+//		Outputs:	Return code - kIOReturnSuccess (transmit started or queued), everything else (it didn't)
 //
-//		Desc:		Handle the EEM command.
+//		Desc:		Set up and send a command packet. If a data transfer is being filled the
+//				command goes in it, otherwise it's sent from one of the command buffers so
+//				it never waits for (or holds up) the data pool.
 //
 /****************************************************************************************************/
 
-void AppleUSBCDCEEM::processEEMCommand(UInt16 EEMHeader, UInt32 poolIndx, SInt16 dataIndx, SInt16 *len)
+IOReturn AppleUSBCDCEEM::USBSendCommand(UInt16 command, UInt16 length, UInt8 *anyData)
 {
-	IOReturn 	rtn = kIOReturnSuccess;
-	UInt16		EEMCommand;
-	UInt16		param;
-	UInt8		*buff = NULL;
-    
-    XTRACE(this, EEMHeader, poolIndx, "processEEMCommand");
-    
-	EEMCommand = EEMHeader & bmEEMCmdMask;
-	param = EEMHeader & bmEEMCmdParamMask;
+	IOReturn		ior = kIOReturnSuccess;
+    pipeOutBuffers	*pipeBuf = NULL;
+    UInt32			need = kEEMHeaderLen + length;
+    UInt32			wLen;
+    UInt32			i;
+	UInt16			EEMHeader;
 	
-	switch (EEMCommand)
-    {
-        case EEMEcho:
-			XTRACE(this, EEMCommand, param, "processEEMCommand - Echo");
-			if (param != 0)
+    XTRACE(this, command, length, "USBSendCommand");
+
+	if (((length > 0) && (anyData == NULL)) || (length > bmEEMCmdParamMask))
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	EEMHeader = bmTypeCommand | (command << 8) | length;
+	
+		// Ride along with the data if there's room
+	
+    if (fTxAggLock)
+    {
+        IOLockLock(fTxAggLock);
+        if (fTxAggBuf && cdc_EEMAggAddCommand(&fTxAggFill, EEMHeader, anyData, length))
+        {
+            LogData(kDataOut, need, &fTxAggBuf->pipeOutBuffer[fTxAggFill.len - need]);
+            fCmdCounters.packets++;
+            fCmdCounters.bytes += need;
+            IOLockUnlock(fTxAggLock);
+            XTRACE(this, command, fTxAggFill.len, "USBSendCommand - Added to the data transfer");
+            return kIOReturnSuccess;
+        }
+        IOLockUnlock(fTxAggLock);
+    }
+	
+		// Otherwise it needs a command buffer
+
+    for (i=0; i<kCmdBufPool; i++)
+    {
+        if (fCmdBuff[i].avail && OSCompareAndSwap(true, false, &fCmdBuff[i].avail))
+        {
+            pipeBuf = &fCmdBuff[i];
+            break;
+        }
+    }
+    if (!pipeBuf)
+    {
+        XTRACE(this, kCmdBufPool, command, "USBSendCommand - Command buffer unavailable");
+        fCmdCounters.errNoBuffer++;
+        return kIOReturnNoResources;
+    }
+	
+	OSWriteLittleInt16(pipeBuf->pipeOutBuffer, 0, EEMHeader);
+	if (length > 0)
+	{
+		bcopy(anyData, &pipeBuf->pipeOutBuffer[kEEMHeaderLen], length);
+	}
+    
+    LogData(kDataOut, need, pipeBuf->pipeOutBuffer);
+	
+    wLen = zlpPad(pipeBuf->pipeOutBuffer, need, &fCmdCounters);
+    pipeBuf->pipeOutMDP->setLength(wLen);
+    ior = cdc_PipeWrite(fOutPipe, pipeBuf->pipeOutMDP, wLen, kPipeNoTimeout, kPipeNoTimeout, &pipeBuf->writeCompletionInfo);
+    if (ior != kIOReturnSuccess)
+    {
+        XTRACE(this, 0, ior, "USBSendCommand - Write failed");
+        fCmdCounters.errPipe++;
+        pipeBuf->avail = true;
+        return ior;
+    }
+        
+	fCmdCounters.packets++;
+	fCmdCounters.bytes += need;
+    
+    return ior;
+
+}/* end USBSendCommand */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::cmdWriteComplete
+//
+//		Inputs:		obj - me
+//				param - the command buffer
+//				rc - return code
+//				remaining - what's left
+//
+//		Outputs:	
+//
+//		Desc:		BulkOut pipe write completion routine for the command buffers
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::cmdWriteComplete(void *obj, void *param, IOReturn rc, UInt32 remaining)
+{
+    AppleUSBCDCEEM	*me = (AppleUSBCDCEEM *)obj;
+	pipeOutBuffers	*pipeBuf = (pipeOutBuffers *)param;
+    UInt32			pktLen;
+	
+	XTRACE(me, rc, pipeBuf->indx, "cmdWriteComplete");
+    
+    if (rc == kIOReturnSuccess)
+    {
+        pktLen = (UInt32)pipeBuf->pipeOutMDP->getLength();
+        if (cdc_NeedZLP(pktLen, me->fOutPacketSize))
+        {
+            XTRACE(me, rc, pktLen, "cmdWriteComplete - writing zero length packet");
+            pipeBuf->pipeOutMDP->setLength(0);
+            me->fOutPipe->Write(pipeBuf->pipeOutMDP, &pipeBuf->writeCompletionInfo);
+            return;
+        }
+    } else {
+        XTRACE(me, rc, pipeBuf->indx, "cmdWriteComplete - IO err");
+        if (rc != kIOReturnAborted)
+        {
+            me->fCmdCounters.errPipe++;
+            rc = me->clearPipeStall(me->fOutPipe);
+            if (rc != kIOReturnSuccess)
+            {
+                XTRACE(me, 0, rc, "cmdWriteComplete - clear stall failed (trying to continue)");
+            }
+        }
+    }
+    
+    pipeBuf->avail = true;
+    
+    return;
+	
+}/* end cmdWriteComplete */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::clearPipeStall
+//
+//		Inputs:		thePipe - the pipe
+//
+//		Outputs:	
+//
+//		Desc:		Clear a stall on the specified pipe.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCEEM::clearPipeStall(IOUSBPipe *thePipe)
+{
+    IOReturn 	rtn = kIOReturnSuccess;
+    
+    XTRACE(this, 0, 0, "clearPipeStall");
+    
+    rtn = cdc_CheckPipe(thePipe, false);
+    if (rtn == kIOReturnSuccess)
+    {
+        XTRACE(this, 0, 0, "clearPipeStall - Successful");
+    } else {
+        XTRACE(this, 0, rtn, "clearPipeStall - Failed or not stalled");
+    }
+    
+    return rtn;
+
+}/* end clearPipeStall */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::rxDeframe
+//
+//		Inputs:		buffer - what the read returned
+//				len - Number of bytes in it
+//
+//		Outputs:	
+//
+//		Desc:		Splits a bulk in transfer into EEM packets (cdc_EEMDeframe does the work).
+//				A packet that runs off the end is held in fRxHold until the next transfer.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::rxDeframe(UInt8 *buffer, UInt32 len)
+{
+    
+    XTRACE(this, fRxHold.len, len, "rxDeframe");
+    
+    cdc_EEMDeframe(&fRxHold, buffer, len, rxPacketAction, this);
+    
+    if (fRxHold.len)
+    {
+        XTRACE(this, fRxHold.need, fRxHold.len, "rxDeframe - Packet continues in the next transfer");
+    }
+    
+}/* end rxDeframe */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::rxPacketAction
+//
+//		Inputs:		target - the driver
+//				packet - a complete EEM packet (header first)
+//				len - its length
+//
+//		Outputs:	
+//
+//		Desc:		cdc_EEMDeframe's per packet callback
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::rxPacketAction(void *target, UInt8 *packet, UInt32 len)
+{
+    
+    ((AppleUSBCDCEEM *)target)->rxPacket(packet, len);
+    
+}/* end rxPacketAction */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::rxPacket
+//
+//		Inputs:		packet - a complete EEM packet (header first)
+//				len - its length, as cdc_EEMPacketLen worked it out
+//
+//		Outputs:	
+//
+//		Desc:		Hands commands to processEEMCommand and frames (less the CRC) to
+//				receivePacket. Zero length data packets are padding and are skipped,
+//				frames marked as having a CRC are dropped if it doesn't match.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::rxPacket(UInt8 *packet, UInt32 len)
+{
+    UInt16	EEMHeader = OSReadLittleInt16(packet, 0);
+    UInt32	frameLen;
+    
+    if (EEMHeader & bmTypeCommand)
+    {
+        processEEMCommand(EEMHeader, &packet[kEEMHeaderLen]);
+        return;
+    }
+    
+    frameLen = len - kEEMHeaderLen;
+    if (frameLen == 0)
+    {
+        return;
+    }
+    if (frameLen <= kEEMCRCLen)
+    {
+        XTRACE(this, EEMHeader, frameLen, "rxPacket - Runt frame, dropped");
+        fRxCounters.errFormat++;
+        return;
+    }
+    
+    LogData(kDataIn, len, packet);
+    
+    frameLen -= kEEMCRCLen;
+    if (EEMHeader & bmCRC)
+    {
+        if (cdc_CRC32(0, &packet[kEEMHeaderLen], frameLen) != OSReadLittleInt32(packet, kEEMHeaderLen + frameLen))
+        {
+            XTRACE(this, EEMHeader, frameLen, "rxPacket - CRC error, dropped");
+            fRxCounters.errFormat++;
+            return;
+        }
+    }
+    
+    receivePacket(&packet[kEEMHeaderLen], frameLen);
+    
+}/* end rxPacket */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::rxPark
+//
+//		Inputs:		pipeBuf - a read buffer that's just been emptied
+//
+//		Outputs:	true (parked, don't queue it), false (queue it)
+//
+//		Desc:		After a ResponseCompleteHint reads are cut back to kRxQuietReads as they
+//				complete. rxUnpark queues them again.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCEEM::rxPark(pipeInBuffers *pipeBuf)
+{
+    
+    if (!fRxQuiet || ((fInBufPool - fRxParked) <= kRxQuietReads))
+    {
+        return false;
+    }
+    
+    XTRACE(this, fRxParked, pipeBuf->indx, "rxPark");
+    
+    pipeBuf->parked = true;
+    fRxParked++;
+    fRxHints.parked++;
+    
+    return true;
+    
+}/* end rxPark */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::rxUnpark
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		The device has data coming, queue every parked read. Read completion
+//				context, same as rxPark.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::rxUnpark()
+{
+    IOReturn	ior;
+    UInt32	i;
+    
+    XTRACE(this, fRxQuiet, fRxParked, "rxUnpark");
+    
+    fRxQuiet = false;
+    if (fRxParked == 0)
+    {
+        return;
+    }
+    
+    for (i=0; i<fInBufPool; i++)
+    {
+        if (fPipeInBuff[i].parked)
+        {
+            fPipeInBuff[i].parked = false;
+            fRxParked--;
+            ior = fInPipe->Read(fPipeInBuff[i].pipeInMDP, &fPipeInBuff[i].readCompletionInfo, NULL);
+            if (ior != kIOReturnSuccess)
+            {
+                XTRACE(this, i, ior, "rxUnpark - Failed to queue read");
+                fPipeInBuff[i].dead = true;
+            } else {
+                fRxHints.unparked++;
+            }
+        }
+    }
+    
+}/* end rxUnpark */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::receivePacket
+//
+//		Inputs:		packet - the packet
+//				size - Number of bytes in the packet
+//
+//		Outputs:	
+//
+//		Desc:		Build the mbufs and then send to the network stack. Larger frames
+//				still in the read buffer go up in place (see rxSlice), the rest are copied.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::receivePacket(UInt8 *packet, UInt32 size)
+{
+    mbuf_t		m;
+    UInt32		submit;
+    
+    XTRACE(this, 0, size, "receivePacket");
+    
+	if (size > fMax_Block_Size)
+    {
+        XTRACE(this, 0, 0, "receivePacket - Packet size error, packet dropped");
+		fRxCounters.errTooBig++;
+        return;
+    }
+    
+    if (fLRO)
+    {
+        if (lroInput(packet, size))
+        {
+            return;
+        }
+        lroFlush();					// Keep the flow in order
+    }
+    
+    m = NULL;
+    if (size >= kRxCopyBreak)
+    {
+        m = rxSlice(packet, size);
+    }
+    if (!m)
+    {
+        m = allocatePacket(size);
+        if (m)
+        {
+            bcopy(packet, mbuf_data(m), size);
+        }
+    }
+    if (m)
+    {
+        submit = fNetworkInterface->inputPacket(m, size);
+        XTRACE(this, 0, submit, "receivePacket - Packets submitted");
+		fRxCounters.packets++;
+		fRxCounters.bytes += size;
+    } else {
+        XTRACE(this, 0, 0, "receivePacket - Buffer allocation failed, packet dropped");
+		fRxCounters.errNoBuffer++;
+    }
+
+}/* end receivePacket */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::rxSlice
+//
+//		Inputs:		packet - the frame
+//				size - Number of bytes in it
+//
+//		Outputs:	mbuf referencing the frame where it is, NULL (copy it instead)
+//
+//		Desc:		Wraps a frame in the read buffer being split as an external cluster. The
+//				buffer is out of the read pool until the last of its frames is freed. Half
+//				the pool at most goes out this way so reads are always queued, frames
+//				that were reassembled in fRxHold are always copied.
+//
+/****************************************************************************************************/
+
+mbuf_t AppleUSBCDCEEM::rxSlice(UInt8 *packet, UInt32 size)
+{
+    pipeInBuffers	*pipeBuf = fRxCurrent;
+    mbuf_t		m = NULL;
+    bool		first;
+    
+    if (!pipeBuf || (packet < pipeBuf->pipeInBuffer) || ((packet + size) > (pipeBuf->pipeInBuffer + fMax_Block_Size)))
+    {
+        return NULL;
+    }
+    
+    if (!cdc_RxLoanTake(&pipeBuf->loan, &fRxLoaned, fInBufPool, &first))
+    {
+        return NULL;
+    }
+    if (first)
+    {
+        retain();						// Released by rxRecycle
+    }
+    
+    if (mbuf_gethdr(MBUF_DONTWAIT, MBUF_TYPE_DATA, &m) != 0)
+    {
+        cdc_RxLoanUntake(&pipeBuf->loan);			// The read completion still holds it
+        return NULL;
+    }
+    if (mbuf_attachcluster(MBUF_DONTWAIT, MBUF_TYPE_DATA, &m, (caddr_t)packet, rxSliceFree, size, (caddr_t)pipeBuf) != 0)
+    {
+        XTRACE(this, 0, size, "rxSlice - mbuf_attachcluster failed");
+        cdc_RxLoanUntake(&pipeBuf->loan);			// The read completion still holds it
+        mbuf_free(m);
+        return NULL;
+    }
+    mbuf_setlen(m, size);
+    mbuf_pkthdr_setlen(m, size);
+    
+    fRxCounters.copyAvoided += size;
+    
+    return m;
+    
+}/* end rxSlice */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::rxSliceFree
+//
+//		Inputs:		buffer - the frame
+//				size - its length
+//				arg - the read buffer it's in
+//
+//		Outputs:	
+//
+//		Desc:		Static member function, the stack has finished with a frame passed up in
+//				place. Called from wherever the mbuf is freed.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::rxSliceFree(caddr_t buffer, u_int size, caddr_t arg)
+{
+    pipeInBuffers	*pipeBuf = (pipeInBuffers *)arg;
+    
+    if (cdc_RxLoanFree(&pipeBuf->loan))
+    {
+        ((AppleUSBCDCEEM *)pipeBuf->owner)->rxRecycle(pipeBuf);
+    }
+    
+}/* end rxSliceFree */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::rxRecycle
+//
+//		Inputs:		pipeBuf - a read buffer that was loaned
+//
+//		Outputs:	
+//
+//		Desc:		Everything in the buffer has been freed. It goes back in the read pool or,
+//				if the resources were released while it was out, it's freed.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::rxRecycle(pipeInBuffers *pipeBuf)
+{
+    IOReturn	ior;
+    
+    XTRACE(this, pipeBuf->loan.orphan, pipeBuf->indx, "rxRecycle");
+    
+    IOLockLock(fBufferPoolLock);
+    if (cdc_RxLoanReturn(&pipeBuf->loan, &fRxLoaned))
+    {
+        if (pipeBuf->pipeInMDP)
+        {
+            pipeBuf->pipeInMDP->release();
+            pipeBuf->pipeInMDP = NULL;
+        }
+        pipeBuf->dead = false;
+    } else {
+        ior = fInPipe->Read(pipeBuf->pipeInMDP, &pipeBuf->readCompletionInfo, NULL);
+        if (ior != kIOReturnSuccess)
+        {
+            XTRACE(this, 0, ior, "rxRecycle - Failed to queue read");
+            pipeBuf->dead = true;
+        }
+    }
+    IOLockUnlock(fBufferPoolLock);
+    
+    release();
+    
+}/* end rxRecycle */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::lroInput
+//
+//		Inputs:		packet - the packet
+//				size - Number of bytes in the packet
+//
+//		Outputs:	true (taken), false (not a candidate, receivePacket should send it up)
+//
+//		Desc:		Merges in-order TCP segments of one flow within a read completion. The
+//				packet being built goes up when the next segment doesn't follow it, on PSH,
+//				when it's full or at the end of the completion.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCEEM::lroInput(UInt8 *packet, UInt32 size)
+{
+    lroSegment	seg;
+    mbuf_t		m;
+    
+    if (!cdc_LROParse(packet, size, &seg))
+    {
+        return false;
+    }
+    
+    if (fLROFlow.head)
+    {
+        if (cdc_LROMatch(&fLROFlow, packet, &seg) && cdc_LROAppend(&fLROFlow, packet, &seg))
+        {
+            XTRACE(this, fLROFlow.segs, seg.payloadLen, "lroInput - Segment merged");
+            fRxCounters.packets++;
+            fRxCounters.bytes += size;
+            fRxCounters.offload++;
+            if ((seg.flags & kTCPFlagPSH) || (fLROFlow.segs >= kLROMaxSegments))
+            {
+                lroFlush();
+            }
+            return true;
+        }
+        lroFlush();
+    }
+    
+    if (seg.flags & kTCPFlagPSH)			// Nothing to merge it with
+    {
+        return false;
+    }
+    
+    m = allocatePacket(size);
+    if (!m)
+    {
+        return false;
+    }
+    bcopy(packet, mbuf_data(m), size);
+    if (!cdc_LROStart(&fLROFlow, m, &seg))
+    {
+        freePacket(m);
+        return false;
+    }
+    
+    fRxCounters.packets++;
+    fRxCounters.bytes += size;
+    
+    return true;
+    
+}/* end lroInput */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::lroFlush
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Send the packet being merged (if any) up the stack
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::lroFlush()
+{
+    mbuf_t		m;
+    UInt32		len;
+    UInt32		submit;
+    
+    if (!fLROFlow.head)
+    {
+        return;
+    }
+    
+    m = cdc_LROFinish(&fLROFlow, &len);
+    XTRACE(this, 0, len, "lroFlush");
+    submit = fNetworkInterface->inputPacket(m, len);
+    XTRACE(this, 0, submit, "lroFlush - Packets submitted");
+    
+}/* end lroFlush */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::statsAccessed
+//
+//		Inputs:		target - me
+//				type - access type
+//
+//		Outputs:	kIOReturnSuccess
+//
+//		Desc:		Static member function called when the network statistics are accessed.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCEEM::statsAccessed(void *target, void *param, IONetworkData *data, UInt32 type, void *buffer, UInt32 *bufferSize, UInt32 offset)
+{
+    AppleUSBCDCEEM	*me = (AppleUSBCDCEEM *)target;
+    
+    if (me && ((type == kIONetworkDataAccessTypeRead) || (type == kIONetworkDataAccessTypeSerialize)))
+    {
+        me->updateStatistics();
+    }
+    
+    return kIOReturnSuccess;
+    
+}/* end statsAccessed */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::updateStatistics
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Adds up the per context host counters and updates the interface statistics
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::updateStatistics()
+{
+    hostTotals		totals;
+    
+    bzero(&totals, sizeof(totals));
+    hostCountersAdd(&totals.input, &fRxCounters);
+    hostCountersAdd(&totals.output, &fTxCounters);
+    hostCountersAdd(&totals.output, &fTxDoneCounters);
+    hostCountersAdd(&totals.output, &fCmdCounters);
+    
+    fHostTotals = totals;
+    
+    setProperty(readHintsTag, (void *)&fRxHints, sizeof(fRxHints));
+    
+    if (!fpNetStats || !fpEtherStats)
+    {
+        return;
+    }
+    
+        // The interface statistics are 32 bits so they just wrap
+    
+    fpNetStats->inputPackets = (UInt32)totals.input.packets;
+    fpNetStats->inputErrors = (UInt32)hostErrors(&totals.input);
+    fpNetStats->outputPackets = (UInt32)totals.output.packets;
+    fpNetStats->outputErrors = (UInt32)hostErrors(&totals.output);
+        
+    fpEtherStats->dot3RxExtraEntry.resourceErrors = (UInt32)totals.input.errNoBuffer;
+    fpEtherStats->dot3TxExtraEntry.resourceErrors = (UInt32)totals.output.errNoBuffer;
+    
+}/* end updateStatistics */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::processEEMCommand
+//
+//		Inputs:		EEMHeader - the EEM packet header
+//					cmdData - what follows the header (cdc_EEMPacketLen has checked it's all there)
+//
+//		Outputs:	
+//
+//		Desc:		Handle the EEM command.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::processEEMCommand(UInt16 EEMHeader, UInt8 *cmdData)
+{
+	IOReturn 	rtn = kIOReturnSuccess;
+	UInt16		EEMCommand;
+	UInt16		param;
+	UInt8		*buff = NULL;
+    
+    XTRACE(this, EEMHeader, 0, "processEEMCommand");
+    
+	EEMCommand = (EEMHeader & bmEEMCmdCodeMask) >> 8;
+	param = EEMHeader & bmEEMCmdParamMask;
+	
+	switch (EEMCommand)
+    {
+        case EEMEcho:
+			XTRACE(this, EEMCommand, param, "processEEMCommand - Echo");
+			if (param != 0)
 			{
-				buff = &fPipeInBuff[poolIndx].pipeInBuffer[2];
+				buff = cmdData;
 			}
 			rtn = USBSendCommand(EEMEchoResponse, param, buff);
 			if (rtn != kIOReturnSuccess)
 			{ 
 				XTRACE(this, 0, rtn, "processEEMCommand - Failed to send echo response");
 			}
-			*len = param + 2;
             break;
         case EEMEchoResponse:
 			XTRACE(this, EEMCommand, param, "processEEMCommand - Echo Response");
-			
-			*len = param + 2;
+			echoResponse(cmdData, param);
 			break;
 		case EEMSuspendHint:
 			XTRACE(this, EEMCommand, param, "processEEMCommand - Suspend Hint");
-			
-			*len = 2;
             break;
         case EEMResponseHint:
 			XTRACE(this, EEMCommand, param, "processEEMCommand - Response Hint");
-			
-			*len = 2;
+			fRxHints.responseHints++;
+			rxUnpark();
 			break;
 		case EEMResponseCompleteHint:
 			XTRACE(this, EEMCommand, param, "processEEMCommand - Response Hint Complete");
-			
-			*len = 2;
+			fRxHints.completeHints++;
+			fRxQuiet = true;				// Reads are cut back as they complete
             break;
         case EEMTickle:
 			XTRACE(this, EEMCommand, param, "processEEMCommand - Tickle");
-			
-			*len = 2;
 			break;
 		default:
             XTRACE(this, EEMCommand, param, "processEEMCommand - unknown command");
-			*len = 2; 
             break;
     }
 	
 }/* end processEEMCommand */
 
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::sendEchoProbe
+//
+//		Inputs:		
+//
+//		Outputs:	Return code - from USBSendCommand
+//
+//		Desc:		Send an echo carrying when it was sent, echoResponse times the round trip.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCEEM::sendEchoProbe()
+{
+    UInt8	payload[kEchoProbeLen];
+    IOReturn	rtn;
+    
+    OSWriteBigInt32(payload, 0, kEchoMagic);
+    OSWriteLittleInt32(payload, 4, (UInt32)OSIncrementAtomic(&fEchoSeq) + 1);
+    OSWriteLittleInt64(payload, 8, mach_absolute_time());
+    
+    rtn = USBSendCommand(EEMEcho, kEchoProbeLen, payload);
+    if (rtn == kIOReturnSuccess)
+    {
+        fEchoStats.sent++;
+    }
+    
+    XTRACE(this, fEchoSeq, rtn, "sendEchoProbe");
+    
+    return rtn;
+    
+}/* end sendEchoProbe */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::echoResponse
+//
+//		Inputs:		data - the echoed payload
+//				len - its length
+//
+//		Outputs:	
+//
+//		Desc:		Match the response to one of our probes and add the round trip to the
+//				histogram. The whole of it is republished in the registry each time.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::echoResponse(UInt8 *data, UInt16 len)
+{
+    UInt64	sentTime;
+    UInt64	us;
+    UInt32	seq;
+    UInt32	b;
+    
+    if ((len != kEchoProbeLen) || (OSReadBigInt32(data, 0) != kEchoMagic))
+    {
+        XTRACE(this, 0, len, "echoResponse - Not one of ours");
+        fEchoStats.unmatched++;
+        return;
+    }
+    
+    seq = OSReadLittleInt32(data, 4);
+    sentTime = OSReadLittleInt64(data, 8);
+    if (((SInt32)(seq - (UInt32)fEchoSeq) > 0) || (sentTime > mach_absolute_time()))
+    {
+        XTRACE(this, seq, fEchoSeq, "echoResponse - Never sent");
+        fEchoStats.unmatched++;
+        return;
+    }
+    
+    absolutetime_to_nanoseconds(mach_absolute_time() - sentTime, &us);
+    us /= 1000;
+    
+    XTRACE(this, seq, (UInt32)us, "echoResponse - Round trip (microseconds)");
+    
+    b = 0;
+    while ((b < (kEchoBuckets - 1)) && ((us >> (b + 1)) != 0))
+    {
+        b++;
+    }
+    
+    if ((fEchoStats.received == 0) || (us < fEchoStats.minUS))
+    {
+        fEchoStats.minUS = us;
+    }
+    if (us > fEchoStats.maxUS)
+    {
+        fEchoStats.maxUS = us;
+    }
+    fEchoStats.received++;
+    fEchoStats.totalUS += us;
+    fEchoStats.bucket[b]++;
+    
+    setProperty(echoLatencyTag, (void *)&fEchoStats, sizeof(fEchoStats));
+    
+}/* end echoResponse */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::echoTimerFired
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Static member function, time for the next periodic probe
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCEEM::echoTimerFired(OSObject *owner, IOTimerEventSource *sender)
+{
+    AppleUSBCDCEEM	*target = OSDynamicCast(AppleUSBCDCEEM, owner);
+    
+    if (!target)
+    {
+        return;
+    }
+    
+    if (target->fReady && target->fLinkStatus)
+    {
+        target->sendEchoProbe();
+    }
+    if (target->fEchoInterval)
+    {
+        sender->setTimeoutMS(target->fEchoInterval);
+    }
+    
+}/* end echoTimerFired */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::setProperties
+//
+//		Inputs:		properties - the properties being set
+//
+//		Outputs:	Return code - from setPropertiesWL, kIOReturnNotReady (not started)
+//
+//		Desc:		Runs setPropertiesWL on the workloop, the echo timer and the transmit
+//				side it touches are otherwise only used from there.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCEEM::setProperties(OSObject *properties)
+{
+    IOWorkLoop	*workLoop = fWorkLoop;
+    IOReturn	rtn = kIOReturnNotReady;
+    
+    XTRACE(this, 0, 0, "setProperties");
+    
+    if (workLoop)
+    {
+        workLoop->retain();					// In case we're stopped while it runs
+        rtn = workLoop->runAction(setPropertiesAction, this, (void *)properties);
+        workLoop->release();
+    }
+    
+    return rtn;
+    
+}/* end setProperties */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::setPropertiesAction
+//
+//		Inputs:		owner - me
+//				arg0 - the properties
+//
+//		Outputs:	Return code - from setPropertiesWL
+//
+//		Desc:		Static member function, workloop action for setProperties
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCEEM::setPropertiesAction(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    AppleUSBCDCEEM	*me = OSDynamicCast(AppleUSBCDCEEM, owner);
+    
+    if (!me)
+    {
+        return kIOReturnBadArgument;
+    }
+    
+    return me->setPropertiesWL((OSObject *)arg0);
+    
+}/* end setPropertiesAction */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCEEM::setPropertiesWL
+//
+//		Inputs:		properties - the properties being set
+//
+//		Outputs:	Return code - kIOReturnSuccess (something was done with them), kIOReturnUnsupported (nothing)
+//
+//		Desc:		Starts, stops or changes the periodic echo probes and sends one on request.
+//				EchoProbeInterval is in milliseconds, 0 stops them and anything else
+//				under kEchoMinIntervalMS is raised to it. Called on the workloop.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCEEM::setPropertiesWL(OSObject *properties)
+{
+    OSDictionary	*dict = OSDynamicCast(OSDictionary, properties);
+    IOReturn		rtn = kIOReturnUnsupported;
+    
+    XTRACE(this, 0, 0, "setPropertiesWL");
+    
+    if (!dict)
+    {
+        return kIOReturnBadArgument;
+    }
+    
+    OSNumber *interval = OSDynamicCast(OSNumber, dict->getObject(echoIntervalTag));
+    if (interval)
+    {
+        fEchoInterval = interval->unsigned32BitValue();
+        if (fEchoInterval && (fEchoInterval < kEchoMinIntervalMS))
+        {
+            fEchoInterval = kEchoMinIntervalMS;		// Don't let a caller flood the device with echoes
+        }
+        XTRACE(this, 0, fEchoInterval, "setPropertiesWL - Echo probe interval");
+        if (fEchoTimer)
+        {
+            if (fEchoInterval)
+            {
+                fEchoTimer->setTimeoutMS(fEchoInterval);
+            } else {
+                fEchoTimer->cancelTimeout();
+            }
+        }
+        rtn = kIOReturnSuccess;
+    }
+    
+    OSBoolean *probe = OSDynamicCast(OSBoolean, dict->getObject(echoProbeTag));
+    if (probe)
+    {
+        if (!probe->isTrue())
+        {
+            rtn = kIOReturnSuccess;
+        } else {
+            if (fReady && fLinkStatus)
+            {
+                rtn = sendEchoProbe();
+            } else {
+                rtn = kIOReturnNotReady;
+            }
+        }
+    }
+    
+    return rtn;
+    
+}/* end setPropertiesWL */
+
 /****************************************************************************************************/
 //
 //		Method:		AppleUSBCDCEEM::message
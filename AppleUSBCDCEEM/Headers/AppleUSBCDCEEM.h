@@ -27,6 +27,11 @@
 
 #include "AppleUSBCDCCommon.h"
 #include "AppleUSBCDC.h"  
+#include "AppleUSBCDCOffload.h"
+#include "AppleUSBCDCPipe.h"
+#include "AppleUSBCDCCRC.h"
+#include "AppleUSBCDCEEMFrame.h"
+#include "AppleUSBCDCRxLoan.h"
 
 #define LDEBUG		0			// for debugging
 #define USE_ELG		0			// to Event LoG (via kprintf and Firewire) - LDEBUG must also be set
@@ -85,6 +90,8 @@ enum
 };
 
 #define TRANSMIT_QUEUE_SIZE     4096
+#define kMinTxQueueSize		64
+#define kMaxTxQueueSize		16384
 #define WATCHDOG_TIMER_MS       1000
 
 #define MAX_BLOCK_SIZE		PAGE_SIZE
@@ -101,18 +108,71 @@ enum
 #define kInBufPool		4
 #define kOutBufPool		2
 
-#define kMaxInBufPool		kInBufPool*16
-#define kMaxOutBufPool		kOutBufPool*8
+#define kMaxInBufPool		kInBufPool*64			// Only the configured number are allocated
+#define kMaxOutBufPool		kOutBufPool*32
 
+#define kTxDoneBatchMax		8				// Most write completions handled together
+
+#define	enableTag		"EnableEEM"			// EEM isn't loaded unless this is true
 #define	inputTag		"InputBuffers"
 #define	outputTag		"OutputBuffers"
+#define	zlpPadTag		"PadZeroLengthPackets"
+#define	txAggTag		"TransmitAggregation"
+#define	txCRCTag		"TransmitCRC"
+#define	txQueueTag		"TransmitQueue"			// "Basic" (default) or "Gated"
+#define	txQueueSizeTag		"TransmitQueueSize"		// Packets, TRANSMIT_QUEUE_SIZE by default
+
+#define kTxAggMaxPackets	32				// Most frames packed in one transfer
+#define kTxAggFlushUS		200				// Longest a partly filled transfer waits
+
+#define kCmdBufPool		2				// Command buffers, separate from the data pool
+
+#define kRxCopyBreak		256				// Smaller frames are copied, larger ones passed up in place
+
+	// Read posting from the device's response hints
+
+#define	readHintsTag		"ReadHints"			// readHints, updated with the statistics
+#define kRxQuietReads		1				// Reads kept queued after a ResponseCompleteHint
+
+	// Devices with a serial number get an address made from this, the same on every attach
+
+#define addressKeyLength	96				// "vendor:product:serial number"
+
+typedef struct
+{
+    UInt64	responseHints;					// Device said data is coming (reads all queued)
+    UInt64	completeHints;					// Device said it's done (reads cut back)
+    UInt64	parked;						// Reads not queued again because the device was quiet
+    UInt64	unparked;					// Parked reads queued again (hint or a full transfer)
+} readHints;
+
+	// Echo latency probe
+
+#define	echoIntervalTag		"EchoProbeInterval"		// Milliseconds between probes, 0 (default) for none
+#define kEchoMinIntervalMS	100				// Anything shorter (other than 0) is raised to this
+#define	echoProbeTag		"EchoProbe"			// Set (to true) to send one probe now
+#define	echoLatencyTag		"EchoLatency"			// echoLatency, updated as responses arrive
+
+#define kEchoMagic		0x45454d50			// 'EEMP', first in the probe payload
+#define kEchoProbeLen		16				// Magic, sequence number and mach_absolute_time
+#define kEchoBuckets		16
+
+typedef struct
+{
+    UInt64	sent;
+    UInt64	received;
+    UInt64	unmatched;					// Responses to echoes that weren't our probes
+    UInt64	minUS;
+    UInt64	maxUS;
+    UInt64	totalUS;
+    UInt64	bucket[kEchoBuckets];				// bucket[n] - round trips under 2^(n+1) microseconds (the last has the rest)
+} echoLatency;
 
 typedef struct 
 {
     IOBufferMemoryDescriptor	*pipeOutMDP;
     UInt8			*pipeOutBuffer;
-    mbuf_t			m;
-    bool			avail;
+    volatile UInt32		avail;				// Claimed with OSCompareAndSwap
     IOUSBCompletion		writeCompletionInfo;
 	UInt32			indx;
 } pipeOutBuffers;
@@ -124,33 +184,11 @@ typedef struct
     bool			dead;
     IOUSBCompletion		readCompletionInfo;
 	UInt32			indx;
+    OSObject			*owner;				// The driver (for rxSliceFree)
+    rxLoan			loan;				// Frames passed up in place (see AppleUSBCDCRxLoan.h)
+    bool			parked;				// Not queued, the device is quiet
 } pipeInBuffers;
 
-	// EEM bit definitions and masks
-	
-#define bmTypeData			0x0000
-#define bmTypeCommand		0x8000
-#define bmCRC				0x4000
-
-	// EEM Data packet masks
-
-#define bmCRCMask			0x7fff
-#define frameLenMask		0x3fff
-
-	// EEM Command packet masks
-	
-#define bmEEMCmdMask		0x3fff
-#define	bmEEMCmdParamMask	0x07ff
-
-	// EEM Commands
-	
-#define EEMEcho					0x00
-#define EEMEchoResponse			0x08
-#define EEMSuspendHint			0x10
-#define EEMResponseHint			0x18
-#define EEMResponseCompleteHint	0x20
-#define EEMTickle				0x28
-
 class AppleUSBCDC;
 
 class AppleUSBCDCEEM : public IOEthernetController
@@ -161,9 +199,13 @@ private:
     bool			fTerminate;				// Are we being terminated (ie the device was unplugged)
     UInt16			fVendorID;
     UInt16			fProductID;
+    IOEthernetAddress		fEthernetAddress;
+    bool			fHaveAddress;
         
     IOEthernetInterface		*fNetworkInterface;
     IOBasicOutputQueue		*fTransmitQueue;
+    bool			fTxQueueGated;			// IOGatedOutputQueue (work loop) rather than IOBasicOutputQueue
+    UInt32			fTxQueueSize;
     
     OSDictionary		*fMediumDict;
 
@@ -175,15 +217,53 @@ private:
     IOUSBPipe			*fInPipe;
     IOUSBPipe			*fOutPipe;
     
-    pipeInBuffers		fPipeInBuff[kMaxInBufPool];
-    pipeOutBuffers		fPipeOutBuff[kMaxOutBufPool];
+    pipeInBuffers		*fPipeInBuff;			// fInBufPool records
+    pipeOutBuffers		*fPipeOutBuff;			// fOutBufPool records
     UInt16			fOutPoolIndex;
     
     UInt32			fCount;
     UInt32			fOutPacketSize;
+    
+    bool			fZLPPad;			// End with a zero length EEM packet rather than a zero length USB packet
+    bool			fLRO;				// Merge received TCP segments
+    bool			fTxCRC;				// Send a real CRC rather than the sentinel
+    lroFlow			fLROFlow;			// Packet being merged (read completion context)
+    
+    eemRxHold			fRxHold;			// EEM packet split across transfers (buffer is kEEMMaxPacket)
+    pipeInBuffers		*fRxCurrent;			// Buffer being split (read completion context)
+    SInt32			fRxLoaned;			// Buffers with frames passed up in place
+    bool			fRxQuiet;			// ResponseCompleteHint seen, keep kRxQuietReads queued
+    UInt32			fRxParked;
+    readHints			fRxHints;
+    
+    volatile SInt32		fTxOutstanding;			// Writes not yet completed
+    pipeOutBuffers		**fTxDone;			// Completed, waiting to go back to the pool (fOutBufPool)
+    UInt32			fTxDoneCount;
+    UInt32			fTxDoneBatch;
+    
+    bool			fTxAgg;				// Pack several frames into each transfer
+    IOLock			*fTxAggLock;			// Protects the transfer being filled
+    pipeOutBuffers		*fTxAggBuf;			// Transfer being filled (NULL if none)
+    eemTxAgg			fTxAggFill;			// How far it's filled
+    IOTimerEventSource		*fTxAggTimer;			// Sends a partly filled transfer
 
     static void			dataReadComplete(void *obj, void *param, IOReturn ior, UInt32 remaining);
     static void			dataWriteComplete(void *obj, void *param, IOReturn ior, UInt32 remaining);
+    void			completeWrites(void);
+    static void			txAggTimerFired(OSObject *owner, IOTimerEventSource *sender);
+    
+    pipeOutBuffers		fCmdBuff[kCmdBufPool];		// Commands that can't ride along with data
+    static void			cmdWriteComplete(void *obj, void *param, IOReturn ior, UInt32 remaining);
+    
+    UInt32			fEchoInterval;			// Milliseconds, 0 for no periodic probes
+    SInt32			fEchoSeq;
+    echoLatency			fEchoStats;
+    IOTimerEventSource		*fEchoTimer;
+    static void			echoTimerFired(OSObject *owner, IOTimerEventSource *sender);
+    IOReturn			sendEchoProbe(void);
+    
+    bool			makeHardwareAddress(void);
+    void			echoResponse(UInt8 *data, UInt16 len);
     
            // CDC EEM Driver instance Methods
 	
@@ -193,16 +273,32 @@ private:
     bool			wakeUp(void);
     void			putToSleep(void);
     bool			createMediumTables(void);
+    bool			allocatePools(void);
+    void			freePools(void);
     bool 			allocateResources(void);
     void			releaseResources(void);
     bool			createNetworkInterface(void);
     UInt32			outputPacket(mbuf_t pkt, void *param);
     IOReturn		USBTransmitPacket(mbuf_t packet);
+    UInt32			zlpPad(UInt8 *buffer, UInt32 len, hostCounters *counters);
+    void			txAggFlush(void);
 	bool			getOutputBuffer(UInt32 *bufIndx);
 	IOReturn		USBSendCommand(UInt16 command, UInt16 length, UInt8 *anyData);
     IOReturn		clearPipeStall(IOUSBPipe *thePipe);
+    void			rxDeframe(UInt8 *buffer, UInt32 len);
+    static void			rxPacketAction(void *target, UInt8 *packet, UInt32 len);
+    void			rxPacket(UInt8 *packet, UInt32 len);
     void			receivePacket(UInt8 *packet, UInt32 size);
-	void			processEEMCommand(UInt16 EEMHeader, UInt32 poolIndx, SInt16 dataIndx, SInt16 *len);
+    mbuf_t			rxSlice(UInt8 *packet, UInt32 size);
+    static void			rxSliceFree(caddr_t buffer, u_int size, caddr_t arg);
+    void			rxRecycle(pipeInBuffers *pipeBuf);
+    bool			rxPark(pipeInBuffers *pipeBuf);
+    void			rxUnpark(void);
+    bool			lroInput(UInt8 *packet, UInt32 size);
+    void			lroFlush(void);
+	void			processEEMCommand(UInt16 EEMHeader, UInt8 *cmdData);
+    void			updateStatistics(void);
+    static IOReturn	statsAccessed(void *target, void *param, IONetworkData *data, UInt32 type, void *buffer, UInt32 *bufferSize, UInt32 offset);
     
 public:
 
@@ -221,14 +317,23 @@ public:
     
     IONetworkStats		*fpNetStats;
     IOEthernetStats		*fpEtherStats;
+    hostCounters		fTxCounters;			// Transmit (output queue) context
+    hostCounters		fTxDoneCounters;		// Write completion context
+    hostCounters		fCmdCounters;			// EEM commands (sent from the read completion)
+    hostCounters		fRxCounters;			// Read completion context
+    hostTotals			fHostTotals;			// Added up when the statistics are read
 
         // IOKit methods
         
 	virtual IOService   *probe(IOService *provider, SInt32 *score);
     virtual bool		init(OSDictionary *properties = 0);
+    virtual void		free(void);
     virtual bool		start(IOService *provider);
     virtual void		stop(IOService *provider);
     virtual IOReturn 		message(UInt32 type, IOService *provider, void *argument = 0);
+    virtual IOReturn		setProperties(OSObject *properties);
+    static IOReturn		setPropertiesAction(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+    IOReturn			setPropertiesWL(OSObject *properties);
 
         // IOEthernetController methods
 
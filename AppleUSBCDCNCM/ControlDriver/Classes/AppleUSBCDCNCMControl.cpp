@@ -0,0 +1,1424 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+    /* AppleUSBCDCNCMControl.cpp - MacOSX implementation of			*/
+    /* USB Communication Device Class (CDC) Driver, Network Control Model Interface.	*/
+
+#include <machine/limits.h>			/* UINT_MAX */
+#include <libkern/OSByteOrder.h>
+
+#include <IOKit/network/IOEthernetController.h>
+#include <IOKit/network/IOEthernetInterface.h>
+#include <IOKit/network/IOGatedOutputQueue.h>
+
+#include <IOKit/IOTimerEventSource.h>
+#include <IOKit/assert.h>
+#include <IOKit/IOLib.h>
+#include <IOKit/IOService.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOMessage.h>
+
+#include <IOKit/pwr_mgt/RootDomain.h>
+
+#if !TARGET_OS_IPHONE
+#include <IOKit/usb/IOUSBBus.h>
+#endif /* TARGET_OS_IPHONE */
+
+#include <IOKit/usb/IOUSBNub.h>
+#include <IOKit/usb/IOUSBDevice.h>
+#include <IOKit/usb/IOUSBPipe.h>
+#include <IOKit/usb/USB.h>
+#include <IOKit/usb/IOUSBInterface.h>
+
+#include <UserNotification/KUNCUserNotifications.h>
+
+extern "C"
+{
+    #include <sys/param.h>
+    #include <sys/mbuf.h>
+}
+
+#define DEBUG_NAME "AppleUSBCDCNCMControl"
+
+#include "AppleUSBCDCNCM.h"
+#include "AppleUSBCDCNCMControl.h"
+#include "AppleUSBCDCNCMData.h"
+
+#define super IOService
+
+OSDefineMetaClassAndStructors(AppleUSBCDCNCMControl, IOService);
+
+/****************************************************************************************************/
+//
+//		Function:	findCDCDriverNC
+//
+//		Inputs:		controlAddr - my address
+//
+//		Outputs:
+//
+//		Desc:		Finds the initiating CDC driver
+//
+/****************************************************************************************************/
+
+AppleUSBCDC *findCDCDriverNC(void *controlAddr, IOReturn *retCode)
+{
+    AppleUSBCDCNCMControl	*me = (AppleUSBCDCNCMControl *)controlAddr;
+    AppleUSBCDC		*CDCDriver = NULL;
+    bool		driverOK = false;
+    OSIterator		*iterator = NULL;
+    OSDictionary	*matchingDictionary = NULL;
+
+    XTRACE(me, 0, 0, "findCDCDriverNC");
+
+        // Get matching dictionary
+
+    matchingDictionary = IOService::serviceMatching("AppleUSBCDC");
+    if (!matchingDictionary)
+    {
+        XTRACE(me, 0, 0, "findCDCDriverNC - Couldn't create a matching dictionary");
+		*retCode = kIOReturnError;
+        return NULL;
+    }
+
+	// Get an iterator
+
+    iterator = IOService::getMatchingServices(matchingDictionary);
+    if (!iterator)
+    {
+        XTRACE(me, 0, 0, "findCDCDriverNC - No AppleUSBCDC driver found!");
+        matchingDictionary->release();
+		*retCode = kIOReturnError;
+        return NULL;
+    }
+
+    	// Iterate until we find our matching CDC driver
+
+    CDCDriver = (AppleUSBCDC *)iterator->getNextObject();
+    while (CDCDriver)
+    {
+        XTRACEP(me, 0, CDCDriver, "findCDCDriverNC - CDC driver candidate");
+
+        if (me->fControlInterface->GetDevice() == CDCDriver->getCDCDevice())
+        {
+            XTRACEP(me, 0, CDCDriver, "findCDCDriverNC - Found our CDC driver");
+            driverOK = CDCDriver->confirmControl(kUSBNetworkControlModel, me->fControlInterface);
+            break;
+        }
+        CDCDriver = (AppleUSBCDC *)iterator->getNextObject();
+    }
+
+    matchingDictionary->release();
+    iterator->release();
+
+    if (!CDCDriver)
+    {
+        XTRACE(me, 0, 0, "findCDCDriverNC - CDC driver not found");
+		*retCode = kIOReturnNotReady;
+        return NULL;
+    }
+
+    if (!driverOK)
+    {
+        XTRACE(me, kUSBNetworkControlModel, 0, "findCDCDriverNC - Not my interface");
+		*retCode = kIOReturnError;
+        return NULL;
+    }
+
+	*retCode = kIOReturnSuccess;
+
+    return CDCDriver;
+
+}/* end findCDCDriverNC */
+
+/****************************************************************************************************/
+//
+//		Function:	AppleUSBCDCNCMControl::Asciihex_to_binary
+//
+//		Inputs:		c - Ascii character
+//
+//		Outputs:	return byte - binary byte
+//
+//		Desc:		Converts to hex (binary).
+//
+/****************************************************************************************************/
+
+UInt8 AppleUSBCDCNCMControl::Asciihex_to_binary(char c)
+{
+
+    if ('0' <= c && c <= '9')
+        return(c-'0');
+
+    if ('A' <= c && c <= 'F')
+        return((c-'A')+10);
+
+    if ('a' <= c && c <= 'f')
+        return((c-'a')+10);
+
+      // Not a hex digit, do whatever
+
+    return(0);
+
+}/* end Asciihex_to_binary */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::commReadComplete
+//
+//		Inputs:		obj - me
+//				param - unused
+//				rc - return code
+//				remaining - what's left
+//
+//		Outputs:
+//
+//		Desc:		Interrupt pipe (Comm interface) read completion routine
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMControl::commReadComplete(void *obj, void *param, IOReturn rc, UInt32 remaining)
+{
+    AppleUSBCDCNCMControl	*me = (AppleUSBCDCNCMControl*)obj;
+    IOReturn			ior;
+    UInt32			dLen;
+    UInt8			notif;
+ 	ConnectionSpeedChange	*speedChange;
+
+    if (rc == kIOReturnSuccess)	// If operation returned ok
+    {
+        dLen = COMM_BUFF_SIZE - remaining;
+        XTRACE(me, rc, dLen, "commReadComplete");
+
+        // Now look at the state stuff
+
+        notif = me->fCommPipeBuffer[1];
+        if (dLen > 7)
+        {
+            switch(notif)
+            {
+                case kUSBNETWORK_CONNECTION:
+                    me->fLinkStatus = me->fCommPipeBuffer[2];
+                    XTRACE(me, 0, me->fLinkStatus, "commReadComplete - kNetwork_Connection");
+					if (me->fDataDriver)
+					{
+						me->fDataDriver->linkStatusChange(me->fLinkStatus);
+					}
+                    break;
+                case kUSBCONNECTION_SPEED_CHANGE:
+                    if (dLen < sizeof(ConnectionSpeedChange))
+                    {
+                        XTRACE(me, 0, dLen, "commReadComplete - Short kConnection_Speed_Change");
+                        break;
+                    }
+                    speedChange = (ConnectionSpeedChange *)me->fCommPipeBuffer;
+					me->fUpSpeed = USBToHostLong(speedChange->USBitRate);
+					me->fDownSpeed = USBToHostLong(speedChange->DSBitRate);
+
+                    XTRACE(me, me->fUpSpeed, me->fDownSpeed, "commReadComplete - kConnection_Speed_Change");
+					if (me->fDataDriver)
+					{
+						me->fDataDriver->linkSpeedChange(me->fUpSpeed, me->fDownSpeed);
+					}
+                    break;
+                default:
+                    XTRACE(me, 0, notif, "commReadComplete - Unknown notification");
+                    break;
+            }
+        } else {
+            XTRACE(me, 0, notif, "commReadComplete - Invalid notification");
+        }
+    } else {
+        XTRACE(me, 0, rc, "commReadComplete - IO error");
+        if (rc != kIOReturnAborted)
+        {
+            rc = me->checkPipe(me->fCommPipe, false);
+            if (rc != kIOReturnSuccess)
+            {
+                XTRACE(me, 0, rc, "commReadComplete - clear stall failed (trying to continue)");
+            }
+        }
+    }
+
+    // Queue the next read, only if not aborted
+
+    if (rc != kIOReturnAborted)
+    {
+        ior = me->fCommPipe->Read(me->fCommPipeMDP, &me->fCommCompletionInfo, NULL);
+        if (ior != kIOReturnSuccess)
+        {
+            XTRACE(me, 0, rc, "commReadComplete - Read io error");
+            me->fCommDead = true;
+        }
+    }
+
+    return;
+
+}/* end commReadComplete */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::merWriteComplete
+//
+//		Inputs:		obj - me
+//				param - MER (may or may not be present depending on request)
+//				rc - return code
+//				remaining - what's left
+//
+//		Outputs:
+//
+//		Desc:		Management element request write completion routine
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMControl::merWriteComplete(void *obj, void *param, IOReturn rc, UInt32 remaining)
+{
+#if LDEBUG
+    AppleUSBCDCNCMControl	*me = (AppleUSBCDCNCMControl *)obj;
+#endif
+    IOUSBDevRequest		*MER = (IOUSBDevRequest*)param;
+    UInt16			dataLen;
+
+    if (MER)
+    {
+        if (rc == kIOReturnSuccess)
+        {
+            XTRACE(me, MER->bRequest, remaining, "merWriteComplete");
+        } else {
+            XTRACE(me, MER->bRequest, rc, "merWriteComplete - io err");
+        }
+
+        dataLen = MER->wLength;
+        XTRACE(me, 0, dataLen, "merWriteComplete - data length");
+        if ((dataLen != 0) && (MER->pData))
+        {
+            IOFree(MER->pData, dataLen);
+        }
+        IOFree(MER, sizeof(IOUSBDevRequest));
+
+    } else {
+        if (rc == kIOReturnSuccess)
+        {
+            XTRACE(me, 0, remaining, "merWriteComplete (request unknown)");
+        } else {
+            XTRACE(me, 0, rc, "merWriteComplete (request unknown) - io err");
+        }
+    }
+
+    return;
+
+}/* end merWriteComplete */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::probe
+//
+//		Inputs:		provider - my provider
+//
+//		Outputs:	IOService - from super::probe, score - probe score
+//
+//		Desc:		Modify the probe score if necessary (we don't  at the moment)
+//
+/****************************************************************************************************/
+
+IOService* AppleUSBCDCNCMControl::probe(IOService *provider, SInt32 *score)
+{
+    IOService   *res;
+
+		// If our IOUSBInterface has a "do not match" property, it means that we should not match and need
+		// to bail.  See rdar://3716623
+
+    OSBoolean *boolObj = OSDynamicCast(OSBoolean, provider->getProperty("kDoNotClassMatchThisInterface"));
+    if (boolObj && boolObj->isTrue())
+    {
+        XTRACE(this, 0, 0, "probe - provider doesn't want us to match");
+        return NULL;
+    }
+
+    res = super::probe(provider, score);
+
+    return res;
+
+}/* end probe */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::start
+//
+//		Inputs:		provider - my provider
+//
+//		Outputs:	Return code - true (it's me), false (sorry it probably was me, but I can't configure it)
+//
+//		Desc:		This is called once it has beed determined I'm probably the best
+//				driver for this device.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMControl::start(IOService *provider)
+{
+	IOReturn	rtn;
+	UInt16		devDriverCount = 0;
+	OSNumber	*sizeNumber;
+
+    XTRACEP(this, provider, 0, "start");
+
+	fCDCDriver = NULL;
+    fMax_Block_Size = kIOEthernetMaxPacketSize - kIOEthernetCRCSize;
+    fCommDead = false;
+    fReleased = false;
+    fPacketFilter = kPACKET_TYPE_DIRECTED | kPACKET_TYPE_BROADCAST | kPACKET_TYPE_MULTICAST;
+    fNCMCapabilities = 0;
+    fNtbInSizeWanted = kNTBInSizeDefault;
+    fNtbOutSize = kNTBOutSizeMax;
+    fNtbMinSize = kNTBSizeMin;
+    fpNetStats = NULL;
+    fpEtherStats = NULL;
+	fDataDriver = NULL;
+
+    if(!super::start(provider))
+    {
+        ALERT(0, 0, "start - super failed");
+        return false;
+    }
+
+    	// Get my USB provider - the interface
+
+    fControlInterface = OSDynamicCast(IOUSBInterface, provider);
+    if(!fControlInterface)
+    {
+        ALERT(0, 0, "start - provider invalid");
+        return false;
+    }
+
+		// See if we can find/wait for the CDC driver
+
+	while (!fCDCDriver)
+	{
+		rtn = kIOReturnSuccess;
+		fCDCDriver = findCDCDriverNC(this, &rtn);
+		if (fCDCDriver)
+		{
+			XTRACE (this, 0, fControlInterface->GetInterfaceNumber(), "start: Found the CDC device driver");
+			break;
+		} else {
+			if (rtn == kIOReturnNotReady)
+			{
+				devDriverCount++;
+				XTRACE(this, devDriverCount, fControlInterface->GetInterfaceNumber(), "start - Waiting for CDC device driver...");
+				if (devDriverCount > 9)
+				{
+					break;
+				}
+				IOSleep(100);
+			} else {
+				break;
+			}
+		}
+	}
+
+		// If we didn't find him then we have to bail
+
+	if (!fCDCDriver)
+	{
+		ALERT(0, fControlInterface->GetInterfaceNumber(), "start - Failed to find the CDC driver");
+        fControlInterface = NULL;
+        return false;
+	}
+
+		// Transfer block size overrides
+
+	sizeNumber = OSDynamicCast(OSNumber, provider->getProperty(ntbInSizeTag));
+	if (!sizeNumber)
+	{
+		sizeNumber = OSDynamicCast(OSNumber, getProperty(ntbInSizeTag));
+	}
+	if (sizeNumber)
+	{
+		fNtbInSizeWanted = sizeNumber->unsigned32BitValue();
+		XTRACE(this, 0, fNtbInSizeWanted, "start - Input block size override value");
+	}
+
+	sizeNumber = OSDynamicCast(OSNumber, provider->getProperty(ntbOutSizeTag));
+	if (!sizeNumber)
+	{
+		sizeNumber = OSDynamicCast(OSNumber, getProperty(ntbOutSizeTag));
+	}
+	if (sizeNumber)
+	{
+		fNtbOutSize = sizeNumber->unsigned32BitValue();
+		XTRACE(this, 0, fNtbOutSize, "start - Output block size override value");
+	}
+
+    if (!configureNCM())
+    {
+        ALERT(0, 0, "start - configureNCM failed");
+        fControlInterface = NULL;
+        return false;
+    }
+
+    if (!allocateResources())
+    {
+        ALERT(0, 0, "start - allocateResources failed");
+        fControlInterface = NULL;
+        return false;
+    }
+
+	fControlInterface->retain();
+
+    registerService();
+
+    XTRACE(this, 0, 0, "start - successful");
+
+    return true;
+
+}/* end start */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::free
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Clean up and free the object
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMControl::free()
+{
+
+    XTRACE(this, 0, 0, "free >>>");
+    if (fControlInterface)
+    {
+        fControlInterface->release();
+    }
+
+    if (fDataDriver)
+    {
+        fDataDriver = NULL;
+    }
+
+    if (fCommPipeMDP)
+    {
+        fCommPipeMDP->release();
+    }
+
+    super::free();
+
+    XTRACE(this, 0, 0, "free <<<");
+}/* end free */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::stop
+//
+//		Inputs:		provider - my provider
+//
+//		Outputs:
+//
+//		Desc:		Stops the driver
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMControl::stop(IOService *provider)
+{
+
+    XTRACE(this, 0, 0, "stop");
+
+    releaseResources();
+
+    super::stop(provider);
+
+    return;
+
+}/* end stop */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::configureNCM
+//
+//		Inputs:
+//
+//		Outputs:	return Code - true (device configured), false (device not configured)
+//
+//		Desc:		Gets the functional descriptors and the transfer block parameters
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMControl::configureNCM()
+{
+
+    XTRACE(this, 0, 0, "configureNCM");
+
+    fCommInterfaceNumber = fControlInterface->GetInterfaceNumber();
+    XTRACE(this, 0, fCommInterfaceNumber, "configureNCM - Comm interface number.");
+
+    if (!getFunctionalDescriptors())
+    {
+        ALERT(0, 0, "configureNCM - getFunctionalDescriptors failed");
+        return false;
+    }
+
+    if (!getNTBParameters())
+    {
+        ALERT(0, 0, "configureNCM - getNTBParameters failed");
+        return false;
+    }
+
+    return true;
+
+}/* end configureNCM */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::getFunctionalDescriptors
+//
+//		Inputs:
+//
+//		Outputs:	return - true (descriptors ok), false (somethings not right or not supported)
+//
+//		Desc:		Finds all the functional descriptors for the specific interface. NCM uses
+//				the Ethernet functional descriptor for the address and segment size and
+//				adds its own for the optional requests it supports.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMControl::getFunctionalDescriptors()
+{
+    bool				gotDescriptors = false;
+    bool				configok = true;
+    bool				enet = false;
+    IOReturn				ior;
+    const HDRFunctionalDescriptor 	*funcDesc = NULL;
+    ECMFunctionalDescriptor		*ENETFDesc = NULL;
+    UnionFunctionalDescriptor		*UNNFDesc;
+    NCMFunctionalDescriptor		*NCMFDesc;
+    UInt8				addrString;
+    char 				ascii_mac[14];
+    UInt16 				i;
+
+    XTRACE(this, 0, 0, "getFunctionalDescriptors");
+
+    do
+    {
+        funcDesc = (const HDRFunctionalDescriptor *)fControlInterface->FindNextAssociatedDescriptor((void*)funcDesc, CS_INTERFACE);
+        if (!funcDesc)
+        {
+            gotDescriptors = true;
+        } else {
+            switch (funcDesc->bDescriptorSubtype)
+            {
+                case Header_FunctionalDescriptor:
+                    XTRACE(this, funcDesc->bDescriptorType, funcDesc->bDescriptorSubtype, "getFunctionalDescriptors - Header Functional Descriptor");
+                    break;
+                case ECM_Functional_Descriptor:
+                    ENETFDesc = (ECMFunctionalDescriptor *)funcDesc;
+                    XTRACE(this, funcDesc->bDescriptorType, funcDesc->bDescriptorSubtype, "getFunctionalDescriptors - Ethernet Functional Descriptor");
+                    enet = true;
+                    break;
+                case NCM_Functional_Descriptor:
+                    NCMFDesc = (NCMFunctionalDescriptor *)funcDesc;
+                    XTRACE(this, funcDesc->bDescriptorType, funcDesc->bDescriptorSubtype, "getFunctionalDescriptors - NCM Functional Descriptor");
+                    if (NCMFDesc->bFunctionLength >= sizeof(NCMFunctionalDescriptor))
+                    {
+                        fNCMCapabilities = NCMFDesc->bmNetworkingCapabilities;
+                        XTRACE(this, USBToHostWord(NCMFDesc->bcdNcmVersion), fNCMCapabilities, "getFunctionalDescriptors - NCM version and capabilities");
+                    }
+                    break;
+                case Union_FunctionalDescriptor:
+                    UNNFDesc = (UnionFunctionalDescriptor *)funcDesc;
+                    XTRACE(this, funcDesc->bDescriptorType, funcDesc->bDescriptorSubtype, "getFunctionalDescriptors - Union Functional Descriptor");
+                    if (UNNFDesc->bFunctionLength > sizeof(FunctionalDescriptorHeader))
+                    {
+                        fDataInterfaceNumber = UNNFDesc->bSlaveInterface[0];		// Use the first slave
+                    } else {
+                        XTRACE(this, UNNFDesc->bFunctionLength, 0, "getFunctionalDescriptors - Union descriptor length error");
+                    }
+                    break;
+                default:
+                    XTRACE(this, funcDesc->bDescriptorType, funcDesc->bDescriptorSubtype, "getFunctionalDescriptors - unknown Functional Descriptor");
+                    break;
+            }
+        }
+    } while(!gotDescriptors);
+
+        // We keep the counts ourselves (the statistics requests are optional for NCM)
+
+    fOutputPktsOK = true;
+    fInputPktsOK = true;
+    fOutputErrsOK = true;
+    fInputErrsOK = true;
+
+    fMcFilters = 0;
+    addrString = fControlInterface->GetDevice()->GetSerialNumberStringIndex();	// Default to the serial number string
+
+    if (enet)
+    {
+        fMcFilters = USBToHostWord(ENETFDesc->wNumberMCFilters);
+        if (ENETFDesc->wMaxSegmentSize != 0)
+        {
+            fMax_Block_Size = USBToHostWord(ENETFDesc->wMaxSegmentSize);
+            XTRACE(this, 0, fMax_Block_Size, "getFunctionalDescriptors - Maximum segment size");
+        }
+        if (ENETFDesc->iMACAddress != 0)
+        {
+            addrString = ENETFDesc->iMACAddress;
+        }
+    }
+
+    ior = fControlInterface->GetDevice()->GetStringDescriptor(addrString, (char *)&ascii_mac, 13);
+    if (ior == kIOReturnSuccess)
+    {
+        for (i = 0; i < 6; i++)
+        {
+            fEaddr[i] = (Asciihex_to_binary(ascii_mac[i*2]) << 4) | Asciihex_to_binary(ascii_mac[i*2+1]);
+        }
+    } else {
+        ALERT(0, addrString, "getFunctionalDescriptors - Error retrieving Ethernet address");
+        configok = false;
+    }
+
+    return configok;
+
+}/* end getFunctionalDescriptors */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::controlRequest
+//
+//		Inputs:		request - the class request
+//				direction - kUSBIn or kUSBOut
+//				value - wValue
+//				data - the data (if any)
+//				length - size of the data
+//
+//		Outputs:	return code - from DeviceRequest
+//
+//		Desc:		Synchronous class request to this interface (configuration time only)
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMControl::controlRequest(UInt8 request, UInt8 direction, UInt16 value, void *data, UInt16 length)
+{
+    IOUSBDevRequest	devreq;
+    IOReturn		rtn;
+
+    XTRACE(this, request, length, "controlRequest");
+
+    devreq.bmRequestType = USBmakebmRequestType(direction, kUSBClass, kUSBInterface);
+    devreq.bRequest = request;
+    devreq.wValue = value;
+    devreq.wIndex = fCommInterfaceNumber;
+    devreq.wLength = length;
+    devreq.pData = data;
+
+    rtn = fControlInterface->GetDevice()->DeviceRequest(&devreq);
+    if (rtn == kIOUSBPipeStalled)
+    {
+        fControlInterface->GetDevice()->GetPipeZero()->ClearPipeStall(false);
+    }
+    if (rtn != kIOReturnSuccess)
+    {
+        XTRACE(this, request, rtn, "controlRequest - DeviceRequest failed");
+    }
+
+    return rtn;
+
+}/* end controlRequest */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::getNTBParameters
+//
+//		Inputs:
+//
+//		Outputs:	return - true (parameters ok), false (no NTB16, the request failed or
+//				the device can't take a full size datagram in a block)
+//
+//		Desc:		Gets the device's transfer block parameters and works out the sizes and
+//				alignment we'll use. The sizes are trimmed to our limits and to what a
+//				16 bit block can describe.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMControl::getNTBParameters()
+{
+    NTBParameters	params;
+    UInt32		outMax;
+    IOReturn		rtn;
+
+    XTRACE(this, 0, 0, "getNTBParameters");
+
+    bzero(&params, sizeof(params));
+    rtn = controlRequest(kGet_NTB_Parameters, kUSBIn, 0, &params, sizeof(params));
+    if (rtn != kIOReturnSuccess)
+    {
+        XTRACE(this, 0, rtn, "getNTBParameters - GET_NTB_PARAMETERS failed");
+        return false;
+    }
+
+    fNtbFormats = USBToHostWord(params.bmNtbFormatsSupported);
+    if (!(fNtbFormats & NCM_Format_Support_NTB16))
+    {
+        XTRACE(this, 0, fNtbFormats, "getNTBParameters - NTB16 not supported");
+        return false;
+    }
+
+        // The smallest block that still holds a full size datagram
+
+    fNtbMinSize = kNTH16Len + kNDP16Len + (2 * kDPE16Len) + fMax_Block_Size + 8;
+    if (fNtbMinSize < kNTBSizeMin)
+    {
+        fNtbMinSize = kNTBSizeMin;
+    }
+
+        // Input, what we'll ask for (the device may not honor it, see setNTBParameters)
+
+    fNtbInMaxSize = USBToHostLong(params.dwNtbInMaxSize);
+    if (fNtbInMaxSize > 0xffff)
+    {
+        fNtbInMaxSize = 0xffff;
+    }
+    if (fNtbInSizeWanted < fNtbMinSize)
+    {
+        fNtbInSizeWanted = fNtbMinSize;
+    }
+    fNtbInSize = min(fNtbInSizeWanted, fNtbInMaxSize);
+    if (fNtbInSize < fNtbMinSize)
+    {
+        XTRACE(this, fNtbInMaxSize, fNtbInSize, "getNTBParameters - Input block too small");
+        return false;
+    }
+
+        // Output
+
+    outMax = USBToHostLong(params.dwNtbOutMaxSize);
+    if (outMax > 0xffff)
+    {
+        outMax = 0xffff;
+    }
+    if (fNtbOutSize > outMax)
+    {
+        fNtbOutSize = outMax;
+    }
+    if (fNtbOutSize < fNtbMinSize)
+    {
+        XTRACE(this, outMax, fNtbOutSize, "getNTBParameters - Output block too small");
+        return false;
+    }
+
+    fNdpOutDivisor = USBToHostWord(params.wNdpOutDivisor);
+    if ((fNdpOutDivisor < 4) || (fNdpOutDivisor & (fNdpOutDivisor - 1)))
+    {
+        fNdpOutDivisor = 4;
+    }
+    fNdpOutRemainder = USBToHostWord(params.wNdpOutPayloadRemainder) & (fNdpOutDivisor - 1);
+    fNdpOutAlignment = USBToHostWord(params.wNdpOutAlignment);
+    if ((fNdpOutAlignment < 4) || (fNdpOutAlignment & (fNdpOutAlignment - 1)))
+    {
+        fNdpOutAlignment = 4;
+    }
+
+    fNtbOutDatagrams = USBToHostWord(params.wNtbOutMaxDatagrams);
+    if ((fNtbOutDatagrams == 0) || (fNtbOutDatagrams > kNTBOutDatagramsMax))
+    {
+        fNtbOutDatagrams = kNTBOutDatagramsMax;
+    }
+
+    XTRACE(this, fNtbInMaxSize, fNtbInSize, "getNTBParameters - Input block size (device max, ours)");
+    XTRACE(this, outMax, fNtbOutSize, "getNTBParameters - Output block size (device max, ours)");
+    XTRACE(this, fNdpOutDivisor, fNdpOutRemainder, "getNTBParameters - Output divisor and remainder");
+    XTRACE(this, fNdpOutAlignment, fNtbOutDatagrams, "getNTBParameters - Output NDP alignment and datagrams");
+
+    return true;
+
+}/* end getNTBParameters */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::setNTBParameters
+//
+//		Inputs:
+//
+//		Outputs:	return - true (ok to go), false (the device won't talk NTB16)
+//
+//		Desc:		Selects NTB16 and sets the input block size. Called by the data driver
+//				while its interface is still in the alternate setting with no endpoints
+//				(the device resets these when the data interface is selected). If the
+//				device doesn't take the input size it'll send its own maximum so the
+//				read buffers have to be that big (and it has to hold a full datagram).
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMControl::setNTBParameters()
+{
+    NTBInSize	inSize;
+    UInt32	inSize32;
+    IOReturn	rtn;
+
+    XTRACE(this, fNtbFormats, fNtbInSize, "setNTBParameters");
+
+    if (!fControlInterface)
+    {
+        XTRACE(this, 0, 0, "setNTBParameters - Control interface has gone");
+        return false;
+    }
+
+        // NTB16 is the default, it only needs selecting if the device can do both
+
+    if (fNtbFormats & NCM_Format_Support_NTB32)
+    {
+        rtn = controlRequest(kSet_NTB_Format, kUSBOut, NCM_Format_Selection_NTB16, NULL, 0);
+        if (rtn != kIOReturnSuccess)
+        {
+            ALERT(0, rtn, "setNTBParameters - SET_NTB_FORMAT failed");
+            return false;
+        }
+    }
+
+    if (fNCMCapabilities & NCM_Support_NTB_Size_8_Byte)
+    {
+        inSize.dwNtbInMaxSize = HostToUSBLong(fNtbInSize);
+        inSize.wNtbInMaxDatagrams = 0;					// No limit
+        inSize.wReserved = 0;
+        rtn = controlRequest(kSet_NTB_Input_Size, kUSBOut, 0, &inSize, sizeof(inSize));
+    } else {
+        inSize32 = HostToUSBLong(fNtbInSize);
+        rtn = controlRequest(kSet_NTB_Input_Size, kUSBOut, 0, &inSize32, sizeof(inSize32));
+    }
+    if (rtn != kIOReturnSuccess)
+    {
+        XTRACE(this, fNtbInSize, rtn, "setNTBParameters - SET_NTB_INPUT_SIZE failed, using the device maximum");
+        fNtbInSize = fNtbInMaxSize;
+        if (fNtbInSize < fNtbMinSize)
+        {
+            ALERT(fNtbMinSize, fNtbInSize, "setNTBParameters - Input block too small");
+            return false;
+        }
+    }
+
+    return true;
+
+}/* end setNTBParameters */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::dataAcquired
+//
+//		Inputs:		netStats - Network statistics structure address
+//				etherStats - Ethernet statistics structure address
+//
+//		Outputs:	return Code - true (it worked), false (it didn't)
+//
+//		Desc:		Tells this driver the data driver's port has been acquired
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMControl::dataAcquired(IONetworkStats *netStats, IOEthernetStats *etherStats)
+{
+    IOReturn 	rtn = kIOReturnSuccess;
+
+    XTRACE(this, 0, 0, "dataAcquired");
+
+            // Read the comm interrupt pipe for status (if we have one)
+
+    fCommCompletionInfo.target = this;
+    fCommCompletionInfo.action = commReadComplete;
+    fCommCompletionInfo.parameter = NULL;
+
+    if (fCommPipe)
+    {
+        rtn = fCommPipe->Read(fCommPipeMDP, &fCommCompletionInfo, NULL);
+    }
+    if (rtn == kIOReturnSuccess)
+    {
+
+            // Set up the management Element Request completion routine
+
+        fMERCompletionInfo.target = this;
+        fMERCompletionInfo.action = merWriteComplete;
+        fMERCompletionInfo.parameter = NULL;
+
+     } else {
+        XTRACE(this, 0, rtn, "dataAcquired - Reading the interrupt pipe failed");
+        return false;
+    }
+
+    fpNetStats = netStats;
+    fpEtherStats = etherStats;
+
+    fdataAcquired = true;
+
+    return true;
+
+}/* end dataAcquired */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::dataReleased
+//
+//		Inputs:		None
+//
+//		Outputs:	None
+//
+//		Desc:		Tells this driver the data driver's port has been released
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMControl::dataReleased()
+{
+
+    XTRACE(this, 0, 0, "dataReleased");
+
+	if (fCommPipe)
+	{
+		fCommPipe->Abort();
+	}
+    fdataAcquired = false;
+
+}/* end dataReleased */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::allocateResources
+//
+//		Inputs:
+//
+//		Outputs:	return code - true (allocate was successful), false (it failed)
+//
+//		Desc:		Finishes up the rest of the configuration and gets all the endpoints open etc.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMControl::allocateResources()
+{
+    IOUSBFindEndpointRequest	epReq;
+
+    XTRACE(this, 0, 0, "allocateResources.");
+
+        // Open the end point and get the buffers
+
+    if (!fControlInterface->open(this))
+    {
+        ALERT(0, 0, "allocateResources - open comm interface failed.");
+        return false;
+    }
+        // Interrupt pipe
+
+    epReq.type = kUSBInterrupt;
+    epReq.direction = kUSBIn;
+    fCommPipe = fControlInterface->FindNextPipe(0, &epReq);
+    if (!fCommPipe)
+    {
+        XTRACE(this, 0, 0, "allocateResources - no interrupt in pipe.");
+        fCommPipeMDP = NULL;
+        fCommPipeBuffer = NULL;
+        fLinkStatus = 1;					// Mark it active cause we'll never get told
+    } else {
+        XTRACE(this, epReq.maxPacketSize << 16 |epReq.interval, 0, "allocateResources - comm pipe.");
+
+            // Allocate Memory Descriptor Pointer with memory for the Interrupt pipe:
+
+        fCommPipeMDP = IOBufferMemoryDescriptor::withCapacity(COMM_BUFF_SIZE, kIODirectionIn);
+        if (!fCommPipeMDP)
+        {
+            XTRACE(this, 0, 0, "allocateResources - Couldn't allocate MDP for interrupt pipe");
+            return false;
+        }
+
+        fCommPipeBuffer = (UInt8*)fCommPipeMDP->getBytesNoCopy();
+        XTRACEP(this, 0, fCommPipeBuffer, "allocateResources - comm buffer");
+    }
+
+    return true;
+
+}/* end allocateResources */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::releaseResources
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Frees up the resources allocated in allocateResources
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMControl::releaseResources()
+{
+    XTRACE(this, 0, 0, "releaseResources >>>");
+
+    if (fReleased)
+        return;
+
+    if (fControlInterface)
+    {
+        XTRACE(this, 0, 0, "releaseResources release fControlInterface");
+        fControlInterface->close(this);
+        fControlInterface->release();
+        fControlInterface = NULL;
+    }
+
+    if (fCommPipeMDP)
+    {
+        fCommPipeMDP->release();
+        fCommPipeMDP = 0;
+    }
+
+    fReleased = true;
+
+    XTRACE(this, 0, 0, "releaseResources <<<");
+}/* end releaseResources */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::USBSetMulticastFilter
+//
+//		Inputs:		addrs - the list of addresses
+//				count - How many
+//
+//		Outputs:	true (sent), false (the device can't filter this many)
+//
+//		Desc:		Set up and send SetMulticastFilter Management Element Request(MER).
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMControl::USBSetMulticastFilter(IOEthernetAddress *addrs, UInt32 count)
+{
+    IOReturn		rc;
+    IOUSBDevRequest	*MER;
+    UInt8		*eaddrs;
+    UInt32		eaddLen;
+    UInt32		i;
+
+    XTRACE(this, fMcFilters, count, "USBSetMulticastFilter");
+
+    if (!fControlInterface)
+    {
+        XTRACE(this, fMcFilters, count, "USBSetMulticastFilter - Control interface has gone");
+        return true;
+    }
+
+    if ((count > (UInt32)(fMcFilters & kFiltersSupportedMask)) || (count > kNCMMaxMulticast))
+    {
+        XTRACE(this, 0, 0, "USBSetMulticastFilter - Not enough multicast filters");
+        return false;
+    }
+
+    MER = (IOUSBDevRequest*)IOMalloc(sizeof(IOUSBDevRequest));
+    if (!MER)
+    {
+        XTRACE(this, 0, 0, "USBSetMulticastFilter - allocate MER failed");
+        return false;
+    }
+    bzero(MER, sizeof(IOUSBDevRequest));
+
+        // Build the filter address buffer (freed in merWriteComplete)
+
+    eaddLen = count * kIOEthernetAddressSize;
+    eaddrs = NULL;
+    if (eaddLen > 0)
+    {
+        eaddrs = (UInt8 *)IOMalloc(eaddLen);
+        if (!eaddrs)
+        {
+            XTRACE(this, 0, 0, "USBSetMulticastFilter - allocate address buffer failed");
+            IOFree(MER, sizeof(IOUSBDevRequest));
+            return false;
+        }
+        for (i=0; i<count; i++)
+        {
+            bcopy(addrs[i].bytes, &eaddrs[i * kIOEthernetAddressSize], kIOEthernetAddressSize);
+        }
+    }
+
+        // Now build the Management Element Request
+
+    MER->bmRequestType = USBmakebmRequestType(kUSBOut, kUSBClass, kUSBInterface);
+    MER->bRequest = kSet_Ethernet_Multicast_Filter;
+    MER->wValue = count;
+    MER->wIndex = fCommInterfaceNumber;
+    MER->wLength = eaddLen;
+    MER->pData = eaddrs;
+
+    fMERCompletionInfo.parameter = MER;
+
+    rc = fControlInterface->GetDevice()->DeviceRequest(MER, &fMERCompletionInfo);
+    if (rc != kIOReturnSuccess)
+    {
+        XTRACE(this, MER->bRequest, rc, "USBSetMulticastFilter - Error issueing DeviceRequest");
+        if (eaddrs)
+        {
+            IOFree(eaddrs, eaddLen);
+        }
+        IOFree(MER, sizeof(IOUSBDevRequest));
+        return false;
+    }
+
+    return true;
+
+}/* end USBSetMulticastFilter */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::USBSetPacketFilter
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Set up and send SetEthernetPackettFilters Management Element Request(MER)
+//				(only if the device says it supports it).
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMControl::USBSetPacketFilter()
+{
+    IOReturn		rc;
+    IOUSBDevRequest	*MER;
+
+    XTRACE(this, fNCMCapabilities, fPacketFilter, "USBSetPacketFilter");
+
+    if (!fControlInterface)
+    {
+        XTRACE(this, 0, fPacketFilter, "USBSetPacketFilter - Control interface has gone");
+        return true;
+    }
+
+    if (!(fNCMCapabilities & NCM_Support_Packet_Filter))
+    {
+        XTRACE(this, 0, fPacketFilter, "USBSetPacketFilter - Not supported");
+        return true;
+    }
+
+    MER = (IOUSBDevRequest*)IOMalloc(sizeof(IOUSBDevRequest));
+    if (!MER)
+    {
+        XTRACE(this, 0, 0, "USBSetPacketFilter - allocate MER failed");
+        return false;
+    }
+    bzero(MER, sizeof(IOUSBDevRequest));
+
+        // Now build the Management Element Request
+
+    MER->bmRequestType = USBmakebmRequestType(kUSBOut, kUSBClass, kUSBInterface);
+    MER->bRequest = kSet_Ethernet_Packet_Filter;
+    MER->wValue = fPacketFilter;
+    MER->wIndex = fCommInterfaceNumber;
+    MER->wLength = 0;
+    MER->pData = NULL;
+
+    fMERCompletionInfo.parameter = MER;
+
+    rc = fControlInterface->GetDevice()->DeviceRequest(MER, &fMERCompletionInfo);
+    if (rc != kIOReturnSuccess)
+    {
+        XTRACE(this, MER->bRequest, rc, "USBSetPacketFilter - DeviceRequest error");
+        if (rc == kIOUSBPipeStalled)
+        {
+
+            // Clear the stall and try it once more
+
+            fControlInterface->GetDevice()->GetPipeZero()->ClearPipeStall(false);
+            rc = fControlInterface->GetDevice()->DeviceRequest(MER, &fMERCompletionInfo);
+        }
+        if (rc != kIOReturnSuccess)
+        {
+            XTRACE(this, MER->bRequest, rc, "USBSetPacketFilter - DeviceRequest failed");
+            IOFree(MER, sizeof(IOUSBDevRequest));
+            return false;
+        }
+    }
+
+    return true;
+
+}/* end USBSetPacketFilter */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::checkInterfaceNumber
+//
+//		Inputs:		dataDriver - the data driver enquiring
+//
+//		Outputs:
+//
+//		Desc:		Called by the data driver to ask if this is the correct
+//				control interface driver.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMControl::checkInterfaceNumber(AppleUSBCDCNCMData *dataDriver)
+{
+    IOUSBInterface	*dataInterface;
+
+    XTRACEP(this, 0, dataDriver, "checkInterfaceNumber");
+
+        // First check we have the same provider (Device)
+
+    dataInterface = OSDynamicCast(IOUSBInterface, dataDriver->getProvider());
+    if (dataInterface == NULL)
+    {
+        XTRACE(this, 0, 0, "checkInterfaceNumber - Error getting Data provider");
+        return FALSE;
+    }
+
+    XTRACEP(this, dataInterface->GetDevice(), fControlInterface->GetDevice(), "checkInterfaceNumber - Checking device");
+    if (dataInterface->GetDevice() == fControlInterface->GetDevice())
+    {
+
+            // Then check to see if it's the correct data interface number
+
+        if (dataDriver->fDataInterfaceNumber == fDataInterfaceNumber)
+        {
+            fDataDriver = dataDriver;
+            fDataDriver->retain();
+            return true;
+        } else {
+            XTRACE(this, dataDriver->fDataInterfaceNumber, fDataInterfaceNumber, "checkInterfaceNumber - Not correct interface number");
+        }
+    } else {
+        XTRACE(this, 0, 0, "checkInterfaceNumber - Not correct device");
+    }
+
+    return false;
+
+}/* end checkInterfaceNumber */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::checkPipe
+//
+//		Inputs:		thePipe - the pipe
+//				devReq - true(send CLEAR_FEATURE), false(only if status returns stalled)
+//
+//		Outputs:
+//
+//		Desc:		Clear a stall on the specified pipe. If ClearPipeStall is issued
+//				all outstanding I/O is returned with kIOUSBTransactionReturned and
+//				a CLEAR_FEATURE Endpoint stall is sent.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMControl::checkPipe(IOUSBPipe *thePipe, bool devReq)
+{
+    IOReturn 	rtn = kIOReturnSuccess;
+
+    XTRACEP(this, 0, thePipe, "checkPipe");
+
+    if (!devReq)
+    {
+        rtn = thePipe->GetPipeStatus();
+        if (rtn != kIOUSBPipeStalled)
+        {
+            XTRACE(this, 0, 0, "checkPipe - Pipe not stalled");
+            return rtn;
+        }
+    }
+
+    rtn = thePipe->ClearPipeStall(true);
+    if (rtn == kIOReturnSuccess)
+    {
+        XTRACE(this, 0, 0, "checkPipe - ClearPipeStall Successful");
+    } else {
+        XTRACE(this, 0, rtn, "checkPipe - ClearPipeStall Failed");
+    }
+
+    return rtn;
+
+}/* end checkPipe */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMControl::message
+//
+//		Inputs:		type - message type
+//				provider - my provider
+//				argument - additional parameters
+//
+//		Outputs:	return Code - kIOReturnSuccess
+//
+//		Desc:		Handles IOKit messages.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMControl::message(UInt32 type, IOService *provider, void *argument)
+{
+    IOReturn	ior;
+
+    XTRACE(this, 0, type, "message");
+
+    switch (type)
+    {
+        case kIOMessageServiceIsTerminated:
+            XTRACE(this, 0, type, "message - kIOMessageServiceIsTerminated");
+			if (fDataDriver)
+			{
+				fDataDriver->message(kIOMessageServiceIsTerminated, fControlInterface, NULL);
+			}
+            fTerminate = true;		// we're being terminated (unplugged)
+            if (fDataDriver)
+                fDataDriver->release();
+
+            releaseResources();
+            return kIOReturnSuccess;
+        case kIOMessageServiceIsSuspended:
+            XTRACE(this, 0, type, "message - kIOMessageServiceIsSuspended");
+            break;
+        case kIOMessageServiceIsResumed:
+            XTRACE(this, 0, type, "message - kIOMessageServiceIsResumed");
+            break;
+        case kIOMessageServiceIsRequestingClose:
+            XTRACE(this, 0, type, "message - kIOMessageServiceIsRequestingClose");
+            break;
+        case kIOMessageServiceWasClosed:
+            XTRACEP(this, provider, type, "message - kIOMessageServiceWasClosed");
+            break;
+        case kIOMessageServiceBusyStateChange:
+            XTRACE(this, 0, type, "message - kIOMessageServiceBusyStateChange");
+            break;
+        case kIOUSBMessagePortHasBeenResumed:
+            XTRACE(this, fCommDead, type, "message - kIOUSBMessagePortHasBeenResumed");
+            if (fCommDead)					// If it's dead try and resurrect it
+            {
+                ior = fCommPipe->Read(fCommPipeMDP, &fCommCompletionInfo, NULL);
+                if (ior != kIOReturnSuccess)
+                {
+                    XTRACE(this, 0, ior, "message - Read io error");
+                } else {
+                    fCommDead = false;
+                }
+            }
+            return kIOReturnSuccess;
+        case kIOUSBMessageHubResumePort:
+            XTRACE(this, 0, type, "message - kIOUSBMessageHubResumePort");
+            break;
+        default:
+            XTRACE(this, 0, type, "message - unknown message");
+            break;
+    }
+
+    return super::message(type, provider, argument);
+
+}/* end message */
@@ -0,0 +1,150 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __APPLEUSBCDCNCMControl__
+#define __APPLEUSBCDCNCMControl__
+
+#include "AppleUSBCDCCommon.h"
+#include "AppleUSBCDCNCMData.h"
+
+    // Miscellaneous
+
+#define COMM_BUFF_SIZE		16
+#define WATCHDOG_TIMER_MS       1000
+#define kDeviceSelfPowered	1
+
+    // Transfer block sizes (the device's parameters win if they're smaller)
+
+#define kNTBInSizeDefault	16384			// What we ask the device to send us
+#define kNTBOutSizeMax		16384			// Most we'll build
+#define kNTBSizeMin		2048			// Anything smaller isn't worth aggregating
+
+#define	ntbInSizeTag		"NTBInputSize"
+#define	ntbOutSizeTag		"NTBOutputSize"
+
+    // Multicast filters
+
+#define kNCMMaxMulticast	32			// Most addresses we'll send, more than this is all multicast
+
+enum
+{
+    kCDCPowerOffState	= 0,
+    kCDCPowerOnState	= 1,
+    kNumCDCStates	= 2
+};
+
+class AppleUSBCDCNCMData;
+
+        /* AppleUSBCDCNCMControl.h - This file contains the class definition for the		*/
+	/* USB Communication Device Class (CDC) Network Control Model driver. 			*/
+
+
+class AppleUSBCDCNCMControl : public IOService
+{
+    OSDeclareDefaultStructors(AppleUSBCDCNCMControl);	// Constructor & Destructor stuff
+
+private:
+	AppleUSBCDC				*fCDCDriver;		// The CDC driver
+	AppleUSBCDCNCMData		*fDataDriver;		// Our data interface driver
+    bool			fdataAcquired;				// Has the data port been acquired
+    bool			fTerminate;				// Are we being terminated (ie the device was unplugged)
+    UInt8			fPowerState;				// Ordinal for power management
+    bool			fCommDead;				// Interrupt read status
+    IOUSBPipe			*fCommPipe;				// The interrupt pipe
+    IOBufferMemoryDescriptor	*fCommPipeMDP;				// Interrupt pipe memory descriptor
+    UInt8			*fCommPipeBuffer;			// Interrupt pipe buffer
+    IOUSBCompletion		fCommCompletionInfo;			// Interrupt completion routine
+    IOUSBCompletion		fMERCompletionInfo;			// MER Completion routine
+    UInt8			fCommInterfaceNumber;			// My interface number
+
+    bool			fReady;
+    bool			fReleased;
+    UInt8			fLinkStatus;
+    UInt32			fUpSpeed;
+    UInt32			fDownSpeed;
+
+    UInt16			fNtbFormats;				// bmNtbFormatsSupported
+    UInt32			fNtbInMaxSize;				// Largest the device can send
+    UInt32			fNtbInSizeWanted;			// Configured (or default) input size
+    UInt32			fNtbMinSize;				// Smallest block that holds a full size datagram
+
+    static void			commReadComplete( void *obj, void *param, IOReturn ior, UInt32 remaining);
+    static void			merWriteComplete(void *obj, void *param, IOReturn ior, UInt32 remaining);
+
+public:
+
+    IOUSBInterface		*fControlInterface;
+    UInt8			fDataInterfaceNumber;			// Matching Data interface number
+
+    UInt16			fPacketFilter;
+    UInt8			fEaddr[6];
+    UInt16			fMcFilters;
+    UInt8			fNCMCapabilities;			// bmNetworkingCapabilities
+
+    UInt16			fMax_Block_Size;			// Largest datagram (wMaxSegmentSize)
+
+        // Transfer block parameters, from GET_NTB_PARAMETERS and trimmed to what we'll use
+
+    UInt32			fNtbInSize;				// Read buffer size (what the device was told)
+    UInt32			fNtbOutSize;				// Write buffer size
+    UInt16			fNdpOutDivisor;				// Datagram alignment on output
+    UInt16			fNdpOutRemainder;
+    UInt16			fNdpOutAlignment;			// NDP alignment on output
+    UInt16			fNtbOutDatagrams;			// Most datagrams per output block
+
+    IONetworkStats		*fpNetStats;
+    IOEthernetStats		*fpEtherStats;
+    bool			fInputPktsOK;
+    bool			fInputErrsOK;
+    bool			fOutputPktsOK;
+    bool			fOutputErrsOK;
+
+        // IOKit methods:
+
+	virtual IOService   *probe(IOService *provider, SInt32 *score);
+    virtual bool		start(IOService *provider);
+    virtual void		free(void);
+    virtual void		stop(IOService *provider);
+    virtual IOReturn 	message(UInt32 type, IOService *provider, void *argument = 0);
+
+        // CDC NCM Control Driver Methods
+
+    UInt8			Asciihex_to_binary(char c);
+    bool			configureNCM(void);
+    bool			getFunctionalDescriptors(void);
+    bool			getNTBParameters(void);
+    IOReturn			controlRequest(UInt8 request, UInt8 direction, UInt16 value, void *data, UInt16 length);
+    virtual bool		setNTBParameters(void);
+    virtual bool		dataAcquired(IONetworkStats *netStats, IOEthernetStats *etherStats);
+    virtual void		dataReleased(void);
+    bool 			allocateResources(void);
+    void			releaseResources(void);
+    virtual bool		checkInterfaceNumber(AppleUSBCDCNCMData *dataDriver);
+    IOReturn			checkPipe(IOUSBPipe *thePipe, bool devReq);
+    virtual bool		USBSetMulticastFilter(IOEthernetAddress *addrs, UInt32 count);
+    virtual bool		USBSetPacketFilter(void);
+
+}; /* end class AppleUSBCDCNCMControl */
+#endif
@@ -0,0 +1,3251 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <machine/limits.h>			/* UINT_MAX */
+#include <libkern/OSByteOrder.h>
+
+#include <IOKit/network/IOEthernetController.h>
+#include <IOKit/network/IOEthernetInterface.h>
+#include <IOKit/network/IOGatedOutputQueue.h>
+
+#include <IOKit/IOTimerEventSource.h>
+#include <IOKit/assert.h>
+#include <IOKit/IOLib.h>
+#include <IOKit/IOService.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOMessage.h>
+
+#include <IOKit/pwr_mgt/RootDomain.h>
+
+#if !TARGET_OS_IPHONE
+#include <IOKit/usb/IOUSBBus.h>
+#endif /* TARGET_OS_IPHONE */
+
+#include <IOKit/usb/IOUSBNub.h>
+#include <IOKit/usb/IOUSBDevice.h>
+#include <IOKit/usb/IOUSBPipe.h>
+#include <IOKit/usb/USB.h>
+#include <IOKit/usb/IOUSBInterface.h>
+
+#include <UserNotification/KUNCUserNotifications.h>
+
+extern "C"
+{
+    #include <sys/param.h>
+    #include <sys/mbuf.h>
+}
+
+#define DEBUG_NAME "AppleUSBCDCNCMData"
+ 
+#include "AppleUSBCDCNCM.h"
+#include "AppleUSBCDCNCMData.h"
+#include "linkup.h"
+
+static IOPMPowerState gOurPowerStates[kNumCDCStates] =
+{
+    {1,0,0,0,0,0,0,0,0,0,0,0},
+    {1,IOPMDeviceUsable,IOPMPowerOn,IOPMPowerOn,0,0,0,0,0,0,0,0}
+};
+    
+static struct MediumTable
+{
+    UInt32	type;
+    UInt32	speed;
+}
+
+mediumTable[] =
+{
+    { kIOMediumEthernetNone,																0    },
+    { kIOMediumEthernetAuto,																0    },
+    { kIOMediumEthernet10BaseT    | kIOMediumOptionHalfDuplex,								10   },
+    { kIOMediumEthernet10BaseT    | kIOMediumOptionFullDuplex,								10   },
+    { kIOMediumEthernet10BaseT    | kIOMediumOptionFullDuplex | kIOMediumOptionFlowControl,	10   },
+    { kIOMediumEthernet100BaseTX  | kIOMediumOptionHalfDuplex,								100  },
+    { kIOMediumEthernet100BaseTX  | kIOMediumOptionFullDuplex,								100  },
+    { kIOMediumEthernet100BaseTX  | kIOMediumOptionFullDuplex | kIOMediumOptionFlowControl,	100  },
+    { kIOMediumEthernet1000BaseTX | kIOMediumOptionFullDuplex,								1000 },
+    { kIOMediumEthernet1000BaseTX | kIOMediumOptionFullDuplex | kIOMediumOptionFlowControl,	1000 }
+};
+
+#define super IOEthernetController
+
+OSDefineMetaClassAndStructors(AppleUSBCDCNCMData, IOEthernetController);
+
+
+/****************************************************************************************************/
+//
+//		Function:	findCDCDriverND
+//
+//		Inputs:		myDevice - Address of the controlling device
+//				dataAddr - my address
+//				dataInterfaceNum - the data interface number
+//
+//		Outputs:
+//
+//		Desc:		Finds the initiating CDC driver and confirm the interface number
+//
+/****************************************************************************************************/
+
+IOReturn findCDCDriverND(IOUSBDevice *myDevice, void *dataAddr, UInt8 dataInterfaceNum)
+{
+    AppleUSBCDCNCMData	*me = (AppleUSBCDCNCMData *)dataAddr;
+    AppleUSBCDC		*CDCDriver = NULL;
+    bool		driverOK = false;
+    OSIterator		*iterator = NULL;
+    OSDictionary	*matchingDictionary = NULL;
+    UInt16		i;
+
+    XTRACE(me, 0, 0, "findCDCDriverND");
+
+        // Get matching dictionary
+
+    matchingDictionary = IOService::serviceMatching("AppleUSBCDC");
+    if (!matchingDictionary)
+    {
+        XTRACE(me, 0, 0, "findCDCDriverND - Couldn't create a matching dictionary");
+        return kIOReturnError;
+    }
+
+	// Get an iterator
+
+    iterator = IOService::getMatchingServices(matchingDictionary);
+    if (!iterator)
+    {
+        XTRACE(me, 0, 0, "findCDCDriverND - No AppleUSBCDC driver found!");
+        matchingDictionary->release();
+        return kIOReturnError;
+    }
+
+ 	// Iterate until we find our matching CDC driver
+
+    CDCDriver = (AppleUSBCDC *)iterator->getNextObject();
+    while (CDCDriver)
+    {
+        XTRACEP(me, 0, CDCDriver, "findCDCDriverND - CDC driver candidate");
+
+        if (me->fDataInterface->GetDevice() == CDCDriver->getCDCDevice())
+        {
+            XTRACEP(me, 0, CDCDriver, "findCDCDriverND - Found our CDC driver");
+            driverOK = CDCDriver->confirmDriver(kUSBNetworkControlModel, dataInterfaceNum);
+            break;
+        }
+        CDCDriver = (AppleUSBCDC *)iterator->getNextObject();
+    }
+
+    matchingDictionary->release();
+    iterator->release();
+
+    if (!CDCDriver)
+    {
+        XTRACE(me, 0, 0, "findCDCDriverND - CDC driver not found");
+        return kIOReturnNotReady;
+    }
+
+    if (!driverOK)
+    {
+        XTRACE(me, kUSBNetworkControlModel, dataInterfaceNum, "findCDCDriverND - Not my interface");
+        return kIOReturnError;
+    }
+
+    me->fConfigAttributes = CDCDriver->fbmAttributes;
+
+    for (i=0; i<6; i++)
+    {
+        me->fEthernetaddr[i] = CDCDriver->fCacheEaddr[i];
+    }
+
+    return kIOReturnSuccess;
+
+}/* end findCDCDriverND */
+
+/****************************************************************************************************/
+//
+//		Function:	findControlDriverND
+//
+//		Inputs:		me - my address
+//
+//		Outputs:
+//
+//		Desc:		Finds our matching control driver
+//
+/****************************************************************************************************/
+
+IOReturn findControlDriverND(AppleUSBCDCNCMData *me)
+{
+    AppleUSBCDCNCMControl	*tempDriver = NULL;
+    OSIterator			*iterator = NULL;
+    OSDictionary		*matchingDictionary = NULL;
+
+    XTRACE(me, 0, 0, "findControlDriverND");
+
+	me->fControlDriver = NULL;
+
+        // Get matching dictionary
+
+    matchingDictionary = IOService::serviceMatching("AppleUSBCDCNCMControl");
+    if (!matchingDictionary)
+    {
+        XTRACE(me, 0, 0, "findControlDriverND - Couldn't create a matching dictionary");
+        return kIOReturnError;
+    }
+
+	// Get an iterator
+
+    iterator = IOService::getMatchingServices(matchingDictionary);
+    if (!iterator)
+    {
+        XTRACE(me, 0, 0, "findControlDriverND - No AppleUSBCDCNCMControl drivers found (iterator)");
+        matchingDictionary->release();
+        return kIOReturnError;
+    }
+
+	// Iterate until we find our matching driver
+
+    tempDriver = (AppleUSBCDCNCMControl *)iterator->getNextObject();
+    while (tempDriver)
+    {
+        XTRACEP(me, 0, tempDriver, "findControlDriverND - Control driver candidate");
+        if (tempDriver->checkInterfaceNumber((AppleUSBCDCNCMData *)me))
+        {
+            XTRACEP(me, 0, tempDriver, "findControlDriverND - Found our control driver");
+            me->fControlDriver = tempDriver;
+            break;
+        }
+        tempDriver = (AppleUSBCDCNCMControl *)iterator->getNextObject();
+    }
+
+    matchingDictionary->release();
+    iterator->release();
+
+    if (!me->fControlDriver)
+    {
+        XTRACE(me, 0, 0, "findControlDriverND - Failed");
+        return kIOReturnError;
+    }
+
+    return kIOReturnSuccess;
+
+}/* end findControlDriverND */
+
+#if LOG_DATA
+#define dumplen		32		// Set this to the number of bytes to dump and the rest should work out correct
+
+#define buflen		((dumplen*2)+dumplen)+3
+#define Asciistart	(dumplen*2)+3
+
+/****************************************************************************************************/
+//
+//		Function:	AppleUSBCDCNCMData::USBLogData
+//
+//		Inputs:		Dir - direction
+//				Count - number of bytes
+//				buf - the data
+//
+//		Outputs:	
+//
+//		Desc:		Puts the data in the log. 
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::USBLogData(UInt8 Dir, SInt32 Count, char *buf)
+{    
+    SInt32	wlen;
+    UInt8	tDir = Dir;
+    SInt32	llen, rlen;
+    SInt16	i, Aspnt, Hxpnt;
+    UInt8	wchr;
+    char	LocBuf[buflen+1];
+    
+    XTRACE(0, 0, Count, "USBLogData >>>>");
+
+    
+    switch (tDir)
+    {
+        case kDataIn:
+            Log("AppleUSBCDCNCMData: USBLogData - Read Complete, address = %8p, size = %8d\n", (void *)buf, (UInt)Count);
+            break;
+        case kDataOut:
+            Log("AppleUSBCDCNCMData: USBLogData - Write, address = %8p, size = %8d\n", (void *)buf, (UInt)Count);
+            break;
+        case kDataOther:
+            Log("AppleUSBCDCNCMData: USBLogData - Other, address = %8p, size = %8d\n", (void *)buf, (UInt)Count);
+            break;
+        case kDataNone:
+            tDir = kDataOther;
+            break;
+    }
+
+#if DUMPALL
+    wlen = Count;
+#else
+    if (Count > dumplen)
+    {
+        wlen = dumplen;
+    } else {
+        wlen = Count;
+    }
+#endif
+
+    if (wlen == 0)
+    {
+        Log("AppleUSBCDCNCMData: USBLogData - No data, Count=0\n");
+        return;
+    }
+
+    rlen = 0;
+    do
+    {
+        memset(LocBuf, 0x20, buflen);
+        
+        if (wlen > dumplen)
+        {
+            llen = dumplen;
+            wlen -= dumplen;
+        } else {
+            llen = wlen;
+            wlen = 0;
+        }
+        Aspnt = Asciistart;
+        Hxpnt = 0;
+        for (i=1; i<=llen; i++)
+        {
+            wchr = buf[i-1];
+            LocBuf[Hxpnt++] = Asciify(wchr >> 4);
+            LocBuf[Hxpnt++] = Asciify(wchr);
+            if ((wchr < 0x20) || (wchr > 0x7F)) 		// Non printable characters
+            {
+                LocBuf[Aspnt++] = 0x2E;				// Replace with a period
+            } else {
+                LocBuf[Aspnt++] = wchr;
+            }
+        }
+        LocBuf[Aspnt] = 0x00;
+		
+		Log("%s\n", LocBuf);
+#if USE_IOL
+        IOSleep(Sleep_Time);					// Try and keep the log from overflowing
+#endif       
+        rlen += llen;
+        buf = &buf[rlen];
+    } while (wlen != 0);
+
+    XTRACE(0, Dir, Count, "USBLogData <<<<");
+    
+}/* end USBLogData */
+
+/****************************************************************************************************/
+//
+//		Function:	AppleUSBCDCNCMData::dumpData
+//
+//		Inputs:		buf - the data
+//				size - number of bytes
+//
+//		Outputs:	None
+//
+//		Desc:		Creats formatted data for the log (cannot be used at interrupt time) 
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::dumpData(char *buf, SInt32 size)
+{
+    SInt32	curr, len, dlen;
+
+    Log("AppleUSBCDCNCMData: dumpData - Address = %8p, size = %8d\n", (void *)buf, (UInt)size);
+
+    dlen = 0;
+    len = size;
+    
+    for (curr=0; curr<size; curr+=dumplen)
+    {
+        if (len > dumplen)
+        {
+            dlen = dumplen;
+        } else {
+            dlen = len;
+        }
+        Log("%8p ", (void *)&buf[curr]);
+        USBLogData(kDataNone, dlen, &buf[curr]);
+        len -= dlen;
+    }
+   
+}/* end dumpData */
+#endif
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::dataReadComplete
+//
+//		Inputs:		obj - me
+//				param - the input buffer
+//				rc - return code
+//				remaining - what's left
+//
+//		Outputs:
+//
+//		Desc:		BulkIn pipe (Data interface) read completion routine, each read is a
+//				whole transfer block
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::dataReadComplete(void *obj, void *param, IOReturn rc, UInt32 remaining)
+{
+    AppleUSBCDCNCMData	*me = (AppleUSBCDCNCMData*)obj;
+    IOReturn			ior;
+	pipeInBuffers		*pipeInBuff = (pipeInBuffers *)param;
+
+    XTRACE(me, 0, pipeInBuff->indx, "dataReadComplete");
+
+    if (me->fTerminate)
+        return;
+
+    if (rc == kIOReturnSuccess)	// If operation returned ok
+    {
+        XTRACE(me, 0, me->fNtbInSize - remaining, "dataReadComplete - data length");
+
+        meLogData(kDataIn, (me->fNtbInSize - remaining), pipeInBuff->pipeInBuffer);
+
+			// If the link is down we're probably in the state where the device is not sending interrupts
+			// If we're in the ready state then we probably need to start things up
+
+		if (me->fLinkStatus == kLinkDown)
+		{
+			XTRACE(me, 0, me->fReady, "dataReadComplete - Link is down, checking ready state");
+			if (me->fReady)
+			{
+				me->linkStatusChange(kLinkUp);
+			}
+		}
+
+            // Take the datagrams out of the block and move them up the stack
+
+        me->receiveNTB(pipeInBuff->pipeInBuffer, me->fNtbInSize - remaining);
+
+    } else {
+        XTRACE(me, 0, rc, "dataReadComplete - Read completion io err");
+        if (rc != kIOReturnAborted)
+        {
+			me->fRxCounters.errPipe++;
+			me->fDeferredClear = true;
+        }
+    }
+
+        // Queue the next read, only if not aborted
+
+    if (rc != kIOReturnAborted)
+    {
+        ior = me->fInPipe->Read(pipeInBuff->pipeInMDP, &pipeInBuff->readCompletionInfo, NULL);
+        if (ior != kIOReturnSuccess)
+        {
+            XTRACE(me, 0, ior, "dataReadComplete - Failed to queue read");
+            pipeInBuff->dead = true;
+        }
+    } else {
+        XTRACE(me, pipeInBuff->indx, 0, "dataReadComplete - Read terminated");
+        pipeInBuff->dead = true;
+    }
+
+    return;
+
+}/* end dataReadComplete */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::dataWriteComplete
+//
+//		Inputs:		obj - me
+//				param - index of the output buffer
+//				rc - return code
+//				remaining - what's left
+//
+//		Outputs:
+//
+//		Desc:		BulkOut pipe (Data interface) write completion routine
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::dataWriteComplete(void *obj, void *param, IOReturn rc, UInt32 remaining)
+{
+    AppleUSBCDCNCMData	*me = (AppleUSBCDCNCMData *)obj;
+    UInt32			poolIndx = (UInt32)(uintptr_t)param;
+	pipeOutBuffers		*pipeOutBuff = &me->fPipeOutBuff[poolIndx];
+    UInt32			pktLen;
+
+    if (rc == kIOReturnSuccess)						// If operation returned ok
+    {
+        XTRACE(me, rc, pipeOutBuff->indx, "dataWriteComplete");
+
+        pktLen = pipeOutBuff->length;
+        if (cdc_NeedZLP(pktLen, me->fOutPacketSize))		// A full block that's a multiple of max packet size needs a zero length write
+        {
+            XTRACE(me, rc, pktLen, "dataWriteComplete - writing zero length packet");
+            pipeOutBuff->length = 0;
+            pipeOutBuff->writeCompletionInfo.parameter = (void *)(uintptr_t)poolIndx;
+            rc = me->fOutPipe->Write(pipeOutBuff->pipeOutMDP, kPipeNoDataTimeout, kPipeCompletionTimeout, 0, &pipeOutBuff->writeCompletionInfo);
+            if (rc == kIOReturnSuccess)
+            {
+                return;							// Buffer's done when that completes
+            }
+            XTRACE(me, rc, pipeOutBuff->indx, "dataWriteComplete - zero length write failed");
+            me->fTxDoneCounters.errPipe += pipeOutBuff->count;
+            me->fDeferredClear = true;
+        }
+    } else {
+        XTRACE(me, rc, pipeOutBuff->indx, "dataWriteComplete - IO err");
+
+        if (rc != kIOReturnAborted)
+        {
+            me->fTxDoneCounters.errPipe += pipeOutBuff->count;
+			me->fDeferredClear = true;
+        }
+    }
+
+        // The buffer goes back to the pool, restart the queue if it was waiting for one
+
+    pipeOutBuff->length = 0;
+    pipeOutBuff->count = 0;
+    pipeOutBuff->avail = true;
+    OSDecrementAtomic(&me->fTxOutstanding);
+    OSMemoryBarrier();					// Buffer's back before fTxStalled is looked at
+
+    if (me->fTxStalled && me->fReady)
+    {
+        me->fTxStalled = false;
+        me->fTransmitQueue->service(IOBasicOutputQueue::kServiceAsync);
+    }
+
+    return;
+
+}/* end dataWriteComplete */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::init
+//
+//		Inputs:		properties - data (keys and values) used to match
+//
+//		Outputs:	Return code - true (init successful), false (init failed)
+//
+//		Desc:		Initialize the driver.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::init(OSDictionary *properties)
+{
+
+    XTRACE(this, 0, 0, "init");
+
+    if (super::init(properties) == false)
+    {
+        XTRACE(this, 0, 0, "init - initialize super failed");
+        return false;
+    }
+
+    fAltInterface = -1;
+    fTerminate = false;
+	fResetState = kResetNormal;
+	fSleeping = false;
+	fDeferredClear = false;
+
+	fLinkStatus = kLinkDown;
+	fUpSpeed = 10000000;				// Set to 10 until we know better (bits/sec)
+    fDownSpeed = 10000000;				// Same here
+    fNtbInSize = 0;
+    fNtbOutSize = 0;
+    fInPacketSize = 0;
+    fOutPacketSize = 0;
+    fTxOutstanding = 0;
+    fTxAgg = true;
+    fTxNTB = NULL;
+    fTxNTBLen = 0;
+    fTxSequence = 0;
+    fTxAggTimer = NULL;
+    bzero(&fTxCounters, sizeof(fTxCounters));
+    bzero(&fTxDoneCounters, sizeof(fTxDoneCounters));
+    bzero(&fRxCounters, sizeof(fRxCounters));
+    bzero(&fHostTotals, sizeof(fHostTotals));
+
+    fQueueStarted = false;              // State of the IO output queue
+    fTxStalled = false;
+
+    fPipeInBuff = NULL;				// Allocated in start once the pool sizes are known
+    fPipeOutBuff = NULL;
+    fOutBufAlloc = 0;
+    fInBufPool = 0;
+    fOutBufPool = 0;
+    fOutPoolIndex = 0;
+
+    return true;
+
+}/* end init*/
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::probe
+//
+//		Inputs:		provider - my provider
+//
+//		Outputs:	IOService - from super::probe, score - probe score
+//
+//		Desc:		Modify the probe score if necessary (we don't at the moment)
+//
+/****************************************************************************************************/
+
+IOService* AppleUSBCDCNCMData::probe(IOService *provider, SInt32 *score)
+{
+    IOService   *res;
+
+		// If our IOUSBInterface has a "do not match" property, it means that we should not match and need
+		// to bail.  See rdar://3716623
+
+    OSBoolean *boolObj = OSDynamicCast(OSBoolean, provider->getProperty("kDoNotClassMatchThisInterface"));
+    if (boolObj && boolObj->isTrue())
+    {
+        XTRACE(this, 0, 0, "probe - provider doesn't want us to match");
+        return NULL;
+    }
+
+    res = super::probe(provider, score);
+
+    return res;
+
+}/* end probe */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::start
+//
+//		Inputs:		provider - my provider
+//
+//		Outputs:	Return code - true (it's me), false (sorry it probably was me, but I can't configure it)
+//
+//		Desc:		This is called once it has beed determined I'm probably the best
+//				driver for this device.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::start(IOService *provider)
+{
+	IOReturn	ret = kIOReturnSuccess;
+	UInt16		devDriverCount = 0;
+    OSNumber	*bufNumber = NULL;
+    OSBoolean	*txAgg;
+    UInt16		bufValue = 0;
+
+    XTRACE(this, 0, 0, "start");
+
+		// Get my USB provider - the interface
+
+    fDataInterface = OSDynamicCast(IOUSBInterface, provider);
+    if(!fDataInterface)
+    {
+        ALERT(0, 0, "start - provider invalid");
+        return false;
+    }
+
+    fDataInterfaceNumber = fDataInterface->GetInterfaceNumber();
+
+		// See if we can find/wait for the CDC driver
+
+	while (1)
+	{
+		ret = findCDCDriverND(fDataInterface->GetDevice(), this, fDataInterfaceNumber);
+		if (ret == kIOReturnSuccess)
+		{
+			XTRACE (this, 0, 0, "start: Found the CDC device driver");
+			break;
+		} else {
+			if (ret == kIOReturnNotReady)
+			{
+				devDriverCount++;
+				XTRACE(this, devDriverCount, fDataInterfaceNumber, "start - Waiting for CDC device driver...");
+				if (devDriverCount > 9)
+				{
+					break;
+				}
+				IOSleep(100);
+			} else {
+				break;
+			}
+		}
+	}
+
+		// If we didn't find him then we have to bail
+
+	if (ret != kIOReturnSuccess)
+	{
+		ALERT(0, fDataInterfaceNumber, "start - Find CDC driver for NCM data interface failed");
+        fDataInterface = NULL;
+		return false;
+	}
+
+		// Now we can start for real
+
+	if(!super::start(provider))
+    {
+        ALERT(0, 0, "start - start super failed");
+        return false;
+    }
+
+        // get workloop - check it first as createOutputQueue is called very early
+
+	if (!fWorkLoop)
+	{
+		fWorkLoop = getWorkLoop();
+		if (!fWorkLoop)
+		{
+			ALERT(0, 0, "start - getWorkLoop failed");
+			return false;
+		}
+	}
+
+    if (!configureData())
+    {
+        ALERT(0, 0, "start - configureData failed");
+        return false;
+    }
+
+		// Check for an input buffer pool override first
+
+	fInBufPool = 0;
+	fOutBufPool = 0;
+
+	bufNumber = OSDynamicCast(OSNumber, provider->getProperty(inputTag));
+    if (!bufNumber)
+    {
+        bufNumber = OSDynamicCast(OSNumber, getProperty(inputTag));
+    }
+    if (bufNumber)
+    {
+		bufValue = bufNumber->unsigned16BitValue();
+		XTRACE(this, 0, bufValue, "start - Number of input buffers requested");
+        if (bufValue <= kMaxInBufPool)
+        {
+            fInBufPool = bufValue;
+        } else {
+            fInBufPool = kMaxInBufPool;
+        }
+	}
+	if (fInBufPool == 0)
+	{
+		fInBufPool = kInBufPool;
+	}
+
+		// Then the output buffer pool
+
+	bufNumber = OSDynamicCast(OSNumber, provider->getProperty(outputTag));
+    if (!bufNumber)
+    {
+        bufNumber = OSDynamicCast(OSNumber, getProperty(outputTag));
+    }
+    if (bufNumber)
+    {
+		bufValue = bufNumber->unsigned16BitValue();
+		XTRACE(this, 0, bufValue, "start - Number of output buffers requested");
+        if (bufValue <= kMaxOutBufPool)
+        {
+            fOutBufPool = bufValue;
+        } else {
+            fOutBufPool = kMaxOutBufPool;
+        }
+	}
+	if (fOutBufPool == 0)
+	{
+		fOutBufPool = kOutBufPool;
+	}
+
+    if (!allocatePools())
+    {
+        ALERT(0, 0, "start - allocatePools failed");
+        return false;
+    }
+
+    txAgg = OSDynamicCast(OSBoolean, provider->getProperty(txAggTag));
+    if (!txAgg)
+    {
+        txAgg = OSDynamicCast(OSBoolean, getProperty(txAggTag));
+    }
+    if (txAgg && txAgg->isFalse())
+    {
+        XTRACE(this, 0, 0, "start - Transmit aggregation disabled");
+        fTxAgg = false;
+    }
+
+        // Partly filled blocks go when this fires, no timer means no aggregation
+
+    if (fTxAgg)
+    {
+        fTxAggTimer = IOTimerEventSource::timerEventSource(this, txAggTimerFired);
+        if (fTxAggTimer)
+        {
+            if (fWorkLoop->addEventSource(fTxAggTimer) != kIOReturnSuccess)
+            {
+                XTRACE(this, 0, 0, "start - Add aggregation timer event source failed");
+                fTxAggTimer->release();
+                fTxAggTimer = NULL;
+            }
+        }
+        if (!fTxAggTimer)
+        {
+            fTxAgg = false;
+        }
+    }
+
+    UInt16 myVID = fDataInterface->GetDevice()->GetVendorID();
+    UInt16 myPID = fDataInterface->GetDevice()->GetProductID();
+
+    char vendorString[20];
+    char productString[20];
+    snprintf(vendorString, sizeof(vendorString), "0x%X", myVID);
+    snprintf(productString, sizeof(productString), "0x%X", myPID);
+
+    cdc_LogToMessageTracer(CDC_ASL_DOMAIN, "AppleUSBCDCNCMData", vendorString, productString, 0, 0);
+
+    XTRACE(this, fInBufPool, fOutBufPool, "start - Buffer pools (input, output)");
+
+    if (findControlDriverND(this) != kIOReturnSuccess)
+    {
+        ALERT(0, 0, "start - Find control driver failed");
+    }
+
+    if (!createNetworkInterface())
+    {
+        ALERT(0, 0, "start - createNetworkInterface failed");
+        return false;
+    }
+
+         // Looks like we're ok (being defensive here)
+
+	if (fDataInterface)
+		fDataInterface->retain();
+
+	if (fWorkLoop)
+		fWorkLoop->retain();
+
+	if (fTransmitQueue)
+		fTransmitQueue->retain();
+
+    XTRACE(this, 0, 0, "start - successful");
+	Log(DEBUG_NAME ": Version number - %s, Input buffers %d, Output buffers %d\n", VersionNumber, fInBufPool, fOutBufPool);
+
+    return true;
+
+}/* end start */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::free
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Clean up and free the object
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::free()
+{
+
+    XTRACE(this, 0, 0, "free >>>");
+
+    if (fNetworkInterface)
+    {
+        fNetworkInterface->release();
+    }
+
+    if (fMediumDict)
+    {
+        fMediumDict->release();
+    }
+
+    if (fWorkLoop)
+    {
+        fWorkLoop->release();
+    }
+
+    if (fTransmitQueue)
+    {
+        fTransmitQueue->release();
+    }
+
+    freePools();
+
+    super::free();
+
+    XTRACE(this, 0, 0, "free <<<");
+}/* end free */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::stop
+//
+//		Inputs:		provider - my provider
+//
+//		Outputs:
+//
+//		Desc:		Stops the driver
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::stop(IOService *provider)
+{
+
+    XTRACE(this, 0, 0, "stop");
+
+    fReady = false;
+
+    if (fTxAggTimer)
+    {
+        fTxAggTimer->cancelTimeout();
+        if (fWorkLoop)
+        {
+            fWorkLoop->removeEventSource(fTxAggTimer);
+        }
+        fTxAggTimer->release();
+        fTxAggTimer = NULL;
+    }
+
+        // Release all resources
+
+    releaseResources();
+
+    if (fNetworkInterface)
+    {
+        detachInterface(fNetworkInterface, FALSE);
+    }
+
+    super::stop(provider);
+
+    return;
+
+}/* end stop */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::configureData
+//
+//		Inputs:
+//
+//		Outputs:	return code - true (configure was successful), false (it failed)
+//
+//		Desc:		Finds the alternate setting with the bulk endpoints. It isn't selected
+//				here, the transfer block parameters have to be set while the interface
+//				is still in the setting with no endpoints (see wakeUp).
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::configureData()
+{
+    IOUSBFindInterfaceRequest		req;
+    const IOUSBInterfaceDescriptor	*altInterfaceDesc;
+    UInt16				numends = 0;
+
+    XTRACE(this, 0, 0, "configureData.");
+
+    if (!fDataInterface)
+    {
+        XTRACE(this, 0, 0, "configureData - Data interface is NULL");
+        return false;
+    }
+
+    if (!fDataInterface->open(this))
+    {
+        XTRACE(this, 0, 0, "configureData - open data interface failed");
+        return false;
+    }
+
+    req.bInterfaceClass = kUSBDataClass;
+    req.bInterfaceSubClass = 0;
+    req.bInterfaceProtocol = kIOUSBFindInterfaceDontCare;
+    req.bAlternateSetting = kIOUSBFindInterfaceDontCare;
+    altInterfaceDesc = fDataInterface->FindNextAltInterface(NULL, &req);
+    while (altInterfaceDesc)
+    {
+        numends = altInterfaceDesc->bNumEndpoints;
+        if (numends > 1)
+        {
+            fAltInterface = altInterfaceDesc->bAlternateSetting;
+            XTRACE(this, numends, fAltInterface, "configureData - Data Class interface (alternate) found");
+            break;
+        } else {
+            XTRACEP(this, 0, altInterfaceDesc, "configureData - No endpoints this alternate");
+        }
+        altInterfaceDesc = fDataInterface->FindNextAltInterface(altInterfaceDesc, &req);
+    }
+
+    if (numends < 2)
+    {
+        XTRACE(this, 0, 0, "configureData - Could not find the correct interface");
+        return false;
+    }
+
+    return true;
+
+}/* end configureData */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::createNetworkInterface
+//
+//		Inputs:
+//
+//		Outputs:	return Code - true (created and initialilzed ok), false (it failed)
+//
+//		Desc:		Creates and initializes the network interface
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::createNetworkInterface()
+{
+
+    XTRACE(this, 0, 0, "createNetworkInterface");
+
+            // Allocate memory for transmit queue
+
+    fTransmitQueue = (IOGatedOutputQueue *)getOutputQueue();
+    if (!fTransmitQueue)
+    {
+        ALERT(0, 0, "createNetworkInterface - Output queue initialization failed");
+        return false;
+    }
+
+        // Allocate Timer event source
+
+    fTimerSource = IOTimerEventSource::timerEventSource(this, timerFired);
+    if (fTimerSource == NULL)
+    {
+        ALERT(0, 0, "createNetworkInterface - Allocate Timer event source failed");
+        return false;
+    }
+
+	if (fWorkLoop)
+	{
+		if (fWorkLoop->addEventSource(fTimerSource) != kIOReturnSuccess)
+		{
+			ALERT(0, 0, "createNetworkInterface - Add Timer event source failed");
+			return false;
+		}
+	}
+
+        // Attach an IOEthernetInterface client (and register it)
+
+    XTRACE(this, 0, 0, "createNetworkInterface - attaching and registering interface");
+
+    if (!attachInterface((IONetworkInterface **)&fNetworkInterface))
+    {
+        ALERT(0, 0, "createNetworkInterface - attachInterface failed");
+        return false;
+    }
+
+    XTRACE(this, 0, 0, "createNetworkInterface - Exiting, successful");
+
+    return true;
+
+}/* end createNetworkInterface */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::enable
+//
+//		Inputs:		netif - the interface being enabled
+//
+//		Outputs:	Return code - kIOReturnSuccess or kIOReturnIOError
+//
+//		Desc:		Called by IOEthernetInterface client to enable the controller.
+//				This method is always called while running on the default workloop
+//				thread
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::enable(IONetworkInterface *netif)
+{
+    IOReturn				ior = kIOReturnSuccess;
+
+    XTRACEP(this, 0, netif, "enable");
+
+    IOSleep(5);				// Just in case (to let start finish - on another thread)
+
+        // If an interface client has previously enabled us,
+        // and we know there can only be one interface client
+        // for this driver, then simply return success.
+
+    if (fNetifEnabled)
+    {
+        XTRACE(this, 0, 0, "enable - already enabled");
+        return kIOReturnSuccess;
+    }
+
+    if (!fControlDriver)
+    {
+        if (findControlDriverND(this) != kIOReturnSuccess)
+        {
+            ALERT(0, 0, "enable - Find control driver failed");
+            return kIOReturnIOError;
+        }
+    }
+
+    if (!fReady)
+    {
+        if (!wakeUp())
+        {
+            XTRACE(this, 0, fReady, "enable - wakeUp failed");
+            return kIOReturnIOError;
+        }
+    }
+
+    if (!fControlDriver->dataAcquired(fpNetStats, fpEtherStats))
+    {
+        XTRACE(this, 0, 0, "enable - dataAcquired to Control failed");
+        return kIOReturnIOError;
+    }
+
+        // Mark the controller as enabled by the interface.
+
+    setLinkStatusDown();
+
+    fNetifEnabled = true;
+
+    fControlDriver->USBSetPacketFilter();
+    XTRACE(this, 0, fControlDriver->fPacketFilter, "enable - packet filter applied");
+
+    return ior;
+
+}/* end enable */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::disable
+//
+//		Inputs:		netif - the interface being disabled
+//
+//		Outputs:	Return code - kIOReturnSuccess
+//
+//		Desc:		Called by IOEthernetInterface client to disable the controller.
+//				This method is always called while running on the default workloop
+//				thread
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::disable(IONetworkInterface *netif)
+{
+    UInt16	packetFilter;
+    bool    result;
+    IOReturn err;
+
+    XTRACE(this, 0, 0, "disable");
+
+    putToSleep();
+
+    fNetifEnabled = false;
+    fReady = false;
+
+         // Tell the Control driver the port's been disabled
+		 // If reset state's not normal then he already knows
+
+    if (fTerminate)
+        return kIOReturnOffline;
+
+	if (fResetState == kResetNormal)
+	{
+		if (fControlDriver)
+		{
+            packetFilter = fControlDriver->fPacketFilter;
+
+            fControlDriver->fPacketFilter = kPACKET_TYPE_DISABLED;
+            result = fControlDriver->USBSetPacketFilter();
+			fControlDriver->dataReleased();
+            XTRACE(this, 0, result, "disable - USBSetPacketFilter");
+
+            fControlDriver->fPacketFilter = packetFilter;
+		}
+	}
+
+        // Back to the setting with no endpoints, the function's reset and stops sending
+
+    err = fDataInterface->SetAlternateInterface(this, 0);
+    XTRACE(this, err, 0, "disable - SetAlternateInterface");
+
+    fDataInterface->GetDevice()->SuspendDevice(true);
+
+    return kIOReturnSuccess;
+
+}/* end disable */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::setWakeOnMagicPacket
+//
+//		Inputs:		active - true(wake), false(don't)
+//
+//		Outputs:	Return code - kIOReturnSuccess
+//
+//		Desc:		Set for wake on magic packet
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::setWakeOnMagicPacket(bool active)
+{
+    IOUSBDevRequest	devreq;
+    IOReturn		ior = kIOReturnSuccess;
+
+    XTRACE(this, 0, active, "setWakeOnMagicPacket");
+
+    fWOL = active;
+
+    if (fConfigAttributes & kUSBAtrRemoteWakeup)
+    {
+
+            // Set/Clear the Device Remote Wake feature depending upon the active flag
+
+		devreq.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBStandard, kUSBDevice);
+		if (active)
+		{
+			devreq.bRequest = kUSBRqSetFeature;
+		} else {
+			devreq.bRequest = kUSBRqClearFeature;
+		}
+		devreq.wValue = kUSBFeatureDeviceRemoteWakeup;
+		devreq.wIndex = 0;
+		devreq.wLength = 0;
+		devreq.pData = 0;
+
+		ior = fDataInterface->GetDevice()->DeviceRequest(&devreq);
+		if (ior == kIOReturnSuccess)
+		{
+			XTRACE(this, 0, ior, "setWakeOnMagicPacket - Set/Clear remote wake up feature successful");
+		} else {
+			XTRACE(this, 0, ior, "setWakeOnMagicPacket - Set/Clear remote wake up feature failed");
+		}
+    } else {
+        XTRACE(this, 0, 0, "setWakeOnMagicPacket - Remote wake up not supported");
+    }
+
+    return kIOReturnSuccess;
+
+}/* end setWakeOnMagicPacket */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::getPacketFilters
+//
+//		Inputs:		group - the filter group
+//
+//		Outputs:	Return code - kIOReturnSuccess and others
+//				filters - the capability
+//
+//		Desc:		Set the filter capability for the driver
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::getPacketFilters(const OSSymbol *group, UInt32 *filters) const
+{
+    IOReturn	rtn = kIOReturnSuccess;
+
+    XTRACEP(this, group, filters, "getPacketFilters");
+
+    if (group == gIOEthernetWakeOnLANFilterGroup)
+    {
+        if (fConfigAttributes & kUSBAtrRemoteWakeup)
+        {
+            *filters = kIOEthernetWakeOnMagicPacket;
+        } else {
+            *filters = 0;
+        }
+    } else {
+        if (group == gIONetworkFilterGroup)
+        {
+            *filters = kIOPacketFilterUnicast | kIOPacketFilterBroadcast | kIOPacketFilterMulticast | kIOPacketFilterMulticastAll | kIOPacketFilterPromiscuous;
+        } else {
+            rtn = super::getPacketFilters(group, filters);
+        }
+    }
+
+    if (rtn != kIOReturnSuccess)
+    {
+        XTRACE(this, 0, rtn, "getPacketFilters - failed");
+    }
+
+    return rtn;
+
+}/* end getPacketFilters */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::getMaxPacketSize
+//
+//		Inputs:
+//
+//		Outputs:	Return code - kIOReturnSuccess or kIOReturnIOError
+//					maxSize - the max size we currently support
+//
+//		Desc:		Set the max size from the descriptors of this device
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::getMaxPacketSize(UInt32 *maxSize) const
+{
+    IOReturn	rtn = kIOReturnSuccess;
+
+    XTRACE(this, 0, 0, "getMaxPacketSize");
+
+	if (fControlDriver)
+	{
+		XTRACE(this, 0, fControlDriver->fMax_Block_Size, "getMaxPacketSize - Setting max size");
+
+			// wMaxSegmentSize doesn't include the CRC, IOEthernetController expects it to
+
+		*maxSize = fControlDriver->fMax_Block_Size + kIOEthernetCRCSize;
+	} else {
+		rtn = kIOReturnIOError;				// If we don't have a control driver by now we're in trouble...
+		XTRACE(this, 0, 0, "getMaxPacketSize - No control driver???");
+	}
+
+    return rtn;
+
+}/* end getMaxPacketSize */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::selectMedium
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Lets us know if someone is playing with ifconfig
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::selectMedium(const IONetworkMedium *medium)
+{
+    IOMediumType	mType;
+
+    XTRACE(this, 0, 0, "selectMedium");
+
+    if (fTerminate)
+	{
+		XTRACE(this, 0, 0, "selectMedium - Device unplugged");
+		return kIOReturnIOError;
+	}
+
+	if (!medium)
+	{
+		XTRACE(this, 0, 0, "selectMedium - No medium defined");
+		return kIOReturnError;
+	}
+
+	mType = medium->getType();
+	XTRACE(this, 0, mType, "selectMedium - Type");
+
+	if ((mType & kIOMediumNetworkTypeMask) != kIOMediumEthernet)
+	{
+		XTRACE(this, 0, 0, "selectMedium - Not ethernet medium");
+		return kIOReturnBadArgument;
+	}
+
+        // Check the type (auto and none is really all we can accept)
+
+    switch (mType & (kIOMediumNetworkTypeMask | kIOMediumSubTypeMask))
+	{
+        case kIOMediumEthernetNone:
+			XTRACE(this, 0, 0, "selectMedium - None, link going down");
+            setSelectedMedium(medium);
+            linkStatusChange(kLinkDown);
+            break;
+		case kIOMediumEthernetAuto:
+			XTRACE(this, 0, 0, "selectMedium - Auto, link going up");
+            setSelectedMedium(medium);
+            linkStatusChange(kLinkUp);
+            break;
+        default:
+			XTRACE(this, 0, 0, "selectMedium - Unsupported");
+            return kIOReturnUnsupported;
+    }
+
+    return kIOReturnSuccess;
+
+}/* end selectMedium */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::getHardwareAddress
+//
+//		Inputs:
+//
+//		Outputs:	Return code - kIOReturnSuccess or kIOReturnError
+//				ea - the address
+//
+//		Desc:		Get the ethernet address from the hardware (actually the descriptor)
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::getHardwareAddress(IOEthernetAddress *ea)
+{
+    UInt32      i;
+
+    XTRACE(this, 0, 0, "getHardwareAddress");
+
+    if (fControlDriver)
+    {
+        for (i=0; i<6; i++)
+        {
+            ea->bytes[i] = fControlDriver->fEaddr[i];
+        }
+    } else {					// Use cached address
+        for (i=0; i<6; i++)
+        {
+            ea->bytes[i] = fEthernetaddr[i];
+        }
+    }
+
+    return kIOReturnSuccess;
+
+}/* end getHardwareAddress */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::newVendorString
+//
+//		Inputs:
+//
+//		Outputs:	Return code - the vendor string
+//
+//		Desc:		Identifies the hardware vendor
+//
+/****************************************************************************************************/
+
+const OSString* AppleUSBCDCNCMData::newVendorString() const
+{
+
+    XTRACE(this, 0, 0, "newVendorString");
+
+    return OSString::withCString((const char *)defaultName);		// Maybe we should use the descriptors
+
+}/* end newVendorString */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::newModelString
+//
+//		Inputs:
+//
+//		Outputs:	Return code - the model string
+//
+//		Desc:		Identifies the hardware model
+//
+/****************************************************************************************************/
+
+const OSString* AppleUSBCDCNCMData::newModelString() const
+{
+
+    XTRACE(this, 0, 0, "newModelString");
+
+    return OSString::withCString("USB");		// Maybe we should use the descriptors
+
+}/* end newModelString */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::newRevisionString
+//
+//		Inputs:
+//
+//		Outputs:	Return code - the revision string
+//
+//		Desc:		Identifies the hardware revision
+//
+/****************************************************************************************************/
+
+const OSString* AppleUSBCDCNCMData::newRevisionString() const
+{
+
+    XTRACE(this, 0, 0, "newRevisionString");
+
+    return OSString::withCString("");
+
+}/* end newRevisionString */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::setMulticastMode
+//
+//		Inputs:		active - true (set it), false (don't)
+//
+//		Outputs:	Return code - kIOReturnSuccess
+//
+//		Desc:		Sets multicast mode
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::setMulticastMode(IOEnetMulticastMode active)
+{
+
+    XTRACE(this, 0, active, "setMulticastMode");
+
+    if (!fReady)
+    {
+        return kIOReturnSuccess;
+    }
+
+    if (fControlDriver)
+    {
+        if (active)
+        {
+            fControlDriver->fPacketFilter |= kPACKET_TYPE_MULTICAST;
+        } else {
+            fControlDriver->fPacketFilter &= ~kPACKET_TYPE_MULTICAST;
+        }
+
+        fControlDriver->USBSetPacketFilter();
+
+        return kIOReturnSuccess;
+    }
+
+    return kIOReturnIOError;
+
+}/* end setMulticastMode */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::setMulticastList
+//
+//		Inputs:		addrs - list of addresses
+//				count - number in the list
+//
+//		Outputs:	Return code - kIOReturnSuccess or kIOReturnIOError
+//
+//		Desc:		Sets multicast list. If the device can't filter that many (or at all)
+//				we ask for all multicast instead.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::setMulticastList(IOEthernetAddress *addrs, UInt32 count)
+{
+
+    XTRACE(this, 0, count, "setMulticastList");
+
+    if (!fReady)
+    {
+        return kIOReturnSuccess;
+    }
+
+    if (fControlDriver)
+    {
+        if (fControlDriver->USBSetMulticastFilter(addrs, count))
+        {
+            fControlDriver->fPacketFilter &= ~kPACKET_TYPE_ALL_MULTICAST;
+        } else {
+            XTRACE(this, fControlDriver->fMcFilters, count, "setMulticastList - Using all multicast");
+            fControlDriver->fPacketFilter |= kPACKET_TYPE_ALL_MULTICAST;
+        }
+
+        fControlDriver->USBSetPacketFilter();
+
+        return kIOReturnSuccess;
+    }
+
+    return kIOReturnIOError;
+
+}/* end setMulticastList */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::setPromiscuousMode
+//
+//		Inputs:		active - true (set it), false (don't)
+//
+//		Outputs:	Return code - kIOReturnSuccess
+//
+//		Desc:		Sets promiscuous mode
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::setPromiscuousMode(IOEnetPromiscuousMode active)
+{
+
+    XTRACE(this, 0, active, "setPromiscuousMode");
+
+    if (!fReady)
+    {
+        return kIOReturnSuccess;
+    }
+
+    if (fControlDriver)
+    {
+        if (active)
+        {
+            fControlDriver->fPacketFilter |= kPACKET_TYPE_PROMISCUOUS;
+        } else {
+            fControlDriver->fPacketFilter &= ~kPACKET_TYPE_PROMISCUOUS;
+        }
+
+        fControlDriver->USBSetPacketFilter();
+
+        return kIOReturnSuccess;
+    }
+
+    return kIOReturnIOError;
+
+}/* end setPromiscuousMode */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::createOutputQueue
+//
+//		Inputs:
+//
+//		Outputs:	Return code - the output queue
+//
+//		Desc:		Creates the output queue. It's gated so outputPacket and the aggregation
+//				timer both run on the work loop and the block being filled needs no lock.
+//
+/****************************************************************************************************/
+
+IOOutputQueue* AppleUSBCDCNCMData::createOutputQueue()
+{
+
+    XTRACE(this, 0, 0, "createOutputQueue");
+
+    if (!fWorkLoop)
+	{
+		fWorkLoop = getWorkLoop();
+		if (!fWorkLoop)
+		{
+			ALERT(0, 0, "createOutputQueue - getWorkLoop failed");
+			return NULL;
+		}
+	}
+
+	return IOGatedOutputQueue::withTarget(this, fWorkLoop, TRANSMIT_QUEUE_SIZE);
+
+}/* end createOutputQueue */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::outputPacket
+//
+//		Inputs:		mbuf - the packet
+//				param - optional parameter
+//
+//		Outputs:	Return code - kIOReturnOutputSuccess or kIOReturnOutputStall
+//
+//		Desc:		Packet transmission. The BSD mbuf needs to be formatted correctly
+//				and transmitted
+//
+/****************************************************************************************************/
+
+UInt32 AppleUSBCDCNCMData::outputPacket(mbuf_t pkt, void *param)
+{
+    UInt32	ior = kIOReturnSuccess;
+
+    XTRACEP(this, pkt, 0, "outputPacket");
+
+    if (!fControlDriver)
+    {
+        XTRACE(this, 0, 0, "outputPacket - Control driver has gone");
+        freePacket(pkt);
+        return kIOReturnOutputDropped;
+    }
+
+    if ((fLinkStatus == kLinkDown) || !fReady)
+    {
+        XTRACEP(this, pkt, 0, "outputPacket - link is down");
+        fTxCounters.errLinkDown++;
+        freePacket(pkt);
+        return kIOReturnOutputDropped;
+    }
+
+	if (fResetState != kResetNormal)
+	{
+		XTRACEP(this, pkt, 0, "outputPacket - deferred reset");
+        fTxCounters.errLinkDown++;
+        freePacket(pkt);
+		if (fResetState == kResetNeeded)
+		{
+			fResetState = kResetDone;
+			fDataInterface->GetDevice()->ReEnumerateDevice(0);
+		}
+        return kIOReturnOutputDropped;
+	}
+
+    ior = USBTransmitPacket(pkt);
+    if (ior != kIOReturnSuccess)
+    {
+        if (ior != kIOReturnOutputStall)
+        {
+            freePacket(pkt);
+            ior = kIOReturnOutputDropped;
+        }
+    }
+
+    return ior;
+
+}/* end outputPacket */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::configureInterface
+//
+//		Inputs:		netif - the interface being configured
+//
+//		Outputs:	Return code - true (configured ok), false (not)
+//
+//		Desc:		Finish the network interface configuration
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::configureInterface(IONetworkInterface *netif)
+{
+    IONetworkData	*nd;
+
+    XTRACEP(this, IOThreadSelf(), netif, "configureInterface");
+
+    if (super::configureInterface(netif) == false)
+    {
+        ALERT(0, 0, "configureInterface - super failed");
+        return false;
+    }
+
+        // Get a pointer to the statistics structure in the interface
+
+    nd = netif->getNetworkData(kIONetworkStatsKey);
+    if (!nd || !(fpNetStats = (IONetworkStats *)nd->getBuffer()))
+    {
+        ALERT(0, 0, "configureInterface - Invalid network statistics");
+        return false;
+    }
+
+        // Bring the counters up to date when someone reads them
+
+    nd->setNotificationTarget(this, statsAccessed, NULL);
+
+        // Get the Ethernet statistics structure
+
+    nd = netif->getParameter(kIOEthernetStatsKey);
+    if (!nd || !(fpEtherStats = (IOEthernetStats*)nd->getBuffer()))
+    {
+        ALERT(0, 0, "configureInterface - Invalid ethernet statistics\n");
+        return false;
+    }
+    nd->setNotificationTarget(this, statsAccessed, NULL);
+
+        // Publish the full 64 bit host counters as well
+
+    nd = IONetworkData::withExternalBuffer(hostCountersTag, sizeof(hostTotals), &fHostTotals, kIONetworkDataBasicAccessTypes, this, statsAccessed, NULL);
+    if (nd)
+    {
+        if (!netif->addNetworkData(nd))
+        {
+            XTRACE(this, 0, 0, "configureInterface - Failed to add the host counters");
+        }
+        nd->release();
+    }
+
+    return true;
+
+}/* end configureInterface */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::wakeUp
+//
+//		Inputs:
+//
+//		Outputs:	Return Code - true(we're awake), false(failed)
+//
+//		Desc:		Resumes the device it it was suspended, sets the transfer block
+//				parameters, selects the data alternate setting and then gets all the
+//				buffers sorted out and the pipes ready.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::wakeUp()
+{
+    IOReturn 	rtn = kIOReturnSuccess;
+    UInt32	i;
+    bool	readOK = false;
+
+    XTRACE(this, 0, 0, "wakeUp");
+
+    fDataInterface->GetDevice()->SuspendDevice(false);
+
+    fReady = false;
+
+    if (fTimerSource)
+    {
+        fTimerSource->cancelTimeout();
+    }
+
+    if (!fControlDriver->setNTBParameters())
+    {
+        ALERT(0, 0, "wakeUp - setNTBParameters failed");
+    	return false;
+    }
+
+    rtn = fDataInterface->SetAlternateInterface(this, fAltInterface);
+    if (rtn != kIOReturnSuccess)
+    {
+        ALERT(0, rtn, "wakeUp - SetAlternateInterface failed");
+    	return false;
+    }
+
+    if (!allocateResources())
+    {
+        ALERT(0, 0, "wakeUp - allocateResources failed");
+    	return false;
+    }
+
+        // Kick off the data-in bulk pipe reads
+
+    for (i=0; i<fInBufPool; i++)
+    {
+        if (fPipeInBuff[i].pipeInMDP)
+        {
+			fPipeInBuff[i].readCompletionInfo.parameter = (void *)&fPipeInBuff[i];
+            rtn = fInPipe->Read(fPipeInBuff[i].pipeInMDP, &fPipeInBuff[i].readCompletionInfo, NULL);
+            if (rtn == kIOReturnSuccess)
+            {
+                readOK = true;
+            } else {
+                XTRACE(this, i, rtn, "wakeUp - Read failed");
+            }
+        }
+    }
+
+    if (!readOK)
+    {
+
+    	// We failed for some reason
+
+        ALERT(0, 0, "wakeUp - Starting the input pipe read(s) failed");
+        return false;
+    } else {
+        if (!fMediumDict)
+        {
+            if (!createMediumTables())
+            {
+                ALERT(0, 0, "wakeUp - createMediumTables failed");
+                return false;
+            }
+        }
+
+		if (fTimerSource)
+		{
+			fTimerSource->setTimeoutMS(WATCHDOG_TIMER_MS);
+		}
+        fReady = true;
+    }
+
+	fSleeping = false;
+
+    return true;
+
+}/* end wakeUp */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::putToSleep
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Do clean up and suspend the device. A block that's being filled is
+//				dropped, the pipe's about to be aborted anyway.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::putToSleep()
+{
+    XTRACE(this, 0, 0, "putToSleep >>>");
+
+    fReady = false;
+
+    if (fTxAggTimer)
+    {
+        fTxAggTimer->cancelTimeout();
+    }
+
+    if (fTxNTB)
+    {
+        fTxCounters.errLinkDown += fTxNTB->count;
+        fTxNTB->count = 0;
+        fTxNTB->avail = true;
+        fTxNTB = NULL;
+        releaseFreePackets();
+    }
+
+		// Abort any outstanding I/O
+
+	if (fInPipe)
+		fInPipe->Abort();
+	if (fOutPipe)
+		fOutPipe->Abort();
+
+    if (fTimerSource)
+    {
+        fTimerSource->cancelTimeout();
+    }
+
+    releaseResources();
+    linkStatusChange(kLinkDown);
+	fSleeping = true;
+
+    XTRACE(this, 0, 0, "putToSleep <<<");
+}/* end putToSleep */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::createMediumTables
+//
+//		Inputs:
+//
+//		Outputs:	Return code - true (tables created), false (not created)
+//
+//		Desc:		Creates the medium tables
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::createMediumTables()
+{
+    IONetworkMedium	*medium;
+    UInt64		maxSpeed;
+    UInt32		i;
+
+    XTRACE(this, 0, 0, "createMediumTables");
+
+    maxSpeed = 1000;
+    fMediumDict = OSDictionary::withCapacity(sizeof(mediumTable) / sizeof(mediumTable[0]));
+    if (fMediumDict == 0)
+    {
+        XTRACE(this, 0, 0, "createMediumTables - create dict. failed");
+        return false;
+    }
+
+    for (i = 0; i < sizeof(mediumTable) / sizeof(mediumTable[0]); i++)
+    {
+        medium = IONetworkMedium::medium(mediumTable[i].type, mediumTable[i].speed);
+        if (medium && (medium->getSpeed() <= maxSpeed))
+        {
+            IONetworkMedium::addMedium(fMediumDict, medium);
+            medium->release();
+        }
+    }
+
+    if (publishMediumDictionary(fMediumDict) != true)
+    {
+        XTRACE(this, 0, 0, "createMediumTables - publish dict. failed");
+        return false;
+    }
+
+    medium = IONetworkMedium::getMediumWithType(fMediumDict, kIOMediumEthernetAuto);
+    setCurrentMedium(medium);
+
+    return true;
+
+}/* end createMediumTables */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::linkMedium
+//
+//		Inputs:		speed - link speed (bits/sec)
+//
+//		Outputs:	The medium for this speed
+//
+//		Desc:		The entry is made from the speed the device reported. The standard Ethernet
+//				speeds get their own type, anything else is auto (full duplex, so it's not
+//				the selectable auto entry). There's one entry per type and it's replaced
+//				(and the dictionary republished) when the speed changes.
+//
+/****************************************************************************************************/
+
+IONetworkMedium *AppleUSBCDCNCMData::linkMedium(UInt64 speed)
+{
+    IONetworkMedium	*medium;
+    IOMediumType	mediumType = kIOMediumOptionFullDuplex;
+
+    switch (speed)
+    {
+        case 10000000ULL:
+            mediumType |= kIOMediumEthernet10BaseT;
+            break;
+        case 100000000ULL:
+            mediumType |= kIOMediumEthernet100BaseTX;
+            break;
+        case 1000000000ULL:
+            mediumType |= kIOMediumEthernet1000BaseTX;
+            break;
+        case 2500000000ULL:
+            mediumType |= kIOMediumEthernet2500BaseT;
+            break;
+        case 5000000000ULL:
+            mediumType |= kIOMediumEthernet5000BaseT;
+            break;
+        case 10000000000ULL:
+            mediumType |= kIOMediumEthernet10GBaseT;
+            break;
+        default:
+            mediumType |= kIOMediumEthernetAuto;
+            break;
+    }
+
+    if (!fMediumDict)
+    {
+        return NULL;
+    }
+
+    medium = IONetworkMedium::getMediumWithType(fMediumDict, mediumType);
+    if (medium && (medium->getSpeed() == speed))
+    {
+        return medium;
+    }
+
+    XTRACE(this, mediumType, (UInt32)(speed / 1000000), "linkMedium - New medium entry (Mbit)");
+
+    medium = IONetworkMedium::medium(mediumType, speed);
+    if (!medium)
+    {
+        return IONetworkMedium::getMediumWithType(fMediumDict, mediumType);
+    }
+    IONetworkMedium::addMedium(fMediumDict, medium);
+    medium->release();
+
+    if (!publishMediumDictionary(fMediumDict))
+    {
+        XTRACE(this, 0, 0, "linkMedium - publish dict. failed");
+    }
+
+    return IONetworkMedium::getMediumWithType(fMediumDict, mediumType);
+
+}/* end linkMedium */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::allocateResources
+//
+//		Inputs:
+//
+//		Outputs:	return code - true (allocate was successful), false (it failed)
+//
+//		Desc:		Gets all the endpoints open and buffers allocated etc. Each buffer holds
+//				a whole transfer block.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::allocateResources()
+{
+    IOUSBFindEndpointRequest		epReq;
+    UInt32				i;
+
+    XTRACE(this, 0, 0, "allocateResources.");
+
+		// Check things are still around (waking from sleep)
+
+	if (!fDataInterface)
+	{
+		XTRACE(this, 0, 0, "allocateResources - No data interface");
+		return false;
+	}
+
+	if (!fControlDriver)
+	{
+		XTRACE(this, 0, 0, "allocateResources - No control driver");
+		return false;
+	}
+
+    fNtbInSize = fControlDriver->fNtbInSize;
+    fNtbOutSize = fControlDriver->fNtbOutSize;
+    XTRACE(this, fNtbInSize, fNtbOutSize, "allocateResources - Transfer block sizes (input, output)");
+
+        // Open all the end points
+
+    epReq.type = kUSBBulk;
+    epReq.direction = kUSBIn;
+    epReq.maxPacketSize	= 0;
+    epReq.interval = 0;
+    fInPipe = fDataInterface->FindNextPipe(0, &epReq);
+    if (!fInPipe)
+    {
+        XTRACE(this, 0, 0, "allocateResources - no bulk input pipe.");
+        return false;
+    }
+    fInPacketSize = epReq.maxPacketSize;
+    XTRACE(this, epReq.maxPacketSize << 16 |epReq.interval, 0, "allocateResources - bulk input pipe.");
+
+    epReq.direction = kUSBOut;
+    fOutPipe = fDataInterface->FindNextPipe(0, &epReq);
+    if (!fOutPipe)
+    {
+        XTRACE(this, 0, 0, "allocateResources - no bulk output pipe.");
+        return false;
+    }
+    fOutPacketSize = epReq.maxPacketSize;
+    XTRACE(this, epReq.maxPacketSize << 16 |epReq.interval, 0, "allocateResources - bulk output pipe.");
+
+        // Allocate Memory Descriptor Pointer with memory for the data-in bulk pipe
+
+    for (i=0; i<fInBufPool; i++)
+    {
+        fPipeInBuff[i].pipeInMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionIn, fNtbInSize, PAGE_SIZE);
+        if (!fPipeInBuff[i].pipeInMDP)
+        {
+            XTRACE(this, 0, i, "allocateResources - Allocate input descriptor failed");
+            return false;
+        }
+
+        fPipeInBuff[i].pipeInMDP->setLength(fNtbInSize);
+        fPipeInBuff[i].pipeInBuffer = (UInt8*)fPipeInBuff[i].pipeInMDP->getBytesNoCopy();
+        XTRACEP(this, fPipeInBuff[i].pipeInMDP, fPipeInBuff[i].pipeInBuffer, "allocateResources - input buffer");
+        fPipeInBuff[i].dead = false;
+        fPipeInBuff[i].readCompletionInfo.target = this;
+        fPipeInBuff[i].readCompletionInfo.action = dataReadComplete;
+        fPipeInBuff[i].readCompletionInfo.parameter = NULL;
+    }
+
+        // Allocate Memory Descriptor Pointers with memory for the data-out bulk pipe pool
+
+    for (i=0; i<fOutBufPool; i++)
+    {
+        fPipeOutBuff[i].pipeOutMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionOut, fNtbOutSize, PAGE_SIZE);
+        if (!fPipeOutBuff[i].pipeOutMDP)
+        {
+            XTRACE(this, 0, i, "allocateResources - Allocate output descriptor failed");
+            return false;
+        }
+
+        fPipeOutBuff[i].pipeOutMDP->setLength(fNtbOutSize);
+        fPipeOutBuff[i].pipeOutBuffer = (UInt8*)fPipeOutBuff[i].pipeOutMDP->getBytesNoCopy();
+        XTRACEP(this, fPipeOutBuff[i].pipeOutMDP, fPipeOutBuff[i].pipeOutBuffer, "allocateResources - output buffer");
+        fPipeOutBuff[i].avail = true;
+        fPipeOutBuff[i].length = 0;
+        fPipeOutBuff[i].count = 0;
+        fPipeOutBuff[i].writeCompletionInfo.target = this;
+        fPipeOutBuff[i].writeCompletionInfo.action = dataWriteComplete;
+        fPipeOutBuff[i].writeCompletionInfo.parameter = NULL;				// for now, filled in with the index when sent
+    }
+
+    fTxNTB = NULL;
+    fTxNTBLen = 0;
+    fTxOutstanding = 0;
+
+    return true;
+
+}/* end allocateResources */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::releaseResources
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Frees up the resources allocated in allocateResources
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::releaseResources()
+{
+    UInt32	i;
+
+    XTRACE(this, 0, 0, "releaseResources >>>");
+
+    fTxNTB = NULL;
+
+    for (i=0; i<fOutBufPool; i++)
+    {
+        if (fPipeOutBuff[i].pipeOutMDP)
+        {
+            fPipeOutBuff[i].pipeOutMDP->release();
+            fPipeOutBuff[i].pipeOutMDP = NULL;
+            fPipeOutBuff[i].avail = false;
+            fPipeOutBuff[i].writeCompletionInfo.target = NULL;
+            fPipeOutBuff[i].writeCompletionInfo.action = NULL;
+            fPipeOutBuff[i].writeCompletionInfo.parameter = NULL;
+        }
+    }
+    fOutPoolIndex = 0;
+
+    for (i=0; i<fInBufPool; i++)
+    {
+        if (fPipeInBuff[i].pipeInMDP)
+        {
+            fPipeInBuff[i].pipeInMDP->release();
+            fPipeInBuff[i].pipeInMDP = NULL;
+            fPipeInBuff[i].dead = false;
+            fPipeInBuff[i].readCompletionInfo.target = NULL;
+            fPipeInBuff[i].readCompletionInfo.action = NULL;
+            fPipeInBuff[i].readCompletionInfo.parameter = NULL;
+        }
+    }
+
+    XTRACE(this, 0, 0, "releaseResources <<<");
+
+}/* end releaseResources */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::allocatePools
+//
+//		Inputs:
+//
+//		Outputs:	return code - true (allocate was successful), false (it failed)
+//
+//		Desc:		Allocate the buffer records (not the buffers) at the configured pool sizes
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::allocatePools()
+{
+    UInt32	i;
+
+    XTRACE(this, fInBufPool, fOutBufPool, "allocatePools");
+
+    fPipeInBuff = (pipeInBuffers *)IOMalloc(fInBufPool * sizeof(pipeInBuffers));
+    if (!fPipeInBuff || !growOutPool(fOutBufPool))
+    {
+        XTRACE(this, 0, 0, "allocatePools - IOMalloc failed");
+        freePools();
+        return false;
+    }
+    bzero(fPipeInBuff, fInBufPool * sizeof(pipeInBuffers));
+
+    for (i=0; i<fInBufPool; i++)
+    {
+		fPipeInBuff[i].indx = i;
+    }
+
+    return true;
+
+}/* end allocatePools */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::growOutPool
+//
+//		Inputs:		outCount - output records wanted
+//
+//		Outputs:	return code - true (there are at least that many), false (IOMalloc failed)
+//
+//		Desc:		Make room for more output records. A bigger array is allocated, the
+//				records copied over and the old one freed. Only done on the workloop
+//				with no block being filled, write completions are passed the index so
+//				nothing points into the old array. The input pool never grows.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::growOutPool(UInt16 outCount)
+{
+    pipeOutBuffers	*newOut;
+    UInt32		i;
+
+    if (outCount <= fOutBufAlloc)
+    {
+        return true;
+    }
+
+    XTRACE(this, fOutBufAlloc, outCount, "growOutPool");
+    newOut = (pipeOutBuffers *)IOMalloc(outCount * sizeof(pipeOutBuffers));
+    if (!newOut)
+    {
+        return false;
+    }
+    bzero(newOut, outCount * sizeof(pipeOutBuffers));
+    if (fPipeOutBuff)
+    {
+        bcopy(fPipeOutBuff, newOut, fOutBufAlloc * sizeof(pipeOutBuffers));
+        IOFree(fPipeOutBuff, fOutBufAlloc * sizeof(pipeOutBuffers));
+    }
+    for (i=fOutBufAlloc; i<outCount; i++)
+    {
+        newOut[i].indx = i;
+    }
+    fPipeOutBuff = newOut;
+    fOutBufAlloc = outCount;
+
+    return true;
+
+}/* end growOutPool */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::freePools
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Free the buffer records, the buffers themselves have already gone
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::freePools()
+{
+
+    XTRACE(this, 0, 0, "freePools");
+
+    if (fPipeInBuff)
+    {
+        IOFree(fPipeInBuff, fInBufPool * sizeof(pipeInBuffers));
+        fPipeInBuff = NULL;
+    }
+    if (fPipeOutBuff)
+    {
+        IOFree(fPipeOutBuff, fOutBufAlloc * sizeof(pipeOutBuffers));
+        fPipeOutBuff = NULL;
+    }
+    fOutBufAlloc = 0;
+
+}/* end freePools */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::getOutputBuffer
+//
+//		Inputs:		bufIndx - index of an available buffer
+//
+//		Outputs:	Return code - True (got one), False (none available)
+//
+//		Desc:		Get an available buffer from the output buffer pool, the pool grows
+//				(up to kMaxOutBufPool) if they're all busy.
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::getOutputBuffer(UInt32 *bufIndx)
+{
+	bool	gotBuffer = false;
+	UInt32	indx = 0;
+
+	XTRACE(this, 0, 0, "getOutputBuffer");
+
+		// Use the hint first then if that's not available look for one and then create one...
+
+	indx = fOutPoolIndex;
+	if (!fPipeOutBuff[indx].avail)
+	{
+		for (indx=0; indx<fOutBufPool; indx++)
+		{
+			if (fPipeOutBuff[indx].avail)
+			{
+				fOutPoolIndex = indx;
+				gotBuffer = true;
+				break;
+			}
+		}
+	} else {
+		gotBuffer = true;
+	}
+
+	if (gotBuffer)
+	{
+		fPipeOutBuff[indx].avail = false;
+		fOutPoolIndex++;
+		if (fOutPoolIndex >= fOutBufPool)
+		{
+			fOutPoolIndex = 0;
+		}
+	} else {
+		if (fOutBufPool >= kMaxOutBufPool)
+		{
+			XTRACE(this, kMaxOutBufPool, fOutBufPool, "getOutputBuffer - Output buffer pool empty");
+			indx = 0;
+			gotBuffer = false;
+		} else {
+			XTRACE(this, 0, fOutBufPool, "getOutputBuffer - Adding output buffer to pool");
+
+				// Create a new one (only with very heavy transmit traffic)
+
+			indx = fOutBufPool;
+			if (growOutPool(fOutBufPool + 1))
+			{
+				fPipeOutBuff[indx].pipeOutMDP = IOBufferMemoryDescriptor::withOptions(kIODirectionOut, fNtbOutSize, PAGE_SIZE);
+			}
+			if ((fOutBufAlloc <= indx) || !fPipeOutBuff[indx].pipeOutMDP)
+			{
+				XTRACE(this, 0, indx, "getOutputBuffer - Allocate output descriptor failed");
+				gotBuffer = false;
+				indx = 0;
+			} else {
+				fPipeOutBuff[indx].pipeOutMDP->setLength(fNtbOutSize);
+				fPipeOutBuff[indx].pipeOutBuffer = (UInt8*)fPipeOutBuff[indx].pipeOutMDP->getBytesNoCopy();
+				XTRACEP(this, fPipeOutBuff[indx].pipeOutMDP, fPipeOutBuff[indx].pipeOutBuffer, "getOutputBuffer - output buffer");
+				fPipeOutBuff[indx].avail = false;
+				fPipeOutBuff[indx].length = 0;
+				fPipeOutBuff[indx].count = 0;
+				fPipeOutBuff[indx].writeCompletionInfo.target = this;
+				fPipeOutBuff[indx].writeCompletionInfo.action = dataWriteComplete;
+				fPipeOutBuff[indx].writeCompletionInfo.parameter = NULL;
+				fPipeOutBuff[indx].indx = indx;
+				fOutBufPool++;
+				fOutPoolIndex = 0;
+				gotBuffer = true;
+			}
+		}
+	}
+
+	*bufIndx = indx;
+
+	return gotBuffer;
+
+}/* end getOutputBuffer */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::USBTransmitPacket
+//
+//		Inputs:		packet - the packet
+//
+//		Outputs:	Return code - kIOReturnSuccess (packet queued, and freed), everything else (it wasn't)
+//
+//		Desc:		Add the packet to the transfer block being filled. The block goes when
+//				it's full, when it has fNtbOutDatagrams in it, when the pipe is idle or
+//				when the flush timer fires, whichever is first. Runs on the work loop.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::USBTransmitPacket(mbuf_t packet)
+{
+    UInt32		total_pkt_length;
+    UInt32		offset;
+    UInt32		count;
+    UInt32		indx;
+    IOReturn	ior;
+
+    XTRACEP(this, 0, packet, "USBTransmitPacket");
+
+	if (fDeferredClear)
+	{
+		ior = clearPipeStall(fOutPipe);
+		if (ior != kIOReturnSuccess)
+		{
+			XTRACE(this, 0, ior, "USBTransmitPacket - clear stall failed (trying to continue)");
+		}
+		fDeferredClear = false;
+	}
+
+    total_pkt_length = (UInt32)mbuf_pkthdr_len(packet);
+
+    XTRACE(this, 0, total_pkt_length, "USBTransmitPacket - Total packet length");
+
+    if ((total_pkt_length > fControlDriver->fMax_Block_Size) || (total_pkt_length == 0))
+    {
+        XTRACE(this, 0, 0, "USBTransmitPacket - Bad packet size");
+        fTxCounters.errTooBig++;
+        return kIOReturnInternalError;
+    }
+
+        // Send what's there if this one won't fit
+
+    if (fTxNTB && !cdc_NTBFits(cdc_NTBAlign(fTxNTBLen, fControlDriver->fNdpOutDivisor, fControlDriver->fNdpOutRemainder), total_pkt_length, fTxNTB->count, fControlDriver->fNdpOutAlignment, fNtbOutSize))
+    {
+        txNTBFlush();
+    }
+
+    if (!fTxNTB)
+    {
+        if (!getOutputBuffer(&indx))
+        {
+                // Say we're stalled before looking again, a completion that frees a
+                // buffer after this restarts the queue
+
+            fTxStalled = true;
+            OSMemoryBarrier();
+            if (!getOutputBuffer(&indx))
+            {
+                XTRACE(this, fOutBufPool, fOutPoolIndex, "USBTransmitPacket - Output buffer unavailable");
+                return kIOReturnOutputStall;
+            }
+        }
+        fTxNTB = &fPipeOutBuff[indx];
+        fTxNTB->count = 0;
+        fTxNTBLen = kNTH16Len;
+    }
+
+    offset = cdc_NTBAlign(fTxNTBLen, fControlDriver->fNdpOutDivisor, fControlDriver->fNdpOutRemainder);
+    if (!cdc_NTBFits(offset, total_pkt_length, fTxNTB->count, fControlDriver->fNdpOutAlignment, fNtbOutSize))
+    {
+        XTRACE(this, offset, total_pkt_length, "USBTransmitPacket - Doesn't fit an empty block");
+        fTxCounters.errTooBig++;
+        return kIOReturnInternalError;
+    }
+
+        // Copy it in and add its pointer (the NDP's written when the block goes)
+
+    mbuf_copydata(packet, 0, total_pkt_length, &fTxNTB->pipeOutBuffer[offset]);
+
+    LogData(kDataOut, total_pkt_length, &fTxNTB->pipeOutBuffer[offset]);
+
+    count = fTxNTB->count;
+    fTxDPE[count * 2] = (UInt16)offset;
+    fTxDPE[(count * 2) + 1] = (UInt16)total_pkt_length;
+    fTxNTB->count = ++count;
+    fTxNTBLen = offset + total_pkt_length;
+	fTxCounters.packets++;
+	fTxCounters.bytes += total_pkt_length;
+
+    freePacket(packet, kDelayFree);			// Copied, it's ours to free
+
+        // Go now unless there's a reason to wait for more
+
+    if (!fTxAgg || (count >= fControlDriver->fNtbOutDatagrams) || (fTxOutstanding == 0) ||
+        !cdc_NTBFits(cdc_NTBAlign(fTxNTBLen, fControlDriver->fNdpOutDivisor, fControlDriver->fNdpOutRemainder), fControlDriver->fMax_Block_Size, count,
+                     fControlDriver->fNdpOutAlignment, fNtbOutSize))
+    {
+        txNTBFlush();
+    } else {
+        if ((count == 1) && fTxAggTimer)
+        {
+            fTxAggTimer->setTimeoutUS(kTxAggFlushUS);
+        }
+    }
+
+    return kIOReturnSuccess;
+
+}/* end USBTransmitPacket */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::txNTBFlush
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Finish the block being filled (cdc_NTBBuild adds the NDP and NTH16) and
+//				send it. A write that fails loses the datagrams in it (they're
+//				counted as pipe errors). Runs on the work loop.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::txNTBFlush()
+{
+    pipeOutBuffers	*ntb = fTxNTB;
+    UInt32		count;
+    UInt32		len;
+    bool		padded;
+    IOReturn	ior;
+
+    if (!ntb)
+    {
+        return;
+    }
+
+    fTxNTB = NULL;
+    if (fTxAggTimer)
+    {
+        fTxAggTimer->cancelTimeout();
+    }
+
+    count = ntb->count;
+    XTRACE(this, count, fTxNTBLen, "txNTBFlush");
+
+    if (count == 0)
+    {
+        ntb->avail = true;
+        return;
+    }
+
+    len = cdc_NTBBuild(ntb->pipeOutBuffer, fTxNTBLen, fTxDPE, count, fTxSequence++,
+                       fControlDriver->fNdpOutAlignment, fOutPacketSize, fNtbOutSize, &padded);
+    if (padded)
+    {
+        fTxCounters.zlpAvoided++;
+    }
+
+    if (count > 1)
+    {
+        fTxCounters.offload += count - 1;
+    }
+
+    ntb->length = len;
+    ntb->writeCompletionInfo.parameter = (void *)(uintptr_t)ntb->indx;
+    OSIncrementAtomic(&fTxOutstanding);
+    ior = cdc_PipeWrite(fOutPipe, ntb->pipeOutMDP, len, kPipeNoDataTimeout, kPipeCompletionTimeout, &ntb->writeCompletionInfo);
+    if (ior != kIOReturnSuccess)
+    {
+        XTRACE(this, count, ior, "txNTBFlush - Write failed");
+        fTxCounters.errPipe += count;
+        OSDecrementAtomic(&fTxOutstanding);
+        ntb->length = 0;
+        ntb->count = 0;
+        ntb->avail = true;
+    }
+
+    fTxNTBLen = 0;
+    releaseFreePackets();
+
+}/* end txNTBFlush */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::txAggTimerFired
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Static member function, a partly filled block has waited long enough
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::txAggTimerFired(OSObject *owner, IOTimerEventSource *sender)
+{
+    AppleUSBCDCNCMData	*target = OSDynamicCast(AppleUSBCDCNCMData, owner);
+
+    if (target && target->fReady)
+    {
+        target->txNTBFlush();
+    }
+
+}/* end txAggTimerFired */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::clearPipeStall
+//
+//		Inputs:		thePipe - the pipe
+//
+//		Outputs:
+//
+//		Desc:		Clear a stall on the specified pipe.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::clearPipeStall(IOUSBPipe *thePipe)
+{
+    IOReturn 	rtn = kIOReturnSuccess;
+
+    XTRACEP(this, 0, thePipe, "clearPipeStall");
+
+    rtn = cdc_CheckPipe(thePipe, true);
+    if (rtn == kIOReturnSuccess)
+    {
+        XTRACE(this, 0, 0, "clearPipeStall - Successful");
+    } else {
+        XTRACE(this, 0, rtn, "clearPipeStall - Failed");
+    }
+
+    return rtn;
+
+}/* end clearPipeStall */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::receiveNTB
+//
+//		Inputs:		block - the transfer block
+//				size - Number of bytes read
+//
+//		Outputs:
+//
+//		Desc:		Sends each datagram in the block up (cdc_NTBParse walks the NDP16s and
+//				checks everything the device gave us), anything that doesn't add up is
+//				counted as a format error and skipped.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::receiveNTB(UInt8 *block, UInt32 size)
+{
+    UInt32	datagrams;
+    UInt32	errors = 0;
+
+    XTRACE(this, 0, size, "receiveNTB");
+
+    if (!fControlDriver)
+    {
+        XTRACE(this, 0, 0, "receiveNTB - Control driver has gone, block dropped");
+        return;
+    }
+
+    datagrams = cdc_NTBParse(block, size, kNCMMinDatagram, fControlDriver->fMax_Block_Size, receiveDatagram, this, &errors);
+    if (errors)
+    {
+        XTRACE(this, datagrams, errors, "receiveNTB - Format errors in the block");
+        fRxCounters.errFormat += errors;
+    }
+
+    if (datagrams > 1)
+    {
+        fRxCounters.offload += datagrams - 1;
+    }
+
+        // Everything from this block goes up the stack together
+
+    if (datagrams != 0)
+    {
+        fNetworkInterface->flushInputQueue();
+    }
+
+}/* end receiveNTB */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::receiveDatagram
+//
+//		Inputs:		target - the driver
+//				datagram - a datagram in the block
+//				len - its length
+//
+//		Outputs:
+//
+//		Desc:		cdc_NTBParse's per datagram callback
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::receiveDatagram(void *target, UInt8 *datagram, UInt32 len)
+{
+
+    ((AppleUSBCDCNCMData *)target)->receivePacket(datagram, len);
+
+}/* end receiveDatagram */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::receivePacket
+//
+//		Inputs:		packet - the packet
+//				size - Number of bytes in the packet
+//
+//		Outputs:
+//
+//		Desc:		Build the mbufs and queue them for the network stack (receiveNTB
+//				flushes the queue at the end of the block).
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::receivePacket(UInt8 *packet, UInt32 size)
+{
+    mbuf_t		m;
+    errno_t     err;
+
+    XTRACE(this, 0, size, "receivePacket");
+
+    m = allocatePacket(size);
+    if (m)
+    {
+        err = mbuf_copyback(m, 0, size, packet, MBUF_DONTWAIT);
+        if (err)
+        {
+            XTRACE(this, 0, err, "receivePacket - Buffer copy failed, packet dropped");
+            fRxCounters.errFormat++;
+            freePacket(m);
+            return;
+        }
+        fNetworkInterface->inputPacket(m, size, IONetworkInterface::kInputOptionQueuePacket);
+        fRxCounters.packets++;
+        fRxCounters.bytes += size;
+    } else {
+        XTRACE(this, 0, 0, "receivePacket - Buffer allocation failed, packet dropped");
+        fRxCounters.errNoBuffer++;
+    }
+
+}/* end receivePacket */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::linkStatusChange
+//
+//		Inputs:		linkState - 0=down, 1=up
+//
+//		Outputs:
+//
+//		Desc:		Notification from the control driver (or wherever) of the link state
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::linkStatusChange(UInt8 linkState)
+{
+
+	XTRACE(this, 0, linkState, "linkStatusChange");
+
+        // Check the state actually changed
+
+	if (fLinkStatus != linkState)
+	{
+		XTRACE(this, 0, linkState, "linkStatusChange - State has changed");
+
+        fLinkStatus = linkState;
+
+		if (linkState == kLinkUp)
+		{
+            setLinkStatusUp();
+
+                // Start our IOOutputQueue object if not already started
+
+			if (fTransmitQueue)
+			{
+                if (!fQueueStarted)
+                {
+                    fTransmitQueue->setCapacity(TRANSMIT_QUEUE_SIZE);
+                    XTRACE(this, 0, TRANSMIT_QUEUE_SIZE, "linkStatusChange - capacity set");
+
+                    fTransmitQueue->start();
+                    XTRACE(this, 0, 0, "linkStatusChange - transmit queue started");
+
+                    fQueueStarted = true;
+                }
+			}
+		} else {
+            if (fQueueStarted)
+            {
+                fTransmitQueue->stop();
+
+                    // Flush all packets currently in the output queue
+
+                fTransmitQueue->setCapacity(0);
+                fTransmitQueue->flush();
+
+                fQueueStarted = false;
+            }
+            setLinkStatusDown();
+		}
+	}
+
+}/* end linkStatusChange */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::linkSpeedChange
+//
+//		Inputs:		upSpeed - in bits/second (already converted to host format)
+//				downSpeed - in bits/second (already converted to host format)
+//
+//		Outputs:
+//
+//		Desc:		Notification from the control driver of the link speed
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::linkSpeedChange(UInt32 upSpeed, UInt32 downSpeed)
+{
+
+	XTRACE(this, upSpeed, downSpeed, "linkSpeedChange");
+
+	fUpSpeed = upSpeed;
+    fDownSpeed = downSpeed;
+
+    if (fLinkStatus == kLinkUp)
+    {
+        setLinkStatusUp();				// New speed
+    } else {
+        if (max(fDownSpeed, fUpSpeed) != 0)
+        {
+            linkStatusChange(kLinkUp);		// force link up
+        }
+    }
+
+}/* end linkSpeedChange */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::setLinkStatusUp
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Set our link status to up
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::setLinkStatusUp()
+{
+    IONetworkMedium	*medium;
+    IOMediumType	mediumType = 0;
+	UInt64			speed;
+    char            line[256];
+    UInt32          linkSpeed;
+    UInt16          regs[LinkUp_Phy_Count] = {0, 0, 0, 0, 0, 0};
+    LinkUpFlow      flowState = kLinkUpFlow_None;
+    char            portNameBuffer[5];
+    OSNumber        *usbPortNumber;
+    char            *portName = NULL;
+
+    XTRACE(this, fUpSpeed, fDownSpeed, "setLinkStatusUp");
+
+    if (fLinkStatus != kLinkUp)
+    {
+        XTRACE(this, 0, 0, "setLinkStatusUp - Link isn't up");
+        return;
+    }
+
+		// We'll default to FDX and use the higher speed
+
+    speed = max(fUpSpeed, fDownSpeed);
+    linkSpeed = speed/1000000;           // Need this in mbits
+
+    if (speed == 0)
+    {
+        fLinkStatus = kLinkDown;
+        XTRACE(this, 0, 0, "setLinkStatusUp - Link speed is 0");
+        return;
+    }
+
+        // Get the port number
+
+    usbPortNumber = OSDynamicCast(OSNumber, fDataInterface->GetDevice()->getProperty("PortNum"));
+    if (usbPortNumber)
+    {
+        snprintf(portNameBuffer, sizeof(portNameBuffer), "%d", usbPortNumber->unsigned16BitValue());
+        portName = portNameBuffer;
+    }
+
+        // Now print it
+
+    ::LinkUpMessage(line, sizeof(line),         // std link up msg to line buffer
+                    NULL,                       // get kext name from kmodinfo
+                    fNetworkInterface,			// where to get the en name
+                    linkSpeed,                  // speed in mbits
+                    true,						// full duplex
+                    flowState,					// flow control type
+                    portName,					// port name or NULL
+                    regs,						// array of 6 useful registers to log
+                    NULL);                      // string of loopback type or NULL
+#if USE_ELG
+    Log("%s\n", line);
+#endif
+
+    medium = linkMedium(speed);
+    if (medium)
+    {
+        mediumType = medium->getType();
+    }
+
+    XTRACE(this, 0, mediumType, "setLinkStatusUp - LinkStatus set");
+
+    setLinkStatus(kIONetworkLinkActive | kIONetworkLinkValid, medium, speed);
+
+}/* end setLinkStatusUp */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::setLinkStatusDown
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Set our link status to down
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::setLinkStatusDown()
+{
+
+    XTRACE(this, 0, 0, "setLinkStatusDown");
+
+        // Set our status to inactive, with the current medium set to 'none'
+
+	setLinkStatus(kIONetworkLinkValid, IONetworkMedium::getMediumWithType(fMediumDict, kIOMediumEthernetNone));
+
+        // Log it if we need to
+
+    if (fNetworkInterface)
+    {
+        Log("Ethernet [%s]: Link down on %s%d\n", DEBUG_NAME, fNetworkInterface->getNamePrefix(), fNetworkInterface->getUnitNumber());
+    } else {
+        Log("Ethernet [%s]: Link down\n", DEBUG_NAME);
+    }
+
+	fLinkStatus = kLinkDown;
+    fUpSpeed = 0;
+    fDownSpeed = 0;
+
+}/* end setLinkStatusDown */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::timerFired
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Static member function called when a timer event fires.
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::timerFired(OSObject *owner, IOTimerEventSource *sender)
+{
+
+    if (owner)
+    {
+        AppleUSBCDCNCMData* target = OSDynamicCast(AppleUSBCDCNCMData, owner);
+
+        if (target)
+        {
+            target->timeoutOccurred(sender);
+        }
+    }
+
+}/* end timerFired */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::timeoutOccurred
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Watchdog, keeps the interface statistics current (NCM has no device
+//				statistics requests we rely on, the host counts everything).
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::timeoutOccurred(IOTimerEventSource * /*timer*/)
+{
+
+    updateStatistics();
+
+    if (fReady)
+    {
+        fTimerSource->setTimeoutMS(WATCHDOG_TIMER_MS);
+    }
+
+}/* end timeoutOccurred */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::statsAccessed
+//
+//		Inputs:		target - me
+//				type - access type
+//
+//		Outputs:	kIOReturnSuccess
+//
+//		Desc:		Static member function called when the network statistics are accessed.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::statsAccessed(void *target, void *param, IONetworkData *data, UInt32 type, void *buffer, UInt32 *bufferSize, UInt32 offset)
+{
+    AppleUSBCDCNCMData	*me = (AppleUSBCDCNCMData *)target;
+
+    if (me && ((type == kIONetworkDataAccessTypeRead) || (type == kIONetworkDataAccessTypeSerialize)))
+    {
+        me->updateStatistics();
+    }
+
+    return kIOReturnSuccess;
+
+}/* end statsAccessed */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::updateStatistics
+//
+//		Inputs:
+//
+//		Outputs:
+//
+//		Desc:		Adds up the per context host counters and updates the interface statistics
+//
+/****************************************************************************************************/
+
+void AppleUSBCDCNCMData::updateStatistics()
+{
+    hostTotals		totals;
+
+    bzero(&totals, sizeof(totals));
+    hostCountersAdd(&totals.input, &fRxCounters);
+    hostCountersAdd(&totals.output, &fTxCounters);
+    hostCountersAdd(&totals.output, &fTxDoneCounters);
+
+    fHostTotals = totals;
+
+    if (!fControlDriver || !fpNetStats || !fpEtherStats)
+    {
+        return;
+    }
+
+        // The interface statistics are 32 bits so they just wrap
+
+    if (fControlDriver->fInputPktsOK)
+        fpNetStats->inputPackets = (UInt32)totals.input.packets;
+    if (fControlDriver->fInputErrsOK)
+        fpNetStats->inputErrors = (UInt32)hostErrors(&totals.input);
+    if (fControlDriver->fOutputPktsOK)
+        fpNetStats->outputPackets = (UInt32)totals.output.packets;
+    if (fControlDriver->fOutputErrsOK)
+        fpNetStats->outputErrors = (UInt32)hostErrors(&totals.output);
+
+    fpEtherStats->dot3RxExtraEntry.resourceErrors = (UInt32)totals.input.errNoBuffer;
+    fpEtherStats->dot3TxExtraEntry.resourceErrors = (UInt32)totals.output.errNoBuffer;
+
+}/* end updateStatistics */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::willTerminate
+//
+//		Inputs:		provider - my provider
+//				options - termination options
+//
+//		Outputs:	true
+//
+//		Desc:		Note we're going (so the read completions stop)
+//
+/****************************************************************************************************/
+
+bool AppleUSBCDCNCMData::willTerminate(IOService *provider, IOOptionBits options)
+{
+
+    XTRACE(this, 0, 0, "willTerminate");
+
+    fTerminate = true;
+
+    return true;
+
+}/* end willTerminate */
+
+/****************************************************************************************************/
+//
+//		Method:		AppleUSBCDCNCMData::message
+//
+//		Inputs:		type - message type
+//				provider - my provider
+//				argument - additional parameters
+//
+//		Outputs:	return Code - kIOReturnSuccess
+//
+//		Desc:		Handles IOKit messages.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::message(UInt32 type, IOService *provider, void *argument)
+{
+    UInt16	i;
+    IOReturn	ior;
+
+    XTRACE(this, 0, type, "message");
+
+    switch (type)
+    {
+        case kIOMessageServiceIsTerminated:
+            XTRACE(this, fReady, type, "message - kIOMessageServiceIsTerminated");
+
+            if (fReady)
+            {
+                if (!fTerminate)		// Check if we're already being terminated
+                {
+                    putToSleep();
+                }
+            }
+            fTerminate = true;              // we're being terminated (unplugged)
+            linkStatusChange(kLinkDown);    // and of course we're offline
+            if (fDataInterface != NULL)
+                fDataInterface->close(this);
+            return kIOReturnSuccess;
+        case kIOMessageServiceIsSuspended:
+            XTRACE(this, 0, type, "message - kIOMessageServiceIsSuspended");
+            break;
+        case kIOMessageServiceIsResumed:
+            XTRACE(this, 0, type, "message - kIOMessageServiceIsResumed");
+            break;
+        case kIOMessageServiceIsRequestingClose:
+            XTRACE(this, 0, type, "message - kIOMessageServiceIsRequestingClose");
+            break;
+        case kIOMessageServiceWasClosed:
+            XTRACE(this, 0, type, "message - kIOMessageServiceWasClosed");
+            break;
+        case kIOMessageServiceBusyStateChange:
+            XTRACE(this, 0, type, "message - kIOMessageServiceBusyStateChange");
+            break;
+        case kIOUSBMessagePortHasBeenResumed:
+            XTRACE(this, fAltInterface, type, "message - kIOUSBMessagePortHasBeenResumed");
+
+            if (!fReady)
+            {
+                return kIOReturnSuccess;
+            }
+
+                // Selecting the data setting resets the function, the block parameters
+                // have to go again first (from the setting with no endpoints)
+
+            fDataInterface->SetAlternateInterface(this, 0);
+            if (fControlDriver)
+            {
+                fControlDriver->setNTBParameters();
+            }
+            ior = fDataInterface->SetAlternateInterface(this, fAltInterface);
+            if (ior != kIOReturnSuccess)
+            {
+                ALERT(0, ior, "message - SetAlternateInterface failed");
+            }
+
+            for (i=0; i<fInBufPool; i++)
+            {
+                if (fPipeInBuff[i].dead)			// If it's dead try and resurrect it
+                {
+                    ior = fInPipe->Read(fPipeInBuff[i].pipeInMDP, &fPipeInBuff[i].readCompletionInfo, NULL);
+                    if (ior != kIOReturnSuccess)
+                    {
+                        XTRACE(this, 0, ior, "message - Read io error");
+                    } else {
+                        fPipeInBuff[i].dead = false;
+                    }
+                }
+            }
+            return kIOReturnSuccess;
+        case kIOUSBMessageHubResumePort:
+            XTRACE(this, 0, type, "message - kIOUSBMessageHubResumePort");
+            break;
+		case kIOMessageServiceIsAttemptingOpen:
+			XTRACE(this, 0, type, "message - kIOMessageServiceIsAttemptingOpen");
+			break;
+        default:
+            XTRACE(this, 0, type, "message - unknown message");
+            break;
+    }
+
+    return super::message(type, provider, argument);
+
+}/* end message */
+
+/****************************************************************************************************/
+//
+//	Method:		AppleUSBCDCNCMData::registerWithPolicyMaker
+//
+//	Inputs:		provider - my provider
+//
+//	Outputs:	return code - From policy maker
+//
+//	Desc:		Initialize the driver for power management and register ourselves with policy-maker.
+//				Called by superclass - not by Power Management.
+//
+/****************************************************************************************************/
+
+IOReturn AppleUSBCDCNCMData::registerWithPolicyMaker(IOService *policyMaker)
+{
+	IOReturn	ior;
+
+	XTRACE(this, 0, 0, "registerWithPolicyMaker");
+
+	ior = policyMaker->registerPowerDriver(this, gOurPowerStates, kNumCDCStates);
+
+	return ior;
+
+}/* end registerWithPolicyMaker */
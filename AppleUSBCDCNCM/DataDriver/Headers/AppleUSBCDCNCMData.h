@@ -0,0 +1,233 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef __APPLEUSBCDCNCMData__
+#define __APPLEUSBCDCNCMData__
+
+#include "AppleUSBCDCCommon.h"
+#include "AppleUSBCDC.h"
+#include "AppleUSBCDCNCMControl.h"
+#include "AppleUSBCDCPipe.h"
+
+#define TRANSMIT_QUEUE_SIZE     PAGE_SIZE
+#define WATCHDOG_TIMER_MS       1000
+
+#define COMM_BUFF_SIZE		16
+
+#define nameLength		32				// Arbitrary length
+#define defaultName		"USB Ethernet"
+
+#define kFiltersSupportedMask	0xefff
+#define kPipeStalled		1
+
+    // Default and Maximum buffer pool values (each buffer is a whole transfer block)
+
+#define kInBufPool		4
+#define kOutBufPool		4
+
+#define kMaxInBufPool		kInBufPool*4
+#define kMaxOutBufPool		kOutBufPool*4
+
+#define	inputTag		"InputBuffers"
+#define	outputTag		"OutputBuffers"
+#define	txAggTag		"TransmitAggregation"
+
+    // Transfer block limits (the NTB16 layout is in AppleUSBCDCNTB.h)
+
+#define kNCMMinDatagram		kIOEthernetAddressSize*2+2	// Ethernet header
+#define kNTBOutDatagramsMax	32				// Most datagrams we'll put in one block
+
+    // Transmit aggregation, a partly filled block goes no later than this (microseconds)
+
+#define kTxAggFlushUS		200
+
+typedef struct
+{
+    IOBufferMemoryDescriptor	*pipeOutMDP;
+    UInt8			*pipeOutBuffer;
+    bool			avail;
+    IOUSBCompletion		writeCompletionInfo;
+	UInt32			indx;
+	UInt32			length;				// Bytes written
+	UInt32			count;				// Datagrams in the block
+} pipeOutBuffers;
+
+typedef struct
+{
+    IOBufferMemoryDescriptor	*pipeInMDP;
+    UInt8			*pipeInBuffer;
+    bool			dead;
+    IOUSBCompletion		readCompletionInfo;
+	UInt32			indx;
+} pipeInBuffers;
+
+class AppleUSBCDC;
+class AppleUSBCDCNCMControl;
+
+class AppleUSBCDCNCMData : public IOEthernetController
+{
+    OSDeclareDefaultStructors(AppleUSBCDCNCMData);	// Constructor & Destructor stuff
+
+private:
+    bool			fTerminate;				// Are we being terminated (ie the device was unplugged)
+
+    IOEthernetInterface		*fNetworkInterface;
+    IOGatedOutputQueue		*fTransmitQueue;
+
+    IOTimerEventSource		*fTimerSource;
+
+    OSDictionary		*fMediumDict;
+
+    bool			fNetifEnabled;
+    bool			fWOL;
+	UInt64			fUpSpeed;
+    UInt64			fDownSpeed;
+	bool			fSleeping;
+
+    IOUSBPipe			*fInPipe;
+    IOUSBPipe			*fOutPipe;
+
+    pipeInBuffers		*fPipeInBuff;			// fInBufPool records
+    pipeOutBuffers		*fPipeOutBuff;			// fOutBufAlloc records, grows with the pool
+    UInt16			fOutBufAlloc;
+    UInt16			fOutPoolIndex;
+
+    UInt32			fOutPacketSize;
+    UInt32			fInPacketSize;
+    UInt32			fNtbInSize;			// Buffer sizes, from the control driver
+    UInt32			fNtbOutSize;
+    volatile SInt32		fTxOutstanding;			// Blocks with a write outstanding
+
+	bool			fDeferredClear;
+
+        // Transmit aggregation, only touched on the work loop (output queue and timer)
+
+    bool			fTxAgg;				// Pack several datagrams into each block
+    pipeOutBuffers		*fTxNTB;			// Block being filled (NULL if none)
+    UInt32			fTxNTBLen;			// Where the next datagram can go
+    UInt16			fTxSequence;			// wSequence of the next block
+    UInt16			fTxDPE[kNTBOutDatagramsMax*2];	// Datagram pointers for the NDP (index, length)
+    IOTimerEventSource		*fTxAggTimer;			// Sends a partly filled block
+
+    static void			dataReadComplete(void *obj, void *param, IOReturn ior, UInt32 remaining);
+    static void			dataWriteComplete(void *obj, void *param, IOReturn ior, UInt32 remaining);
+
+           // CDC Driver instance Methods
+
+    bool			configureData(void);
+    bool			wakeUp(void);
+    void			putToSleep(void);
+    bool			createMediumTables(void);
+    IONetworkMedium		*linkMedium(UInt64 speed);
+    bool 			allocateResources(void);
+    void			releaseResources(void);
+    bool			allocatePools(void);
+    bool			growOutPool(UInt16 outCount);
+    void			freePools(void);
+    bool			createNetworkInterface(void);
+    UInt32			outputPacket(mbuf_t pkt, void *param);
+	bool			getOutputBuffer(UInt32 *bufIndx);
+    IOReturn		USBTransmitPacket(mbuf_t packet);
+    void			txNTBFlush(void);
+    IOReturn		clearPipeStall(IOUSBPipe *thePipe);
+    void			receiveNTB(UInt8 *block, UInt32 size);
+    static void			receiveDatagram(void *target, UInt8 *datagram, UInt32 len);
+    void			receivePacket(UInt8 *packet, UInt32 size);
+    void            setLinkStatusUp(void);
+    void            setLinkStatusDown(void);
+    void			updateStatistics(void);
+    static void 	timerFired(OSObject *owner, IOTimerEventSource *sender);
+    static void 	txAggTimerFired(OSObject *owner, IOTimerEventSource *sender);
+    static IOReturn	statsAccessed(void *target, void *param, IONetworkData *data, UInt32 type, void *buffer, UInt32 *bufferSize, UInt32 offset);
+    void			timeoutOccurred(IOTimerEventSource *timer);
+
+public:
+
+#if LOG_DATA
+    virtual void			USBLogData(UInt8 Dir, SInt32 Count, char *buf);
+    virtual void			dumpData(char *buf, SInt32 size);
+#endif
+
+	AppleUSBCDCNCMControl		*fControlDriver;			// Our Control driver
+    IOUSBInterface		*fDataInterface;
+    IOWorkLoop			*fWorkLoop;
+    UInt8			fDataInterfaceNumber;
+    UInt16			fAltInterface;
+
+    UInt16			fInBufPool;
+    UInt16			fOutBufPool;
+
+    UInt8			fConfigAttributes;
+    UInt8			fEthernetaddr[6];
+
+	UInt8			fLinkStatus;
+
+	bool			fReady;
+	UInt8			fResetState;
+    bool            fQueueStarted;
+    bool			fTxStalled;
+
+    IONetworkStats		*fpNetStats;
+    IOEthernetStats		*fpEtherStats;
+    hostCounters		fTxCounters;			// Transmit (output queue) context
+    hostCounters		fTxDoneCounters;		// Write completion context
+    hostCounters		fRxCounters;			// Read completion context
+    hostTotals			fHostTotals;			// Added up when the statistics are read
+
+		// CDC Driver instance Methods
+
+	virtual void		linkStatusChange(UInt8 linkState);
+	virtual void		linkSpeedChange(UInt32 upSpeed, UInt32 downSpeed);
+
+        // IOKit methods
+
+    virtual bool		init(OSDictionary *properties = 0);
+	virtual IOService   *probe(IOService *provider, SInt32 *score);
+    virtual bool		start(IOService *provider);
+    virtual void		free(void);
+    virtual void		stop(IOService *provider);
+    virtual bool            willTerminate( IOService * provider, IOOptionBits options );
+    virtual IOReturn 		message(UInt32 type, IOService *provider, void *argument = 0);
+
+        // IOEthernetController methods
+
+    virtual IOReturn		enable(IONetworkInterface *netif);
+    virtual IOReturn		disable(IONetworkInterface *netif);
+    virtual IOReturn		setWakeOnMagicPacket(bool active);
+    virtual IOReturn		getPacketFilters(const OSSymbol	*group, UInt32 *filters ) const;
+    virtual IOReturn		selectMedium(const IONetworkMedium *medium);
+    virtual IOReturn		getHardwareAddress(IOEthernetAddress *addr);
+	virtual IOReturn		getMaxPacketSize(UInt32 *maxSize) const;
+    virtual IOReturn		setMulticastMode(IOEnetMulticastMode mode);
+    virtual IOReturn		setMulticastList(IOEthernetAddress *addrs, UInt32 count);
+    virtual IOReturn		setPromiscuousMode(IOEnetPromiscuousMode mode);
+    virtual IOOutputQueue	*createOutputQueue(void);
+    virtual const OSString	*newVendorString(void) const;
+    virtual const OSString	*newModelString(void) const;
+    virtual const OSString	*newRevisionString(void) const;
+    virtual bool			configureInterface(IONetworkInterface *netif);
+	virtual IOReturn		registerWithPolicyMaker(IOService *policyMaker);
+
+}; /* end class AppleUSBCDCNCMData */
+#endif
@@ -0,0 +1,130 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+ 
+
+    /* AppleUSBCDCCRC.cpp - Ethernet CRC32, slicing by 8 */
+
+#include <libkern/OSByteOrder.h>
+#include <libkern/OSAtomic.h>
+
+#include "AppleUSBCDCCRC.h"
+
+static UInt32	crcTable[8][256];				// crcTable[n] - a byte followed by n zero bytes
+static bool	crcTableReady = false;
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_CRC32Init
+//
+//		Inputs:		
+//
+//		Outputs:	
+//
+//		Desc:		Build the slicing tables. Every caller writes the same values so drivers
+//				starting at the same time don't need to be serialized.
+//
+/****************************************************************************************************/
+
+void cdc_CRC32Init()
+{
+    UInt32	i, k;
+    UInt32	c;
+    
+    if (crcTableReady)
+    {
+        OSMemoryBarrier();					// Don't let table reads get ahead of the flag
+        return;
+    }
+    
+    for (i=0; i<256; i++)
+    {
+        c = i;
+        for (k=0; k<8; k++)
+        {
+            c = (c & 1) ? ((c >> 1) ^ kCRC32Poly) : (c >> 1);
+        }
+        crcTable[0][i] = c;
+    }
+    for (i=0; i<256; i++)
+    {
+        for (k=1; k<8; k++)
+        {
+            crcTable[k][i] = (crcTable[k-1][i] >> 8) ^ crcTable[0][crcTable[k-1][i] & 0xff];
+        }
+    }
+    
+    OSMemoryBarrier();						// Tables visible before the flag is
+    crcTableReady = true;
+
+}/* end cdc_CRC32Init */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_CRC32
+//
+//		Inputs:		crc - 0 or the result of the previous call
+//				buffer - the bytes
+//				len - how many
+//
+//		Outputs:	The CRC (as it goes on the wire, least significant byte first)
+//
+//		Desc:		Eight bytes per step, one byte at a time only to get aligned and for
+//				whatever's left at the end.
+//
+/****************************************************************************************************/
+
+UInt32 cdc_CRC32(UInt32 crc, const UInt8 *buffer, UInt32 len)
+{
+    UInt32	one, two;
+    
+    crc = ~crc;
+    
+    while (len && ((uintptr_t)buffer & 3))
+    {
+        crc = crcTable[0][(crc ^ *buffer++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    
+    while (len >= 8)
+    {
+        one = OSReadLittleInt32(buffer, 0) ^ crc;
+        two = OSReadLittleInt32(buffer, 4);
+        crc = crcTable[7][one & 0xff] ^ crcTable[6][(one >> 8) & 0xff] ^
+              crcTable[5][(one >> 16) & 0xff] ^ crcTable[4][one >> 24] ^
+              crcTable[3][two & 0xff] ^ crcTable[2][(two >> 8) & 0xff] ^
+              crcTable[1][(two >> 16) & 0xff] ^ crcTable[0][two >> 24];
+        buffer += 8;
+        len -= 8;
+    }
+    
+    while (len--)
+    {
+        crc = crcTable[0][(crc ^ *buffer++) & 0xff] ^ (crc >> 8);
+    }
+    
+    return ~crc;
+
+}/* end cdc_CRC32 */
@@ -0,0 +1,42 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+ 
+#ifndef __APPLEUSBCDCCRC__
+#define __APPLEUSBCDCCRC__
+
+#include <libkern/OSTypes.h>
+
+        /* AppleUSBCDCCRC.h - Ethernet CRC32 (as carried by EEM frames)	*/
+
+#define kCRC32Poly			0xEDB88320		// Reflected IEEE 802.3 polynomial
+
+    // cdc_CRC32Init builds the tables, it must be called (once is enough) before cdc_CRC32.
+    // Start with a crc of 0, to continue a CRC pass the previous result back in.
+
+void		cdc_CRC32Init(void);
+UInt32		cdc_CRC32(UInt32 crc, const UInt8 *buffer, UInt32 len);
+
+#endif
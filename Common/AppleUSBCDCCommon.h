@@ -379,11 +379,10 @@ typedef struct
 
 #define NCM_MAX_OUT						16				// Arbitrary for unlimited datagrams
 
-#define NTH16_Signature                 0x484D434E		// NCMH
+#include "AppleUSBCDCNTB.h"			// NTH16, NDP16 and their signatures
+
 #define NTH32_Signature					0x686D636E		// ncmh
 
-#define NCM16_Signature_NoCRC           0x304D434E		// NCM0
-#define NCM16_Signature_CRC             0x314D434E		// NCM1
 #define NCM32_Signature_NoCRC           0x306D636E		// ncm0
 #define NCM32_Signature_CRC             0x316D636E		// ncm1
 
@@ -392,15 +391,6 @@ typedef struct
 #define MBIM_DSS_16                     0x00535344      //DSS<SessionId> Device Service Stream payload
 #define MBIM_DSS_32                     0x00737364      //DSS<SessionId> Device Service Stream payload
 
-typedef struct
-{
-    UInt32 	dwSignature;
-    UInt16 	wHeaderLength;
-	UInt16	wSequence;
-	UInt16	wBlockLength;
-	UInt16	wNdpIndex;
-} __attribute__((packed)) NTH16;
-
 typedef struct
 {
     UInt32 	dwSignature;
@@ -410,13 +400,6 @@ typedef struct
 	UInt32	wNdpIndex;
 } __attribute__((packed)) NTH32;
 
-typedef struct
-{
-    UInt32		dwSignature;
-    UInt16		wLength;
-	UInt16		wNextNdpIndex;  //Reserved for use as a link to the next NDP16 in the NTB set to 0x0000
-} __attribute__((packed)) NDP16;
-
 typedef struct
 {
     UInt16 	wDatagramIndex;
@@ -454,6 +437,55 @@ typedef struct
 	DPIndex32	dp32_Next;
 } __attribute__((packed)) FullNDP32;
 
+    // Host side traffic counters (networking drivers)
+    // Each context that counts (transmit, transmit completion, receive) owns one set
+    // on its own cache line so there's no sharing and no atomics. They're only added up
+    // when the interface statistics are read.
+
+#define kCacheLineSize				64
+#define hostCountersTag				"USBCDCHostCounters"
+
+typedef struct
+{
+    UInt64	packets;
+    UInt64	bytes;
+    UInt64	errLinkDown;					// Dropped, link down or reset pending
+    UInt64	errTooBig;					// Dropped, bigger than the maximum segment
+    UInt64	errNoBuffer;					// Dropped, no buffer or mbuf available
+    UInt64	errPipe;					// USB transfer failed
+    UInt64	errFormat;					// Framing or copy error
+    UInt64	filtered;					// Not for us, dropped by the driver (not an error)
+    UInt64	offload;					// Segments split on output (TSO) or merged on input
+    UInt64	zlpAvoided;					// Transfers padded so no zero length packet was needed
+    UInt64	copyAvoided;					// Bytes passed up in place rather than copied
+} __attribute__((aligned(kCacheLineSize))) hostCounters;
+
+typedef struct
+{
+    hostCounters	input;
+    hostCounters	output;
+} hostTotals;
+
+static inline UInt64 hostErrors(const hostCounters *hc)
+{
+    return hc->errLinkDown + hc->errTooBig + hc->errNoBuffer + hc->errPipe + hc->errFormat;
+}
+
+static inline void hostCountersAdd(hostCounters *total, const hostCounters *hc)
+{
+    total->packets += hc->packets;
+    total->bytes += hc->bytes;
+    total->errLinkDown += hc->errLinkDown;
+    total->errTooBig += hc->errTooBig;
+    total->errNoBuffer += hc->errNoBuffer;
+    total->errPipe += hc->errPipe;
+    total->errFormat += hc->errFormat;
+    total->filtered += hc->filtered;
+    total->offload += hc->offload;
+    total->zlpAvoided += hc->zlpAvoided;
+    total->copyAvoided += hc->copyAvoided;
+}
+
     // Inline conversions
 	
 static inline unsigned long tval2long(mach_timespec val)
@@ -0,0 +1,336 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+ 
+ 
+
+    /* AppleUSBCDCEEMFrame.cpp - Splits the EEM bulk in stream into packets and packs the bulk out one */
+
+#include <string.h>
+#include <libkern/OSByteOrder.h>
+
+#include "AppleUSBCDCEEMFrame.h"
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_EEMPacketLen
+//
+//		Inputs:		EEMHeader - the EEM packet header
+//
+//		Outputs:	Length of the whole EEM packet, header included (never more than kEEMMaxPacket)
+//
+//		Desc:		Works out how much of the stream belongs to this packet. Only the echo
+//				commands carry data, the other commands are just the header.
+//
+/****************************************************************************************************/
+
+UInt32 cdc_EEMPacketLen(UInt16 EEMHeader)
+{
+    
+    if (EEMHeader & bmTypeCommand)
+    {
+        switch ((EEMHeader & bmEEMCmdCodeMask) >> 8)
+        {
+            case EEMEcho:
+            case EEMEchoResponse:
+                return kEEMHeaderLen + (EEMHeader & bmEEMCmdParamMask);
+            default:
+                return kEEMHeaderLen;
+        }
+    }
+    
+    return kEEMHeaderLen + (EEMHeader & frameLenMask);
+    
+}/* end cdc_EEMPacketLen */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_EEMDeframe
+//
+//		Inputs:		hold - the packet carried over from the last transfer (if any)
+//				buffer - what the read returned
+//				len - Number of bytes in it
+//				action - called for each complete packet
+//				target - passed to action
+//
+//		Outputs:	
+//
+//		Desc:		Splits a bulk in transfer into EEM packets. Each header is checked against
+//				what's left of the transfer, a packet that runs off the end (or a header
+//				split in two) is held and finished from the next transfer. Only packets
+//				that span transfers are copied, the rest are passed up where they are.
+//
+/****************************************************************************************************/
+
+void cdc_EEMDeframe(eemRxHold *hold, UInt8 *buffer, UInt32 len, eemPacketAction action, void *target)
+{
+    UInt32	pos = 0;
+    UInt32	left;
+    UInt32	pktLen;
+    
+        // Finish the one carried over from the last transfer first
+    
+    if (hold->len && (len > 0))
+    {
+        if (hold->need == 0)				// Only the first byte of the header so far
+        {
+            hold->buffer[1] = buffer[pos++];
+            hold->len = kEEMHeaderLen;
+            hold->need = cdc_EEMPacketLen(OSReadLittleInt16(hold->buffer, 0));
+        }
+        left = hold->need - hold->len;
+        if (left > (len - pos))
+        {
+            left = len - pos;
+        }
+        bcopy(&buffer[pos], &hold->buffer[hold->len], left);
+        hold->len += left;
+        pos += left;
+        if (hold->len < hold->need)
+        {
+            return;
+        }
+        pktLen = hold->len;
+        hold->len = 0;
+        hold->need = 0;
+        action(target, hold->buffer, pktLen);
+    }
+    
+        // Then the ones that are all here
+    
+    while (pos < len)
+    {
+        left = len - pos;
+        if (left < kEEMHeaderLen)
+        {
+            hold->buffer[0] = buffer[pos];
+            hold->len = 1;
+            hold->need = 0;
+            break;
+        }
+        pktLen = cdc_EEMPacketLen(OSReadLittleInt16(buffer, pos));
+        if (pktLen > left)
+        {
+            bcopy(&buffer[pos], hold->buffer, left);
+            hold->len = left;
+            hold->need = pktLen;
+            break;
+        }
+        action(target, &buffer[pos], pktLen);
+        pos += pktLen;
+    }
+    
+}/* end cdc_EEMDeframe */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_EEMDeframeReset
+//
+//		Inputs:		hold - the packet carried over
+//
+//		Outputs:	true if part of a packet was thrown away
+//
+//		Desc:		Forget anything partly reassembled, the stream has a hole in it or
+//				is starting again.
+//
+/****************************************************************************************************/
+
+bool cdc_EEMDeframeReset(eemRxHold *hold)
+{
+    bool	lost = (hold->len != 0);
+    
+    hold->len = 0;
+    hold->need = 0;
+    
+    return lost;
+    
+}/* end cdc_EEMDeframeReset */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_EEMAggStart
+//
+//		Inputs:		agg - the transfer
+//				buffer - where it's built
+//				max - size of buffer
+//
+//		Outputs:	
+//
+//		Desc:		Start packing a new transfer
+//
+/****************************************************************************************************/
+
+void cdc_EEMAggStart(eemTxAgg *agg, UInt8 *buffer, UInt32 max)
+{
+    
+    agg->buffer = buffer;
+    agg->max = max;
+    agg->len = 0;
+    agg->count = 0;
+    
+}/* end cdc_EEMAggStart */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_EEMAggFits
+//
+//		Inputs:		agg - the transfer
+//				frameLen - Ethernet frame length
+//
+//		Outputs:	true if a data packet carrying the frame still fits
+//
+//		Desc:		Room check, header and CRC included
+//
+/****************************************************************************************************/
+
+bool cdc_EEMAggFits(const eemTxAgg *agg, UInt32 frameLen)
+{
+    
+    return ((agg->len + kEEMHeaderLen + frameLen + kEEMCRCLen) <= agg->max);
+    
+}/* end cdc_EEMAggFits */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_EEMAggFrame
+//
+//		Inputs:		agg - the transfer
+//
+//		Outputs:	Where the next frame is copied to
+//
+//		Desc:		The frame goes in first so the CRC can be worked out where it lies,
+//				cdc_EEMAggAddData then puts the header and CRC round it.
+//
+/****************************************************************************************************/
+
+UInt8 *cdc_EEMAggFrame(const eemTxAgg *agg)
+{
+    
+    return &agg->buffer[agg->len + kEEMHeaderLen];
+    
+}/* end cdc_EEMAggFrame */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_EEMAggAddData
+//
+//		Inputs:		agg - the transfer
+//				frameLen - length of the frame already at cdc_EEMAggFrame
+//				crc - true (crcValue is the frame's CRC), false (send the sentinel)
+//				crcValue - the CRC
+//
+//		Outputs:	
+//
+//		Desc:		Finish an EEM data packet round the frame. The caller has checked it
+//				fits (cdc_EEMAggFits).
+//
+/****************************************************************************************************/
+
+void cdc_EEMAggAddData(eemTxAgg *agg, UInt32 frameLen, bool crc, UInt32 crcValue)
+{
+    UInt8	*buf = &agg->buffer[agg->len];
+    UInt16	EEMHeader = bmTypeData | (UInt16)(frameLen + kEEMCRCLen);
+    
+    if (crc)
+    {
+        EEMHeader |= bmCRC;
+        OSWriteLittleInt32(buf, kEEMHeaderLen + frameLen, crcValue);
+    } else {
+        OSWriteBigInt32(buf, kEEMHeaderLen + frameLen, kEEMSentinel);
+    }
+    OSWriteLittleInt16(buf, 0, EEMHeader);
+    
+    agg->len += kEEMHeaderLen + frameLen + kEEMCRCLen;
+    agg->count++;
+    
+}/* end cdc_EEMAggAddData */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_EEMAggAddCommand
+//
+//		Inputs:		agg - the transfer
+//				EEMHeader - the command header
+//				data - anything that follows it
+//				len - length of data
+//
+//		Outputs:	true (it's in), false (no room)
+//
+//		Desc:		A command rides along with the data, it doesn't count as a packet
+//				towards the transfer's limit.
+//
+/****************************************************************************************************/
+
+bool cdc_EEMAggAddCommand(eemTxAgg *agg, UInt16 EEMHeader, const UInt8 *data, UInt32 len)
+{
+    
+    if ((agg->len + kEEMHeaderLen + len) > agg->max)
+    {
+        return false;
+    }
+    
+    OSWriteLittleInt16(agg->buffer, agg->len, EEMHeader);
+    if (len > 0)
+    {
+        bcopy(data, &agg->buffer[agg->len + kEEMHeaderLen], len);
+    }
+    agg->len += kEEMHeaderLen + len;
+    
+    return true;
+    
+}/* end cdc_EEMAggAddCommand */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_EEMAggNext
+//
+//		Inputs:		agg - the transfer
+//				maxPackets - most data packets in one transfer (1 is no packing)
+//				pipeIdle - nothing else is being written
+//
+//		Outputs:	kEEMAggSend, kEEMAggArmTimer or kEEMAggHold
+//
+//		Desc:		Decide, after a data packet has gone in, whether the transfer goes. It
+//				goes when it has maxPackets in it, when the pipe is idle (waiting gains
+//				nothing) or when there's no room for another frame. Otherwise the
+//				first packet starts the flush timer and later ones just wait.
+//
+/****************************************************************************************************/
+
+UInt32 cdc_EEMAggNext(const eemTxAgg *agg, UInt32 maxPackets, bool pipeIdle)
+{
+    
+    if ((agg->count >= maxPackets) || pipeIdle || ((agg->len + kEEMHeaderLen + kEEMCRCLen) >= agg->max))
+    {
+        return kEEMAggSend;
+    }
+    if (agg->count == 1)
+    {
+        return kEEMAggArmTimer;
+    }
+    
+    return kEEMAggHold;
+    
+}/* end cdc_EEMAggNext */
@@ -0,0 +1,111 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+ 
+ 
+#ifndef __APPLEUSBCDCEEMFRAME__
+#define __APPLEUSBCDCEEMFRAME__
+
+#include <libkern/OSTypes.h>
+
+        /* AppleUSBCDCEEMFrame.h - EEM packet framing, kept free of IOKit so it builds on the host	*/
+
+	// EEM bit definitions and masks
+	
+#define bmTypeData			0x0000
+#define bmTypeCommand		0x8000
+#define bmCRC				0x4000
+
+	// EEM Data packet masks
+
+#define bmCRCMask			0x7fff
+#define frameLenMask		0x3fff
+
+#define kEEMHeaderLen		2
+#define kEEMCRCLen			4
+#define kEEMSentinel		0xDEADBEEF			// Sent in place of the CRC (bmCRC clear)
+#define kEEMMaxPacket		(kEEMHeaderLen + frameLenMask)	// Largest EEM packet, header included
+
+	// EEM Command packet masks
+	
+#define bmEEMCmdMask		0x3fff
+#define bmEEMCmdCodeMask	0x3800
+#define	bmEEMCmdParamMask	0x07ff
+
+	// EEM Commands (bmEEMCmdCodeMask bits, high byte)
+	
+#define EEMEcho					0x00
+#define EEMEchoResponse			0x08
+#define EEMSuspendHint			0x10
+#define EEMResponseHint			0x18
+#define EEMResponseCompleteHint	0x20
+#define EEMTickle				0x28
+
+    // An EEM packet split across bulk in transfers. The caller supplies the buffer
+    // (kEEMMaxPacket bytes), the de-framer owns len and need.
+
+typedef struct
+{
+    UInt8			*buffer;
+    UInt32			len;				// Bytes of it received so far
+    UInt32			need;				// Bytes in all of it (0 until the header is complete)
+} eemRxHold;
+
+    // Called once per complete EEM packet (header first), packet is only good for the call
+
+typedef void (*eemPacketAction)(void *target, UInt8 *packet, UInt32 len);
+
+    // A bulk out transfer being packed with EEM packets. The caller supplies the
+    // buffer (max bytes, the device's block size) and does the sending.
+
+typedef struct
+{
+    UInt8			*buffer;
+    UInt32			max;				// Size of buffer
+    UInt32			len;				// Bytes packed so far
+    UInt32			count;				// Data packets in it (commands don't count)
+} eemTxAgg;
+
+    // What to do with the transfer after a data packet has gone in
+
+enum
+{
+    kEEMAggHold		= 0,				// Keep filling
+    kEEMAggArmTimer,					// First packet in, start the flush timer
+    kEEMAggSend						// Send it now
+};
+
+UInt32		cdc_EEMPacketLen(UInt16 EEMHeader);
+void		cdc_EEMDeframe(eemRxHold *hold, UInt8 *buffer, UInt32 len, eemPacketAction action, void *target);
+bool		cdc_EEMDeframeReset(eemRxHold *hold);
+
+void		cdc_EEMAggStart(eemTxAgg *agg, UInt8 *buffer, UInt32 max);
+bool		cdc_EEMAggFits(const eemTxAgg *agg, UInt32 frameLen);
+UInt8		*cdc_EEMAggFrame(const eemTxAgg *agg);
+void		cdc_EEMAggAddData(eemTxAgg *agg, UInt32 frameLen, bool crc, UInt32 crcValue);
+bool		cdc_EEMAggAddCommand(eemTxAgg *agg, UInt16 EEMHeader, const UInt8 *data, UInt32 len);
+UInt32		cdc_EEMAggNext(const eemTxAgg *agg, UInt32 maxPackets, bool pipeIdle);
+
+#endif
@@ -0,0 +1,296 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+ 
+ 
+
+    /* AppleUSBCDCMcFilter.cpp - Our address, broadcast and a hashed multicast set, checked before an mbuf is spent */
+
+#include <string.h>
+#include <libkern/OSAtomic.h>
+
+#include "AppleUSBCDCMcFilter.h"
+
+static inline UInt32 mcHash(const UInt8 *addr)
+{
+    UInt32	hash = 2166136261U;				// FNV-1a
+    UInt32	i;
+    
+    for (i=0; i<kMcAddrLen; i++)
+    {
+        hash = (hash ^ addr[i]) * 16777619U;
+    }
+    
+    return hash;
+}
+
+/****************************************************************************************************/
+//
+//		Function:	mcSetContains
+//
+//		Inputs:		table - the set
+//				hash - mcHash of the address
+//				addr - the address
+//
+//		Outputs:	true (it's there), false (it's not)
+//
+//		Desc:		Looks up an address in a multicast hash set (linear probing)
+//
+/****************************************************************************************************/
+
+static bool mcSetContains(const mcEntry *table, UInt32 hash, const UInt8 *addr)
+{
+    UInt32	slot = hash & (kMcHashSize - 1);
+    UInt32	i;
+    
+    for (i=0; i<kMcHashSize; i++)
+    {
+        if (!table[slot].used)
+        {
+            return false;
+        }
+        if (bcmp(table[slot].addr, addr, kMcAddrLen) == 0)
+        {
+            return true;
+        }
+        slot = (slot + 1) & (kMcHashSize - 1);
+    }
+    
+    return false;
+    
+}/* end mcSetContains */
+
+/****************************************************************************************************/
+//
+//		Function:	mcSetInsert
+//
+//		Inputs:		mc - the filter
+//				set - which of the two sets
+//				addr - the address
+//
+//		Outputs:	
+//
+//		Desc:		Adds an address to a multicast hash set (caller checks it's not there already)
+//
+/****************************************************************************************************/
+
+static void mcSetInsert(mcFilter *mc, UInt32 set, const UInt8 *addr)
+{
+    mcEntry	*table = mc->set[set];
+    UInt32	hash = mcHash(addr);
+    UInt32	slot = hash & (kMcHashSize - 1);
+    
+    mc->bloom[set] |= 1ULL << (hash >> 26);
+    while (table[slot].used)
+    {
+        slot = (slot + 1) & (kMcHashSize - 1);
+    }
+    bcopy(addr, table[slot].addr, kMcAddrLen);
+    table[slot].used = true;
+    
+}/* end mcSetInsert */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_McFilterInit
+//
+//		Inputs:		mc - the filter
+//
+//		Outputs:	
+//
+//		Desc:		Empty set, nothing passes the multicast check
+//
+/****************************************************************************************************/
+
+void cdc_McFilterInit(mcFilter *mc)
+{
+    
+    bzero(mc, sizeof(mcFilter));
+    
+}/* end cdc_McFilterInit */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_McFilterUpdate
+//
+//		Inputs:		mc - the filter
+//				addrs - the addresses (kMcAddrLen apart)
+//				count - How many
+//
+//		Outputs:	true (the set changed), false (no change)
+//
+//		Desc:		Builds the new multicast set in the spare table and compares it against the
+//				current one, it's only made current if it really changed. More than
+//				kMcMaxAddrs switches to overflow (everything multicast passes).
+//
+/****************************************************************************************************/
+
+bool cdc_McFilterUpdate(mcFilter *mc, const UInt8 *addrs, UInt32 count)
+{
+    UInt32	cur = mc->active;
+    UInt32	next = cur ^ 1;
+    UInt32	unique = 0;
+    UInt32	i;
+    
+    if (count > kMcMaxAddrs)
+    {
+        if (mc->overflow)
+        {
+            return false;						// Still too many, nothing changes
+        }
+        mc->overflow = true;
+        return true;
+    }
+    
+        // The spare was current until the last update so a lookup may still be in it,
+        // moving the generation on makes that lookup start again on the current one
+    
+    mc->gen++;
+    OSMemoryBarrier();
+    
+    bzero(mc->set[next], sizeof(mc->set[next]));
+    mc->bloom[next] = 0;
+    for (i=0; i<count; i++)
+    {
+        if (!mcSetContains(mc->set[next], mcHash(&addrs[i * kMcAddrLen]), &addrs[i * kMcAddrLen]))
+        {
+            mcSetInsert(mc, next, &addrs[i * kMcAddrLen]);
+            unique++;
+        }
+    }
+    
+        // Same size and everything's already in the current set means no change
+    
+    if (!mc->overflow && (unique == mc->count))
+    {
+        for (i=0; i<count; i++)
+        {
+            if (!mcSetContains(mc->set[cur], mcHash(&addrs[i * kMcAddrLen]), &addrs[i * kMcAddrLen]))
+            {
+                break;
+            }
+        }
+        if (i == count)
+        {
+            return false;
+        }
+    }
+    
+    OSMemoryBarrier();						// New set's complete before it's made current
+    mc->active = next;
+    mc->count = unique;
+    mc->overflow = false;
+    
+    return true;
+    
+}/* end cdc_McFilterUpdate */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_McFilterMatch
+//
+//		Inputs:		mc - the filter
+//				addr - destination address of a received multicast frame
+//
+//		Outputs:	true (we want it), false (we didn't ask for it)
+//
+//		Desc:		Runs on the read completion without a lock, if cdc_McFilterUpdate started
+//				rebuilding the set we were looking in the answer's thrown away and we
+//				look again (the set's small so that's cheap and rare).
+//
+/****************************************************************************************************/
+
+bool cdc_McFilterMatch(mcFilter *mc, const UInt8 *addr)
+{
+    UInt32	hash = mcHash(addr);
+    UInt32	gen;
+    UInt32	set;
+    bool	match;
+    
+    if (mc->overflow)
+    {
+        return true;						// Too many to track, take them all
+    }
+    
+    do
+    {
+        gen = mc->gen;
+        OSMemoryBarrier();
+        set = mc->active;
+        match = (mc->bloom[set] & (1ULL << (hash >> 26))) && mcSetContains(mc->set[set], hash, addr);
+        OSMemoryBarrier();
+    } while (gen != mc->gen);
+    
+    return match;
+    
+}/* end cdc_McFilterMatch */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_IngressAccept
+//
+//		Inputs:		frame - the received frame (at least an address long)
+//				ourHi, ourLo - our address as loaded from memory (first 4 and last 2 bytes)
+//				filter - kIngressPromiscuous passes everything, kIngressBroadcast passes broadcasts
+//				mc - the multicast set
+//
+//		Outputs:	true (pass it up), false (drop it)
+//
+//		Desc:		The destination is loaded as a word and a half word and compared without
+//				branching on each byte, multicast goes through the set (bloom bit first).
+//
+/****************************************************************************************************/
+
+bool cdc_IngressAccept(const UInt8 *frame, UInt32 ourHi, UInt16 ourLo, UInt16 filter, mcFilter *mc)
+{
+    UInt32	dstHi;
+    UInt16	dstLo;
+    
+    if (filter & kIngressPromiscuous)
+    {
+        return true;
+    }
+    
+    bcopy(&frame[0], &dstHi, sizeof(dstHi));
+    bcopy(&frame[4], &dstLo, sizeof(dstLo));
+    
+    if (((dstHi ^ ourHi) | (UInt32)(dstLo ^ ourLo)) == 0)
+    {
+        return true;						// Ours
+    }
+    
+    if (!(frame[0] & 0x01))
+    {
+        return false;						// Someone else's
+    }
+    
+    if ((dstHi == 0xffffffff) && (dstLo == 0xffff))
+    {
+        return (filter & kIngressBroadcast) != 0;
+    }
+    
+    return cdc_McFilterMatch(mc, frame);
+    
+}/* end cdc_IngressAccept */
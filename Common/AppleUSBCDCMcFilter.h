@@ -0,0 +1,67 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+ 
+ 
+#ifndef __APPLEUSBCDCMCFILTER__
+#define __APPLEUSBCDCMCFILTER__
+
+#include <libkern/OSTypes.h>
+
+        /* AppleUSBCDCMcFilter.h - ECM software receive filter, kept free of IOKit so it builds on the host	*/
+
+#define kMcAddrLen			6				// Ethernet address
+#define kMcHashSize			128				// Hash set slots (power of 2)
+#define kMcMaxAddrs			(kMcHashSize / 2)		// Most we'll track, keeps the set half empty
+
+    // cdc_IngressAccept filter bits, the same as the CDC packet filter's (kPACKET_TYPE_...)
+
+#define kIngressPromiscuous		0x0001
+#define kIngressBroadcast		0x0008
+
+typedef struct
+{
+    UInt8			addr[kMcAddrLen];
+    bool			used;
+} mcEntry;
+
+    // Written only by cdc_McFilterUpdate (serialized by the caller), read without a lock by cdc_McFilterMatch
+
+typedef struct
+{
+    mcEntry			set[2][kMcHashSize];			// Double buffered so the receive side can look without a lock
+    UInt64			bloom[2];				// One bit per address, quick reject before the set lookup
+    volatile UInt32		active;					// Which one is current
+    volatile UInt32		gen;					// Bumped before the spare is rebuilt, a lookup that sees it change retries
+    UInt32			count;					// Addresses in the current set
+    bool			overflow;				// More than we can track, pass them all
+} mcFilter;
+
+void		cdc_McFilterInit(mcFilter *mc);
+bool		cdc_McFilterUpdate(mcFilter *mc, const UInt8 *addrs, UInt32 count);
+bool		cdc_McFilterMatch(mcFilter *mc, const UInt8 *addr);
+bool		cdc_IngressAccept(const UInt8 *frame, UInt32 ourHi, UInt16 ourLo, UInt16 filter, mcFilter *mc);
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+ 
+ 
+
+    /* AppleUSBCDCNTB.cpp - Building and walking NCM 16 bit transfer blocks */
+
+#include <libkern/OSByteOrder.h>
+
+#include "AppleUSBCDCNTB.h"
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_NTBAlign
+//
+//		Inputs:		offset - where we are in the block
+//				divisor - alignment (a power of 2)
+//				remainder - wanted offset modulo divisor
+//
+//		Outputs:	The first offset at or after offset that's remainder modulo divisor
+//
+//		Desc:		Datagrams go at wNdpOutDivisor/wNdpOutPayloadRemainder, the NDP at
+//				wNdpOutAlignment (remainder zero)
+//
+/****************************************************************************************************/
+
+UInt32 cdc_NTBAlign(UInt32 offset, UInt32 divisor, UInt32 remainder)
+{
+
+    return ((offset - remainder + divisor - 1) & ~(divisor - 1)) + remainder;
+
+}/* end cdc_NTBAlign */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_NTBNDPLength
+//
+//		Inputs:		count - number of datagrams
+//
+//		Outputs:	Length of the NDP16 for them
+//
+//		Desc:		The header, one pointer per datagram and the zero pointer that ends the list
+//
+/****************************************************************************************************/
+
+UInt32 cdc_NTBNDPLength(UInt32 count)
+{
+
+    return kNDP16Len + ((count + 1) * kDPE16Len);
+
+}/* end cdc_NTBNDPLength */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_NTBFits
+//
+//		Inputs:		offset - where the datagram would go
+//				len - the datagram length
+//				count - datagrams already in the block
+//				ndpAlignment - wNdpOutAlignment
+//				ntbSize - the block size
+//
+//		Outputs:	true (there's room), false (there isn't)
+//
+//		Desc:		Checks a datagram and the (now bigger) NDP after it fit in the block
+//
+/****************************************************************************************************/
+
+bool cdc_NTBFits(UInt32 offset, UInt32 len, UInt32 count, UInt32 ndpAlignment, UInt32 ntbSize)
+{
+    UInt32	ndpIndex;
+
+    ndpIndex = cdc_NTBAlign(offset + len, ndpAlignment, 0);
+
+    return (ndpIndex + cdc_NTBNDPLength(count + 1)) <= ntbSize;
+
+}/* end cdc_NTBFits */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_NTBBuild
+//
+//		Inputs:		block - the block, datagrams already in place after the NTH16
+//				len - end of the last datagram
+//				dpe - datagram pointers (index, length pairs)
+//				count - number of datagrams
+//				sequence - wSequence
+//				ndpAlignment - wNdpOutAlignment
+//				packetSize - bulk out max packet size
+//				ntbSize - the block size
+//				padded - set if a byte of padding was added
+//
+//		Outputs:	Length of the finished block
+//
+//		Desc:		Finish the block, the NDP after the last datagram (cdc_NTBFits has made
+//				sure there's room), then the NTH16 in front. A block that's a multiple of
+//				the packet size would need a zero length packet to end it, a byte of
+//				padding does the same job without the extra round trip.
+//
+/****************************************************************************************************/
+
+UInt32 cdc_NTBBuild(UInt8 *block, UInt32 len, const UInt16 *dpe, UInt32 count, UInt16 sequence,
+                    UInt32 ndpAlignment, UInt32 packetSize, UInt32 ntbSize, bool *padded)
+{
+    UInt32	ndpIndex;
+    UInt32	i;
+
+    *padded = false;
+
+        // NDP16, the datagram pointers and the terminating zero pointer
+
+    ndpIndex = cdc_NTBAlign(len, ndpAlignment, 0);
+    OSWriteLittleInt32(block, ndpIndex, NCM16_Signature_NoCRC);
+    OSWriteLittleInt16(block, ndpIndex + 4, cdc_NTBNDPLength(count));
+    OSWriteLittleInt16(block, ndpIndex + 6, 0);
+    len = ndpIndex + kNDP16Len;
+    for (i=0; i<count; i++)
+    {
+        OSWriteLittleInt16(block, len, dpe[i * 2]);
+        OSWriteLittleInt16(block, len + 2, dpe[(i * 2) + 1]);
+        len += kDPE16Len;
+    }
+    OSWriteLittleInt32(block, len, 0);
+    len += kDPE16Len;
+
+    if (((len % packetSize) == 0) && (len < ntbSize))
+    {
+        block[len++] = 0;
+        *padded = true;
+    }
+
+        // And the NTH16 in front
+
+    OSWriteLittleInt32(block, 0, NTH16_Signature);
+    OSWriteLittleInt16(block, 4, kNTH16Len);
+    OSWriteLittleInt16(block, 6, sequence);
+    OSWriteLittleInt16(block, 8, len);
+    OSWriteLittleInt16(block, 10, ndpIndex);
+
+    return len;
+
+}/* end cdc_NTBBuild */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_NTBParse
+//
+//		Inputs:		block - the transfer block
+//				size - Number of bytes read
+//				minDatagram - shortest datagram that's any use
+//				maxDatagram - longest we'll take
+//				action - called for each good datagram
+//				target - passed to action
+//				errors - incremented for each thing that doesn't add up
+//
+//		Outputs:	Number of datagrams passed to action
+//
+//		Desc:		Walks the NDP16s in the block. Everything the device gave us is checked
+//				against the block before it's used. A bad NTH16 drops the block, a bad
+//				NDP16 (or one we've already walked) ends the walk and a bad datagram
+//				pointer is skipped.
+//
+/****************************************************************************************************/
+
+UInt32 cdc_NTBParse(UInt8 *block, UInt32 size, UInt32 minDatagram, UInt32 maxDatagram,
+                    ntbDatagramAction action, void *target, UInt32 *errors)
+{
+    UInt32	blockLen;
+    UInt32	ndpIndex;
+    UInt32	ndpLen;
+    UInt32	dgIndex;
+    UInt32	dgLen;
+    UInt32	entry;
+    UInt32	seen[kNCMMaxNDPs];
+    UInt32	ndps = 0;
+    UInt32	datagrams = 0;
+    UInt32	i;
+
+    if ((size < kNTH16Len) || (OSReadLittleInt32(block, 0) != NTH16_Signature) || (OSReadLittleInt16(block, 4) != kNTH16Len))
+    {
+        (*errors)++;
+        return 0;
+    }
+
+    blockLen = OSReadLittleInt16(block, 8);
+    if (blockLen == 0)
+    {
+        blockLen = size;					// Ended by a short packet
+    }
+    if (blockLen > size)
+    {
+        (*errors)++;
+        return 0;
+    }
+
+    ndpIndex = OSReadLittleInt16(block, 10);
+    while (ndpIndex != 0)
+    {
+        if ((ndps >= kNCMMaxNDPs) || (ndpIndex & 3) || (ndpIndex < kNTH16Len) || ((ndpIndex + kNDP16Len) > blockLen))
+        {
+            (*errors)++;
+            break;
+        }
+
+            // wNextNdpIndex pointing back at one we've done would pass its datagrams up again
+
+        for (i=0; i<ndps; i++)
+        {
+            if (seen[i] == ndpIndex)
+            {
+                break;
+            }
+        }
+        if (i < ndps)
+        {
+            (*errors)++;
+            break;
+        }
+        seen[ndps++] = ndpIndex;
+
+        ndpLen = OSReadLittleInt16(block, ndpIndex + 4);
+        if ((OSReadLittleInt32(block, ndpIndex) != NCM16_Signature_NoCRC) || (ndpLen < cdc_NTBNDPLength(1)) || ((ndpIndex + ndpLen) > blockLen))
+        {
+            (*errors)++;
+            break;
+        }
+
+        for (entry=ndpIndex+kNDP16Len; (entry + kDPE16Len) <= (ndpIndex + ndpLen); entry+=kDPE16Len)
+        {
+            dgIndex = OSReadLittleInt16(block, entry);
+            dgLen = OSReadLittleInt16(block, entry + 2);
+            if ((dgIndex == 0) || (dgLen == 0))
+            {
+                break;						// End of the list
+            }
+            if ((dgIndex < kNTH16Len) || ((dgIndex + dgLen) > blockLen) || (dgLen < minDatagram) || (dgLen > maxDatagram))
+            {
+                (*errors)++;
+                continue;
+            }
+            action(target, &block[dgIndex], dgLen);
+            datagrams++;
+        }
+
+        ndpIndex = OSReadLittleInt16(block, ndpIndex + 6);
+    }
+
+    return datagrams;
+
+}/* end cdc_NTBParse */
@@ -0,0 +1,74 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+ 
+ 
+#ifndef __APPLEUSBCDCNTB__
+#define __APPLEUSBCDCNTB__
+
+#include <libkern/OSTypes.h>
+
+        /* AppleUSBCDCNTB.h - NCM 16 bit transfer blocks, kept free of IOKit so it builds on the host	*/
+
+#define NTH16_Signature                 0x484D434E		// NCMH
+#define NCM16_Signature_NoCRC           0x304D434E		// NCM0
+#define NCM16_Signature_CRC             0x314D434E		// NCM1
+
+typedef struct
+{
+    UInt32 	dwSignature;
+    UInt16 	wHeaderLength;
+	UInt16	wSequence;
+	UInt16	wBlockLength;
+	UInt16	wNdpIndex;
+} __attribute__((packed)) NTH16;
+
+typedef struct
+{
+    UInt32		dwSignature;
+    UInt16		wLength;
+	UInt16		wNextNdpIndex;  //Reserved for use as a link to the next NDP16 in the NTB set to 0x0000
+} __attribute__((packed)) NDP16;
+
+    // Transfer block layout (NTB16)
+
+#define kNTH16Len		sizeof(NTH16)			// 12
+#define kNDP16Len		sizeof(NDP16)			// 8, the datagram pointers follow
+#define kDPE16Len		4				// wDatagramIndex, wDatagramLength
+#define kNCMMaxNDPs		8				// Most NDPs we'll follow in one block
+
+    // Called once per datagram found by cdc_NTBParse, datagram is only good for the call
+
+typedef void (*ntbDatagramAction)(void *target, UInt8 *datagram, UInt32 len);
+
+UInt32		cdc_NTBAlign(UInt32 offset, UInt32 divisor, UInt32 remainder);
+UInt32		cdc_NTBNDPLength(UInt32 count);
+bool		cdc_NTBFits(UInt32 offset, UInt32 len, UInt32 count, UInt32 ndpAlignment, UInt32 ntbSize);
+UInt32		cdc_NTBBuild(UInt8 *block, UInt32 len, const UInt16 *dpe, UInt32 count, UInt16 sequence,
+                             UInt32 ndpAlignment, UInt32 packetSize, UInt32 ntbSize, bool *padded);
+UInt32		cdc_NTBParse(UInt8 *block, UInt32 size, UInt32 minDatagram, UInt32 maxDatagram,
+                             ntbDatagramAction action, void *target, UInt32 *errors);
+
+#endif
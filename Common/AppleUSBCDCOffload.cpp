@@ -0,0 +1,749 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+    /* AppleUSBCDCOffload.cpp - Software offloads shared by the CDC networking drivers */
+
+#include <string.h>
+#include <sys/param.h>				/* MCLBYTES, MBIGCLBYTES */
+#include <libkern/OSByteOrder.h>
+
+#include "AppleUSBCDCOffload.h"
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_CsumPartial
+//
+//		Inputs:		data - the bytes
+//				len - how many
+//				sum - running sum
+//
+//		Outputs:	The new running sum
+//
+//		Desc:		Adds the bytes to a ones complement sum. Words are taken as they sit in memory
+//				(four bytes at a time into a 64 bit accumulator) so the folded result can be
+//				stored straight back without swapping.
+//
+/****************************************************************************************************/
+
+UInt64 cdc_CsumPartial(const UInt8 *data, UInt32 len, UInt64 sum)
+{
+    UInt32	w32;
+    UInt16	w16;
+    
+    while (len >= 16)
+    {
+        bcopy(data, &w32, 4);
+        sum += w32;
+        bcopy(data+4, &w32, 4);
+        sum += w32;
+        bcopy(data+8, &w32, 4);
+        sum += w32;
+        bcopy(data+12, &w32, 4);
+        sum += w32;
+        data += 16;
+        len -= 16;
+    }
+    while (len >= 4)
+    {
+        bcopy(data, &w32, 4);
+        sum += w32;
+        data += 4;
+        len -= 4;
+    }
+    if (len >= 2)
+    {
+        bcopy(data, &w16, 2);
+        sum += w16;
+        data += 2;
+        len -= 2;
+    }
+    if (len)
+    {
+        w16 = 0;
+        ((UInt8 *)&w16)[0] = *data;
+        sum += w16;
+    }
+    
+    return sum;
+    
+}/* end cdc_CsumPartial */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_CsumFold
+//
+//		Inputs:		sum - running sum
+//
+//		Outputs:	16 bit ones complement sum (not inverted)
+//
+//		Desc:		Folds the carries back in
+//
+/****************************************************************************************************/
+
+UInt16 cdc_CsumFold(UInt64 sum)
+{
+    
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    
+    return (UInt16)sum;
+    
+}/* end cdc_CsumFold */
+
+/****************************************************************************************************/
+//
+//		Function:	csumReplace
+//
+//		Inputs:		sum - running sum
+//				oldp - the old word
+//				newp - the new word
+//
+//		Outputs:	The adjusted sum
+//
+//		Desc:		Incremental update for a changed 16 bit word (RFC 1624)
+//
+/****************************************************************************************************/
+
+static inline UInt64 csumReplace(UInt64 sum, const UInt8 *oldp, const UInt8 *newp)
+{
+    UInt16	oldw, neww;
+    
+    bcopy(oldp, &oldw, 2);
+    bcopy(newp, &neww, 2);
+    
+    return sum + (UInt16)~oldw + neww;
+    
+}/* end csumReplace */
+
+/****************************************************************************************************/
+//
+//		Function:	pseudoHeaderSum
+//
+//		Inputs:		ip - start of the IP header
+//				ipv6 - IPv6 (true) or IPv4 (false)
+//
+//		Outputs:	Sum of the TCP pseudo header without the length
+//
+//		Desc:		Source and destination addresses plus the protocol
+//
+/****************************************************************************************************/
+
+static UInt64 pseudoHeaderSum(const UInt8 *ip, bool ipv6)
+{
+    UInt64	sum;
+    UInt8	proto[2];
+    
+    if (ipv6)
+    {
+        sum = cdc_CsumPartial(&ip[8], 32, 0);
+    } else {
+        sum = cdc_CsumPartial(&ip[12], 8, 0);
+    }
+    proto[0] = 0;
+    proto[1] = kIPProtoTCP;
+    
+    return cdc_CsumPartial(proto, 2, sum);
+    
+}/* end pseudoHeaderSum */
+
+/****************************************************************************************************/
+//
+//		Function:	lengthSum
+//
+//		Inputs:		sum - running sum
+//				len - a 16 bit length
+//
+//		Outputs:	The new running sum
+//
+//		Desc:		Adds a length in network order
+//
+/****************************************************************************************************/
+
+static inline UInt64 lengthSum(UInt64 sum, UInt32 len)
+{
+    UInt8	val[2];
+    
+    val[0] = (len >> 8) & 0xff;
+    val[1] = len & 0xff;
+    
+    return cdc_CsumPartial(val, 2, sum);
+    
+}/* end lengthSum */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_TSOParse
+//
+//		Inputs:		m - the large send
+//				mss - segment size from the stack
+//				ipv6 - IPv6 (true) or IPv4 (false)
+//				tso - where the state goes
+//
+//		Outputs:	true (it can be segmented), false (it can't)
+//
+//		Desc:		Takes a copy of the headers and works out the segments. The IP and TCP
+//				base sums are done once here, each segment then just adjusts them.
+//
+/****************************************************************************************************/
+
+bool cdc_TSOParse(mbuf_t m, UInt32 mss, bool ipv6, tsoInfo *tso)
+{
+    UInt32	total = (UInt32)mbuf_pkthdr_len(m);
+    UInt32	copyLen;
+    UInt32	ipHdrLen;
+    UInt32	tcpHdrLen;
+    UInt16	etherType;
+    UInt8	*hdr = tso->hdr;
+    
+    if (mss == 0)
+    {
+        return false;
+    }
+    
+    copyLen = (total < kTSOMaxHeaders) ? total : kTSOMaxHeaders;
+    if (mbuf_copydata(m, 0, copyLen, hdr) != 0)
+    {
+        return false;
+    }
+    
+        // Ethernet (maybe tagged)
+    
+    tso->ipOffset = kEtherHeaderLen;
+    etherType = (hdr[12] << 8) | hdr[13];
+    if (etherType == kEtherTypeVLAN)
+    {
+        tso->ipOffset += kVLANTagLen;
+        etherType = (hdr[16] << 8) | hdr[17];
+    }
+    
+        // IP
+    
+    tso->ipv6 = ipv6;
+    if (ipv6)
+    {
+        if ((etherType != kEtherTypeIPv6) || (hdr[tso->ipOffset + 6] != kIPProtoTCP))	// No extension headers
+        {
+            return false;
+        }
+        ipHdrLen = kIPv6HeaderLen;
+    } else {
+        if (etherType != kEtherTypeIPv4)
+        {
+            return false;
+        }
+        ipHdrLen = (hdr[tso->ipOffset] & 0x0f) * 4;
+        if ((ipHdrLen < 20) || (hdr[tso->ipOffset + 9] != kIPProtoTCP))
+        {
+            return false;
+        }
+    }
+    tso->tcpOffset = tso->ipOffset + ipHdrLen;
+    if (tso->tcpOffset + 20 > copyLen)
+    {
+        return false;
+    }
+    
+        // TCP
+    
+    tcpHdrLen = (hdr[tso->tcpOffset + 12] >> 4) * 4;
+    tso->hdrLen = tso->tcpOffset + tcpHdrLen;
+    if ((tcpHdrLen < 20) || (tso->hdrLen > copyLen))
+    {
+        return false;
+    }
+    
+    tso->mss = mss;
+    tso->payloadLen = total - tso->hdrLen;
+    tso->segments = (tso->payloadLen + mss - 1) / mss;
+    if (tso->segments == 0)
+    {
+        return false;
+    }
+    
+        // Base sums, with the checksum fields cleared in our copy
+    
+    tso->ipBaseSum = 0;
+    if (!ipv6)
+    {
+        hdr[tso->ipOffset + 10] = 0;
+        hdr[tso->ipOffset + 11] = 0;
+        tso->ipBaseSum = cdc_CsumPartial(&hdr[tso->ipOffset], ipHdrLen, 0);
+    }
+    
+    hdr[tso->tcpOffset + 16] = 0;
+    hdr[tso->tcpOffset + 17] = 0;
+    tso->tcpBaseSum = pseudoHeaderSum(&hdr[tso->ipOffset], ipv6);
+    tso->tcpBaseSum = cdc_CsumPartial(&hdr[tso->tcpOffset], tcpHdrLen, tso->tcpBaseSum);
+    
+    return true;
+    
+}/* end cdc_TSOParse */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_TSOSegment
+//
+//		Inputs:		m - the large send
+//				tso - state from cdc_TSOParse
+//				seg - which segment
+//				frame - where to build it
+//
+//		Outputs:	Length of the frame
+//
+//		Desc:		Builds one segment, the headers are fixed up with incremental checksum
+//				updates and only the payload is summed in full.
+//
+/****************************************************************************************************/
+
+UInt32 cdc_TSOSegment(mbuf_t m, tsoInfo *tso, UInt32 seg, UInt8 *frame)
+{
+    UInt32	offset = seg * tso->mss;
+    UInt32	segLen = tso->payloadLen - offset;
+    UInt8	*ip = &frame[tso->ipOffset];
+    UInt8	*tcp = &frame[tso->tcpOffset];
+    UInt8	*oip = &tso->hdr[tso->ipOffset];
+    UInt8	*otcp = &tso->hdr[tso->tcpOffset];
+    UInt64	sum;
+    UInt32	seq;
+    UInt16	val;
+    
+    if (segLen > tso->mss)
+    {
+        segLen = tso->mss;
+    }
+    
+    bcopy(tso->hdr, frame, tso->hdrLen);
+    mbuf_copydata(m, tso->hdrLen + offset, segLen, &frame[tso->hdrLen]);
+    
+        // IP length (and id for v4)
+    
+    if (tso->ipv6)
+    {
+        val = OSSwapHostToBigInt16((UInt16)(tso->hdrLen - tso->tcpOffset + segLen));
+        bcopy(&val, &ip[4], 2);
+    } else {
+        val = OSSwapHostToBigInt16((UInt16)(tso->hdrLen - tso->ipOffset + segLen));
+        bcopy(&val, &ip[2], 2);
+        val = OSSwapHostToBigInt16((UInt16)(((oip[4] << 8) | oip[5]) + seg));
+        bcopy(&val, &ip[4], 2);
+        
+        sum = csumReplace(tso->ipBaseSum, &oip[2], &ip[2]);
+        sum = csumReplace(sum, &oip[4], &ip[4]);
+        val = ~cdc_CsumFold(sum);
+        bcopy(&val, &ip[10], 2);
+    }
+    
+        // TCP sequence and flags (FIN and PSH only on the last, CWR only on the first)
+    
+    seq = ((UInt32)otcp[4] << 24) | ((UInt32)otcp[5] << 16) | ((UInt32)otcp[6] << 8) | otcp[7];
+    seq = OSSwapHostToBigInt32(seq + offset);
+    bcopy(&seq, &tcp[4], 4);
+    if (seg != tso->segments - 1)
+    {
+        tcp[13] &= ~(kTCPFlagFIN | kTCPFlagPSH);
+    }
+    if (seg != 0)
+    {
+        tcp[13] &= ~kTCPFlagCWR;
+    }
+    
+    sum = csumReplace(tso->tcpBaseSum, &otcp[4], &tcp[4]);
+    sum = csumReplace(sum, &otcp[6], &tcp[6]);
+    sum = csumReplace(sum, &otcp[12], &tcp[12]);
+    
+    sum = lengthSum(sum, tso->hdrLen - tso->tcpOffset + segLen);
+    sum = cdc_CsumPartial(&frame[tso->hdrLen], segLen, sum);
+    
+    val = ~cdc_CsumFold(sum);
+    bcopy(&val, &tcp[16], 2);
+    
+    return tso->hdrLen + segLen;
+    
+}/* end cdc_TSOSegment */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_LROParse
+//
+//		Inputs:		frame - received frame
+//				size - its length
+//				seg - where the details go
+//
+//		Outputs:	true (a segment we can merge), false (pass it up as is)
+//
+//		Desc:		Only plain data segments (ACK, maybe PSH) are candidates. IPv4 options,
+//				fragments and IPv6 extension headers are left alone. The IP and TCP checksums
+//				are checked here as the merged packet goes up marked as verified.
+//
+/****************************************************************************************************/
+
+bool cdc_LROParse(const UInt8 *frame, UInt32 size, lroSegment *seg)
+{
+    const UInt8	*ip;
+    const UInt8	*tcp;
+    UInt32	ipLen;
+    UInt32	ipHdrLen;
+    UInt32	tcpHdrLen;
+    UInt16	etherType;
+    UInt64	sum;
+    
+    if (size < kEtherHeaderLen + 40)
+    {
+        return false;
+    }
+    
+    seg->ipOffset = kEtherHeaderLen;
+    etherType = (frame[12] << 8) | frame[13];
+    if (etherType == kEtherTypeVLAN)
+    {
+        seg->ipOffset += kVLANTagLen;
+        etherType = (frame[16] << 8) | frame[17];
+    }
+    ip = &frame[seg->ipOffset];
+    
+    if (etherType == kEtherTypeIPv4)
+    {
+        if ((ip[0] != 0x45) || (ip[9] != kIPProtoTCP) || (ip[6] & 0x3f) || ip[7])		// No options or fragments
+        {
+            return false;
+        }
+        ipHdrLen = 20;
+        ipLen = (ip[2] << 8) | ip[3];
+        seg->ipv6 = false;
+    } else if (etherType == kEtherTypeIPv6) {
+        if (((ip[0] >> 4) != 6) || (ip[6] != kIPProtoTCP))
+        {
+            return false;
+        }
+        ipHdrLen = kIPv6HeaderLen;
+        ipLen = kIPv6HeaderLen + ((ip[4] << 8) | ip[5]);
+        seg->ipv6 = true;
+    } else {
+        return false;
+    }
+    
+    if ((ipLen < ipHdrLen + 20) || (seg->ipOffset + ipLen > size))
+    {
+        return false;
+    }
+    
+    seg->tcpOffset = seg->ipOffset + ipHdrLen;
+    tcp = &frame[seg->tcpOffset];
+    tcpHdrLen = (tcp[12] >> 4) * 4;
+    seg->hdrLen = seg->tcpOffset + tcpHdrLen;
+    if ((tcpHdrLen < 20) || (seg->hdrLen >= seg->ipOffset + ipLen))		// Pure ACKs aren't worth it
+    {
+        return false;
+    }
+    seg->payloadLen = seg->ipOffset + ipLen - seg->hdrLen;
+    if (seg->payloadLen > MBIGCLBYTES)
+    {
+        return false;
+    }
+    
+    seg->flags = tcp[13];
+    if ((seg->flags & ~kTCPFlagPSH) != kTCPFlagACK)
+    {
+        return false;
+    }
+    seg->seq = ((UInt32)tcp[4] << 24) | ((UInt32)tcp[5] << 16) | ((UInt32)tcp[6] << 8) | tcp[7];
+    
+        // Checksums
+    
+    if (!seg->ipv6 && (cdc_CsumFold(cdc_CsumPartial(ip, ipHdrLen, 0)) != 0xffff))
+    {
+        return false;
+    }
+    
+    sum = cdc_CsumPartial(&frame[seg->hdrLen], seg->payloadLen, 0);
+    seg->payloadSum = cdc_CsumFold(sum);
+    sum = lengthSum(sum, ipLen - ipHdrLen);
+    sum += pseudoHeaderSum(ip, seg->ipv6);
+    sum = cdc_CsumPartial(tcp, tcpHdrLen, sum);
+    if (cdc_CsumFold(sum) != 0xffff)
+    {
+        return false;
+    }
+    
+    return true;
+    
+}/* end cdc_LROParse */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_LROMatch
+//
+//		Inputs:		flow - the packet being built
+//				frame - received frame
+//				seg - from cdc_LROParse
+//
+//		Outputs:	true (can be appended), false (flush first)
+//
+//		Desc:		Same addresses, ports and header layout, next in sequence and room for it.
+//				The TCP options must match apart from the timestamp values.
+//
+/****************************************************************************************************/
+
+bool cdc_LROMatch(const lroFlow *flow, const UInt8 *frame, const lroSegment *seg)
+{
+    const lroSegment	*first = &flow->first;
+    const UInt8		*hdr;
+    const UInt8		*ip = &frame[seg->ipOffset];
+    const UInt8		*tcp = &frame[seg->tcpOffset];
+    const UInt8		*fip;
+    const UInt8		*ftcp;
+    UInt32		optLen;
+    
+    if (!flow->head)
+    {
+        return false;
+    }
+    
+    if ((seg->ipv6 != first->ipv6) || (seg->ipOffset != first->ipOffset) || (seg->hdrLen != first->hdrLen))
+    {
+        return false;
+    }
+    
+    if ((flow->segs >= kLROMaxSegments) || (seg->seq != flow->nextSeq) ||
+        (flow->len - first->ipOffset + seg->payloadLen > kLROMaxIPLen))
+    {
+        return false;
+    }
+    
+    hdr = (const UInt8 *)mbuf_data(flow->head);
+    fip = &hdr[first->ipOffset];
+    ftcp = &hdr[first->tcpOffset];
+    
+        // Ethernet (and VLAN), then IP
+    
+    if (bcmp(frame, hdr, seg->ipOffset) != 0)
+    {
+        return false;
+    }
+    if (seg->ipv6)
+    {
+        if ((bcmp(ip, fip, 4) != 0) || (ip[7] != fip[7]) || (bcmp(&ip[8], &fip[8], 32) != 0))
+        {
+            return false;
+        }
+    } else {
+        if ((ip[1] != fip[1]) || (ip[8] != fip[8]) || (bcmp(&ip[12], &fip[12], 8) != 0))
+        {
+            return false;
+        }
+    }
+    
+        // Ports and options
+    
+    if (bcmp(tcp, ftcp, 4) != 0)
+    {
+        return false;
+    }
+    optLen = seg->hdrLen - seg->tcpOffset - 20;
+    if (optLen > 0)
+    {
+        if ((optLen == 12) && (tcp[20] == 1) && (tcp[21] == 1) && (tcp[22] == 8) && (tcp[23] == 10))
+        {
+            if (bcmp(&tcp[20], &ftcp[20], 4) != 0)
+            {
+                return false;
+            }
+        } else if (bcmp(&tcp[20], &ftcp[20], optLen) != 0) {
+            return false;
+        }
+    }
+    
+    return true;
+    
+}/* end cdc_LROMatch */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_LROStart
+//
+//		Inputs:		flow - idle flow
+//				m - the segment's frame
+//				seg - from cdc_LROParse
+//
+//		Outputs:	true (flow started), false (headers not contiguous, pass it up as is)
+//
+//		Desc:		The first segment provides the headers for the merged packet, anything
+//				after the IP payload (padding) is trimmed.
+//
+/****************************************************************************************************/
+
+bool cdc_LROStart(lroFlow *flow, mbuf_t m, const lroSegment *seg)
+{
+    UInt32	len = seg->hdrLen + seg->payloadLen;
+    UInt32	total = (UInt32)mbuf_pkthdr_len(m);
+    
+    if (mbuf_len(m) < seg->hdrLen)
+    {
+        return false;
+    }
+    
+    if (total > len)
+    {
+        mbuf_adj(m, -(int)(total - len));
+    }
+    
+    flow->head = m;
+    flow->tail = m;
+    while (mbuf_next(flow->tail))
+    {
+        flow->tail = mbuf_next(flow->tail);
+    }
+    flow->len = len;
+    flow->segs = 1;
+    flow->nextSeq = seg->seq + seg->payloadLen;
+    flow->payloadSum = seg->payloadSum;
+    flow->odd = (seg->payloadLen & 1) != 0;
+    flow->first = *seg;
+    
+    return true;
+    
+}/* end cdc_LROStart */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_LROAppend
+//
+//		Inputs:		flow - the packet being built
+//				frame - received frame
+//				seg - from cdc_LROParse (and cdc_LROMatch)
+//
+//		Outputs:	true (appended), false (no mbuf)
+//
+//		Desc:		Copies the payload onto the end of the chain. The acknowledgment, window
+//				and options are taken from the latest segment and PSH is carried over.
+//
+/****************************************************************************************************/
+
+bool cdc_LROAppend(lroFlow *flow, const UInt8 *frame, const lroSegment *seg)
+{
+    mbuf_t	m;
+    UInt8	*tcp;
+    UInt16	sum;
+    
+    if (mbuf_getcluster(MBUF_DONTWAIT, MBUF_TYPE_DATA, (seg->payloadLen <= MCLBYTES) ? MCLBYTES : MBIGCLBYTES, &m) != 0)
+    {
+        return false;
+    }
+    bcopy(&frame[seg->hdrLen], mbuf_data(m), seg->payloadLen);
+    mbuf_setlen(m, seg->payloadLen);
+    
+    mbuf_setnext(flow->tail, m);
+    flow->tail = m;
+    flow->len += seg->payloadLen;
+    mbuf_pkthdr_setlen(flow->head, flow->len);
+    
+        // A payload after an odd length one sits at odd offsets, so its sum is byte swapped
+    
+    sum = seg->payloadSum;
+    if (flow->odd)
+    {
+        sum = (UInt16)((sum << 8) | (sum >> 8));
+    }
+    flow->payloadSum += sum;
+    if (seg->payloadLen & 1)
+    {
+        flow->odd = !flow->odd;
+    }
+    
+    tcp = &((UInt8 *)mbuf_data(flow->head))[seg->tcpOffset];
+    bcopy(&frame[seg->tcpOffset + 8], &tcp[8], 4);			// Acknowledgment
+    tcp[13] |= seg->flags & kTCPFlagPSH;
+    bcopy(&frame[seg->tcpOffset + 14], &tcp[14], 2);			// Window
+    bcopy(&frame[seg->tcpOffset + 20], &tcp[20], seg->hdrLen - seg->tcpOffset - 20);
+    
+    flow->segs++;
+    flow->nextSeq += seg->payloadLen;
+    
+    return true;
+    
+}/* end cdc_LROAppend */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_LROFinish
+//
+//		Inputs:		flow - the packet being built
+//
+//		Outputs:	The packet (flow is idle again), len - its length
+//
+//		Desc:		Fixes up the lengths and checksums of a merged packet. The checksums were
+//				checked on the way in so the packet is marked as verified.
+//
+/****************************************************************************************************/
+
+mbuf_t cdc_LROFinish(lroFlow *flow, UInt32 *len)
+{
+    mbuf_t	m = flow->head;
+    UInt8	*hdr = (UInt8 *)mbuf_data(m);
+    UInt8	*ip = &hdr[flow->first.ipOffset];
+    UInt8	*tcp = &hdr[flow->first.tcpOffset];
+    UInt32	csumFlags = MBUF_CSUM_DID_DATA | MBUF_CSUM_PSEUDO_HDR;
+    UInt64	sum;
+    UInt16	val;
+    
+    if (flow->segs > 1)
+    {
+        if (flow->first.ipv6)
+        {
+            val = OSSwapHostToBigInt16((UInt16)(flow->len - flow->first.tcpOffset));
+            bcopy(&val, &ip[4], 2);
+        } else {
+            val = OSSwapHostToBigInt16((UInt16)(flow->len - flow->first.ipOffset));
+            bcopy(&val, &ip[2], 2);
+            ip[10] = 0;
+            ip[11] = 0;
+            val = ~cdc_CsumFold(cdc_CsumPartial(ip, 20, 0));
+            bcopy(&val, &ip[10], 2);
+        }
+        
+        tcp[16] = 0;
+        tcp[17] = 0;
+        sum = pseudoHeaderSum(ip, flow->first.ipv6);
+        sum = lengthSum(sum, flow->len - flow->first.tcpOffset);
+        sum = cdc_CsumPartial(tcp, flow->first.hdrLen - flow->first.tcpOffset, sum);
+        val = ~cdc_CsumFold(sum + flow->payloadSum);
+        bcopy(&val, &tcp[16], 2);
+    }
+    
+    if (!flow->first.ipv6)
+    {
+        csumFlags |= MBUF_CSUM_DID_IP | MBUF_CSUM_IP_GOOD;
+    }
+    mbuf_set_csum_performed(m, csumFlags, 0xffff);
+    
+    *len = flow->len;
+    flow->head = NULL;
+    flow->tail = NULL;
+    
+    return m;
+    
+}/* end cdc_LROFinish */
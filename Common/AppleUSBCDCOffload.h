@@ -0,0 +1,125 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+#ifndef __APPLEUSBCDCOFFLOAD__
+#define __APPLEUSBCDCOFFLOAD__
+
+#include <libkern/OSTypes.h>
+
+extern "C"
+{
+    #include <sys/kpi_mbuf.h>
+}
+
+        /* AppleUSBCDCOffload.h - Software offloads shared by the CDC networking drivers,	*/
+	/* kept free of IOKit so it builds on the host (Tests/shim stands in for the mbuf KPI)	*/
+        
+    // Frame layout
+
+#define kEtherHeaderLen			14
+#define kVLANTagLen			4
+#define kEtherTypeIPv4			0x0800
+#define kEtherTypeIPv6			0x86DD
+#define kEtherTypeVLAN			0x8100
+#define kIPv4MaxHeaderLen		60
+#define kIPv6HeaderLen			40
+#define kTCPMaxHeaderLen		60
+#define kIPProtoTCP			6
+
+#define kTCPFlagFIN			0x01
+#define kTCPFlagPSH			0x08
+#define kTCPFlagACK			0x10
+#define kTCPFlagCWR			0x80
+
+#define kTSOMaxHeaders			(kEtherHeaderLen + kVLANTagLen + kIPv4MaxHeaderLen + kTCPMaxHeaderLen)
+
+#define	tsoTag				"TCPSegmentation"
+#define	lroTag				"ReceiveCoalescing"
+
+#define kLROMaxSegments			16				// Segments merged into one packet
+#define kLROMaxIPLen			65535
+
+    // TCP segmentation (TSO) state for one large send
+
+typedef struct
+{
+    UInt32	ipOffset;					// Start of the IP header
+    UInt32	tcpOffset;					// Start of the TCP header
+    UInt32	hdrLen;						// All the headers (Ethernet, IP and TCP)
+    UInt32	payloadLen;					// TCP payload of the large send
+    UInt32	mss;
+    UInt32	segments;
+    bool	ipv6;
+    UInt64	ipBaseSum;					// IPv4 header sum (checksum field zero)
+    UInt64	tcpBaseSum;					// Pseudo header (no length) and TCP header sum (checksum field zero)
+    UInt8	hdr[kTSOMaxHeaders];				// The original headers
+} tsoInfo;
+
+    // Receive coalescing (LRO), one eligible TCP segment as it sits in the receive buffer
+
+typedef struct
+{
+    UInt32	ipOffset;
+    UInt32	tcpOffset;
+    UInt32	hdrLen;
+    UInt32	payloadLen;
+    UInt32	seq;
+    UInt8	flags;
+    bool	ipv6;
+    UInt16	payloadSum;					// Folded, checked along with the rest of the segment
+} lroSegment;
+
+    // A packet being built from consecutive in-order segments of one flow
+
+typedef struct
+{
+    mbuf_t	head;						// NULL when idle, holds the first segment's frame
+    mbuf_t	tail;						// Last mbuf of the chain
+    UInt32	len;						// Frame length so far
+    UInt32	segs;
+    UInt32	nextSeq;
+    UInt64	payloadSum;					// Payload sum of the merged segments
+    bool	odd;						// Payload so far is an odd length
+    lroSegment	first;
+} lroFlow;
+
+    // Ones complement checksum helpers (sums are kept in memory order)
+
+UInt64	cdc_CsumPartial(const UInt8 *data, UInt32 len, UInt64 sum);
+UInt16	cdc_CsumFold(UInt64 sum);
+
+    // Segmentation
+
+bool	cdc_TSOParse(mbuf_t m, UInt32 mss, bool ipv6, tsoInfo *tso);
+UInt32	cdc_TSOSegment(mbuf_t m, tsoInfo *tso, UInt32 seg, UInt8 *frame);
+
+    // Coalescing
+
+bool	cdc_LROParse(const UInt8 *frame, UInt32 size, lroSegment *seg);
+bool	cdc_LROMatch(const lroFlow *flow, const UInt8 *frame, const lroSegment *seg);
+bool	cdc_LROStart(lroFlow *flow, mbuf_t m, const lroSegment *seg);
+bool	cdc_LROAppend(lroFlow *flow, const UInt8 *frame, const lroSegment *seg);
+mbuf_t	cdc_LROFinish(lroFlow *flow, UInt32 *len);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+
+    /* AppleUSBCDCPipe.cpp - Bulk pipe helpers shared by the CDC data drivers */
+
+#include <IOKit/IOLib.h>
+
+#include "AppleUSBCDCPipe.h"
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_CheckPipe
+//
+//		Inputs:		thePipe - the pipe
+//				devReq - true(send CLEAR_FEATURE), false(only if status returns stalled)
+//
+//		Outputs:	Return code - kIOReturnSuccess (cleared), the pipe status (wasn't stalled)
+//				or the ClearPipeStall error
+//
+//		Desc:		Clear a stall on the specified pipe. If ClearPipeStall is issued
+//				all outstanding I/O is returned with kIOUSBTransactionReturned and
+//				a CLEAR_FEATURE Endpoint stall is sent.
+//
+/****************************************************************************************************/
+
+IOReturn cdc_CheckPipe(IOUSBPipe *thePipe, bool devReq)
+{
+    IOReturn 	rtn;
+    
+    if (!devReq)
+    {
+        rtn = thePipe->GetPipeStatus();
+        if (rtn != kIOUSBPipeStalled)
+        {
+            return rtn;
+        }
+    }
+    
+    return thePipe->ClearPipeStall(true);
+
+}/* end cdc_CheckPipe */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_PipeWrite
+//
+//		Inputs:		thePipe - the bulk out pipe
+//				mdp - the buffer
+//				len - bytes to write
+//				noDataTimeout, completionTimeout - in milliseconds (kPipeNoTimeout for none)
+//				completion - called when the write finishes
+//
+//		Outputs:	Return code - kIOReturnSuccess (write started), everything else (it didn't)
+//
+//		Desc:		Start a write. A pipe that's reported as stalled has the stall cleared
+//				and the write is tried once more, a second failure goes back to the caller
+//				who still owns the buffer.
+//
+/****************************************************************************************************/
+
+IOReturn cdc_PipeWrite(IOUSBPipe *thePipe, IOMemoryDescriptor *mdp, UInt32 len, UInt32 noDataTimeout, UInt32 completionTimeout, IOUSBCompletion *completion)
+{
+    IOReturn	ior;
+    
+    ior = thePipe->Write(mdp, noDataTimeout, completionTimeout, len, completion);
+    if (ior == kIOUSBPipeStalled)
+    {
+        cdc_CheckPipe(thePipe, true);
+        ior = thePipe->Write(mdp, noDataTimeout, completionTimeout, len, completion);
+    }
+    
+    return ior;
+
+}/* end cdc_PipeWrite */
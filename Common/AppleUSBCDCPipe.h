@@ -0,0 +1,48 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+#ifndef __APPLEUSBCDCPIPE__
+#define __APPLEUSBCDCPIPE__
+
+#include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/usb/IOUSBPipe.h>
+
+#include "AppleUSBCDCCommon.h"
+#include "AppleUSBCDCZLP.h"
+
+        /* AppleUSBCDCPipe.h - Bulk pipe helpers shared by the CDC data drivers (stall	*/
+        /* recovery, the write retry and the ZLP rule). The buffers, completions and read	*/
+        /* re-arming are still each driver's own.						*/
+
+    // Write timeouts (milliseconds), zero means none
+
+#define kPipeNoTimeout			0
+#define kPipeNoDataTimeout		2000
+#define kPipeCompletionTimeout		5000
+
+IOReturn	cdc_CheckPipe(IOUSBPipe *thePipe, bool devReq);
+IOReturn	cdc_PipeWrite(IOUSBPipe *thePipe, IOMemoryDescriptor *mdp, UInt32 len, UInt32 noDataTimeout, UInt32 completionTimeout, IOUSBCompletion *completion);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+    /* AppleUSBCDCRxLoan.cpp - Reference counting for read buffers loaned to the stack */
+
+#include <libkern/OSAtomic.h>
+
+#include "AppleUSBCDCRxLoan.h"
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_RxLoanSplit
+//
+//		Inputs:		loan - the read buffer's loan state
+//
+//		Outputs:	
+//
+//		Desc:		The read completion is about to split the buffer, it holds the first
+//				reference until it's done.
+//
+/****************************************************************************************************/
+
+void cdc_RxLoanSplit(rxLoan *loan)
+{
+    
+    loan->refs = 1;
+    
+}/* end cdc_RxLoanSplit */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_RxLoanTake
+//
+//		Inputs:		loan - the read buffer's loan state
+//				poolLoaned - buffers on loan across the pool
+//				poolSize - buffers in the pool
+//				first - set if this made the buffer loaned (the caller takes its own
+//					reference on the driver then)
+//
+//		Outputs:	true (a frame can go up in place), false (copy it)
+//
+//		Desc:		Takes a reference for a frame going up in place. Half the pool at most
+//				goes out so reads are always queued, a buffer that's already out can
+//				keep lending.
+//
+/****************************************************************************************************/
+
+bool cdc_RxLoanTake(rxLoan *loan, volatile SInt32 *poolLoaned, UInt32 poolSize, bool *first)
+{
+    
+    *first = false;
+    if (!loan->loaned && ((UInt32)*poolLoaned >= (poolSize / 2)))
+    {
+        return false;
+    }
+    
+    OSIncrementAtomic(&loan->refs);
+    if (!loan->loaned)
+    {
+        loan->loaned = true;
+        OSIncrementAtomic(poolLoaned);
+        *first = true;
+    }
+    
+    return true;
+    
+}/* end cdc_RxLoanTake */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_RxLoanUntake
+//
+//		Inputs:		loan - the read buffer's loan state
+//
+//		Outputs:	
+//
+//		Desc:		The frame couldn't go up after all (no mbuf), drop its reference. The
+//				read completion still holds one so this is never the last, a buffer
+//				marked loaned by it stays loaned and comes back through the completion.
+//
+/****************************************************************************************************/
+
+void cdc_RxLoanUntake(rxLoan *loan)
+{
+    
+    OSDecrementAtomic(&loan->refs);
+    
+}/* end cdc_RxLoanUntake */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_RxLoanSplitDone
+//
+//		Inputs:		loan - the read buffer's loan state
+//
+//		Outputs:	kRxLoanRequeue, kRxLoanRecycle or kRxLoanOut
+//
+//		Desc:		The read completion has finished with the buffer and drops its reference.
+//				If the frames' frees all got in first this is the last reference.
+//
+/****************************************************************************************************/
+
+UInt32 cdc_RxLoanSplitDone(rxLoan *loan)
+{
+    
+    if (!loan->loaned)
+    {
+        loan->refs = 0;
+        return kRxLoanRequeue;
+    }
+    if (OSDecrementAtomic(&loan->refs) == 1)
+    {
+        return kRxLoanRecycle;
+    }
+    
+    return kRxLoanOut;
+    
+}/* end cdc_RxLoanSplitDone */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_RxLoanFree
+//
+//		Inputs:		loan - the read buffer's loan state
+//
+//		Outputs:	true if that was the last reference (recycle the buffer)
+//
+//		Desc:		The stack has freed a frame passed up in place. Called from wherever the
+//				mbuf is freed.
+//
+/****************************************************************************************************/
+
+bool cdc_RxLoanFree(rxLoan *loan)
+{
+    
+    return (OSDecrementAtomic(&loan->refs) == 1);
+    
+}/* end cdc_RxLoanFree */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_RxLoanReturn
+//
+//		Inputs:		loan - the read buffer's loan state
+//				poolLoaned - buffers on loan across the pool
+//
+//		Outputs:	true (free the buffer, it was released while out), false (read into it again)
+//
+//		Desc:		Everything in the buffer has been freed, it's no longer on loan. Called
+//				with the buffer pool lock held.
+//
+/****************************************************************************************************/
+
+bool cdc_RxLoanReturn(rxLoan *loan, volatile SInt32 *poolLoaned)
+{
+    bool	orphan = loan->orphan;
+    
+    loan->loaned = false;
+    loan->orphan = false;
+    OSDecrementAtomic(poolLoaned);
+    
+    return orphan;
+    
+}/* end cdc_RxLoanReturn */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_RxLoanRelease
+//
+//		Inputs:		loan - the read buffer's loan state
+//
+//		Outputs:	true (free the buffer now), false (it's out, freed when it's back)
+//
+//		Desc:		The driver's resources are going. Called with the buffer pool lock held.
+//
+/****************************************************************************************************/
+
+bool cdc_RxLoanRelease(rxLoan *loan)
+{
+    
+    if (loan->loaned)
+    {
+        loan->orphan = true;
+        return false;
+    }
+    
+    return true;
+    
+}/* end cdc_RxLoanRelease */
+
+/****************************************************************************************************/
+//
+//		Function:	cdc_RxLoanReclaim
+//
+//		Inputs:		loan - the read buffer's loan state
+//
+//		Outputs:	true (allocate the buffer), false (it's still out, keep it)
+//
+//		Desc:		The resources are back before a loaned buffer was, it's ours again and
+//				is read into when it returns rather than freed.
+//
+/****************************************************************************************************/
+
+bool cdc_RxLoanReclaim(rxLoan *loan)
+{
+    
+    if (loan->loaned)
+    {
+        loan->orphan = false;
+        return false;
+    }
+    
+    return true;
+    
+}/* end cdc_RxLoanReclaim */
@@ -0,0 +1,66 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+ 
+ 
+ 
+#ifndef __APPLEUSBCDCRXLOAN__
+#define __APPLEUSBCDCRXLOAN__
+
+#include <libkern/OSTypes.h>
+
+        /* AppleUSBCDCRxLoan.h - Bookkeeping for a read buffer whose frames go up the stack in place	*/
+
+    // One per read buffer. The read completion holds a reference while it splits the
+    // transfer, each frame passed up in place holds another. The buffer is on loan from
+    // the first of those until the last reference goes. Only the read completion sets
+    // loaned, clearing it and anything to do with orphan is done under the caller's
+    // buffer pool lock.
+
+typedef struct
+{
+    volatile SInt32		refs;				// Read completion plus frames passed up in place
+    bool			loaned;				// Frames passed up in place, not back yet
+    bool			orphan;				// Resources released while loaned, free when it's back
+} rxLoan;
+
+    // What the read completion does with its buffer once it's split
+
+enum
+{
+    kRxLoanRequeue	= 0,				// Nothing went up in place, read into it again
+    kRxLoanRecycle,						// Its frames are all back already, recycle it now
+    kRxLoanOut							// Still out, the last free recycles it
+};
+
+void		cdc_RxLoanSplit(rxLoan *loan);
+bool		cdc_RxLoanTake(rxLoan *loan, volatile SInt32 *poolLoaned, UInt32 poolSize, bool *first);
+void		cdc_RxLoanUntake(rxLoan *loan);
+UInt32		cdc_RxLoanSplitDone(rxLoan *loan);
+bool		cdc_RxLoanFree(rxLoan *loan);
+bool		cdc_RxLoanReturn(rxLoan *loan, volatile SInt32 *poolLoaned);
+bool		cdc_RxLoanRelease(rxLoan *loan);
+bool		cdc_RxLoanReclaim(rxLoan *loan);
+
+#endif
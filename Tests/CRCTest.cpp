@@ -0,0 +1,136 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+    /* CRCTest.cpp - Host test for cdc_CRC32 (Common/AppleUSBCDCCRC.cpp) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AppleUSBCDCCRC.h"
+
+static int	failures = 0;
+
+#define CHECK(cond, what)	do { if (!(cond)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, what); failures++; } } while (0)
+
+    // One bit at a time, nothing shared with the code under test
+
+static UInt32 refCRC32(const UInt8 *buffer, UInt32 len)
+{
+    UInt32	crc = 0xffffffff;
+    UInt32	k;
+    
+    while (len--)
+    {
+        crc ^= *buffer++;
+        for (k=0; k<8; k++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+        }
+    }
+    
+    return ~crc;
+}
+
+static void testVectors()
+{
+    
+    CHECK(cdc_CRC32(0, (const UInt8 *)"123456789", 9) == 0xCBF43926, "check value");
+    CHECK(cdc_CRC32(0, (const UInt8 *)"", 0) == 0, "empty");
+    CHECK(cdc_CRC32(0, (const UInt8 *)"The quick brown fox jumps over the lazy dog", 43) == 0x414FA339, "fox");
+}
+
+    // Every start alignment and a spread of lengths, so the slicing-by-8 loop, the
+    // byte at a time lead in and the tail all run (and mix) against the bit at a time answer
+
+static void testAlignment()
+{
+    static UInt8	buf[8 + 1600];
+    UInt32		off, len;
+    
+    srand(1);
+    for (len=0; len<sizeof(buf); len++)
+    {
+        buf[len] = (UInt8)rand();
+    }
+    
+    for (off=0; off<8; off++)
+    {
+        for (len=0; len<=1514; len++)
+        {
+            if (cdc_CRC32(0, &buf[off], len) != refCRC32(&buf[off], len))
+            {
+                printf("offset %u length %u\n", off, len);
+                CHECK(false, "slicing-by-8 disagrees with the bitwise CRC");
+                return;
+            }
+        }
+    }
+}
+
+    // Carrying the CRC across calls (how EEM runs it over a frame in an mbuf chain)
+
+static void testChained()
+{
+    static UInt8	buf[1514];
+    UInt32		whole, cut, crc;
+    
+    for (cut=0; cut<sizeof(buf); cut++)
+    {
+        buf[cut] = (UInt8)(cut * 7 + 3);
+    }
+    whole = cdc_CRC32(0, buf, sizeof(buf));
+    for (cut=0; cut<=sizeof(buf); cut++)
+    {
+        crc = cdc_CRC32(0, buf, cut);
+        crc = cdc_CRC32(crc, &buf[cut], sizeof(buf) - cut);
+        if (crc != whole)
+        {
+            printf("cut %u\n", cut);
+            CHECK(false, "chained CRC");
+            return;
+        }
+    }
+}
+
+int main()
+{
+    
+    cdc_CRC32Init();
+    cdc_CRC32Init();						// Second call is a no-op
+    
+    testVectors();
+    testAlignment();
+    testChained();
+    
+    if (failures)
+    {
+        printf("CRCTest: %d failed\n", failures);
+        return 1;
+    }
+    printf("CRCTest: passed\n");
+    
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+
+    /* CacheLineBench.cpp - What the ACM port's per-line grouping buys, and what it costs	*/
+    /* if the port doesn't start on a line. Two threads each own a queue's worth of state	*/
+    /* (like the client side and the write completion) and hammer it.				*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libkern/OSTypes.h>
+
+#define kCacheLineSize	64
+#define kIterations	(50 * 1000 * 1000)
+
+typedef struct
+{
+    UInt32		InQueue;
+    UInt32		OutQueue;
+    UInt32		Count;
+    UInt32		Size;
+    UInt64		Bytes;
+} queueState;
+
+typedef struct
+{
+    queueState		*q;
+    double		ns;
+} worker;
+
+static void *hammer(void *arg)
+{
+    worker		*w = (worker *)arg;
+    queueState		*q = w->q;
+    struct timespec	t0, t1;
+    UInt32		i;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i=0; i<kIterations; i++)
+    {
+        __atomic_store_n(&q->InQueue, (q->InQueue + 1) % q->Size, __ATOMIC_RELAXED);
+        __atomic_store_n(&q->Count, q->Count + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&q->Bytes, q->Bytes + 64, __ATOMIC_RELAXED);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    
+    w->ns = (((t1.tv_sec - t0.tv_sec) * 1e9) + (t1.tv_nsec - t0.tv_nsec)) / kIterations;
+    
+    return NULL;
+}
+
+    // Base is line aligned, the two queues start off bytes in and stride bytes apart
+
+static void run(const char *name, UInt8 *base, size_t off, size_t stride)
+{
+    worker	w[2];
+    pthread_t	t[2];
+    UInt32	i;
+    
+    for (i=0; i<2; i++)
+    {
+        w[i].q = (queueState *)(base + off + (i * stride));
+        memset(w[i].q, 0, sizeof(queueState));
+        w[i].q->Size = 4096;
+        pthread_create(&t[i], NULL, hammer, &w[i]);
+    }
+    for (i=0; i<2; i++)
+    {
+        pthread_join(t[i], NULL);
+    }
+    
+    printf("%-40s %10.2f %10.2f\n", name, w[0].ns, w[1].ns);
+}
+
+int main()
+{
+    UInt8	*base = (UInt8 *)aligned_alloc(kCacheLineSize, 4 * kCacheLineSize);
+    
+    if (!base)
+    {
+        return 1;
+    }
+    
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+    {
+        printf("CacheLineBench: one CPU, the threads can't contend so the layouts will time the same\n");
+    }
+    
+    printf("%-40s %10s %10s\n", "layout", "ns/op a", "ns/op b");
+    run("packed, one line", base, 0, sizeof(queueState));
+    run("line per queue, port misaligned by 48", base, 48, kCacheLineSize);
+    run("line per queue, port line aligned", base, 0, kCacheLineSize);
+    
+    free(base);
+    
+    return 0;
+}
@@ -0,0 +1,664 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+    /* EEMFrameTest.cpp - Host test for cdc_EEMDeframe and the cdc_EEMAgg packer (Common/AppleUSBCDCEEMFrame.cpp) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "AppleUSBCDCEEMFrame.h"
+
+#define kGuard		0xA5
+#define kGuardLen	64
+
+static int	failures = 0;
+
+#define CHECK(cond, what)	do { if (!(cond)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, what); failures++; } } while (0)
+
+typedef std::vector<UInt8>	bytes;
+
+    // What came out of the de-framer
+
+static void collect(void *target, UInt8 *packet, UInt32 len)
+{
+    std::vector<bytes>	*out = (std::vector<bytes> *)target;
+    
+    out->push_back(bytes(packet, packet + len));
+}
+
+    // Fixed seed so failures reproduce
+
+static UInt32	seed = 0x12345678;
+
+static UInt32 rnd(UInt32 range)
+{
+    seed = (seed * 1103515245) + 12345;
+    return ((seed >> 8) % range);
+}
+
+    // Reference lengths, straight from the EEM spec rather than the code under test
+
+static UInt32 refPacketLen(UInt16 header)
+{
+    UInt16	code;
+    
+    if (!(header & 0x8000))
+    {
+        return 2 + (header & 0x3fff);
+    }
+    code = (header >> 11) & 7;
+    if ((code == 0) || (code == 1))			// Echo and EchoResponse carry data
+    {
+        return 2 + (header & 0x07ff);
+    }
+    return 2;
+}
+
+static void addPacket(bytes &stream, std::vector<bytes> &expect, UInt16 header, UInt32 dataLen)
+{
+    bytes	pkt;
+    UInt32	i;
+    
+    pkt.push_back((UInt8)header);
+    pkt.push_back((UInt8)(header >> 8));
+    for (i=0; i<dataLen; i++)
+    {
+        pkt.push_back((UInt8)rnd(256));
+    }
+    stream.insert(stream.end(), pkt.begin(), pkt.end());
+    expect.push_back(pkt);
+}
+
+    // A random mix of data packets, echoes and the header only commands
+
+static void buildStream(bytes &stream, std::vector<bytes> &expect, UInt32 count, UInt32 maxData)
+{
+    UInt32	i, len;
+    
+    for (i=0; i<count; i++)
+    {
+        switch (rnd(4))
+        {
+            case 0:
+            case 1:
+                len = rnd(maxData + 1);
+                addPacket(stream, expect, (UInt16)(bmTypeData | (rnd(2) ? bmCRC : 0) | len), len);
+                break;
+            case 2:
+                len = rnd((maxData < bmEEMCmdParamMask ? maxData : bmEEMCmdParamMask) + 1);
+                addPacket(stream, expect, (UInt16)(bmTypeCommand | ((rnd(2) ? EEMEchoResponse : EEMEcho) << 8) | len), len);
+                break;
+            default:
+                addPacket(stream, expect, (UInt16)(bmTypeCommand | (EEMTickle << 8) | rnd(bmEEMCmdParamMask + 1)), 0);
+                break;
+        }
+    }
+}
+
+    // Feed the stream in the given pieces, the hold buffer has guard bytes after it
+
+static void runSplits(const bytes &stream, const std::vector<UInt32> &cuts, std::vector<bytes> &out, eemRxHold *hold)
+{
+    UInt32	pos = 0;
+    UInt32	i;
+    bytes	xfer;
+    
+    for (i=0; i<=cuts.size(); i++)
+    {
+        UInt32	end = (i < cuts.size()) ? cuts[i] : (UInt32)stream.size();
+        
+            // Its own buffer each time so reading past the transfer shows up under ASan
+        
+        UInt8	*buf = (UInt8 *)malloc((end - pos) ? (end - pos) : 1);
+        memcpy(buf, stream.data() + pos, end - pos);
+        cdc_EEMDeframe(hold, buf, end - pos, collect, &out);
+        free(buf);
+        pos = end;
+    }
+}
+
+static bool guardOK(UInt8 *holdBuf)
+{
+    UInt32	i;
+    
+    for (i=0; i<kGuardLen; i++)
+    {
+        if (holdBuf[kEEMMaxPacket + i] != kGuard)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void newHold(eemRxHold *hold)
+{
+    hold->buffer = (UInt8 *)malloc(kEEMMaxPacket + kGuardLen);
+    memset(hold->buffer, kGuard, kEEMMaxPacket + kGuardLen);
+    hold->len = 0;
+    hold->need = 0;
+}
+
+static void testPacketLen()
+{
+    UInt32	h;
+    
+    for (h=0; h<=0xffff; h++)
+    {
+        if (cdc_EEMPacketLen((UInt16)h) != refPacketLen((UInt16)h))
+        {
+            CHECK(false, "cdc_EEMPacketLen disagrees with the spec");
+            return;
+        }
+        if (cdc_EEMPacketLen((UInt16)h) > kEEMMaxPacket)
+        {
+            CHECK(false, "packet longer than kEEMMaxPacket");
+            return;
+        }
+    }
+}
+
+    // Every two way split of a short stream, so each header gets cut between its bytes
+
+static void testSplitHeaders()
+{
+    bytes			stream;
+    std::vector<bytes>	expect;
+    eemRxHold		hold;
+    UInt32		cut;
+    
+    buildStream(stream, expect, 24, 40);
+    newHold(&hold);
+    for (cut=0; cut<=stream.size(); cut++)
+    {
+        std::vector<bytes>	out;
+        std::vector<UInt32>	cuts(1, cut);
+        
+        runSplits(stream, cuts, out, &hold);
+        CHECK(out == expect, "two way split");
+        CHECK(hold.len == 0, "nothing left held");
+    }
+    CHECK(guardOK(hold.buffer), "hold buffer overrun");
+    free(hold.buffer);
+}
+
+    // One byte transfers, every packet goes through the 1 byte header tail
+
+static void testOneByteTails()
+{
+    bytes			stream;
+    std::vector<bytes>	expect;
+    std::vector<bytes>	out;
+    std::vector<UInt32>	cuts;
+    eemRxHold		hold;
+    UInt32		i;
+    
+    buildStream(stream, expect, 40, 64);
+    for (i=1; i<stream.size(); i++)
+    {
+        cuts.push_back(i);
+    }
+    newHold(&hold);
+    runSplits(stream, cuts, out, &hold);
+    CHECK(out == expect, "one byte transfers");
+    CHECK(hold.len == 0, "nothing left held");
+    CHECK(guardOK(hold.buffer), "hold buffer overrun");
+    free(hold.buffer);
+}
+
+    // The longest lengths a header can claim, the hold buffer must take them exactly
+
+static void testOversize()
+{
+    bytes			stream;
+    std::vector<bytes>	expect;
+    std::vector<bytes>	out;
+    std::vector<UInt32>	cuts;
+    eemRxHold		hold;
+    UInt32		i;
+    
+    addPacket(stream, expect, bmTypeData | bmCRC | frameLenMask, frameLenMask);
+    addPacket(stream, expect, bmTypeCommand | (EEMEcho << 8) | bmEEMCmdParamMask, bmEEMCmdParamMask);
+    addPacket(stream, expect, bmTypeData | frameLenMask, frameLenMask);
+    for (i=511; i<stream.size(); i+=512)
+    {
+        cuts.push_back(i);
+    }
+    newHold(&hold);
+    runSplits(stream, cuts, out, &hold);
+    CHECK(out == expect, "maximum length packets");
+    CHECK(guardOK(hold.buffer), "hold buffer overrun");
+    
+        // Truncated, a header claiming more than ever arrives is held (never overruns) and
+        // the reset says so
+    
+    out.clear();
+    UInt8	partial[100];
+    memset(partial, 0, sizeof(partial));
+    partial[0] = 0xff;
+    partial[1] = 0x3f;					// Data, no CRC, frameLenMask bytes
+    cdc_EEMDeframe(&hold, partial, sizeof(partial), collect, &out);
+    CHECK(out.empty(), "truncated packet not passed up");
+    CHECK((hold.len == sizeof(partial)) && (hold.need == kEEMMaxPacket), "truncated packet held");
+    CHECK(cdc_EEMDeframeReset(&hold), "reset reports the lost packet");
+    CHECK(!cdc_EEMDeframeReset(&hold), "second reset has nothing to lose");
+    CHECK(guardOK(hold.buffer), "hold buffer overrun");
+    free(hold.buffer);
+}
+
+    // Random streams in random pieces against the spec's own reading of them, then random
+    // garbage which only has to stay inside the buffers
+
+static void testFuzz()
+{
+    UInt32	iter, i;
+    
+    for (iter=0; iter<2000; iter++)
+    {
+        bytes			stream;
+        std::vector<bytes>	expect;
+        std::vector<bytes>	out;
+        std::vector<UInt32>	cuts;
+        eemRxHold		hold;
+        UInt32		pos = 0;
+        
+        buildStream(stream, expect, 1 + rnd(30), (iter & 1) ? 1600 : 20);
+        while (true)
+        {
+            pos += 1 + rnd(iter & 2 ? 2048 : 16);
+            if (pos >= stream.size())
+            {
+                break;
+            }
+            cuts.push_back(pos);
+        }
+        newHold(&hold);
+        runSplits(stream, cuts, out, &hold);
+        if ((out != expect) || (hold.len != 0) || !guardOK(hold.buffer))
+        {
+            printf("fuzz iteration %u\n", iter);
+            CHECK(false, "random splits");
+            free(hold.buffer);
+            return;
+        }
+        free(hold.buffer);
+    }
+    
+    for (iter=0; iter<500; iter++)
+    {
+        bytes			stream(1 + rnd(40000));
+        std::vector<bytes>	out;
+        std::vector<UInt32>	cuts;
+        eemRxHold		hold;
+        UInt32		total = 0;
+        UInt32		pos = 0;
+        
+        for (i=0; i<stream.size(); i++)
+        {
+            stream[i] = (UInt8)rnd(256);
+        }
+        while (true)
+        {
+            pos += 1 + rnd(4096);
+            if (pos >= stream.size())
+            {
+                break;
+            }
+            cuts.push_back(pos);
+        }
+        newHold(&hold);
+        runSplits(stream, cuts, out, &hold);
+        for (i=0; i<out.size(); i++)
+        {
+            total += out[i].size();
+            if (out[i].size() != refPacketLen((UInt16)(out[i][0] | (out[i][1] << 8))))
+            {
+                CHECK(false, "garbage packet length");
+                break;
+            }
+        }
+        CHECK(total + hold.len == stream.size(), "garbage stream accounted for");
+        CHECK(guardOK(hold.buffer), "hold buffer overrun");
+        free(hold.buffer);
+    }
+}
+
+    // The transmit side the way the driver drives it, one transfer being filled at
+    // a time. It goes when cdc_EEMAggNext says so, when the next frame won't fit or
+    // when the timer fires (the test fires it).
+
+#define kTxBlock	1600
+
+typedef struct
+{
+    std::vector<bytes>	sent;				// Transfers written
+    std::vector<UInt32>	counts;				// Data packets in each
+    std::vector<UInt32>	firsts;				// Index of each one's first frame
+    UInt8		buf[kTxBlock + kGuardLen];
+    UInt32		max;
+    UInt32		maxPackets;
+    eemTxAgg		agg;
+    bool		filling;
+    bool		timerArmed;
+    UInt32		frames;				// Frames handed in so far
+} txModel;
+
+static void txInit(txModel *tx, UInt32 max, UInt32 maxPackets)
+{
+    
+    tx->sent.clear();
+    tx->counts.clear();
+    tx->firsts.clear();
+    memset(tx->buf, kGuard, sizeof(tx->buf));
+    tx->max = max;
+    tx->maxPackets = maxPackets;
+    tx->filling = false;
+    tx->timerArmed = false;
+    tx->frames = 0;
+}
+
+static void txFlush(txModel *tx)
+{
+    
+    if (!tx->filling)
+    {
+        return;
+    }
+    tx->sent.push_back(bytes(tx->buf, tx->buf + tx->agg.len));
+    tx->counts.push_back(tx->agg.count);
+    tx->filling = false;
+    tx->timerArmed = false;
+}
+
+static bool txGuardOK(txModel *tx)
+{
+    UInt32	i;
+    
+    for (i=tx->max; i<sizeof(tx->buf); i++)
+    {
+        if (tx->buf[i] != kGuard)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static UInt32 txFrame(txModel *tx, const bytes &frame, bool crc, bool idle)
+{
+    UInt32	next;
+    
+    if (tx->filling && !cdc_EEMAggFits(&tx->agg, (UInt32)frame.size()))
+    {
+        txFlush(tx);
+    }
+    if (!tx->filling)
+    {
+        cdc_EEMAggStart(&tx->agg, tx->buf, tx->max);
+        tx->firsts.push_back(tx->frames);
+        tx->filling = true;
+    }
+    if (!frame.empty())
+    {
+        memcpy(cdc_EEMAggFrame(&tx->agg), &frame[0], frame.size());
+    }
+    cdc_EEMAggAddData(&tx->agg, (UInt32)frame.size(), crc, crc ? (0xC0DE0000 | tx->frames) : 0);
+    tx->frames++;
+    
+    next = cdc_EEMAggNext(&tx->agg, tx->maxPackets, idle);
+    switch (next)
+    {
+        case kEEMAggSend:
+            txFlush(tx);
+            break;
+        case kEEMAggArmTimer:
+            tx->timerArmed = true;
+            break;
+        default:
+            break;
+    }
+    
+    return next;
+}
+
+    // Reference EEM data packet, straight from the spec
+
+static bytes refDataPacket(const bytes &frame, bool crc, UInt32 n)
+{
+    bytes	pkt;
+    UInt16	header = (UInt16)((crc ? 0x4000 : 0) | (frame.size() + 4));
+    UInt32	tail = crc ? (0xC0DE0000 | n) : 0;
+    
+    pkt.push_back((UInt8)header);
+    pkt.push_back((UInt8)(header >> 8));
+    pkt.insert(pkt.end(), frame.begin(), frame.end());
+    if (crc)
+    {
+        pkt.push_back((UInt8)tail);
+        pkt.push_back((UInt8)(tail >> 8));
+        pkt.push_back((UInt8)(tail >> 16));
+        pkt.push_back((UInt8)(tail >> 24));
+    } else {
+        pkt.push_back(0xDE);
+        pkt.push_back(0xAD);
+        pkt.push_back(0xBE);
+        pkt.push_back(0xEF);
+    }
+    
+    return pkt;
+}
+
+static bytes randomFrame(UInt32 maxLen)
+{
+    bytes	frame(rnd(maxLen + 1));
+    UInt32	i;
+    
+    for (i=0; i<frame.size(); i++)
+    {
+        frame[i] = (UInt8)rnd(256);
+    }
+    
+    return frame;
+}
+
+    // Every transfer de-frames back to the packets put in, in order, and none went early
+
+static void testAggPacking()
+{
+    UInt32	iter, i, t, size, nextLen;
+    
+    for (iter=0; iter<200; iter++)
+    {
+        txModel			tx;
+        std::vector<bytes>	frames;
+        std::vector<bytes>	expect;
+        std::vector<bytes>	out;
+        eemRxHold		hold;
+        UInt32		maxPackets = 1 + rnd(40);
+        bool		crc;
+        
+        txInit(&tx, 64 + rnd(kTxBlock - 63), maxPackets);
+        for (i=0; i<(1 + rnd(200)); i++)
+        {
+            frames.push_back(randomFrame((iter & 1) ? tx.max - 6 : 64));
+            crc = rnd(2);
+            expect.push_back(refDataPacket(frames[i], crc, i));
+            txFrame(&tx, frames[i], crc, false);
+        }
+        txFlush(&tx);					// The timer
+        
+        newHold(&hold);
+        for (t=0; t<tx.sent.size(); t++)
+        {
+            size = (UInt32)tx.sent[t].size();
+            CHECK(size <= tx.max, "transfer bigger than the block");
+            CHECK((tx.counts[t] >= 1) && (tx.counts[t] <= maxPackets), "packets in a transfer");
+            if (t + 1 < tx.sent.size())
+            {
+                nextLen = (UInt32)frames[tx.firsts[t + 1]].size();
+                CHECK((tx.counts[t] == maxPackets) || (size + 6 >= tx.max) || (size + 6 + nextLen > tx.max), "transfer sent before it had to be");
+            }
+            cdc_EEMDeframe(&hold, &tx.sent[t][0], size, collect, &out);
+            CHECK(hold.len == 0, "packet split across transfers");
+        }
+        CHECK(out == expect, "packed packets");
+        CHECK(txGuardOK(&tx), "transfer buffer overrun");
+        free(hold.buffer);
+        if (failures)
+        {
+            printf("packing iteration %u\n", iter);
+            return;
+        }
+    }
+}
+
+    // The flush limits one at a time
+
+static void testAggFull()
+{
+    txModel	tx;
+    bytes	frame(500, 0x11);
+    
+        // Three 506 byte packets fit in 1600, the fourth starts a new transfer
+    
+    txInit(&tx, kTxBlock, 32);
+    txFrame(&tx, frame, false, false);
+    txFrame(&tx, frame, false, false);
+    txFrame(&tx, frame, false, false);
+    CHECK(tx.sent.empty(), "sent before it was full");
+    txFrame(&tx, frame, false, false);
+    CHECK((tx.sent.size() == 1) && (tx.counts[0] == 3) && (tx.sent[0].size() == 1518), "full transfer sent when the next won't fit");
+    CHECK(tx.filling && (tx.agg.count == 1), "next frame starts a new transfer");
+    
+        // Exactly full goes straight away, no room left for even an empty frame
+    
+    txInit(&tx, 2 * (6 + 100), 32);
+    bytes	small(100, 0x22);
+    CHECK(txFrame(&tx, small, true, false) == kEEMAggArmTimer, "first of two");
+    CHECK(txFrame(&tx, small, true, false) == kEEMAggSend, "exactly full");
+    CHECK((tx.sent.size() == 1) && (tx.sent[0].size() == tx.max), "exactly full transfer");
+    
+        // Room for only an empty frame (or less) also goes
+    
+    txInit(&tx, 106 + 6, 32);
+    CHECK(txFrame(&tx, small, false, false) == kEEMAggSend, "room for an empty frame only");
+    txInit(&tx, 106 + 7, 32);
+    CHECK(txFrame(&tx, small, false, false) == kEEMAggArmTimer, "room for a one byte frame");
+}
+
+static void testAggLimit()
+{
+    txModel	tx;
+    bytes	frame(60, 0x33);
+    UInt32	i;
+    
+    txInit(&tx, kTxBlock, 4);
+    for (i=0; i<10; i++)
+    {
+        txFrame(&tx, frame, false, false);
+    }
+    CHECK((tx.sent.size() == 2) && (tx.counts[0] == 4) && (tx.counts[1] == 4), "datagram limit");
+    CHECK(tx.filling && (tx.agg.count == 2), "remainder waits");
+    
+        // A limit of one is aggregation off, every frame goes alone
+    
+    txInit(&tx, kTxBlock, 1);
+    for (i=0; i<5; i++)
+    {
+        CHECK(txFrame(&tx, frame, false, false) == kEEMAggSend, "unpacked frame sent");
+    }
+    CHECK((tx.sent.size() == 5) && !tx.filling, "no aggregation");
+}
+
+static void testAggTimer()
+{
+    txModel	tx;
+    bytes	frame(60, 0x44);
+    
+    txInit(&tx, kTxBlock, 32);
+    CHECK(txFrame(&tx, frame, false, false) == kEEMAggArmTimer, "first packet arms the timer");
+    CHECK(tx.timerArmed && tx.sent.empty(), "waiting for the timer");
+    CHECK(txFrame(&tx, frame, false, false) == kEEMAggHold, "second packet just waits");
+    txFlush(&tx);					// Timer fires
+    CHECK((tx.sent.size() == 1) && (tx.counts[0] == 2) && !tx.timerArmed, "timer sends the partial transfer");
+    
+        // An idle pipe doesn't wait at all
+    
+    CHECK(txFrame(&tx, frame, false, true) == kEEMAggSend, "idle pipe");
+    CHECK((tx.sent.size() == 2) && (tx.counts[1] == 1), "sent on idle");
+}
+
+    // Commands ride along without counting towards the limit
+
+static void testAggCommand()
+{
+    txModel		tx;
+    bytes		frame(60, 0x55);
+    std::vector<bytes>	out;
+    eemRxHold		hold;
+    UInt8		echo[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    UInt32		len;
+    
+    txInit(&tx, 80, 32);
+    txFrame(&tx, frame, false, false);
+    CHECK(cdc_EEMAggAddCommand(&tx.agg, (UInt16)(bmTypeCommand | (EEMEcho << 8) | 8), echo, 8), "echo rides along");
+    CHECK((tx.agg.count == 1) && (tx.agg.len == 66 + 10), "command isn't a packet");
+    len = tx.agg.len;
+    CHECK(!cdc_EEMAggAddCommand(&tx.agg, (UInt16)(bmTypeCommand | (EEMEcho << 8) | 8), echo, 8), "echo that won't fit");
+    CHECK(tx.agg.len == len, "refused command left the transfer alone");
+    CHECK(cdc_EEMAggAddCommand(&tx.agg, (UInt16)(bmTypeCommand | (EEMTickle << 8)), NULL, 0), "header only command fits");
+    txFlush(&tx);
+    
+    newHold(&hold);
+    cdc_EEMDeframe(&hold, &tx.sent[0][0], (UInt32)tx.sent[0].size(), collect, &out);
+    CHECK((out.size() == 3) && (out[1].size() == 10) && (memcmp(&out[1][2], echo, 8) == 0) && (out[2].size() == 2), "commands de-frame");
+    free(hold.buffer);
+}
+
+int main()
+{
+    
+    testPacketLen();
+    testSplitHeaders();
+    testOneByteTails();
+    testOversize();
+    testFuzz();
+    testAggPacking();
+    testAggFull();
+    testAggLimit();
+    testAggTimer();
+    testAggCommand();
+    
+    if (failures)
+    {
+        printf("EEMFrameTest: %d failed\n", failures);
+        return 1;
+    }
+    printf("EEMFrameTest: passed\n");
+    
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+
+    /* McFilterBench.cpp - Cost per frame of the ECM software receive filter at a few traffic mixes */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "AppleUSBCDCMcFilter.h"
+
+#define kFrames		4096				// Destinations cycled through per pass
+#define kPasses		2000
+
+static UInt32	seed = 0x9e3779b9;
+
+static UInt32 rnd(UInt32 range)
+{
+    seed = (seed * 1103515245) + 12345;
+    return ((seed >> 8) % range);
+}
+
+static const UInt8	ourAddr[kMcAddrLen] = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 };
+
+static void mcAddr(UInt8 *addr, UInt32 n)
+{
+    
+    addr[0] = 0x01;
+    addr[1] = 0x00;
+    addr[2] = 0x5e;
+    addr[3] = (UInt8)(n >> 16) & 0x7f;
+    addr[4] = (UInt8)(n >> 8);
+    addr[5] = (UInt8)n;
+}
+
+typedef struct
+{
+    const char		*name;
+    UInt32		ours;				// Percentages, what's left is someone else's unicast
+    UInt32		broadcast;
+    UInt32		mcHit;
+    UInt32		mcMiss;
+} trafficMix;
+
+static const trafficMix	mixes[] =
+{
+    { "all ours",			100,	0,	0,	0 },
+    { "switched LAN",			90,	5,	5,	0 },
+    { "hub, half not ours",		50,	5,	0,	0 },
+    { "multicast heavy, hits",		20,	0,	80,	0 },
+    { "multicast heavy, misses",	20,	0,	0,	80 },
+    { "mDNS/SSDP storm",		10,	30,	30,	30 },
+};
+
+static UInt8	frames[kFrames][64];
+
+static double run(const trafficMix *mix, UInt32 setLen, UInt32 *accepted)
+{
+    mcFilter		mc;
+    UInt8		addrs[kMcMaxAddrs * kMcAddrLen];
+    UInt32		ourHi, pick, i, p;
+    UInt16		ourLo;
+    struct timespec	t0, t1;
+    UInt32		count = 0;
+    
+    memcpy(&ourHi, &ourAddr[0], sizeof(ourHi));
+    memcpy(&ourLo, &ourAddr[4], sizeof(ourLo));
+    
+    cdc_McFilterInit(&mc);
+    for (i=0; i<setLen; i++)
+    {
+        mcAddr(&addrs[i * kMcAddrLen], i * 3);
+    }
+    cdc_McFilterUpdate(&mc, addrs, setLen);
+    
+    for (i=0; i<kFrames; i++)
+    {
+        pick = rnd(100);
+        memset(frames[i], 0, sizeof(frames[i]));
+        if (pick < mix->ours)
+        {
+            memcpy(frames[i], ourAddr, kMcAddrLen);
+        } else if ((pick -= mix->ours) < mix->broadcast) {
+            memset(frames[i], 0xff, kMcAddrLen);
+        } else if ((pick -= mix->broadcast) < mix->mcHit) {
+            mcAddr(frames[i], setLen ? rnd(setLen) * 3 : 1);
+        } else if ((pick -= mix->mcHit) < mix->mcMiss) {
+            mcAddr(frames[i], (rnd(0x10000) * 3) + 1);
+        } else {
+            memcpy(frames[i], ourAddr, kMcAddrLen);
+            frames[i][5] ^= (UInt8)(1 + rnd(255));
+        }
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (p=0; p<kPasses; p++)
+    {
+        for (i=0; i<kFrames; i++)
+        {
+            count += cdc_IngressAccept(frames[i], ourHi, ourLo, kIngressBroadcast, &mc);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    
+    *accepted = count / kPasses;
+    
+    return (((t1.tv_sec - t0.tv_sec) * 1e9) + (t1.tv_nsec - t0.tv_nsec)) / ((double)kFrames * kPasses);
+}
+
+int main()
+{
+    static const UInt32	setLens[] = { 4, kMcMaxAddrs };
+    UInt32		accepted;
+    UInt32		m, s;
+    double		ns;
+    
+    printf("%-28s %8s %10s %10s\n", "mix", "set", "ns/frame", "accepted");
+    for (m=0; m<sizeof(mixes) / sizeof(mixes[0]); m++)
+    {
+        for (s=0; s<sizeof(setLens) / sizeof(setLens[0]); s++)
+        {
+            ns = run(&mixes[m], setLens[s], &accepted);
+            printf("%-28s %8u %10.2f %9u%%\n", mixes[m].name, setLens[s], ns, (accepted * 100) / kFrames);
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,319 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+
+    /* McFilterTest.cpp - Host test for the ECM software receive filter (Common/AppleUSBCDCMcFilter.cpp) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "AppleUSBCDCMcFilter.h"
+
+static int	failures = 0;
+
+#define CHECK(cond, what)	do { if (!(cond)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, what); failures++; } } while (0)
+
+static UInt32	seed = 0x9e3779b9;
+
+static UInt32 rnd(UInt32 range)
+{
+    seed = (seed * 1103515245) + 12345;
+    return ((seed >> 8) % range);
+}
+
+static const UInt8	ourAddr[kMcAddrLen] = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 };
+static const UInt8	bcastAddr[kMcAddrLen] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+static UInt32	ourHi;
+static UInt16	ourLo;
+
+    // A multicast address with the low bytes from n
+
+static void mcAddr(UInt8 *addr, UInt32 n)
+{
+    
+    addr[0] = 0x01;
+    addr[1] = 0x00;
+    addr[2] = 0x5e;
+    addr[3] = (UInt8)(n >> 16) & 0x7f;
+    addr[4] = (UInt8)(n >> 8);
+    addr[5] = (UInt8)n;
+}
+
+static bool accept(mcFilter *mc, const UInt8 *dst, UInt16 filter)
+{
+    UInt8	frame[64];
+    
+    memset(frame, 0xa5, sizeof(frame));
+    memcpy(frame, dst, kMcAddrLen);
+    
+    return cdc_IngressAccept(frame, ourHi, ourLo, filter, mc);
+}
+
+static void testUnicast()
+{
+    mcFilter	mc;
+    UInt8	other[kMcAddrLen];
+    UInt32	i;
+    
+    cdc_McFilterInit(&mc);
+    
+    CHECK(accept(&mc, ourAddr, 0), "our address");
+    CHECK(accept(&mc, ourAddr, kIngressBroadcast), "our address, broadcast on");
+    
+        // Differ from ours in each byte in turn, each bit of it
+    
+    for (i=1; i<kMcAddrLen * 8; i++)				// Bit 0 is the group bit
+    {
+        memcpy(other, ourAddr, kMcAddrLen);
+        other[i / 8] ^= (UInt8)(1 << (i % 8));
+        CHECK(!accept(&mc, other, kIngressBroadcast), "someone else's unicast");
+    }
+    
+        // Overflow passes all multicast, not other people's unicast
+    
+    mc.overflow = true;
+    memcpy(other, ourAddr, kMcAddrLen);
+    other[5]++;
+    CHECK(!accept(&mc, other, 0), "unicast while in overflow");
+}
+
+static void testBroadcast()
+{
+    mcFilter	mc;
+    
+    cdc_McFilterInit(&mc);
+    
+    CHECK(accept(&mc, bcastAddr, kIngressBroadcast), "broadcast on");
+    CHECK(!accept(&mc, bcastAddr, 0), "broadcast off");
+    
+        // Broadcast isn't a multicast member even in overflow
+    
+    mc.overflow = true;
+    CHECK(!accept(&mc, bcastAddr, 0), "broadcast off in overflow");
+}
+
+static void testMulticast()
+{
+    mcFilter	mc;
+    UInt8	addrs[kMcMaxAddrs * kMcAddrLen];
+    UInt8	addr[kMcAddrLen];
+    UInt32	i;
+    
+    cdc_McFilterInit(&mc);
+    
+    mcAddr(addr, 1);
+    CHECK(!accept(&mc, addr, kIngressBroadcast), "empty set");
+    
+    for (i=0; i<10; i++)
+    {
+        mcAddr(&addrs[i * kMcAddrLen], i * 7);
+    }
+    CHECK(cdc_McFilterUpdate(&mc, addrs, 10), "first set changes");
+    CHECK(mc.count == 10, "count");
+    for (i=0; i<10; i++)
+    {
+        mcAddr(addr, i * 7);
+        CHECK(accept(&mc, addr, 0), "member");
+        mcAddr(addr, (i * 7) + 1);
+        CHECK(!accept(&mc, addr, 0), "not a member");
+    }
+    
+        // Same set again (reversed, with a duplicate) is no change
+    
+    for (i=0; i<10; i++)
+    {
+        mcAddr(&addrs[i * kMcAddrLen], (9 - i) * 7);
+    }
+    mcAddr(&addrs[10 * kMcAddrLen], 0);
+    CHECK(!cdc_McFilterUpdate(&mc, addrs, 11), "same set, no change");
+    CHECK(mc.count == 10, "duplicate counted once");
+    
+        // One swapped
+    
+    mcAddr(&addrs[3 * kMcAddrLen], 1000);
+    CHECK(cdc_McFilterUpdate(&mc, addrs, 10), "one address swapped");
+    mcAddr(addr, 1000);
+    CHECK(accept(&mc, addr, 0), "new member");
+    mcAddr(addr, 6 * 7);
+    CHECK(!accept(&mc, addr, 0), "swapped out");
+    
+        // Empty again
+    
+    CHECK(cdc_McFilterUpdate(&mc, addrs, 0), "emptied");
+    mcAddr(addr, 1000);
+    CHECK(!accept(&mc, addr, 0), "emptied set");
+    
+        // Full set of random addresses, everything in it and nothing else
+    
+    for (i=0; i<kMcMaxAddrs; i++)
+    {
+        mcAddr(&addrs[i * kMcAddrLen], (i << 12) | rnd(4096));
+    }
+    CHECK(cdc_McFilterUpdate(&mc, addrs, kMcMaxAddrs), "full set");
+    for (i=0; i<kMcMaxAddrs; i++)
+    {
+        CHECK(accept(&mc, &addrs[i * kMcAddrLen], 0), "full set member");
+    }
+    for (i=0; i<10000; i++)
+    {
+        mcAddr(addr, (kMcMaxAddrs << 12) + rnd(0x100000));
+        CHECK(!accept(&mc, addr, 0), "full set non member");
+    }
+}
+
+static void testPromiscuous()
+{
+    mcFilter	mc;
+    UInt8	addr[kMcAddrLen];
+    
+    cdc_McFilterInit(&mc);
+    
+    memcpy(addr, ourAddr, kMcAddrLen);
+    addr[5]++;
+    CHECK(accept(&mc, addr, kIngressPromiscuous), "someone else's unicast");
+    CHECK(accept(&mc, bcastAddr, kIngressPromiscuous), "broadcast without the broadcast bit");
+    mcAddr(addr, 5);
+    CHECK(accept(&mc, addr, kIngressPromiscuous), "multicast not in the set");
+}
+
+static void testOverflow()
+{
+    mcFilter	mc;
+    UInt8	addrs[(kMcMaxAddrs + 1) * kMcAddrLen];
+    UInt8	addr[kMcAddrLen];
+    UInt32	i;
+    
+    cdc_McFilterInit(&mc);
+    
+    for (i=0; i<=kMcMaxAddrs; i++)
+    {
+        mcAddr(&addrs[i * kMcAddrLen], i);
+    }
+    CHECK(cdc_McFilterUpdate(&mc, addrs, kMcMaxAddrs), "most we'll track");
+    CHECK(mc.count == kMcMaxAddrs, "full count");
+    CHECK(!mc.overflow, "at the limit isn't overflow");
+    
+    CHECK(cdc_McFilterUpdate(&mc, addrs, kMcMaxAddrs + 1), "one too many changes");
+    CHECK(mc.overflow, "overflow");
+    CHECK(!cdc_McFilterUpdate(&mc, addrs, kMcMaxAddrs + 1), "still too many, no change");
+    mcAddr(addr, 0x7fffff);
+    CHECK(accept(&mc, addr, 0), "overflow passes any multicast");
+    
+        // Back under the limit with the set we had before is still a change
+    
+    CHECK(cdc_McFilterUpdate(&mc, addrs, kMcMaxAddrs), "out of overflow");
+    CHECK(!mc.overflow, "overflow cleared");
+    CHECK(!accept(&mc, addr, 0), "strict again");
+    CHECK(accept(&mc, &addrs[0], 0), "member after overflow");
+}
+
+    // A lookup racing set rebuilds. A is in both sets the writer flips between, X in neither,
+    // B and C only in one each. Whatever the interleaving A always matches and X never does.
+
+#define kRaceSetLen	(kMcMaxAddrs / 2)
+
+static mcFilter		raceMc;
+static UInt8		setB[kRaceSetLen * kMcAddrLen];
+static UInt8		setC[kRaceSetLen * kMcAddrLen];
+static volatile bool	raceStop;
+
+static void *raceWriter(void *arg)
+{
+    UInt32	i;
+    
+    for (i=0; !raceStop; i++)
+    {
+        cdc_McFilterUpdate(&raceMc, (i & 1) ? setC : setB, kRaceSetLen);
+    }
+    
+    return arg;
+}
+
+static void testRace()
+{
+    pthread_t	writer;
+    UInt8	a[kMcAddrLen], x[kMcAddrLen], b[kMcAddrLen];
+    UInt32	missA = 0, hitX = 0;
+    UInt32	i;
+    
+    for (i=0; i<kRaceSetLen; i++)
+    {
+        mcAddr(&setB[i * kMcAddrLen], i == 0 ? 1 : 0x1000 + i);
+        mcAddr(&setC[i * kMcAddrLen], i == 0 ? 1 : 0x2000 + i);
+    }
+    cdc_McFilterInit(&raceMc);
+    cdc_McFilterUpdate(&raceMc, setB, kRaceSetLen);
+    mcAddr(a, 1);
+    mcAddr(x, 0x3000);
+    mcAddr(b, 0x1005);
+    raceStop = false;
+    
+    CHECK(pthread_create(&writer, NULL, raceWriter, NULL) == 0, "writer thread");
+    
+    for (i=0; i<200000; i++)
+    {
+        if (!cdc_McFilterMatch(&raceMc, a))
+        {
+            missA++;
+        }
+        if (cdc_McFilterMatch(&raceMc, x))
+        {
+            hitX++;
+        }
+        cdc_McFilterMatch(&raceMc, b);				// Either answer's right
+    }
+    
+    raceStop = true;
+    pthread_join(writer, NULL);
+    
+    CHECK(missA == 0, "member of both sets missed during a rebuild");
+    CHECK(hitX == 0, "member of neither set matched during a rebuild");
+}
+
+int main()
+{
+    
+    memcpy(&ourHi, &ourAddr[0], sizeof(ourHi));
+    memcpy(&ourLo, &ourAddr[4], sizeof(ourLo));
+    
+    testUnicast();
+    testBroadcast();
+    testMulticast();
+    testPromiscuous();
+    testOverflow();
+    testRace();
+    
+    if (failures)
+    {
+        printf("McFilterTest: %d failed\n", failures);
+        return 1;
+    }
+    printf("McFilterTest: passed\n");
+    
+    return 0;
+}
@@ -0,0 +1,414 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+    /* NTBTest.cpp - Host test for the NTB16 builder and parser (Common/AppleUSBCDCNTB.cpp) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <libkern/OSByteOrder.h>
+
+#include "AppleUSBCDCNTB.h"
+
+#define kMinDatagram	14				// Ethernet header
+#define kMaxDatagram	1514
+#define kNtbSize	16384
+
+static int	failures = 0;
+
+#define CHECK(cond, what)	do { if (!(cond)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, what); failures++; } } while (0)
+
+typedef std::vector<UInt8>	bytes;
+
+static void collect(void *target, UInt8 *datagram, UInt32 len)
+{
+    std::vector<bytes>	*out = (std::vector<bytes> *)target;
+    
+    out->push_back(bytes(datagram, datagram + len));
+}
+
+static UInt32	seed = 0x9e3779b9;
+
+static UInt32 rnd(UInt32 range)
+{
+    seed = (seed * 1103515245) + 12345;
+    return ((seed >> 8) % range);
+}
+
+    // Fill a block the way AppleUSBCDCNCMData::USBTransmitPacket does and finish it
+
+static UInt32 buildBlock(UInt8 *block, std::vector<bytes> &dgs, UInt32 divisor, UInt32 remainder, UInt32 ndpAlign,
+                         UInt32 packetSize, UInt32 ntbSize, bool *padded)
+{
+    UInt16	dpe[64];
+    UInt32	len = kNTH16Len;
+    UInt32	offset;
+    UInt32	i;
+    
+    for (i=0; i<dgs.size(); i++)
+    {
+        offset = cdc_NTBAlign(len, divisor, remainder);
+        if (!cdc_NTBFits(offset, (UInt32)dgs[i].size(), i, ndpAlign, ntbSize))
+        {
+            dgs.resize(i);
+            break;
+        }
+        memcpy(&block[offset], &dgs[i][0], dgs[i].size());
+        dpe[i * 2] = (UInt16)offset;
+        dpe[(i * 2) + 1] = (UInt16)dgs[i].size();
+        len = offset + (UInt32)dgs[i].size();
+    }
+    
+    return cdc_NTBBuild(block, len, dpe, (UInt32)dgs.size(), 7, ndpAlign, packetSize, ntbSize, padded);
+}
+
+static std::vector<bytes> randomDatagrams(UInt32 count, UInt32 maxLen)
+{
+    std::vector<bytes>	dgs;
+    UInt32		i, k;
+    
+    for (i=0; i<count; i++)
+    {
+        bytes	d(kMinDatagram + rnd(maxLen - kMinDatagram + 1));
+        
+        for (k=0; k<d.size(); k++)
+        {
+            d[k] = (UInt8)rnd(256);
+        }
+        dgs.push_back(d);
+    }
+    
+    return dgs;
+}
+
+    // Parse a copy exactly size bytes long, so ASan sees anything read past the end
+
+static UInt32 parse(const UInt8 *block, UInt32 size, std::vector<bytes> &out, UInt32 *errors)
+{
+    UInt8	*copy = (UInt8 *)malloc(size ? size : 1);
+    UInt32	n;
+    
+    memcpy(copy, block, size);
+    *errors = 0;
+    n = cdc_NTBParse(copy, size, kMinDatagram, kMaxDatagram, collect, &out, errors);
+    free(copy);
+    
+    return n;
+}
+
+static void testAlign()
+{
+    UInt32	divisor, remainder, offset, a;
+    
+    for (divisor=1; divisor<=512; divisor<<=1)
+    {
+        for (remainder=0; remainder<divisor; remainder+=(divisor > 16 ? 7 : 1))
+        {
+            for (offset=remainder; offset<2048; offset++)
+            {
+                a = cdc_NTBAlign(offset, divisor, remainder);
+                if ((a < offset) || ((a - offset) >= divisor) || ((a % divisor) != remainder))
+                {
+                    printf("divisor %u remainder %u offset %u gave %u\n", divisor, remainder, offset, a);
+                    CHECK(false, "cdc_NTBAlign");
+                    return;
+                }
+            }
+        }
+    }
+    CHECK(cdc_NTBNDPLength(0) == kNDP16Len + kDPE16Len, "empty NDP is the header and the terminator");
+    CHECK(cdc_NTBNDPLength(3) == kNDP16Len + (4 * kDPE16Len), "NDP length");
+}
+
+    // Build then parse, over the divisor/remainder/alignment combinations devices use
+
+static void testRoundTrip()
+{
+    static UInt8	block[kNtbSize];
+    UInt32		divisors[] = { 4, 8, 32, 512 };
+    UInt32		aligns[] = { 4, 8, 16 };
+    UInt32		d, r, a, iter, i, len, errors;
+    bool		padded;
+    
+    for (d=0; d<sizeof(divisors)/sizeof(divisors[0]); d++)
+    {
+        for (r=0; r<divisors[d]; r+=(divisors[d] > 8 ? 14 : 2))
+        {
+            for (a=0; a<sizeof(aligns)/sizeof(aligns[0]); a++)
+            {
+                for (iter=0; iter<10; iter++)
+                {
+                    std::vector<bytes>	dgs = randomDatagrams(1 + rnd(30), (iter & 1) ? kMaxDatagram : 100);
+                    std::vector<bytes>	out;
+                    
+                    memset(block, 0xee, sizeof(block));
+                    len = buildBlock(block, dgs, divisors[d], r, aligns[a], 512, sizeof(block), &padded);
+                    CHECK(len <= sizeof(block), "block overflows");
+                    CHECK(OSReadLittleInt16(block, 8) == len, "wBlockLength");
+                    CHECK((OSReadLittleInt16(block, 10) % aligns[a]) == 0, "NDP alignment");
+                    for (i=0; i<dgs.size(); i++)
+                    {
+                        if ((OSReadLittleInt16(block, OSReadLittleInt16(block, 10) + kNDP16Len + (i * kDPE16Len)) % divisors[d]) != r)
+                        {
+                            CHECK(false, "datagram alignment");
+                            return;
+                        }
+                    }
+                    CHECK(parse(block, len, out, &errors) == dgs.size(), "datagram count");
+                    CHECK(errors == 0, "no errors in a good block");
+                    if (out != dgs)
+                    {
+                        CHECK(false, "round trip");
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+    // A block that ends on a packet boundary gets one zero byte, unless it's already full
+
+static void testZLPPad()
+{
+    static UInt8	block[kNtbSize];
+    UInt32		size, len, packetSize, want, errors;
+    bool		padded;
+    
+    for (packetSize=64; packetSize<=512; packetSize<<=1)
+    {
+            // One datagram, sized so the finished block is exactly two packets
+        
+        want = 2 * packetSize;
+        size = want - kNTH16Len - cdc_NTBNDPLength(1);
+        
+        std::vector<bytes>	dgs(1, bytes(size, 0x5a));
+        std::vector<bytes>	out;
+        
+        memset(block, 0xee, sizeof(block));
+        len = buildBlock(block, dgs, 4, 0, 4, packetSize, sizeof(block), &padded);
+        CHECK(padded && (len == want + 1), "padded to avoid the zero length packet");
+        CHECK(block[want] == 0, "pad byte is zero");
+        CHECK(OSReadLittleInt16(block, 8) == len, "wBlockLength covers the pad");
+        CHECK((parse(block, len, out, &errors) == 1) && (errors == 0) && (out == dgs), "padded block parses");
+        
+            // The same, but the block is full so there's no room for the pad
+        
+        memset(block, 0xee, sizeof(block));
+        len = buildBlock(block, dgs, 4, 0, 4, packetSize, want, &padded);
+        CHECK(!padded && (len == want), "full block isn't padded");
+        CHECK(block[want] == 0xee, "nothing written past a full block");
+        
+            // And one byte shorter, nothing to do
+        
+        dgs[0].resize(size - 4);
+        len = buildBlock(block, dgs, 4, 0, 4, packetSize, sizeof(block), &padded);
+        CHECK(!padded && ((len % packetSize) != 0), "no pad off a packet boundary");
+    }
+}
+
+    // A small good block to break: two datagrams, NDP after them
+
+static UInt32 goodBlock(UInt8 *block, std::vector<bytes> &dgs)
+{
+    bool	padded;
+    
+    dgs = randomDatagrams(2, 60);
+    memset(block, 0, 512);
+    return buildBlock(block, dgs, 4, 0, 4, 512, 512, &padded);
+}
+
+static void testBadHeaders()
+{
+    UInt8		block[512];
+    std::vector<bytes>	dgs, out;
+    UInt32		len, ndp, errors;
+    
+    len = goodBlock(block, dgs);
+    ndp = OSReadLittleInt16(block, 10);
+    
+    OSWriteLittleInt32(block, 0, 0x484D434F);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "bad NTH16 signature");
+    OSWriteLittleInt32(block, 0, NTH16_Signature);
+    
+    OSWriteLittleInt16(block, 4, 16);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "bad NTH16 header length");
+    OSWriteLittleInt16(block, 4, kNTH16Len);
+    
+    CHECK((parse(block, kNTH16Len - 1, out, &errors) == 0) && (errors == 1), "short of an NTH16");
+    
+    OSWriteLittleInt16(block, 8, len + 1);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "wBlockLength past the read");
+    OSWriteLittleInt16(block, 8, 0);
+    CHECK((parse(block, len, out, &errors) == 2) && (errors == 0), "wBlockLength 0 means the read length");
+    OSWriteLittleInt16(block, 8, len);
+    
+    OSWriteLittleInt32(block, ndp, NCM16_Signature_CRC);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "NDP16 with CRCs (not negotiated)");
+    OSWriteLittleInt32(block, ndp, 0x12345678);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "bad NDP16 signature");
+    OSWriteLittleInt32(block, ndp, NCM16_Signature_NoCRC);
+    
+    OSWriteLittleInt16(block, ndp + 4, kNDP16Len);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "NDP16 too short for a pointer");
+    OSWriteLittleInt16(block, ndp + 4, len);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "NDP16 runs past the block");
+    OSWriteLittleInt16(block, ndp + 4, cdc_NTBNDPLength(2));
+    
+    out.clear();
+    CHECK((parse(block, len, out, &errors) == 2) && (errors == 0) && (out == dgs), "repaired block parses");
+}
+
+static void testOutOfRange()
+{
+    UInt8		block[512];
+    std::vector<bytes>	dgs, out;
+    UInt32		len, ndp, errors;
+    
+    len = goodBlock(block, dgs);
+    ndp = OSReadLittleInt16(block, 10);
+    
+    OSWriteLittleInt16(block, 10, len);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "wNdpIndex past the block");
+    OSWriteLittleInt16(block, 10, len - kNDP16Len + 4);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "NDP16 header runs off the end");
+    OSWriteLittleInt16(block, 10, ndp + 2);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "wNdpIndex not 4 byte aligned");
+    OSWriteLittleInt16(block, 10, 8);
+    CHECK((parse(block, len, out, &errors) == 0) && (errors == 1), "wNdpIndex inside the NTH16");
+    OSWriteLittleInt16(block, 10, ndp);
+    
+        // Bad datagram pointers are skipped, the good one still goes up
+    
+    OSWriteLittleInt16(block, ndp + kNDP16Len, len - 10);
+    out.clear();
+    CHECK((parse(block, len, out, &errors) == 1) && (errors == 1) && (out[0] == dgs[1]), "datagram runs past the block");
+    OSWriteLittleInt16(block, ndp + kNDP16Len, 4);
+    out.clear();
+    CHECK((parse(block, len, out, &errors) == 1) && (errors == 1) && (out[0] == dgs[1]), "datagram inside the NTH16");
+    OSWriteLittleInt16(block, ndp + kNDP16Len, kNTH16Len);
+    OSWriteLittleInt16(block, ndp + kNDP16Len + 2, kMinDatagram - 1);
+    out.clear();
+    CHECK((parse(block, len, out, &errors) == 1) && (errors == 1), "runt datagram");
+    OSWriteLittleInt16(block, ndp + kNDP16Len + 2, 0xffff);
+    out.clear();
+    CHECK((parse(block, len, out, &errors) == 1) && (errors == 1), "datagram index + length wraps 16 bits");
+}
+
+    // wNextNdpIndex back at itself or at an earlier NDP must not send datagrams up twice
+
+static void testNDPLoops()
+{
+    UInt8		block[512];
+    std::vector<bytes>	dgs, out;
+    UInt32		len, ndp, second, errors;
+    
+    len = goodBlock(block, dgs);
+    ndp = OSReadLittleInt16(block, 10);
+    
+    OSWriteLittleInt16(block, ndp + 6, ndp);
+    out.clear();
+    CHECK((parse(block, len, out, &errors) == 2) && (errors == 1) && (out == dgs), "NDP pointing at itself");
+    
+        // A second NDP (copy of the first) that points back at the first
+    
+    second = (len + 3) & ~3;
+    memcpy(&block[second], &block[ndp], cdc_NTBNDPLength(2));
+    len = second + cdc_NTBNDPLength(2);
+    OSWriteLittleInt16(block, 8, len);
+    OSWriteLittleInt16(block, ndp + 6, second);
+    OSWriteLittleInt16(block, second + 6, ndp);
+    out.clear();
+    CHECK((parse(block, len, out, &errors) == 4) && (errors == 1), "two NDPs pointing at each other");
+    
+        // The same two, properly ended, both are walked
+    
+    OSWriteLittleInt16(block, second + 6, 0);
+    out.clear();
+    CHECK((parse(block, len, out, &errors) == 4) && (errors == 0), "chained NDPs");
+}
+
+    // Random damage to good blocks, the parser only has to stay inside them
+
+static void testFuzz()
+{
+    static UInt8	block[kNtbSize];
+    UInt32		iter, n, len, errors, k;
+    bool		padded;
+    
+    for (iter=0; iter<20000; iter++)
+    {
+        std::vector<bytes>	dgs = randomDatagrams(1 + rnd(8), 200);
+        std::vector<bytes>	out;
+        
+        len = buildBlock(block, dgs, 4, rnd(2) * 2, 4, 512, 2048, &padded);
+        n = 1 + rnd(8);
+        for (k=0; k<n; k++)
+        {
+            block[rnd(len)] = (UInt8)rnd(256);
+        }
+        if (rnd(4) == 0)
+        {
+            len = rnd(len + 1);
+        }
+        parse(block, len, out, &errors);
+        for (k=0; k<out.size(); k++)
+        {
+            if ((out[k].size() < kMinDatagram) || (out[k].size() > kMaxDatagram))
+            {
+                CHECK(false, "datagram outside the limits");
+                return;
+            }
+        }
+        if (out.size() > (kNCMMaxNDPs * (len / kDPE16Len)))
+        {
+            CHECK(false, "more datagrams than the NDPs could hold");
+            return;
+        }
+    }
+}
+
+int main()
+{
+    
+    testAlign();
+    testRoundTrip();
+    testZLPPad();
+    testBadHeaders();
+    testOutOfRange();
+    testNDPLoops();
+    testFuzz();
+    
+    if (failures)
+    {
+        printf("NTBTest: %d failed\n", failures);
+        return 1;
+    }
+    printf("NTBTest: passed\n");
+    
+    return 0;
+}
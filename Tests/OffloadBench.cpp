@@ -0,0 +1,135 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+
+    /* OffloadBench.cpp - Software TCP segmentation throughput (Common/AppleUSBCDCOffload.cpp) */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "AppleUSBCDCOffload.h"
+
+#define kSendLen	65535				// Largest send the stack hands over
+#define kSends		4000
+
+static double now()
+{
+    struct timespec	t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    
+    return t.tv_sec + (t.tv_nsec / 1e9);
+}
+
+    // One IPv4 or IPv6 large send with timestamps in a chain of 2K clusters
+
+static mbuf_t buildSend(bool ipv6)
+{
+    static UInt8	f[kSendLen];
+    UInt32		ipOffset = kEtherHeaderLen;
+    UInt32		tcpOffset = ipOffset + (ipv6 ? kIPv6HeaderLen : 20);
+    UInt32		i, n;
+    mbuf_t		head = NULL, tail = NULL, m;
+    
+    for (i=0; i<sizeof(f); i++)
+    {
+        f[i] = (UInt8)(i * 7);
+    }
+    f[12] = ipv6 ? 0x86 : 0x08;
+    f[13] = ipv6 ? 0xdd : 0x00;
+    if (ipv6)
+    {
+        f[ipOffset] = 0x60;
+        f[ipOffset + 6] = kIPProtoTCP;
+    } else {
+        f[ipOffset] = 0x45;
+        f[ipOffset + 9] = kIPProtoTCP;
+    }
+    f[tcpOffset + 12] = 8 << 4;				// 32 bytes, timestamps
+    f[tcpOffset + 13] = kTCPFlagACK | kTCPFlagPSH;
+    
+    for (i=0; i<sizeof(f); i+=n)
+    {
+        n = (sizeof(f) - i < MCLBYTES) ? sizeof(f) - i : MCLBYTES;
+        mbuf_getcluster(MBUF_DONTWAIT, MBUF_TYPE_DATA, MCLBYTES, &m);
+        memcpy(mbuf_data(m), &f[i], n);
+        mbuf_setlen(m, n);
+        if (tail)
+        {
+            mbuf_setnext(tail, m);
+        } else {
+            head = m;
+        }
+        tail = m;
+    }
+    mbuf_pkthdr_setlen(head, sizeof(f));
+    
+    return head;
+}
+
+static void run(bool ipv6, UInt32 mss)
+{
+    static UInt8	frame[kTSOMaxHeaders + 9000];
+    mbuf_t		m = buildSend(ipv6);
+    tsoInfo		tso;
+    UInt32		s, seg;
+    UInt64		bytes = 0, segs = 0;
+    UInt32		check = 0;
+    double		t0, t;
+    
+    t0 = now();
+    for (s=0; s<kSends; s++)
+    {
+        cdc_TSOParse(m, mss, ipv6, &tso);
+        for (seg=0; seg<tso.segments; seg++)
+        {
+            bytes += cdc_TSOSegment(m, &tso, seg, frame);
+            check += frame[tso.tcpOffset + 16];
+        }
+        segs += tso.segments;
+    }
+    t = now() - t0;
+    
+    printf("%-6s %6u %10.1f %10.2f %12.2f   (%u)\n", ipv6 ? "IPv6" : "IPv4", mss, (segs / t) / 1e3, ((bytes * 8) / t) / 1e9,
+           (t * 1e9) / segs, check & 0xff);
+    
+    mbuf_freem(m);
+}
+
+int main()
+{
+    static const UInt32	mss[] = { 536, 1448, 8948 };
+    UInt32		i;
+    
+    printf("%-6s %6s %10s %10s %12s\n", "", "mss", "kseg/s", "Gbit/s", "ns/segment");
+    for (i=0; i<sizeof(mss) / sizeof(mss[0]); i++)
+    {
+        run(false, mss[i]);
+        run(true, mss[i]);
+    }
+    
+    return 0;
+}
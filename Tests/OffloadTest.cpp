@@ -0,0 +1,854 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+
+    /* OffloadTest.cpp - Host test for TCP segmentation and receive coalescing (Common/AppleUSBCDCOffload.cpp) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "AppleUSBCDCOffload.h"
+
+static int	failures = 0;
+
+#define CHECK(cond, what)	do { if (!(cond)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, what); failures++; } } while (0)
+
+typedef std::vector<UInt8>	bytes;
+
+static UInt32	seed = 0x9e3779b9;
+
+static UInt32 rnd(UInt32 range)
+{
+    seed = (seed * 1103515245) + 12345;
+    return ((seed >> 8) % range);
+}
+
+static UInt16 get16(const UInt8 *p)
+{
+    return (UInt16)((p[0] << 8) | p[1]);
+}
+
+static UInt32 get32(const UInt8 *p)
+{
+    return ((UInt32)p[0] << 24) | ((UInt32)p[1] << 16) | ((UInt32)p[2] << 8) | p[3];
+}
+
+static void put16(UInt8 *p, UInt32 v)
+{
+    p[0] = (UInt8)(v >> 8);
+    p[1] = (UInt8)v;
+}
+
+static void put32(UInt8 *p, UInt32 v)
+{
+    p[0] = (UInt8)(v >> 24);
+    p[1] = (UInt8)(v >> 16);
+    p[2] = (UInt8)(v >> 8);
+    p[3] = (UInt8)v;
+}
+
+    // RFC 1071 the slow way, big endian words, nothing shared with the code under test
+
+static UInt32 refSum(const UInt8 *data, UInt32 len, UInt32 sum)
+{
+    UInt32	i;
+    
+    for (i=0; i+1<len; i+=2)
+    {
+        sum += get16(&data[i]);
+    }
+    if (len & 1)
+    {
+        sum += data[len - 1] << 8;
+    }
+    
+    return sum;
+}
+
+static UInt16 refFold(UInt32 sum)
+{
+    
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    
+    return (UInt16)sum;
+}
+
+    // IPv4 header checksum from scratch (the field itself zeroed)
+
+static UInt16 refIPv4Csum(const UInt8 *ip)
+{
+    UInt8	hdr[60];
+    UInt32	len = (ip[0] & 0x0f) * 4;
+    
+    memcpy(hdr, ip, len);
+    hdr[10] = 0;
+    hdr[11] = 0;
+    
+    return (UInt16)~refFold(refSum(hdr, len, 0));
+}
+
+    // TCP checksum from scratch over pseudo header, header and payload (the field zeroed)
+
+static UInt16 refTCPCsum(const UInt8 *ip, bool ipv6, const UInt8 *tcp, UInt32 tcpLen)
+{
+    bytes	seg(tcp, tcp + tcpLen);
+    UInt32	sum;
+    
+    seg[16] = 0;
+    seg[17] = 0;
+    if (ipv6)
+    {
+        sum = refSum(&ip[8], 32, 0);
+    } else {
+        sum = refSum(&ip[12], 8, 0);
+    }
+    sum += kIPProtoTCP + tcpLen;
+    
+    return (UInt16)~refFold(refSum(&seg[0], tcpLen, sum));
+}
+
+    // A large send as the stack would hand it over
+
+typedef struct
+{
+    bool	vlan;
+    bool	ipv6;
+    UInt32	ipOptLen;				// IPv4 options
+    UInt32	tcpOptLen;
+    UInt32	payloadLen;
+    UInt32	seq;
+    UInt16	ipID;
+    UInt8	flags;
+} sendSpec;
+
+static bytes buildSend(const sendSpec *spec, UInt32 *ipOffset, UInt32 *tcpOffset, UInt32 *hdrLen)
+{
+    bytes	f;
+    UInt32	ipHdrLen = spec->ipv6 ? kIPv6HeaderLen : 20 + spec->ipOptLen;
+    UInt32	tcpHdrLen = 20 + spec->tcpOptLen;
+    UInt32	i;
+    UInt8	*ip, *tcp;
+    
+    *ipOffset = kEtherHeaderLen + (spec->vlan ? kVLANTagLen : 0);
+    *tcpOffset = *ipOffset + ipHdrLen;
+    *hdrLen = *tcpOffset + tcpHdrLen;
+    f.resize(*hdrLen + spec->payloadLen);
+    
+    for (i=0; i<12; i++)
+    {
+        f[i] = (UInt8)(0x10 + i);
+    }
+    if (spec->vlan)
+    {
+        put16(&f[12], kEtherTypeVLAN);
+        put16(&f[14], 0x2123);
+    }
+    put16(&f[*ipOffset - 2], spec->ipv6 ? kEtherTypeIPv6 : kEtherTypeIPv4);
+    
+    ip = &f[*ipOffset];
+    if (spec->ipv6)
+    {
+        ip[0] = 0x60;
+        ip[1] = 0x0a;
+        put16(&ip[4], tcpHdrLen + spec->payloadLen);	// The stack's own length, we rewrite it
+        ip[6] = kIPProtoTCP;
+        ip[7] = 64;
+        for (i=8; i<40; i++)
+        {
+            ip[i] = (UInt8)(0xa0 + i);
+        }
+    } else {
+        ip[0] = 0x40 | (ipHdrLen / 4);
+        put16(&ip[2], ipHdrLen + tcpHdrLen + spec->payloadLen);
+        put16(&ip[4], spec->ipID);
+        ip[6] = 0x40;					// DF
+        ip[8] = 64;
+        ip[9] = kIPProtoTCP;
+        put32(&ip[12], 0xc0a80102);
+        put32(&ip[16], 0x0a000001);
+        for (i=20; i<ipHdrLen; i++)
+        {
+            ip[i] = 1;					// NOPs
+        }
+        put16(&ip[10], 0xdead);				// Left stale by the stack
+    }
+    
+    tcp = &f[*tcpOffset];
+    put16(&tcp[0], 49152);
+    put16(&tcp[2], 443);
+    put32(&tcp[4], spec->seq);
+    put32(&tcp[8], 0x01020304);
+    tcp[12] = (UInt8)((tcpHdrLen / 4) << 4);
+    tcp[13] = spec->flags;
+    put16(&tcp[14], 0xffff);
+    put16(&tcp[16], 0xbeef);				// Left stale by the stack
+    for (i=20; i<tcpHdrLen; i++)
+    {
+        tcp[i] = (UInt8)(i == 20 ? 1 : rnd(256));
+    }
+    
+    for (i=*hdrLen; i<f.size(); i++)
+    {
+        f[i] = (UInt8)rnd(256);
+    }
+    
+    return f;
+}
+
+    // Spread the bytes over a chain of mbufs cut at random places
+
+static mbuf_t toChain(const bytes &f)
+{
+    mbuf_t	head = NULL, tail = NULL, m;
+    UInt32	pos = 0, n;
+    
+    while (pos < f.size())
+    {
+        n = 1 + rnd(MCLBYTES);
+        if (n > f.size() - pos)
+        {
+            n = (UInt32)f.size() - pos;
+        }
+        mbuf_getcluster(MBUF_DONTWAIT, MBUF_TYPE_DATA, MCLBYTES, &m);
+        memcpy(mbuf_data(m), &f[pos], n);
+        mbuf_setlen(m, n);
+        if (tail)
+        {
+            mbuf_setnext(tail, m);
+        } else {
+            head = m;
+        }
+        tail = m;
+        pos += n;
+    }
+    mbuf_pkthdr_setlen(head, f.size());
+    
+    return head;
+}
+
+    // Segment one send and check every frame against the original
+
+static void checkSegments(const sendSpec *spec, UInt32 mss)
+{
+    UInt32	ipOffset, tcpOffset, hdrLen;
+    bytes	f = buildSend(spec, &ipOffset, &tcpOffset, &hdrLen);
+    mbuf_t	m = toChain(f);
+    tsoInfo	tso;
+    UInt8	frame[kTSOMaxHeaders + 16384];
+    UInt32	seg, len, segLen, done = 0;
+    UInt8	*ip, *tcp;
+    UInt8	flags;
+    
+    CHECK(cdc_TSOParse(m, mss, spec->ipv6, &tso), "parse");
+    CHECK(tso.hdrLen == hdrLen, "header length");
+    CHECK(tso.segments == (spec->payloadLen + mss - 1) / mss, "segment count");
+    
+    for (seg=0; seg<tso.segments; seg++)
+    {
+        len = cdc_TSOSegment(m, &tso, seg, frame);
+        segLen = len - hdrLen;
+        CHECK(segLen == ((seg == tso.segments - 1) ? spec->payloadLen - done : mss), "segment length");
+        CHECK(memcmp(frame, &f[0], ipOffset) == 0, "Ethernet header");
+        CHECK(memcmp(&frame[hdrLen], &f[hdrLen + done], segLen) == 0, "payload");
+        
+        ip = &frame[ipOffset];
+        tcp = &frame[tcpOffset];
+        if (spec->ipv6)
+        {
+            CHECK(get16(&ip[4]) == hdrLen - tcpOffset + segLen, "IPv6 payload length");
+            CHECK(memcmp(ip, &f[ipOffset], 4) == 0 && memcmp(&ip[6], &f[ipOffset + 6], 34) == 0, "rest of the IPv6 header");
+        } else {
+            CHECK(get16(&ip[2]) == hdrLen - ipOffset + segLen, "IPv4 total length");
+            CHECK(get16(&ip[4]) == (UInt16)(spec->ipID + seg), "IPv4 id");
+            CHECK(get16(&ip[10]) == refIPv4Csum(ip), "IPv4 header checksum");
+            CHECK(memcmp(&ip[12], &f[ipOffset + 12], tcpOffset - ipOffset - 12) == 0, "IPv4 addresses and options");
+        }
+        
+        CHECK(get32(&tcp[4]) == spec->seq + done, "sequence number");
+        CHECK(memcmp(&tcp[8], &f[tcpOffset + 8], 5) == 0, "ack and offset");
+        flags = spec->flags;
+        if (seg != tso.segments - 1)
+        {
+            flags &= ~(kTCPFlagFIN | kTCPFlagPSH);
+        }
+        if (seg != 0)
+        {
+            flags &= ~kTCPFlagCWR;
+        }
+        CHECK(tcp[13] == flags, "TCP flags");
+        CHECK(memcmp(&tcp[14], &f[tcpOffset + 14], 2) == 0, "window");
+        CHECK(memcmp(&tcp[18], &f[tcpOffset + 18], hdrLen - tcpOffset - 18) == 0, "urgent pointer and options");
+        CHECK(get16(&tcp[16]) == refTCPCsum(ip, spec->ipv6, tcp, len - tcpOffset), "TCP checksum");
+        
+        done += segLen;
+    }
+    CHECK(done == spec->payloadLen, "all the payload sent");
+    
+    mbuf_freem(m);
+}
+
+static void testTSO()
+{
+    sendSpec	spec;
+    
+        // Large IPv4 send, the id and sequence both wrap part way through
+    
+    memset(&spec, 0, sizeof(spec));
+    spec.tcpOptLen = 12;
+    spec.payloadLen = 65000;
+    spec.seq = 0xffff0000;
+    spec.ipID = 0xfff0;
+    spec.flags = kTCPFlagACK | kTCPFlagPSH | kTCPFlagFIN | kTCPFlagCWR;
+    checkSegments(&spec, 1448);
+    
+        // IPv6
+    
+    spec.ipv6 = true;
+    spec.payloadLen = 64000;
+    checkSegments(&spec, 1428);
+    
+        // VLAN tagged, both
+    
+    spec.vlan = true;
+    checkSegments(&spec, 1424);
+    spec.ipv6 = false;
+    checkSegments(&spec, 1444);
+    
+        // IPv4 options
+    
+    spec.vlan = false;
+    spec.ipOptLen = 8;
+    spec.payloadLen = 9000;
+    checkSegments(&spec, 1440);
+    spec.ipOptLen = 0;
+    
+        // Odd length tails and odd mss
+    
+    spec.payloadLen = 4001;
+    checkSegments(&spec, 1000);
+    spec.payloadLen = 3999;
+    checkSegments(&spec, 1333);
+    spec.ipv6 = true;
+    spec.payloadLen = 2897;
+    checkSegments(&spec, 1448);
+    
+        // One byte segments, first and last flags on the same segment when there's only one
+    
+    spec.payloadLen = 37;
+    checkSegments(&spec, 1);
+    spec.ipv6 = false;
+    checkSegments(&spec, 1);
+    spec.payloadLen = 1;
+    checkSegments(&spec, 1);
+    
+        // Exactly a multiple of the mss
+    
+    spec.payloadLen = 1448 * 4;
+    spec.flags = kTCPFlagACK;
+    checkSegments(&spec, 1448);
+}
+
+static void testTSOFuzz()
+{
+    sendSpec	spec;
+    UInt32	i;
+    
+    for (i=0; i<300; i++)
+    {
+        memset(&spec, 0, sizeof(spec));
+        spec.vlan = rnd(2);
+        spec.ipv6 = rnd(2);
+        spec.ipOptLen = spec.ipv6 ? 0 : rnd(11) * 4;
+        spec.tcpOptLen = rnd(11) * 4;
+        spec.payloadLen = 1 + rnd(20000);
+        spec.seq = rnd(0xffffff) << 8;
+        spec.ipID = (UInt16)rnd(0x10000);
+        spec.flags = (UInt8)(kTCPFlagACK | (rnd(256) & (kTCPFlagFIN | kTCPFlagPSH | kTCPFlagCWR)));
+        checkSegments(&spec, 1 + rnd(9000));
+    }
+}
+
+static void testTSOReject()
+{
+    sendSpec	spec;
+    UInt32	ipOffset, tcpOffset, hdrLen;
+    bytes	f;
+    mbuf_t	m;
+    tsoInfo	tso;
+    
+    memset(&spec, 0, sizeof(spec));
+    spec.payloadLen = 3000;
+    spec.flags = kTCPFlagACK;
+    
+    f = buildSend(&spec, &ipOffset, &tcpOffset, &hdrLen);
+    m = toChain(f);
+    CHECK(!cdc_TSOParse(m, 0, false, &tso), "mss of zero");
+    CHECK(!cdc_TSOParse(m, 1448, true, &tso), "IPv4 asked for as IPv6");
+    mbuf_freem(m);
+    
+    f[ipOffset + 9] = 17;					// UDP
+    m = toChain(f);
+    CHECK(!cdc_TSOParse(m, 1448, false, &tso), "not TCP");
+    mbuf_freem(m);
+    
+    spec.ipv6 = true;
+    f = buildSend(&spec, &ipOffset, &tcpOffset, &hdrLen);
+    f[ipOffset + 6] = 0;					// Hop by hop options
+    m = toChain(f);
+    CHECK(!cdc_TSOParse(m, 1448, true, &tso), "IPv6 extension header");
+    mbuf_freem(m);
+    
+    spec.ipv6 = false;
+    spec.payloadLen = 0;
+    f = buildSend(&spec, &ipOffset, &tcpOffset, &hdrLen);
+    m = toChain(f);
+    CHECK(!cdc_TSOParse(m, 1448, false, &tso), "no payload");
+    mbuf_freem(m);
+}
+
+    // A received segment with good checksums. Options are the timestamp (kind 8) when
+    // tcpOptLen is 12, tsVal and ack move on per segment like a real flow.
+
+static bytes buildSegment(const sendSpec *spec, UInt32 tsVal, UInt32 ack, UInt16 window, UInt32 padTo,
+                          UInt32 *tcpOffset, UInt32 *hdrLen)
+{
+    UInt32	ipOffset;
+    bytes	f = buildSend(spec, &ipOffset, tcpOffset, hdrLen);
+    UInt8	*ip = &f[ipOffset];
+    UInt8	*tcp = &f[*tcpOffset];
+    
+    put32(&tcp[8], ack);
+    put16(&tcp[14], window);
+    if (spec->tcpOptLen == 12)
+    {
+        tcp[20] = 1;
+        tcp[21] = 1;
+        tcp[22] = 8;
+        tcp[23] = 10;
+        put32(&tcp[24], tsVal);
+        put32(&tcp[28], tsVal - 1000);
+    }
+    if (!spec->ipv6)
+    {
+        put16(&ip[10], refIPv4Csum(ip));
+    }
+    put16(&tcp[16], refTCPCsum(ip, spec->ipv6, tcp, (UInt32)f.size() - *tcpOffset));
+    
+    if (f.size() < padTo)
+    {
+        f.resize(padTo, 0);					// Ethernet padding, not part of the IP packet
+    }
+    
+    return f;
+}
+
+static mbuf_t toMbuf(const bytes &f)
+{
+    mbuf_t	m;
+    
+    mbuf_getcluster(MBUF_DONTWAIT, MBUF_TYPE_DATA, MBIGCLBYTES * 2, &m);
+    memcpy(mbuf_data(m), &f[0], f.size());
+    mbuf_setlen(m, f.size());
+    mbuf_pkthdr_setlen(m, f.size());
+    
+    return m;
+}
+
+    // Feed segments through the way the drivers' lroInput does, return the packets that go up
+
+static std::vector<bytes> coalesce(const std::vector<bytes> &frames, UInt32 *merged)
+{
+    std::vector<bytes>	out;
+    lroFlow		flow;
+    lroSegment		seg;
+    mbuf_t		m;
+    UInt32		i, len;
+    bytes		pkt;
+    
+    memset(&flow, 0, sizeof(flow));
+    *merged = 0;
+    
+    for (i=0; i<=frames.size(); i++)
+    {
+        if (i < frames.size())
+        {
+            CHECK(cdc_LROParse(&frames[i][0], (UInt32)frames[i].size(), &seg), "segment accepted");
+            if (cdc_LROMatch(&flow, &frames[i][0], &seg))
+            {
+                CHECK(cdc_LROAppend(&flow, &frames[i][0], &seg), "append");
+                (*merged)++;
+                continue;
+            }
+        }
+        if (flow.head)
+        {
+            m = cdc_LROFinish(&flow, &len);
+            CHECK(len == mbuf_pkthdr_len(m), "packet length");
+            pkt.resize(len);
+            CHECK(mbuf_copydata(m, 0, len, &pkt[0]) == 0, "chain holds the packet");
+            CHECK((m->csumFlags & (MBUF_CSUM_DID_DATA | MBUF_CSUM_PSEUDO_HDR)) == (MBUF_CSUM_DID_DATA | MBUF_CSUM_PSEUDO_HDR), "data checksum marked good");
+            out.push_back(pkt);
+            mbuf_freem(m);
+        }
+        if (i < frames.size())
+        {
+            CHECK(cdc_LROStart(&flow, toMbuf(frames[i]), &seg), "start");
+        }
+    }
+    
+    return out;
+}
+
+    // A merged packet against the segments it was built from, checksums from scratch
+
+static void checkMerged(const bytes &pkt, const std::vector<bytes> &frames, UInt32 first, UInt32 count, bool ipv6,
+                        UInt32 tcpOffset, UInt32 hdrLen)
+{
+    UInt32	ipOffset = tcpOffset - (ipv6 ? kIPv6HeaderLen : 20);
+    const UInt8	*ip = &pkt[ipOffset];
+    const UInt8	*tcp = &pkt[tcpOffset];
+    const bytes	&last = frames[first + count - 1];
+    UInt32	payload = 0;
+    UInt32	i, ipLen;
+    UInt8	flags = kTCPFlagACK;
+    bytes	expect;
+    
+    for (i=first; i<first+count; i++)
+    {
+        ipLen = ipv6 ? kIPv6HeaderLen + get16(&frames[i][ipOffset + 4]) : get16(&frames[i][ipOffset + 2]);
+        expect.insert(expect.end(), frames[i].begin() + hdrLen, frames[i].begin() + ipOffset + ipLen);
+        payload += ipOffset + ipLen - hdrLen;
+        flags |= frames[i][tcpOffset + 13];
+    }
+    
+    CHECK(pkt.size() == hdrLen + payload, "merged length");
+    CHECK(memcmp(&pkt[hdrLen], &expect[0], payload) == 0, "merged payload");
+    CHECK(memcmp(&pkt[0], &frames[first][0], ipOffset) == 0, "Ethernet header");
+    if (ipv6)
+    {
+        CHECK(get16(&ip[4]) == pkt.size() - tcpOffset, "IPv6 payload length");
+    } else {
+        CHECK(get16(&ip[2]) == pkt.size() - ipOffset, "IPv4 total length");
+        CHECK(get16(&ip[10]) == refIPv4Csum(ip), "IPv4 header checksum");
+    }
+    CHECK(get32(&tcp[4]) == get32(&frames[first][tcpOffset + 4]), "first sequence number");
+    CHECK(memcmp(&tcp[8], &last[tcpOffset + 8], 4) == 0, "latest ack");
+    CHECK(memcmp(&tcp[14], &last[tcpOffset + 14], 2) == 0, "latest window");
+    CHECK(memcmp(&tcp[20], &last[tcpOffset + 20], hdrLen - tcpOffset - 20) == 0, "latest options");
+    CHECK(tcp[13] == flags, "PSH carried over");
+    CHECK(get16(&tcp[16]) == refTCPCsum(ip, ipv6, tcp, (UInt32)pkt.size() - tcpOffset), "TCP checksum");
+}
+
+    // In order segments of one flow, payload lengths from lens
+
+static std::vector<bytes> buildFlow(sendSpec *spec, const UInt32 *lens, UInt32 count, UInt32 *tcpOffset, UInt32 *hdrLen)
+{
+    std::vector<bytes>	frames;
+    UInt32		i;
+    
+    for (i=0; i<count; i++)
+    {
+        spec->payloadLen = lens[i];
+        spec->flags = kTCPFlagACK | ((i % 3 == 2) ? kTCPFlagPSH : 0);
+        frames.push_back(buildSegment(spec, 5000 + i, 0x10000 + (i * 100), (UInt16)(8000 + i), 60, tcpOffset, hdrLen));
+        spec->seq += lens[i];
+        spec->ipID++;
+    }
+    
+    return frames;
+}
+
+static void testLROMerge()
+{
+    static const UInt32	even[] = { 1448, 1448, 1448, 1448, 1448, 1448, 1448, 1448 };
+    static const UInt32	mixed[] = { 1001, 1000, 7, 1448, 3, 2, 999, 1, 1, 1448, 4096 };
+    static const UInt32	*const sets[] = { even, mixed };
+    static const UInt32	setLens[] = { sizeof(even) / sizeof(even[0]), sizeof(mixed) / sizeof(mixed[0]) };
+    std::vector<bytes>	frames, pkts;
+    sendSpec		spec;
+    UInt32		tcpOffset, hdrLen, merged;
+    UInt32		s, v;
+    
+    for (v=0; v<8; v++)
+    {
+        for (s=0; s<2; s++)
+        {
+            memset(&spec, 0, sizeof(spec));
+            spec.ipv6 = v & 1;
+            spec.vlan = (v & 2) != 0;
+            spec.tcpOptLen = (v & 4) ? 12 : 0;
+            spec.seq = 0xfffff000;					// Wraps part way through
+            frames = buildFlow(&spec, sets[s], setLens[s], &tcpOffset, &hdrLen);
+            pkts = coalesce(frames, &merged);
+            CHECK(pkts.size() == 1, "one packet");
+            CHECK(merged == setLens[s] - 1, "all merged");
+            if (pkts.size() == 1)
+            {
+                checkMerged(pkts[0], frames, 0, setLens[s], spec.ipv6, tcpOffset, hdrLen);
+            }
+        }
+    }
+    
+        // Random odd and even mixes
+    
+    for (v=0; v<200; v++)
+    {
+        UInt32	lens[kLROMaxSegments];
+        
+        for (s=0; s<kLROMaxSegments; s++)
+        {
+            lens[s] = 1 + rnd(rnd(2) ? 16 : 4000);
+        }
+        memset(&spec, 0, sizeof(spec));
+        spec.ipv6 = rnd(2);
+        spec.tcpOptLen = rnd(2) ? 12 : 0;
+        spec.seq = rnd(0x1000000) << 8;
+        frames = buildFlow(&spec, lens, kLROMaxSegments, &tcpOffset, &hdrLen);
+        pkts = coalesce(frames, &merged);
+        CHECK(pkts.size() == 1, "one packet (random)");
+        if (pkts.size() == 1)
+        {
+            checkMerged(pkts[0], frames, 0, kLROMaxSegments, spec.ipv6, tcpOffset, hdrLen);
+        }
+    }
+}
+
+    // Each case breaks the flow at frame 3, the rest must still merge around it
+
+static void checkBreak(std::vector<bytes> &frames, bool ipv6, UInt32 tcpOffset, UInt32 hdrLen, const char *what)
+{
+    std::vector<bytes>	pkts;
+    UInt32		merged;
+    
+    pkts = coalesce(frames, &merged);
+    CHECK(pkts.size() == 2, what);
+    if (pkts.size() == 2)
+    {
+        checkMerged(pkts[0], frames, 0, 3, ipv6, tcpOffset, hdrLen);
+        checkMerged(pkts[1], frames, 3, (UInt32)frames.size() - 3, ipv6, tcpOffset, hdrLen);
+    }
+}
+
+static void testLROBreaks()
+{
+    static const UInt32	lens[] = { 100, 101, 102, 103, 104, 105 };
+    std::vector<bytes>	frames;
+    sendSpec		spec;
+    UInt32		tcpOffset, hdrLen, ipOffset, i;
+    lroSegment		seg;
+    bytes		f;
+    
+    memset(&spec, 0, sizeof(spec));
+    spec.tcpOptLen = 12;
+    spec.seq = 1000;
+    
+        // Out of order: 3 and 4 swapped, 0-2 merge and 4, 3 and 5 each go up on their own
+    
+    frames = buildFlow(&spec, lens, 6, &tcpOffset, &hdrLen);
+    std::swap(frames[3], frames[4]);
+    {
+        std::vector<bytes>	pkts;
+        UInt32			merged;
+        
+        pkts = coalesce(frames, &merged);
+        CHECK(pkts.size() == 4, "out of order");
+        CHECK(merged == 2, "out of order merges");
+    }
+    
+        // A gap (lost segment)
+    
+    spec.seq = 1000;
+    frames = buildFlow(&spec, lens, 6, &tcpOffset, &hdrLen);
+    frames.erase(frames.begin() + 3);
+    checkBreak(frames, false, tcpOffset, hdrLen, "sequence gap");
+    
+        // Timestamp values move on every segment and still merge (testLROMerge), any other
+        // option change doesn't. The new options are the same from 3 on so those merge.
+    
+    spec.seq = 1000;
+    frames = buildFlow(&spec, lens, 6, &tcpOffset, &hdrLen);
+    for (i=3; i<6; i++)
+    {
+        frames[i][tcpOffset + 21] = 3;					// NOP, window scale, junk instead of NOP, NOP, timestamp
+        frames[i][tcpOffset + 22] = 3;
+        frames[i][tcpOffset + 23] = 7;
+        memmove(&frames[i][tcpOffset + 24], &frames[3][tcpOffset + 24], 8);
+        put16(&frames[i][tcpOffset + 16], refTCPCsum(&frames[i][kEtherHeaderLen], false, &frames[i][tcpOffset],
+                                                      (UInt32)(frames[i].size() - tcpOffset)));
+    }
+    checkBreak(frames, false, tcpOffset, hdrLen, "different options");
+    
+        // The other way round, timestamps turning up after other options
+    
+    spec.seq = 1000;
+    frames = buildFlow(&spec, lens, 6, &tcpOffset, &hdrLen);
+    for (i=0; i<3; i++)
+    {
+        frames[i][tcpOffset + 21] = 3;
+        frames[i][tcpOffset + 22] = 3;
+        frames[i][tcpOffset + 23] = 7;
+        memmove(&frames[i][tcpOffset + 24], &frames[0][tcpOffset + 24], 8);
+        put16(&frames[i][tcpOffset + 16], refTCPCsum(&frames[i][kEtherHeaderLen], false, &frames[i][tcpOffset],
+                                                      (UInt32)(frames[i].size() - tcpOffset)));
+    }
+    checkBreak(frames, false, tcpOffset, hdrLen, "timestamps after other options");
+    
+        // Different ports (another flow)
+    
+    spec.seq = 1000;
+    frames = buildFlow(&spec, lens, 6, &tcpOffset, &hdrLen);
+    for (i=3; i<6; i++)
+    {
+        frames[i][tcpOffset + 1]++;
+        put16(&frames[i][tcpOffset + 16], refTCPCsum(&frames[i][kEtherHeaderLen], false, &frames[i][tcpOffset],
+                                                      (UInt32)(frames[i].size() - tcpOffset)));
+    }
+    checkBreak(frames, false, tcpOffset, hdrLen, "different port");
+    
+        // Only plain ACK (and PSH) segments are candidates
+    
+    spec.seq = 1000;
+    spec.payloadLen = 200;
+    ipOffset = kEtherHeaderLen;
+    for (i=0; i<8; i++)
+    {
+        UInt8	flag = (UInt8)(1 << i);
+        
+        if ((flag == kTCPFlagACK) || (flag == kTCPFlagPSH))
+        {
+            continue;
+        }
+        spec.flags = kTCPFlagACK | flag;
+        f = buildSegment(&spec, 1, 1, 1, 60, &tcpOffset, &hdrLen);
+        CHECK(!cdc_LROParse(&f[0], (UInt32)f.size(), &seg), "flag other than ACK or PSH");
+    }
+    spec.flags = kTCPFlagACK;
+    f = buildSegment(&spec, 1, 1, 1, 60, &tcpOffset, &hdrLen);
+    CHECK(cdc_LROParse(&f[0], (UInt32)f.size(), &seg), "plain ACK with data");
+    
+        // Bad checksums, IP fragments and options, pure ACKs
+    
+    f[hdrLen + 5] ^= 0x10;
+    CHECK(!cdc_LROParse(&f[0], (UInt32)f.size(), &seg), "bad TCP checksum");
+    f = buildSegment(&spec, 1, 1, 1, 60, &tcpOffset, &hdrLen);
+    f[ipOffset + 8]--;
+    CHECK(!cdc_LROParse(&f[0], (UInt32)f.size(), &seg), "bad IP checksum");
+    f = buildSegment(&spec, 1, 1, 1, 60, &tcpOffset, &hdrLen);
+    f[ipOffset + 6] |= 0x20;
+    CHECK(!cdc_LROParse(&f[0], (UInt32)f.size(), &seg), "more fragments");
+    spec.ipOptLen = 4;
+    f = buildSegment(&spec, 1, 1, 1, 60, &tcpOffset, &hdrLen);
+    CHECK(!cdc_LROParse(&f[0], (UInt32)f.size(), &seg), "IP options");
+    spec.ipOptLen = 0;
+    spec.payloadLen = 0;
+    f = buildSegment(&spec, 1, 1, 1, 60, &tcpOffset, &hdrLen);
+    CHECK(!cdc_LROParse(&f[0], (UInt32)f.size(), &seg), "pure ACK");
+}
+
+static void testLROLimits()
+{
+    UInt32		lens[kLROMaxSegments + 4];
+    std::vector<bytes>	frames, pkts;
+    sendSpec		spec;
+    UInt32		tcpOffset, hdrLen, merged, i, ipLen;
+    
+        // Segment count
+    
+    for (i=0; i<kLROMaxSegments + 4; i++)
+    {
+        lens[i] = 10;
+    }
+    memset(&spec, 0, sizeof(spec));
+    frames = buildFlow(&spec, lens, kLROMaxSegments + 4, &tcpOffset, &hdrLen);
+    pkts = coalesce(frames, &merged);
+    CHECK(pkts.size() == 2, "segment limit");
+    if (pkts.size() == 2)
+    {
+        checkMerged(pkts[0], frames, 0, kLROMaxSegments, false, tcpOffset, hdrLen);
+        checkMerged(pkts[1], frames, kLROMaxSegments, 4, false, tcpOffset, hdrLen);
+    }
+    
+        // IP length, big segments run into kLROMaxIPLen before the segment limit
+    
+    for (i=0; i<kLROMaxSegments; i++)
+    {
+        lens[i] = MBIGCLBYTES;
+    }
+    for (i=0; i<2; i++)
+    {
+        memset(&spec, 0, sizeof(spec));
+        spec.ipv6 = i;
+        spec.tcpOptLen = 12;
+        frames = buildFlow(&spec, lens, kLROMaxSegments, &tcpOffset, &hdrLen);
+        pkts = coalesce(frames, &merged);
+        CHECK(pkts.size() == 2, "IP length limit");
+        if (pkts.size() == 2)
+        {
+            ipLen = (UInt32)pkts[0].size() - (tcpOffset - (i ? kIPv6HeaderLen : 20));
+            CHECK(ipLen <= kLROMaxIPLen, "merged packet fits an IP length");
+            CHECK(ipLen + MBIGCLBYTES > kLROMaxIPLen, "merged as much as fits");
+            checkMerged(pkts[0], frames, 0, kLROMaxSegments - 1, i, tcpOffset, hdrLen);
+            checkMerged(pkts[1], frames, kLROMaxSegments - 1, 1, i, tcpOffset, hdrLen);
+        }
+    }
+    
+        // A payload bigger than a cluster isn't taken
+    
+    {
+        lroSegment	seg;
+        bytes		f;
+        
+        memset(&spec, 0, sizeof(spec));
+        spec.payloadLen = MBIGCLBYTES + 1;
+        spec.flags = kTCPFlagACK;
+        f = buildSegment(&spec, 1, 1, 1, 60, &tcpOffset, &hdrLen);
+        CHECK(!cdc_LROParse(&f[0], (UInt32)f.size(), &seg), "payload bigger than a cluster");
+    }
+}
+
+int main()
+{
+    
+    testTSO();
+    testTSOFuzz();
+    testTSOReject();
+    testLROMerge();
+    testLROBreaks();
+    testLROLimits();
+    
+    if (failures)
+    {
+        printf("OffloadTest: %d failed\n", failures);
+        return 1;
+    }
+    printf("OffloadTest: passed\n");
+    
+    return 0;
+}
@@ -0,0 +1,389 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+
+    /* RxLoanTest.cpp - Host test for the read buffer loan bookkeeping (Common/AppleUSBCDCRxLoan.cpp) */
+
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <libkern/OSAtomic.h>
+
+#include "AppleUSBCDCRxLoan.h"
+
+#define kPool		8
+
+static int	failures = 0;
+
+#define CHECK(cond, what)	do { if (!(cond)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, what); failures++; } } while (0)
+
+    // Fixed seed so failures reproduce
+
+static UInt32	seed = 0x2468ace0;
+
+static UInt32 rnd(UInt32 range)
+{
+    seed = (seed * 1103515245) + 12345;
+    return ((seed >> 8) % range);
+}
+
+    // A read pool the way the driver uses it. The driver's own retain/release is
+    // driverRefs, a read queued is reads and a buffer freed is freed.
+
+typedef struct
+{
+    rxLoan		loan;
+    bool		allocated;
+    volatile SInt32	reads;
+    volatile SInt32	freed;
+} readBuf;
+
+static readBuf		pool[kPool];
+static volatile SInt32	poolLoaned;
+static volatile SInt32	driverRefs;
+static std::mutex	poolLock;
+
+static void newPool()
+{
+    UInt32	i;
+    
+    for (i=0; i<kPool; i++)
+    {
+        memset(&pool[i], 0, sizeof(pool[i]));
+        pool[i].allocated = true;
+    }
+    poolLoaned = 0;
+    driverRefs = 0;
+}
+
+    // rxRecycle
+
+static void recycle(readBuf *b)
+{
+    
+    poolLock.lock();
+    if (cdc_RxLoanReturn(&b->loan, &poolLoaned))
+    {
+        b->allocated = false;
+        OSIncrementAtomic(&b->freed);
+    } else {
+        OSIncrementAtomic(&b->reads);
+    }
+    poolLock.unlock();
+    OSDecrementAtomic(&driverRefs);
+}
+
+    // The read completion's split, frames that go up in place are added to out
+
+static UInt32 split(readBuf *b, UInt32 frames, std::vector<readBuf *> &out)
+{
+    UInt32	i, inPlace = 0;
+    bool	first;
+    
+    cdc_RxLoanSplit(&b->loan);
+    for (i=0; i<frames; i++)
+    {
+        if (cdc_RxLoanTake(&b->loan, &poolLoaned, kPool, &first))
+        {
+            if (first)
+            {
+                OSIncrementAtomic(&driverRefs);
+            }
+            out.push_back(b);
+            inPlace++;
+        }
+    }
+    
+    return inPlace;
+}
+
+static UInt32 splitDone(readBuf *b)
+{
+    UInt32	what = cdc_RxLoanSplitDone(&b->loan);
+    
+    switch (what)
+    {
+        case kRxLoanRecycle:
+            recycle(b);
+            break;
+        case kRxLoanRequeue:
+            OSIncrementAtomic(&b->reads);
+            break;
+        default:
+            break;
+    }
+    
+    return what;
+}
+
+    // rxSliceFree
+
+static void frameFree(readBuf *b)
+{
+    
+    if (cdc_RxLoanFree(&b->loan))
+    {
+        recycle(b);
+    }
+}
+
+static void releaseAll()
+{
+    UInt32	i;
+    
+    poolLock.lock();
+    for (i=0; i<kPool; i++)
+    {
+        if (cdc_RxLoanRelease(&pool[i].loan))
+        {
+            pool[i].allocated = false;
+        }
+    }
+    poolLock.unlock();
+}
+
+static void reclaimAll()
+{
+    UInt32	i;
+    
+    poolLock.lock();
+    for (i=0; i<kPool; i++)
+    {
+        if (cdc_RxLoanReclaim(&pool[i].loan))
+        {
+            pool[i].allocated = true;
+        }
+    }
+    poolLock.unlock();
+}
+
+static bool settled()
+{
+    return (poolLoaned == 0) && (driverRefs == 0);
+}
+
+static void testNoLoan()
+{
+    std::vector<readBuf *>	out;
+    
+    newPool();
+    split(&pool[0], 0, out);
+    CHECK(splitDone(&pool[0]) == kRxLoanRequeue, "nothing went up in place");
+    CHECK((pool[0].reads == 1) && (pool[0].loan.refs == 0) && settled(), "requeued straight away");
+}
+
+    // The last free lands before the read completion drops its reference
+
+static void testFreeBeforeDone()
+{
+    std::vector<readBuf *>	out;
+    UInt32			i;
+    
+    newPool();
+    CHECK(split(&pool[0], 3, out) == 3, "three in place");
+    CHECK(pool[0].loan.loaned && (poolLoaned == 1) && (driverRefs == 1), "loaned once");
+    for (i=0; i<out.size(); i++)
+    {
+        frameFree(out[i]);
+    }
+    CHECK(pool[0].reads == 0, "not recycled while the completion holds it");
+    CHECK(splitDone(&pool[0]) == kRxLoanRecycle, "completion drops the last reference");
+    CHECK((pool[0].reads == 1) && !pool[0].loan.loaned && settled(), "recycled once");
+}
+
+    // And after it
+
+static void testFreeAfterDone()
+{
+    std::vector<readBuf *>	out;
+    
+    newPool();
+    split(&pool[0], 3, out);
+    CHECK(splitDone(&pool[0]) == kRxLoanOut, "frames still out");
+    frameFree(out[0]);
+    frameFree(out[1]);
+    CHECK((pool[0].reads == 0) && pool[0].loan.loaned, "still out with one frame up");
+    frameFree(out[2]);
+    CHECK((pool[0].reads == 1) && !pool[0].loan.loaned && settled(), "last free recycles");
+}
+
+    // Half the pool at most, a buffer that's out keeps lending
+
+static void testPoolLimit()
+{
+    std::vector<readBuf *>	out;
+    UInt32			i;
+    
+    newPool();
+    for (i=0; i<(kPool / 2) - 1; i++)
+    {
+        CHECK(split(&pool[i], 1, out) == 1, "under the limit");
+        splitDone(&pool[i]);
+    }
+    CHECK(split(&pool[i], 3, out) == 3, "the one that reaches the limit keeps lending");
+    splitDone(&pool[i]);
+    CHECK(poolLoaned == (kPool / 2), "half the pool out");
+    CHECK(split(&pool[kPool / 2], 2, out) == 0, "over the limit copies");
+    CHECK(splitDone(&pool[kPool / 2]) == kRxLoanRequeue, "refused buffer requeues");
+    
+    for (i=0; i<out.size(); i++)
+    {
+        frameFree(out[i]);
+    }
+    CHECK(settled(), "all back");
+    split(&pool[kPool / 2], 1, out);
+    CHECK(pool[kPool / 2].loan.loaned, "room again once they're back");
+    frameFree(out.back());
+    CHECK(splitDone(&pool[kPool / 2]) == kRxLoanRecycle, "freed before done");
+}
+
+    // A frame that can't go up after all leaves the first loan to the completion
+
+static void testUntakeFirst()
+{
+    bool	first;
+    
+    newPool();
+    cdc_RxLoanSplit(&pool[0].loan);
+    CHECK(cdc_RxLoanTake(&pool[0].loan, &poolLoaned, kPool, &first) && first, "first loan");
+    OSIncrementAtomic(&driverRefs);
+    cdc_RxLoanUntake(&pool[0].loan);
+    CHECK(splitDone(&pool[0]) == kRxLoanRecycle, "completion recycles");
+    CHECK((pool[0].reads == 1) && settled(), "driver reference dropped");
+}
+
+    // Resources released while buffers are out
+
+static void testReleaseWhileLoaned()
+{
+    std::vector<readBuf *>	out;
+    UInt32			i;
+    
+    newPool();
+    split(&pool[1], 2, out);
+    splitDone(&pool[1]);
+    releaseAll();
+    CHECK(pool[1].allocated && pool[1].loan.orphan, "loaned buffer kept");
+    for (i=0; i<kPool; i++)
+    {
+        CHECK((i == 1) || !pool[i].allocated, "idle buffers freed");
+    }
+    frameFree(out[0]);
+    CHECK(pool[1].allocated, "still out");
+    frameFree(out[1]);
+    CHECK(!pool[1].allocated && (pool[1].freed == 1) && (pool[1].reads == 0), "freed, not read into, when it's back");
+    CHECK(!pool[1].loan.orphan && settled(), "orphan cleared");
+}
+
+    // Released while the completion is still splitting, frames back before it's done
+
+static void testReleaseDuringSplit()
+{
+    std::vector<readBuf *>	out;
+    
+    newPool();
+    split(&pool[0], 2, out);
+    releaseAll();
+    frameFree(out[0]);
+    frameFree(out[1]);
+    CHECK(pool[0].allocated, "completion still holds it");
+    CHECK(splitDone(&pool[0]) == kRxLoanRecycle, "completion drops the last reference");
+    CHECK(!pool[0].allocated && (pool[0].freed == 1) && settled(), "freed by the completion");
+}
+
+    // Released and then allocated again before a loaned buffer came back
+
+static void testReleaseThenReclaim()
+{
+    std::vector<readBuf *>	out;
+    
+    newPool();
+    split(&pool[2], 1, out);
+    splitDone(&pool[2]);
+    releaseAll();
+    reclaimAll();
+    CHECK(pool[2].allocated && !pool[2].loan.orphan, "ours again");
+    CHECK(pool[0].allocated, "idle buffers allocated again");
+    frameFree(out[0]);
+    CHECK((pool[2].reads == 1) && (pool[2].freed == 0) && settled(), "read into when it's back");
+}
+
+    // The stack frees frames on another thread while the completion finishes, whichever
+    // reference goes last recycles the buffer, exactly once
+
+static void testRace()
+{
+    UInt32	iter, frames, inPlace, i;
+    
+    newPool();
+    for (iter=0; iter<5000; iter++)
+    {
+        std::vector<readBuf *>	out;
+        readBuf			*b = &pool[iter % kPool];
+        SInt32			reads = b->reads;
+        
+        frames = 1 + rnd(6);
+        inPlace = split(b, frames, out);
+        std::thread	stack([&out]() { for (UInt32 j=0; j<out.size(); j++) frameFree(out[j]); });
+        for (i=0; i<rnd(200); i++)
+        {
+            OSMemoryBarrier();
+        }
+        splitDone(b);
+        stack.join();
+        if ((b->reads != reads + 1) || b->loan.loaned || !settled() || (inPlace != frames))
+        {
+            printf("race iteration %u\n", iter);
+            CHECK(false, "recycled exactly once");
+            return;
+        }
+    }
+}
+
+int main()
+{
+    
+    testNoLoan();
+    testFreeBeforeDone();
+    testFreeAfterDone();
+    testPoolLimit();
+    testUntakeFirst();
+    testReleaseWhileLoaned();
+    testReleaseDuringSplit();
+    testReleaseThenReclaim();
+    testRace();
+    
+    if (failures)
+    {
+        printf("RxLoanTest: %d failed\n", failures);
+        return 1;
+    }
+    printf("RxLoanTest: passed\n");
+    
+    return 0;
+}
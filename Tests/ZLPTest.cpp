@@ -0,0 +1,157 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1998-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+ 
+
+
+    /* ZLPTest.cpp - Host test for the bulk transfer termination rule (Common/AppleUSBCDCZLP.h) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "AppleUSBCDCZLP.h"
+
+static int	failures = 0;
+
+#define CHECK(cond, what)	do { if (!(cond)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, what); failures++; } } while (0)
+
+static UInt32	seed = 0x9e3779b9;
+
+static UInt32 rnd(UInt32 range)
+{
+    seed = (seed * 1103515245) + 12345;
+    return ((seed >> 8) % range);
+}
+
+static const UInt32	packetSizes[] = { 8, 16, 32, 64, 512, 1024 };	// Full, high and super speed bulk
+
+static void testRule()
+{
+    UInt32	p, ps, len;
+    
+    for (p=0; p<sizeof(packetSizes) / sizeof(packetSizes[0]); p++)
+    {
+        ps = packetSizes[p];
+        CHECK(!cdc_NeedZLP(0, ps), "empty write is its own zero length packet");
+        for (len=1; len<=(4 * ps) + 1; len++)
+        {
+            CHECK(cdc_NeedZLP(len, ps) == ((len % ps) == 0), "multiple of the packet size");
+        }
+        CHECK(cdc_NeedZLP(ps * 65536, ps), "large multiple");
+        CHECK(!cdc_NeedZLP((ps * 65536) - 1, ps), "one short of a large multiple");
+    }
+    
+    CHECK(!cdc_NeedZLP(512, 0), "no packet size (pipe not open)");
+    CHECK(!cdc_NeedZLP(0, 0), "nothing at all");
+}
+
+    // The bus as the receiver sees it, each write cut into max packets. With zlp the rule is
+    // followed, the receiver ends a transfer on any short packet and must see the writes.
+
+static std::vector<UInt32> sendAndReceive(const std::vector<UInt32> &writes, UInt32 ps, bool zlp)
+{
+    std::vector<UInt32>	packets, got;
+    UInt32		i, left, n, acc = 0;
+    
+    for (i=0; i<writes.size(); i++)
+    {
+        left = writes[i];
+        do
+        {
+            n = (left < ps) ? left : ps;
+            packets.push_back(n);
+            left -= n;
+        } while (left);
+        if (zlp && cdc_NeedZLP(writes[i], ps))
+        {
+            packets.push_back(0);
+        }
+    }
+    
+    for (i=0; i<packets.size(); i++)
+    {
+        acc += packets[i];
+        if (packets[i] < ps)
+        {
+            got.push_back(acc);
+            acc = 0;
+        }
+    }
+    
+    return got;
+}
+
+static void testBoundaries()
+{
+    std::vector<UInt32>	writes;
+    UInt32		p, ps, i, t;
+    
+    for (p=0; p<sizeof(packetSizes) / sizeof(packetSizes[0]); p++)
+    {
+        ps = packetSizes[p];
+        for (t=0; t<200; t++)
+        {
+            writes.clear();
+            for (i=0; i<1 + rnd(20); i++)
+            {
+                switch (rnd(4))
+                {
+                    case 0:
+                        writes.push_back(ps * (1 + rnd(8)));		// Exact multiple
+                        break;
+                    case 1:
+                        writes.push_back(rnd(ps));			// Short, maybe empty
+                        break;
+                    default:
+                        writes.push_back(rnd(16 * ps));
+                        break;
+                }
+            }
+            CHECK(sendAndReceive(writes, ps, true) == writes, "every write seen as one transfer");
+        }
+        
+            // Without it a full write runs into the next one
+        
+        writes.clear();
+        writes.push_back(ps * 2);
+        writes.push_back(5);
+        CHECK(sendAndReceive(writes, ps, false).size() == 1, "no zero length packet, writes merge");
+    }
+}
+
+int main()
+{
+    
+    testRule();
+    testBoundaries();
+    
+    if (failures)
+    {
+        printf("ZLPTest: %d failed\n", failures);
+        return 1;
+    }
+    printf("ZLPTest: passed\n");
+    
+    return 0;
+}
@@ -0,0 +1,30 @@
+    /* Host stand-in for <libkern/OSAtomic.h> */
+
+#ifndef __TESTSHIM_OSATOMIC__
+#define __TESTSHIM_OSATOMIC__
+
+#include <libkern/OSTypes.h>
+
+static inline void OSMemoryBarrier(void)
+{
+    __sync_synchronize();
+}
+
+    // These return the value before the change, like the kernel's
+
+static inline SInt32 OSAddAtomic(SInt32 amount, volatile SInt32 *address)
+{
+    return __sync_fetch_and_add(address, amount);
+}
+
+static inline SInt32 OSIncrementAtomic(volatile SInt32 *address)
+{
+    return __sync_fetch_and_add(address, 1);
+}
+
+static inline SInt32 OSDecrementAtomic(volatile SInt32 *address)
+{
+    return __sync_fetch_and_sub(address, 1);
+}
+
+#endif
@@ -0,0 +1,75 @@
+    /* Host stand-in for <libkern/OSByteOrder.h> (any host byte order, unaligned is fine) */
+
+#ifndef __TESTSHIM_OSBYTEORDER__
+#define __TESTSHIM_OSBYTEORDER__
+
+#include <stdint.h>
+#include <libkern/OSTypes.h>
+
+static inline UInt16 OSReadLittleInt16(const volatile void *base, uintptr_t offset)
+{
+    const volatile UInt8	*p = (const volatile UInt8 *)base + offset;
+    
+    return (UInt16)(p[0] | (p[1] << 8));
+}
+
+static inline UInt32 OSReadLittleInt32(const volatile void *base, uintptr_t offset)
+{
+    const volatile UInt8	*p = (const volatile UInt8 *)base + offset;
+    
+    return (UInt32)p[0] | ((UInt32)p[1] << 8) | ((UInt32)p[2] << 16) | ((UInt32)p[3] << 24);
+}
+
+static inline void OSWriteLittleInt16(volatile void *base, uintptr_t offset, UInt16 data)
+{
+    volatile UInt8	*p = (volatile UInt8 *)base + offset;
+    
+    p[0] = (UInt8)data;
+    p[1] = (UInt8)(data >> 8);
+}
+
+static inline void OSWriteLittleInt32(volatile void *base, uintptr_t offset, UInt32 data)
+{
+    volatile UInt8	*p = (volatile UInt8 *)base + offset;
+    
+    p[0] = (UInt8)data;
+    p[1] = (UInt8)(data >> 8);
+    p[2] = (UInt8)(data >> 16);
+    p[3] = (UInt8)(data >> 24);
+}
+
+static inline void OSWriteBigInt16(volatile void *base, uintptr_t offset, UInt16 data)
+{
+    volatile UInt8	*p = (volatile UInt8 *)base + offset;
+    
+    p[0] = (UInt8)(data >> 8);
+    p[1] = (UInt8)data;
+}
+
+static inline void OSWriteBigInt32(volatile void *base, uintptr_t offset, UInt32 data)
+{
+    volatile UInt8	*p = (volatile UInt8 *)base + offset;
+    
+    p[0] = (UInt8)(data >> 24);
+    p[1] = (UInt8)(data >> 16);
+    p[2] = (UInt8)(data >> 8);
+    p[3] = (UInt8)data;
+}
+
+static inline UInt16 OSSwapHostToBigInt16(UInt16 data)
+{
+    UInt16	be;
+    
+    OSWriteBigInt16(&be, 0, data);
+    return be;
+}
+
+static inline UInt32 OSSwapHostToBigInt32(UInt32 data)
+{
+    UInt32	be;
+    
+    OSWriteBigInt32(&be, 0, data);
+    return be;
+}
+
+#endif
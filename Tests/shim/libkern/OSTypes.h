@@ -0,0 +1,17 @@
+    /* Host stand-in for <libkern/OSTypes.h>, just what the Common framing code uses */
+
+#ifndef __TESTSHIM_OSTYPES__
+#define __TESTSHIM_OSTYPES__
+
+#include <stdint.h>
+
+typedef uint8_t		UInt8;
+typedef uint16_t	UInt16;
+typedef uint32_t	UInt32;
+typedef uint64_t	UInt64;
+typedef int8_t		SInt8;
+typedef int16_t		SInt16;
+typedef int32_t		SInt32;
+typedef int64_t		SInt64;
+
+#endif
@@ -0,0 +1,141 @@
+    /* Host stand-in for <sys/kpi_mbuf.h>, just what the Common offload code uses. An mbuf is	*/
+    /* one malloc'd buffer, chained through next, the first one carries the packet length.	*/
+
+#ifndef __TESTSHIM_KPI_MBUF__
+#define __TESTSHIM_KPI_MBUF__
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libkern/OSTypes.h>
+
+typedef int	errno_t;
+typedef int	mbuf_how_t;
+typedef int	mbuf_type_t;
+typedef UInt32	mbuf_csum_performed_flags_t;
+
+#define MBUF_DONTWAIT			1
+#define MBUF_WAITOK			0
+#define MBUF_TYPE_DATA			1
+
+#define MCLBYTES			2048
+#define MBIGCLBYTES			4096
+
+#define MBUF_CSUM_DID_IP		0x0100
+#define MBUF_CSUM_IP_GOOD		0x0200
+#define MBUF_CSUM_DID_DATA		0x0400
+#define MBUF_CSUM_PSEUDO_HDR		0x0800
+
+struct __mbuf
+{
+    struct __mbuf	*next;
+    UInt8		*buf;
+    size_t		size;					// Of buf
+    size_t		len;					// In this mbuf
+    size_t		pktlen;					// Whole chain, first mbuf only
+    UInt32		csumFlags;
+    UInt32		csumValue;
+};
+
+typedef struct __mbuf	*mbuf_t;
+
+static inline errno_t mbuf_getcluster(mbuf_how_t how, mbuf_type_t type, size_t size, mbuf_t *mbuf)
+{
+    mbuf_t	m = (mbuf_t)calloc(1, sizeof(struct __mbuf));
+    
+    (void)how;
+    (void)type;
+    *mbuf = m;
+    if (!m)
+    {
+        return ENOMEM;
+    }
+    m->buf = (UInt8 *)malloc(size);
+    m->size = size;
+    
+    return 0;
+}
+
+static inline void mbuf_freem(mbuf_t m)
+{
+    mbuf_t	next;
+    
+    while (m)
+    {
+        next = m->next;
+        free(m->buf);
+        free(m);
+        m = next;
+    }
+}
+
+static inline void *mbuf_data(mbuf_t m)			{ return m->buf; }
+static inline size_t mbuf_len(mbuf_t m)			{ return m->len; }
+static inline size_t mbuf_maxlen(mbuf_t m)		{ return m->size; }
+static inline void mbuf_setlen(mbuf_t m, size_t len)	{ m->len = len; }
+static inline mbuf_t mbuf_next(mbuf_t m)		{ return m->next; }
+static inline errno_t mbuf_setnext(mbuf_t m, mbuf_t next)	{ m->next = next; return 0; }
+static inline size_t mbuf_pkthdr_len(mbuf_t m)		{ return m->pktlen; }
+static inline void mbuf_pkthdr_setlen(mbuf_t m, size_t len)	{ m->pktlen = len; }
+
+static inline void mbuf_set_csum_performed(mbuf_t m, mbuf_csum_performed_flags_t flags, UInt32 value)
+{
+    m->csumFlags = flags;
+    m->csumValue = value;
+}
+
+static inline errno_t mbuf_copydata(mbuf_t m, size_t offset, size_t length, void *out_data)
+{
+    UInt8	*out = (UInt8 *)out_data;
+    size_t	n;
+    
+    while (m && (offset >= m->len))
+    {
+        offset -= m->len;
+        m = m->next;
+    }
+    while (length)
+    {
+        if (!m)
+        {
+            return EINVAL;
+        }
+        n = m->len - offset;
+        if (n > length)
+        {
+            n = length;
+        }
+        memcpy(out, &m->buf[offset], n);
+        out += n;
+        length -= n;
+        offset = 0;
+        m = m->next;
+    }
+    
+    return 0;
+}
+
+    // Only trimming from the end (negative len) is needed
+
+static inline void mbuf_adj(mbuf_t mbuf, int len)
+{
+    size_t	keep;
+    mbuf_t	m;
+    
+    if (len >= 0)
+    {
+        abort();
+    }
+    mbuf->pktlen -= (size_t)-len;
+    keep = mbuf->pktlen;
+    for (m = mbuf; m; m = m->next)
+    {
+        if (m->len > keep)
+        {
+            m->len = keep;
+        }
+        keep -= m->len;
+    }
+}
+
+#endif